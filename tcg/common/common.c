@@ -47,11 +47,18 @@
 #include <iconv.h>
 #include <langinfo.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/sha.h>
 #include <openssl/rsa.h>
+#include <openssl/rand.h>
+#include <openssl/objects.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/param_build.h>
+#endif
 
 #include "common.h"
 
@@ -62,13 +69,34 @@ struct option long_options[] = {
 	{0,0,0,0}
 };
 
+/* tests connect many contexts to the same server, so the last conversion is
+ * kept and handed out again rather than leaking a new one per connect */
+static __thread char *last_server;
+static __thread UNICODE *last_server_unicode;
+
 UNICODE *
 get_server(char *server)
 {
+	UNICODE *u;
+	char *s;
+
 	if (server == NULL)
 		return NULL;
-	else
-		return (UNICODE *)TestSuite_Native_To_UNICODE(server, NULL);
+
+	if (last_server && strcmp(last_server, server) == 0)
+		return last_server_unicode;
+
+	if ((u = (UNICODE *)TestSuite_Native_To_UNICODE((BYTE *)server, NULL)) == NULL)
+		return NULL;
+	if ((s = strdup(server)) == NULL)
+		return u;
+
+	/* the UNICODE strings handed out earlier are left valid */
+	free(last_server);
+	last_server = s;
+	last_server_unicode = u;
+
+	return u;
 }
 
 void
@@ -894,1326 +922,3706 @@ set_srk_readable(TSS_HCONTEXT hContext)
 	return Tspi_TPM_SetStatus( hTPM, TSS_TPMSTATUS_DISABLEPUBSRKREAD, FALSE );
 }
 
-void
-TestSuite_LoadBlob_KEY_FLAGS(UINT16 * offset, BYTE * blob, TCPA_KEY_FLAGS * flags)
-{
-        UINT32 tempFlag = 0;
+/*
+ * Marshalling of TPM structures.
+ *
+ * A struct testsuite_blob is a cursor over a buffer of known size. Every
+ * operation checks that it stays inside the buffer; the first one which
+ * doesn't, or fails to allocate, sets blob->result and all operations after
+ * it do nothing, so a sequence of calls only needs checking once at the end.
+ *
+ * By default the Get functions of variable sized fields don't copy: the
+ * field's pointer is set to where the data is in the buffer, which must
+ * then outlive the structure, and must not be freed. With blob->copy set,
+ * each such field is malloc'ed and copied instead, and on failure the
+ * copies made so far are freed again.
+ *
+ * The TestSuite_LoadBlob_* and TestSuite_UnloadBlob_* functions taking a
+ * UINT16 offset are wrappers kept for existing tests. They don't know the
+ * size of the buffer and their offsets wrap at 64 KiB.
+ */
 
-        if (*flags & migratable)
-                tempFlag |= migratable;
-        if (*flags & redirection)
-                tempFlag |= redirection;
-        if (*flags & volatileKey)
-                tempFlag |= volatileKey;
-        TestSuite_LoadBlob_UINT32(offset, tempFlag, blob);
-}
+#define BLOB_SIZE_MAX	((UINT32)~0)
 
 void
-TestSuite_UnloadBlob_KEY_FLAGS(UINT16 * offset, BYTE * blob, TCPA_KEY_FLAGS * flags)
+TestSuite_Blob_Init(struct testsuite_blob *blob, BYTE *buf, UINT32 size)
 {
-        UINT32 tempFlag = 0;
-        memset(flags, 0x00, sizeof(TCPA_KEY_FLAGS));
-
-        TestSuite_UnloadBlob_UINT32(offset, &tempFlag, blob);
-
-        if (tempFlag & redirection)
-                *flags |= redirection;
-        if (tempFlag & migratable)
-                *flags |= migratable;
-        if (tempFlag & volatileKey)
-                *flags |= volatileKey;
+	blob->buf = buf;
+	blob->size = size;
+	blob->offset = 0;
+	blob->result = TSS_SUCCESS;
+	blob->copy = 0;
 }
 
-TSS_RESULT
-TestSuite_UnloadBlob_SYMMETRIC_KEY(UINT16 *offset, BYTE *blob, TCPA_SYMMETRIC_KEY *key)
+/* claim the next n bytes of the buffer */
+static BYTE *
+blob_next(struct testsuite_blob *blob, UINT32 n)
 {
-	TestSuite_UnloadBlob_UINT32(offset, &key->algId, blob);
-	TestSuite_UnloadBlob_UINT16(offset, &key->encScheme, blob);
-	TestSuite_UnloadBlob_UINT16(offset, &key->size, blob);
+	BYTE *p;
 
-	if (key->size > 0) {
-		key->data = malloc(key->size);
-		if (key->data == NULL) {
-			key->size = 0;
-			return TSS_E_OUTOFMEMORY;
-		}
-		TestSuite_UnloadBlob(offset, key->size, blob, key->data);
-	} else {
-		key->data = NULL;
+	if (blob->result)
+		return NULL;
+	if (n > blob->size - blob->offset) {
+		blob->result = TSS_E_BAD_PARAMETER;
+		return NULL;
 	}
 
-	return TSS_SUCCESS;
+	p = &blob->buf[blob->offset];
+	blob->offset += n;
+
+	return p;
 }
 
+/* release a field set by blob_view() after a later failure */
+static void
+blob_drop(struct testsuite_blob *blob, BYTE **field)
+{
+	if (blob->copy)
+		free(*field);
+	*field = NULL;
+}
 
 void
-TestSuite_LoadBlob_PUBKEY(UINT16 *offset, BYTE *blob, TCPA_PUBKEY *pubKey)
+TestSuite_Blob_Put_BYTE(struct testsuite_blob *blob, BYTE in)
 {
-	TestSuite_LoadBlob_KEY_PARMS(offset, blob, &pubKey->algorithmParms);
-	TestSuite_LoadBlob_STORE_PUBKEY(offset, blob, &pubKey->pubKey);
+	BYTE *p = blob_next(blob, 1);
+
+	if (p)
+		*p = in;
 }
 
-TSS_RESULT
-TestSuite_UnloadBlob_PUBKEY(UINT16 * offset, BYTE * blob, TCPA_PUBKEY * pubKey)
+void
+TestSuite_Blob_Get_BYTE(struct testsuite_blob *blob, BYTE *out)
 {
-	TSS_RESULT result;
-
-	if ((result = TestSuite_UnloadBlob_KEY_PARMS(offset, blob, &pubKey->algorithmParms)))
-		return result;
-	if ((result = TestSuite_UnloadBlob_STORE_PUBKEY(offset, blob, &pubKey->pubKey))) {
-		free(pubKey->pubKey.key);
-		free(pubKey->algorithmParms.parms);
-		pubKey->pubKey.key = NULL;
-		pubKey->pubKey.keyLength = 0;
-		pubKey->algorithmParms.parms = NULL;
-		pubKey->algorithmParms.parmSize = 0;
-		return result;
-	}
+	BYTE *p = blob_next(blob, 1);
 
-	return TSS_SUCCESS;
+	*out = p ? *p : 0;
 }
 
 void
-TestSuite_LoadBlob(UINT16 * offset, UINT32 size, BYTE * container, BYTE * object)
+TestSuite_Blob_Put_UINT16(struct testsuite_blob *blob, UINT16 in)
 {
-	if (size == 0)
-		return;
-	memcpy(&container[(*offset)], object, size);
-	(*offset) += (UINT16) size;
+	TestSuite_Blob_Put_UINT16s(blob, &in, 1);
 }
 
 void
-TestSuite_UnloadBlob(UINT16 * offset, UINT32 size, BYTE * container, BYTE * object)
+TestSuite_Blob_Get_UINT16(struct testsuite_blob *blob, UINT16 *out)
 {
-	if (size == 0)
-		return;
-	memcpy(object, &container[(*offset)], size);
-	(*offset) += (UINT16) size;
+	TestSuite_Blob_Get_UINT16s(blob, out, 1);
 }
 
 void
-TestSuite_LoadBlob_BYTE(UINT16 * offset, BYTE data, BYTE * blob)
+TestSuite_Blob_Put_UINT32(struct testsuite_blob *blob, UINT32 in)
 {
-	blob[*offset] = data;
-	(*offset)++;
+	TestSuite_Blob_Put_UINT32s(blob, &in, 1);
 }
 
 void
-TestSuite_UnloadBlob_BYTE(UINT16 * offset, BYTE * dataOut, BYTE * blob)
+TestSuite_Blob_Get_UINT32(struct testsuite_blob *blob, UINT32 *out)
 {
-	*dataOut = blob[*offset];
-	(*offset)++;
+	TestSuite_Blob_Get_UINT32s(blob, out, 1);
 }
 
+/* big endian arrays, checked once for the whole array */
 void
-TestSuite_LoadBlob_BOOL(UINT16 * offset, TSS_BOOL data, BYTE * blob)
+TestSuite_Blob_Put_UINT16s(struct testsuite_blob *blob, const UINT16 *in, UINT32 n)
 {
-	blob[*offset] = (BYTE) data;
-	(*offset)++;
+	BYTE *p = n <= BLOB_SIZE_MAX / 2 ? blob_next(blob, n * 2) : NULL;
+	UINT32 i;
+
+	if (p == NULL) {
+		if (!blob->result)
+			blob->result = TSS_E_BAD_PARAMETER;
+		return;
+	}
+
+	for (i = 0; i < n; i++, p += 2) {
+		p[0] = (BYTE)(in[i] >> 8);
+		p[1] = (BYTE)in[i];
+	}
 }
 
 void
-TestSuite_UnloadBlob_BOOL(UINT16 * offset, TSS_BOOL * dataOut, BYTE * blob)
+TestSuite_Blob_Get_UINT16s(struct testsuite_blob *blob, UINT16 *out, UINT32 n)
 {
-	*dataOut = blob[*offset];
-	(*offset)++;
+	BYTE *p = n <= BLOB_SIZE_MAX / 2 ? blob_next(blob, n * 2) : NULL;
+	UINT32 i;
+
+	if (p == NULL) {
+		if (!blob->result)
+			blob->result = TSS_E_BAD_PARAMETER;
+		memset(out, 0, n * sizeof(UINT16));
+		return;
+	}
+
+	for (i = 0; i < n; i++, p += 2)
+		out[i] = (UINT16)((p[0] << 8) | p[1]);
 }
 
 void
-TestSuite_LoadBlob_UINT32(UINT16 * offset, UINT32 in, BYTE * blob)
+TestSuite_Blob_Put_UINT32s(struct testsuite_blob *blob, const UINT32 *in, UINT32 n)
 {
-	UINT32ToArray(in, &blob[*offset]);
-	*offset += 4;
+	BYTE *p = n <= BLOB_SIZE_MAX / 4 ? blob_next(blob, n * 4) : NULL;
+	UINT32 i;
+
+	if (p == NULL) {
+		if (!blob->result)
+			blob->result = TSS_E_BAD_PARAMETER;
+		return;
+	}
+
+	for (i = 0; i < n; i++, p += 4)
+		UINT32ToArray(in[i], p);
 }
 
 void
-TestSuite_LoadBlob_UINT16(UINT16 * offset, UINT16 in, BYTE * blob)
+TestSuite_Blob_Get_UINT32s(struct testsuite_blob *blob, UINT32 *out, UINT32 n)
 {
-	UINT16ToArray(in, &blob[*offset]);
-	*offset += sizeof(UINT16);
+	BYTE *p = n <= BLOB_SIZE_MAX / 4 ? blob_next(blob, n * 4) : NULL;
+	UINT32 i;
+
+	if (p == NULL) {
+		if (!blob->result)
+			blob->result = TSS_E_BAD_PARAMETER;
+		memset(out, 0, n * sizeof(UINT32));
+		return;
+	}
+
+	for (i = 0; i < n; i++, p += 4)
+		out[i] = ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | p[3];
 }
 
 void
-TestSuite_UnloadBlob_UINT32(UINT16 * offset, UINT32 * out, BYTE * blob)
+TestSuite_Blob_Put(struct testsuite_blob *blob, const BYTE *in, UINT32 n)
 {
-	*out = Decode_UINT32(&blob[*offset]);
-	*offset += sizeof(UINT32);
+	BYTE *p = blob_next(blob, n);
+
+	if (p && n)
+		memcpy(p, in, n);
 }
 
 void
-TestSuite_UnloadBlob_UINT16(UINT16 * offset, UINT16 * out, BYTE * blob)
+TestSuite_Blob_Get(struct testsuite_blob *blob, BYTE *out, UINT32 n)
 {
-	*out = Decode_UINT16(&blob[*offset]);
-	*offset += sizeof(UINT16);
+	BYTE *p = blob_next(blob, n);
+
+	if (p && n)
+		memcpy(out, p, n);
 }
 
+/* point *out at the next n bytes, or at a copy of them with blob->copy set.
+ * NULL for n == 0 */
 void
-TestSuite_LoadBlob_RSA_KEY_PARMS(UINT16 * offset, BYTE * blob, TCPA_RSA_KEY_PARMS * parms)
+TestSuite_Blob_Get_View(struct testsuite_blob *blob, BYTE **out, UINT32 n)
 {
-	TestSuite_LoadBlob_UINT32(offset, parms->keyLength, blob);
-	TestSuite_LoadBlob_UINT32(offset, parms->numPrimes, blob);
-	TestSuite_LoadBlob_UINT32(offset, parms->exponentSize, blob);
+	BYTE *p = blob_next(blob, n);
+
+	*out = NULL;
+	if (p == NULL || n == 0)
+		return;
+
+	if (!blob->copy) {
+		*out = p;
+		return;
+	}
 
-	if (parms->exponentSize > 0)
-		TestSuite_LoadBlob(offset, parms->exponentSize, blob, parms->exponent);
+	if ((*out = malloc(n)) == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.", n);
+		blob->result = TSS_E_OUTOFMEMORY;
+		return;
+	}
+	memcpy(*out, p, n);
 }
 
 void
-TestSuite_LoadBlob_TSS_VERSION(UINT16 * offset, BYTE * blob, TSS_VERSION version)
+TestSuite_Blob_Put_TCPA_VERSION(struct testsuite_blob *blob, TCPA_VERSION *ver)
 {
-	blob[(*offset)++] = version.bMajor;
-	blob[(*offset)++] = version.bMinor;
-	blob[(*offset)++] = version.bRevMajor;
-	blob[(*offset)++] = version.bRevMinor;
+	BYTE *p = blob_next(blob, 4);
+
+	if (p == NULL)
+		return;
+	p[0] = ver->major;
+	p[1] = ver->minor;
+	p[2] = ver->revMajor;
+	p[3] = ver->revMinor;
 }
 
 void
-TestSuite_UnloadBlob_TCPA_VERSION(UINT16 * offset, BYTE * blob, TCPA_VERSION * out)
+TestSuite_Blob_Get_TCPA_VERSION(struct testsuite_blob *blob, TCPA_VERSION *ver)
 {
-	out->major = blob[(*offset)++];
-	out->minor = blob[(*offset)++];
-	out->revMajor = blob[(*offset)++];
-	out->revMinor = blob[(*offset)++];
+	BYTE *p = blob_next(blob, 4);
+
+	if (p == NULL) {
+		memset(ver, 0, sizeof(TCPA_VERSION));
+		return;
+	}
+	ver->major = p[0];
+	ver->minor = p[1];
+	ver->revMajor = p[2];
+	ver->revMinor = p[3];
 }
 
 void
-TestSuite_LoadBlob_TCPA_VERSION(UINT16 * offset, BYTE * blob, TCPA_VERSION version)
+TestSuite_Blob_Put_TSS_VERSION(struct testsuite_blob *blob, TSS_VERSION *ver)
 {
-	blob[(*offset)++] = version.major;
-	blob[(*offset)++] = version.minor;
-	blob[(*offset)++] = version.revMajor;
-	blob[(*offset)++] = version.revMinor;
+	BYTE *p = blob_next(blob, 4);
+
+	if (p == NULL)
+		return;
+	p[0] = ver->bMajor;
+	p[1] = ver->bMinor;
+	p[2] = ver->bRevMajor;
+	p[3] = ver->bRevMinor;
 }
 
+/* only the flags known to 1.1 are kept */
 void
-TestSuite_LoadBlob_KEY(UINT16 * offset, BYTE * blob, TCPA_KEY * key)
+TestSuite_Blob_Put_KEY_FLAGS(struct testsuite_blob *blob, TCPA_KEY_FLAGS *flags)
 {
-	TestSuite_LoadBlob_TCPA_VERSION(offset, blob, key->ver);
-	TestSuite_LoadBlob_UINT16(offset, key->keyUsage, blob);
-	TestSuite_LoadBlob_KEY_FLAGS(offset, blob, &key->keyFlags);
-	blob[(*offset)++] = key->authDataUsage;
-	TestSuite_LoadBlob_KEY_PARMS(offset, blob, &key->algorithmParms);
-	TestSuite_LoadBlob_UINT32(offset, key->PCRInfoSize, blob);
-	TestSuite_LoadBlob(offset, key->PCRInfoSize, blob, key->PCRInfo);
-	TestSuite_LoadBlob_STORE_PUBKEY(offset, blob, &key->pubKey);
-	TestSuite_LoadBlob_UINT32(offset, key->encSize, blob);
-	TestSuite_LoadBlob(offset, key->encSize, blob, key->encData);
+	TestSuite_Blob_Put_UINT32(blob, *flags & (migratable | redirection | volatileKey));
 }
 
 void
-TestSuite_LoadBlob_KEY_PARMS(UINT16 * offset, BYTE * blob, TCPA_KEY_PARMS * keyInfo)
+TestSuite_Blob_Get_KEY_FLAGS(struct testsuite_blob *blob, TCPA_KEY_FLAGS *flags)
 {
-	TestSuite_LoadBlob_UINT32(offset, keyInfo->algorithmID, blob);
-	TestSuite_LoadBlob_UINT16(offset, keyInfo->encScheme, blob);
-	TestSuite_LoadBlob_UINT16(offset, keyInfo->sigScheme, blob);
-	TestSuite_LoadBlob_UINT32(offset, keyInfo->parmSize, blob);
+	UINT32 tempFlag;
 
-	if (keyInfo->parmSize > 0)
-		TestSuite_LoadBlob(offset, keyInfo->parmSize, blob, keyInfo->parms);
+	TestSuite_Blob_Get_UINT32(blob, &tempFlag);
+	*flags = tempFlag & (migratable | redirection | volatileKey);
 }
 
 void
-TestSuite_LoadBlob_STORE_PUBKEY(UINT16 * offset, BYTE * blob, TCPA_STORE_PUBKEY * store)
+TestSuite_Blob_Put_RSA_KEY_PARMS(struct testsuite_blob *blob, TCPA_RSA_KEY_PARMS *parms)
 {
-	TestSuite_LoadBlob_UINT32(offset, store->keyLength, blob);
-	TestSuite_LoadBlob(offset, store->keyLength, blob, store->key);
+	UINT32 v[3] = { parms->keyLength, parms->numPrimes, parms->exponentSize };
+
+	TestSuite_Blob_Put_UINT32s(blob, v, 3);
+	TestSuite_Blob_Put(blob, parms->exponent, parms->exponentSize);
 }
 
 TSS_RESULT
-TestSuite_UnloadBlob_KEY_PARMS(UINT16 * offset, BYTE * blob, TCPA_KEY_PARMS * keyParms)
+TestSuite_Blob_Get_RSA_KEY_PARMS(struct testsuite_blob *blob, TCPA_RSA_KEY_PARMS *parms)
 {
-	TestSuite_UnloadBlob_UINT32(offset, &keyParms->algorithmID, blob);
-	TestSuite_UnloadBlob_UINT16(offset, &keyParms->encScheme, blob);
-	TestSuite_UnloadBlob_UINT16(offset, &keyParms->sigScheme, blob);
-	TestSuite_UnloadBlob_UINT32(offset, &keyParms->parmSize, blob);
+	UINT32 v[3];
 
-	if (keyParms->parmSize > 0) {
-		keyParms->parms = malloc(keyParms->parmSize);
-		if (keyParms->parms == NULL) {
-			fprintf(stderr, "malloc of %d bytes failed.", keyParms->parmSize);
-			return TSS_E_OUTOFMEMORY;
-		}
-		TestSuite_UnloadBlob(offset, keyParms->parmSize, blob, keyParms->parms);
-	} else {
-		keyParms->parms = NULL;
-	}
+	TestSuite_Blob_Get_UINT32s(blob, v, 3);
+	parms->keyLength = v[0];
+	parms->numPrimes = v[1];
+	parms->exponentSize = v[2];
+	TestSuite_Blob_Get_View(blob, &parms->exponent, parms->exponentSize);
 
-	return TSS_SUCCESS;
+	return blob->result;
+}
+
+void
+TestSuite_Blob_Put_KEY_PARMS(struct testsuite_blob *blob, TCPA_KEY_PARMS *keyParms)
+{
+	UINT16 schemes[2] = { keyParms->encScheme, keyParms->sigScheme };
+
+	TestSuite_Blob_Put_UINT32(blob, keyParms->algorithmID);
+	TestSuite_Blob_Put_UINT16s(blob, schemes, 2);
+	TestSuite_Blob_Put_UINT32(blob, keyParms->parmSize);
+	TestSuite_Blob_Put(blob, keyParms->parms, keyParms->parmSize);
 }
 
 TSS_RESULT
-TestSuite_UnloadBlob_KEY12(UINT16 * offset, BYTE * blob, TPM_KEY12 * key)
+TestSuite_Blob_Get_KEY_PARMS(struct testsuite_blob *blob, TCPA_KEY_PARMS *keyParms)
 {
-	TSS_RESULT result;
+	UINT16 schemes[2];
 
-	TestSuite_UnloadBlob_UINT16(offset, &key->tag, blob);
-	TestSuite_UnloadBlob_UINT16(offset, &key->fill, blob);
-	TestSuite_UnloadBlob_UINT16(offset, &key->keyUsage, blob);
-	TestSuite_UnloadBlob_KEY_FLAGS(offset, blob, &key->keyFlags);
-	key->authDataUsage = blob[(*offset)++];
-	if ((result = TestSuite_UnloadBlob_KEY_PARMS(offset, (BYTE *) blob, &key->algorithmParms)))
-		return result;
-	TestSuite_UnloadBlob_UINT32(offset, &key->PCRInfoSize, blob);
+	TestSuite_Blob_Get_UINT32(blob, &keyParms->algorithmID);
+	TestSuite_Blob_Get_UINT16s(blob, schemes, 2);
+	keyParms->encScheme = schemes[0];
+	keyParms->sigScheme = schemes[1];
+	TestSuite_Blob_Get_UINT32(blob, &keyParms->parmSize);
+	TestSuite_Blob_Get_View(blob, &keyParms->parms, keyParms->parmSize);
 
-	if (key->PCRInfoSize > 0) {
-		key->PCRInfo = malloc(key->PCRInfoSize);
-		if (key->PCRInfo == NULL) {
-			fprintf(stderr, "malloc of %d bytes failed.", key->PCRInfoSize);
-			return TSS_E_OUTOFMEMORY;
-		}
-		TestSuite_UnloadBlob(offset, key->PCRInfoSize, blob, key->PCRInfo);
-	} else {
-		key->PCRInfo = NULL;
-	}
+	return blob->result;
+}
 
-	if ((result = TestSuite_UnloadBlob_STORE_PUBKEY(offset, blob, &key->pubKey)))
-		return result;
-	TestSuite_UnloadBlob_UINT32(offset, &key->encSize, blob);
+void
+TestSuite_Blob_Put_STORE_PUBKEY(struct testsuite_blob *blob, TCPA_STORE_PUBKEY *store)
+{
+	TestSuite_Blob_Put_UINT32(blob, store->keyLength);
+	TestSuite_Blob_Put(blob, store->key, store->keyLength);
+}
 
-	if (key->encSize > 0) {
-		key->encData = malloc(key->encSize);
-		if (key->encData == NULL) {
-			fprintf(stderr, "malloc of %d bytes failed.", key->encSize);
-			return TSS_E_OUTOFMEMORY;
-		}
-		TestSuite_UnloadBlob(offset, key->encSize, blob, key->encData);
-	} else {
-		key->encData = NULL;
-	}
+TSS_RESULT
+TestSuite_Blob_Get_STORE_PUBKEY(struct testsuite_blob *blob, TCPA_STORE_PUBKEY *store)
+{
+	TestSuite_Blob_Get_UINT32(blob, &store->keyLength);
+	TestSuite_Blob_Get_View(blob, &store->key, store->keyLength);
 
-	return result;
+	return blob->result;
+}
+
+void
+TestSuite_Blob_Put_PUBKEY(struct testsuite_blob *blob, TCPA_PUBKEY *pubKey)
+{
+	TestSuite_Blob_Put_KEY_PARMS(blob, &pubKey->algorithmParms);
+	TestSuite_Blob_Put_STORE_PUBKEY(blob, &pubKey->pubKey);
 }
 
 TSS_RESULT
-TestSuite_UnloadBlob_KEY(UINT16 * offset, BYTE * blob, TCPA_KEY * key)
+TestSuite_Blob_Get_PUBKEY(struct testsuite_blob *blob, TCPA_PUBKEY *pubKey)
 {
-	TSS_RESULT result;
+	pubKey->pubKey.key = NULL;
 
-	TestSuite_UnloadBlob_TCPA_VERSION(offset, blob, &key->ver);
-	TestSuite_UnloadBlob_UINT16(offset, &key->keyUsage, blob);
-	TestSuite_UnloadBlob_KEY_FLAGS(offset, blob, &key->keyFlags);
-	key->authDataUsage = blob[(*offset)++];
-	if ((result = TestSuite_UnloadBlob_KEY_PARMS(offset, (BYTE *) blob, &key->algorithmParms)))
-		return result;
-	TestSuite_UnloadBlob_UINT32(offset, &key->PCRInfoSize, blob);
+	TestSuite_Blob_Get_KEY_PARMS(blob, &pubKey->algorithmParms);
+	TestSuite_Blob_Get_STORE_PUBKEY(blob, &pubKey->pubKey);
 
-	if (key->PCRInfoSize > 0) {
-		key->PCRInfo = malloc(key->PCRInfoSize);
-		if (key->PCRInfo == NULL) {
-			fprintf(stderr, "malloc of %d bytes failed.", key->PCRInfoSize);
-			return TSS_E_OUTOFMEMORY;
-		}
-		TestSuite_UnloadBlob(offset, key->PCRInfoSize, blob, key->PCRInfo);
-	} else {
-		key->PCRInfo = NULL;
+	if (blob->result) {
+		blob_drop(blob, &pubKey->algorithmParms.parms);
+		blob_drop(blob, &pubKey->pubKey.key);
+		pubKey->algorithmParms.parmSize = 0;
+		pubKey->pubKey.keyLength = 0;
 	}
 
-	if ((result = TestSuite_UnloadBlob_STORE_PUBKEY(offset, blob, &key->pubKey)))
-		return result;
-	TestSuite_UnloadBlob_UINT32(offset, &key->encSize, blob);
+	return blob->result;
+}
 
-	if (key->encSize > 0) {
-		key->encData = malloc(key->encSize);
-		if (key->encData == NULL) {
-			fprintf(stderr, "malloc of %d bytes failed.", key->encSize);
-			return TSS_E_OUTOFMEMORY;
-		}
-		TestSuite_UnloadBlob(offset, key->encSize, blob, key->encData);
-	} else {
-		key->encData = NULL;
+void
+TestSuite_Blob_Put_KEY(struct testsuite_blob *blob, TCPA_KEY *key)
+{
+	TestSuite_Blob_Put_TCPA_VERSION(blob, &key->ver);
+	TestSuite_Blob_Put_UINT16(blob, key->keyUsage);
+	TestSuite_Blob_Put_KEY_FLAGS(blob, &key->keyFlags);
+	TestSuite_Blob_Put_BYTE(blob, key->authDataUsage);
+	TestSuite_Blob_Put_KEY_PARMS(blob, &key->algorithmParms);
+	TestSuite_Blob_Put_UINT32(blob, key->PCRInfoSize);
+	TestSuite_Blob_Put(blob, key->PCRInfo, key->PCRInfoSize);
+	TestSuite_Blob_Put_STORE_PUBKEY(blob, &key->pubKey);
+	TestSuite_Blob_Put_UINT32(blob, key->encSize);
+	TestSuite_Blob_Put(blob, key->encData, key->encSize);
+}
+
+/* the part of TCPA_KEY and TPM_KEY12 after the version or tag */
+static TSS_RESULT
+blob_get_key_body(struct testsuite_blob *blob, TCPA_KEY_USAGE *keyUsage, TCPA_KEY_FLAGS *keyFlags,
+		  TCPA_AUTH_DATA_USAGE *authDataUsage, TCPA_KEY_PARMS *algorithmParms,
+		  UINT32 *PCRInfoSize, BYTE **PCRInfo, TCPA_STORE_PUBKEY *pubKey,
+		  UINT32 *encSize, BYTE **encData)
+{
+	algorithmParms->parms = NULL;
+	*PCRInfo = NULL;
+	pubKey->key = NULL;
+	*encData = NULL;
+
+	TestSuite_Blob_Get_UINT16(blob, keyUsage);
+	TestSuite_Blob_Get_KEY_FLAGS(blob, keyFlags);
+	TestSuite_Blob_Get_BYTE(blob, authDataUsage);
+	TestSuite_Blob_Get_KEY_PARMS(blob, algorithmParms);
+	TestSuite_Blob_Get_UINT32(blob, PCRInfoSize);
+	TestSuite_Blob_Get_View(blob, PCRInfo, *PCRInfoSize);
+	TestSuite_Blob_Get_STORE_PUBKEY(blob, pubKey);
+	TestSuite_Blob_Get_UINT32(blob, encSize);
+	TestSuite_Blob_Get_View(blob, encData, *encSize);
+
+	if (blob->result) {
+		blob_drop(blob, &algorithmParms->parms);
+		blob_drop(blob, PCRInfo);
+		blob_drop(blob, &pubKey->key);
+		blob_drop(blob, encData);
 	}
 
-	return result;
+	return blob->result;
 }
 
 TSS_RESULT
-TestSuite_UnloadBlob_STORE_PUBKEY(UINT16 * offset, BYTE * blob, TCPA_STORE_PUBKEY * store)
+TestSuite_Blob_Get_KEY(struct testsuite_blob *blob, TCPA_KEY *key)
 {
-	TestSuite_UnloadBlob_UINT32(offset, &store->keyLength, blob);
+	TestSuite_Blob_Get_TCPA_VERSION(blob, &key->ver);
 
-	if (store->keyLength > 0) {
-		store->key = malloc(store->keyLength);
-		if (store->key == NULL) {
-			fprintf(stderr, "malloc of %d bytes failed.", store->keyLength);
-			return TSS_E_OUTOFMEMORY;
-		}
-		TestSuite_UnloadBlob(offset, store->keyLength, blob, store->key);
-	} else {
-		store->key = NULL;
-	}
+	return blob_get_key_body(blob, &key->keyUsage, &key->keyFlags, &key->authDataUsage,
+				 &key->algorithmParms, &key->PCRInfoSize, &key->PCRInfo,
+				 &key->pubKey, &key->encSize, &key->encData);
+}
 
-	return TSS_SUCCESS;
+TSS_RESULT
+TestSuite_Blob_Get_KEY12(struct testsuite_blob *blob, TPM_KEY12 *key)
+{
+	TestSuite_Blob_Get_UINT16(blob, &key->tag);
+	TestSuite_Blob_Get_UINT16(blob, &key->fill);
+
+	return blob_get_key_body(blob, &key->keyUsage, &key->keyFlags, &key->authDataUsage,
+				 &key->algorithmParms, &key->PCRInfoSize, &key->PCRInfo,
+				 &key->pubKey, &key->encSize, &key->encData);
 }
 
 void
-TestSuite_UnloadBlob_VERSION(UINT16 * offset, BYTE * blob, TCPA_VERSION * out)
+TestSuite_Blob_Put_SYMMETRIC_KEY(struct testsuite_blob *blob, TCPA_SYMMETRIC_KEY *key)
 {
-	TestSuite_UnloadBlob_BYTE(offset, &out->major, blob);
-	TestSuite_UnloadBlob_BYTE(offset, &out->minor, blob);
-	TestSuite_UnloadBlob_BYTE(offset, &out->revMajor, blob);
-	TestSuite_UnloadBlob_BYTE(offset, &out->revMinor, blob);
+	UINT16 v[2] = { key->encScheme, key->size };
+
+	TestSuite_Blob_Put_UINT32(blob, key->algId);
+	TestSuite_Blob_Put_UINT16s(blob, v, 2);
+	TestSuite_Blob_Put(blob, key->data, key->size);
 }
 
-void
-TestSuite_LoadBlob_SYMMETRIC_KEY(UINT16 *offset, BYTE *blob, TCPA_SYMMETRIC_KEY *key)
+TSS_RESULT
+TestSuite_Blob_Get_SYMMETRIC_KEY(struct testsuite_blob *blob, TCPA_SYMMETRIC_KEY *key)
 {
-	TestSuite_LoadBlob_UINT32(offset, key->algId, blob);
-	TestSuite_LoadBlob_UINT16(offset, key->encScheme, blob);
-	TestSuite_LoadBlob_UINT16(offset, key->size, blob);
+	TestSuite_Blob_Get_UINT32(blob, &key->algId);
+	TestSuite_Blob_Get_UINT16(blob, &key->encScheme);
+	TestSuite_Blob_Get_UINT16(blob, &key->size);
+	TestSuite_Blob_Get_View(blob, &key->data, key->size);
 
-	if (key->size > 0)
-		TestSuite_LoadBlob(offset, key->size, blob, key->data);
+	if (blob->result)
+		key->size = 0;
+
+	return blob->result;
 }
 
 TSS_RESULT
-TestSuite_UnloadBlob_IDENTITY_PROOF(UINT16 *offset, BYTE *blob, TCPA_IDENTITY_PROOF *proof)
+TestSuite_Blob_Get_IDENTITY_PROOF(struct testsuite_blob *blob, TCPA_IDENTITY_PROOF *proof)
 {
-	TSS_RESULT result;
+	UINT32 sizes[5];
 
 	/* helps when an error occurs */
 	memset(proof, 0, sizeof(TCPA_IDENTITY_PROOF));
 
-	TestSuite_UnloadBlob_VERSION(offset, blob, (TCPA_VERSION *)&proof->ver);
-	TestSuite_UnloadBlob_UINT32(offset, &proof->labelSize, blob);
-	TestSuite_UnloadBlob_UINT32(offset, &proof->identityBindingSize, blob);
-	TestSuite_UnloadBlob_UINT32(offset, &proof->endorsementSize, blob);
-	TestSuite_UnloadBlob_UINT32(offset, &proof->platformSize, blob);
-	TestSuite_UnloadBlob_UINT32(offset, &proof->conformanceSize, blob);
-
-	if ((result = TestSuite_UnloadBlob_PUBKEY(offset, blob,
-					      &proof->identityKey))) {
+	TestSuite_Blob_Get_TCPA_VERSION(blob, (TCPA_VERSION *)&proof->ver);
+	TestSuite_Blob_Get_UINT32s(blob, sizes, 5);
+	proof->labelSize = sizes[0];
+	proof->identityBindingSize = sizes[1];
+	proof->endorsementSize = sizes[2];
+	proof->platformSize = sizes[3];
+	proof->conformanceSize = sizes[4];
+
+	TestSuite_Blob_Get_PUBKEY(blob, &proof->identityKey);
+	TestSuite_Blob_Get_View(blob, &proof->labelArea, proof->labelSize);
+	TestSuite_Blob_Get_View(blob, &proof->identityBinding, proof->identityBindingSize);
+	TestSuite_Blob_Get_View(blob, &proof->endorsementCredential, proof->endorsementSize);
+	TestSuite_Blob_Get_View(blob, &proof->platformCredential, proof->platformSize);
+	TestSuite_Blob_Get_View(blob, &proof->conformanceCredential, proof->conformanceSize);
+
+	if (blob->result) {
 		proof->labelSize = 0;
 		proof->identityBindingSize = 0;
 		proof->endorsementSize = 0;
 		proof->platformSize = 0;
 		proof->conformanceSize = 0;
-		return result;
-	}
-
-	if (proof->labelSize > 0) {
-		proof->labelArea = malloc(proof->labelSize);
-		if (proof->labelArea == NULL) {
-			result = TSS_E_OUTOFMEMORY;
-			goto error;
-		}
-		TestSuite_UnloadBlob(offset, proof->labelSize, blob, proof->labelArea);
-	} else {
-		proof->labelArea = NULL;
-	}
-
-	if (proof->identityBindingSize > 0) {
-		proof->identityBinding = malloc(proof->identityBindingSize);
-		if (proof->identityBinding == NULL) {
-			result = TSS_E_OUTOFMEMORY;
-			goto error;
-		}
-		TestSuite_UnloadBlob(offset, proof->identityBindingSize, blob,
-				 proof->identityBinding);
-	} else {
-		proof->identityBinding = NULL;
-	}
-
-	if (proof->endorsementSize > 0) {
-		proof->endorsementCredential = malloc(proof->endorsementSize);
-		if (proof->endorsementCredential == NULL) {
-			result = TSS_E_OUTOFMEMORY;
-			goto error;
-		}
-		TestSuite_UnloadBlob(offset, proof->endorsementSize, blob,
-				 proof->endorsementCredential);
-	} else {
-		proof->endorsementCredential = NULL;
-	}
-
-	if (proof->platformSize > 0) {
-		proof->platformCredential = malloc(proof->platformSize);
-		if (proof->platformCredential == NULL) {
-			result = TSS_E_OUTOFMEMORY;
-			goto error;
-		}
-		TestSuite_UnloadBlob(offset, proof->platformSize, blob,
-				 proof->platformCredential);
-	} else {
-		proof->platformCredential = NULL;
-	}
-
-	if (proof->conformanceSize > 0) {
-		proof->conformanceCredential = malloc(proof->conformanceSize);
-		if (proof->conformanceCredential == NULL) {
-			result = TSS_E_OUTOFMEMORY;
-			goto error;
-		}
-		TestSuite_UnloadBlob(offset, proof->conformanceSize, blob,
-				 proof->conformanceCredential);
-	} else {
-		proof->conformanceCredential = NULL;
+		blob_drop(blob, &proof->labelArea);
+		blob_drop(blob, &proof->identityBinding);
+		blob_drop(blob, &proof->endorsementCredential);
+		blob_drop(blob, &proof->platformCredential);
+		blob_drop(blob, &proof->conformanceCredential);
+		blob_drop(blob, &proof->identityKey.pubKey.key);
+		blob_drop(blob, &proof->identityKey.algorithmParms.parms);
+		proof->identityKey.pubKey.keyLength = 0;
+		proof->identityKey.algorithmParms.parmSize = 0;
 	}
 
-	return TSS_SUCCESS;
-error:
-	proof->labelSize = 0;
-	proof->identityBindingSize = 0;
-	proof->endorsementSize = 0;
-	proof->platformSize = 0;
-	proof->conformanceSize = 0;
-	free(proof->labelArea);
-	proof->labelArea = NULL;
-	free(proof->identityBinding);
-	proof->identityBinding = NULL;
-	free(proof->endorsementCredential);
-	proof->endorsementCredential = NULL;
-	free(proof->conformanceCredential);
-	proof->conformanceCredential = NULL;
-	/* free identityKey */
-	free(proof->identityKey.pubKey.key);
-	free(proof->identityKey.algorithmParms.parms);
-	proof->identityKey.pubKey.key = NULL;
-	proof->identityKey.pubKey.keyLength = 0;
-	proof->identityKey.algorithmParms.parms = NULL;
-	proof->identityKey.algorithmParms.parmSize = 0;
-
-	return result;
+	return blob->result;
 }
 
 void
-TestSuite_LoadBlob_SYM_CA_ATTESTATION(UINT16 *offset, BYTE *blob,
-				  TCPA_SYM_CA_ATTESTATION *sym)
+TestSuite_Blob_Put_SYM_CA_ATTESTATION(struct testsuite_blob *blob, TCPA_SYM_CA_ATTESTATION *sym)
 {
-	TestSuite_LoadBlob_UINT32(offset, sym->credSize, blob);
-	TestSuite_LoadBlob_KEY_PARMS(offset, blob, &sym->algorithm);
-	TestSuite_LoadBlob(offset, sym->credSize, blob, sym->credential);
+	TestSuite_Blob_Put_UINT32(blob, sym->credSize);
+	TestSuite_Blob_Put_KEY_PARMS(blob, &sym->algorithm);
+	TestSuite_Blob_Put(blob, sym->credential, sym->credSize);
 }
 
 TSS_RESULT
-TestSuite_UnloadBlob_SYM_CA_ATTESTATION(UINT16 *offset, BYTE *blob,
-				    TCPA_SYM_CA_ATTESTATION *sym)
+TestSuite_Blob_Get_SYM_CA_ATTESTATION(struct testsuite_blob *blob, TCPA_SYM_CA_ATTESTATION *sym)
 {
-	TSS_RESULT result;
+	sym->algorithm.parms = NULL;
 
-	TestSuite_UnloadBlob_UINT32(offset, &sym->credSize, blob);
-	if ((result = TestSuite_UnloadBlob_KEY_PARMS(offset, blob,
-						 &sym->algorithm))) {
-		sym->credSize = 0;
-		return result;
-	}
+	TestSuite_Blob_Get_UINT32(blob, &sym->credSize);
+	TestSuite_Blob_Get_KEY_PARMS(blob, &sym->algorithm);
+	TestSuite_Blob_Get_View(blob, &sym->credential, sym->credSize);
 
-	if (sym->credSize > 0) {
-		if ((sym->credential = malloc(sym->credSize)) == NULL) {
-			free(sym->algorithm.parms);
-			sym->algorithm.parmSize = 0;
-			sym->credSize = 0;
-			return TSS_E_OUTOFMEMORY;
-		}
-		TestSuite_UnloadBlob(offset, sym->credSize, blob, sym->credential);
-	} else {
-		sym->credential = NULL;
+	if (blob->result) {
+		blob_drop(blob, &sym->algorithm.parms);
+		sym->algorithm.parmSize = 0;
+		sym->credSize = 0;
 	}
 
-	return TSS_SUCCESS;
+	return blob->result;
 }
 
 void
-TestSuite_LoadBlob_ASYM_CA_CONTENTS(UINT16 *offset, BYTE *blob,
-				TCPA_ASYM_CA_CONTENTS *asym)
+TestSuite_Blob_Put_ASYM_CA_CONTENTS(struct testsuite_blob *blob, TCPA_ASYM_CA_CONTENTS *asym)
 {
-	TestSuite_LoadBlob_SYMMETRIC_KEY(offset, blob, &asym->sessionKey);
-	TestSuite_LoadBlob(offset, TCPA_SHA1_160_HASH_LEN, blob,
-		       (BYTE *)&asym->idDigest);
+	TestSuite_Blob_Put_SYMMETRIC_KEY(blob, &asym->sessionKey);
+	TestSuite_Blob_Put(blob, (BYTE *)&asym->idDigest, TCPA_SHA1_160_HASH_LEN);
 }
 
 TSS_RESULT
-TestSuite_UnloadBlob_ASYM_CA_CONTENTS(UINT16 *offset, BYTE *blob,
-				  TCPA_ASYM_CA_CONTENTS *asym)
+TestSuite_Blob_Get_ASYM_CA_CONTENTS(struct testsuite_blob *blob, TCPA_ASYM_CA_CONTENTS *asym)
 {
-	TSS_RESULT result;
-
-	if ((result = TestSuite_UnloadBlob_SYMMETRIC_KEY(offset, blob,
-						     &asym->sessionKey)))
-		return result;
+	TestSuite_Blob_Get_SYMMETRIC_KEY(blob, &asym->sessionKey);
+	TestSuite_Blob_Get(blob, (BYTE *)&asym->idDigest, TCPA_SHA1_160_HASH_LEN);
 
-	TestSuite_UnloadBlob(offset, TCPA_SHA1_160_HASH_LEN, blob,
-			 (BYTE *)&asym->idDigest);
+	if (blob->result)
+		blob_drop(blob, &asym->sessionKey.data);
 
-	return TSS_SUCCESS;
+	return blob->result;
 }
 
-static int
-hacky_strlen(char *codeset, BYTE *string)
+TSS_RESULT
+TestSuite_Blob_Get_IDENTITY_REQ(struct testsuite_blob *blob, TCPA_IDENTITY_REQ *req)
 {
-	BYTE *ptr = string;
-	int len = 0;
-
-	if (strcmp("UTF-16", codeset) == 0) {
-		while (!(ptr[0] == '\0' && ptr[1] == '\0')) {
-			len += 2;
-			ptr += 2;
-		}
-	} else if (strcmp("UTF-32", codeset) == 0) {
-		while (!(ptr[0] == '\0' && ptr[1] == '\0' &&
-			 ptr[2] == '\0' && ptr[3] == '\0')) {
-			len += 4;
-			ptr += 4;
-		}
-	} else {
-		/* default to 8bit chars */
-		while (*ptr++ != '\0') {
-			len++;
-		}
+	req->asymAlgorithm.parms = NULL;
+	req->symAlgorithm.parms = NULL;
+	req->asymBlob = NULL;
+
+	TestSuite_Blob_Get_UINT32(blob, &req->asymSize);
+	TestSuite_Blob_Get_UINT32(blob, &req->symSize);
+	TestSuite_Blob_Get_KEY_PARMS(blob, &req->asymAlgorithm);
+	TestSuite_Blob_Get_KEY_PARMS(blob, &req->symAlgorithm);
+	TestSuite_Blob_Get_View(blob, &req->asymBlob, req->asymSize);
+	TestSuite_Blob_Get_View(blob, &req->symBlob, req->symSize);
+
+	if (blob->result) {
+		blob_drop(blob, &req->asymAlgorithm.parms);
+		blob_drop(blob, &req->symAlgorithm.parms);
+		blob_drop(blob, &req->asymBlob);
+		req->asymSize = 0;
+		req->symSize = 0;
 	}
 
-	return len;
+	return blob->result;
 }
 
-static inline int
-char_width(char *codeset)
+/* a cursor for the old helpers, which copy and don't know the size */
+static void
+blob_wrap(struct testsuite_blob *blob, UINT16 *offset, BYTE *buf)
 {
-	if (strcmp("UTF-16", codeset) == 0) {
-		return 2;
-	} else if (strcmp("UTF-32", codeset) == 0) {
-		return 4;
-	}
-
-	return 1;
+	TestSuite_Blob_Init(blob, buf, BLOB_SIZE_MAX);
+	blob->offset = *offset;
+	blob->copy = 1;
 }
 
-#define MAX_BUF_SIZE	4096
-
-BYTE *
-TestSuite_Native_To_UNICODE(BYTE *string, unsigned *size)
+static TSS_RESULT
+blob_unwrap(struct testsuite_blob *blob, UINT16 *offset)
 {
-	char *ptr, *ret, *outbuf, tmpbuf[MAX_BUF_SIZE] = { 0, };
-	unsigned len = 0, tmplen;
-	iconv_t cd = 0;
-	size_t rc, outbytesleft, inbytesleft;
+	*offset = (UINT16)blob->offset;
 
-	if (string == NULL)
-		goto alloc_string;
+	return blob->result;
+}
+
+void
+TestSuite_LoadBlob_KEY_FLAGS(UINT16 * offset, BYTE * blob, TCPA_KEY_FLAGS * flags)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_KEY_FLAGS(&b, flags);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_UnloadBlob_KEY_FLAGS(UINT16 * offset, BYTE * blob, TCPA_KEY_FLAGS * flags)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_KEY_FLAGS(&b, flags);
+	blob_unwrap(&b, offset);
+}
+
+TSS_RESULT
+TestSuite_UnloadBlob_SYMMETRIC_KEY(UINT16 *offset, BYTE *blob, TCPA_SYMMETRIC_KEY *key)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_SYMMETRIC_KEY(&b, key);
+	return blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_PUBKEY(UINT16 *offset, BYTE *blob, TCPA_PUBKEY *pubKey)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_PUBKEY(&b, pubKey);
+	blob_unwrap(&b, offset);
+}
+
+TSS_RESULT
+TestSuite_UnloadBlob_PUBKEY(UINT16 * offset, BYTE * blob, TCPA_PUBKEY * pubKey)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_PUBKEY(&b, pubKey);
+	return blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob(UINT16 * offset, UINT32 size, BYTE * container, BYTE * object)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, container);
+	TestSuite_Blob_Put(&b, object, size);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_UnloadBlob(UINT16 * offset, UINT32 size, BYTE * container, BYTE * object)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, container);
+	TestSuite_Blob_Get(&b, object, size);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_BYTE(UINT16 * offset, BYTE data, BYTE * blob)
+{
+	blob[(*offset)++] = data;
+}
+
+void
+TestSuite_UnloadBlob_BYTE(UINT16 * offset, BYTE * dataOut, BYTE * blob)
+{
+	*dataOut = blob[(*offset)++];
+}
+
+void
+TestSuite_LoadBlob_BOOL(UINT16 * offset, TSS_BOOL data, BYTE * blob)
+{
+	blob[(*offset)++] = (BYTE) data;
+}
+
+void
+TestSuite_UnloadBlob_BOOL(UINT16 * offset, TSS_BOOL * dataOut, BYTE * blob)
+{
+	*dataOut = blob[(*offset)++];
+}
+
+void
+TestSuite_LoadBlob_UINT32(UINT16 * offset, UINT32 in, BYTE * blob)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_UINT32(&b, in);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_UINT16(UINT16 * offset, UINT16 in, BYTE * blob)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_UINT16(&b, in);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_UnloadBlob_UINT32(UINT16 * offset, UINT32 * out, BYTE * blob)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_UINT32(&b, out);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_UnloadBlob_UINT16(UINT16 * offset, UINT16 * out, BYTE * blob)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_UINT16(&b, out);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_RSA_KEY_PARMS(UINT16 * offset, BYTE * blob, TCPA_RSA_KEY_PARMS * parms)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_RSA_KEY_PARMS(&b, parms);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_TSS_VERSION(UINT16 * offset, BYTE * blob, TSS_VERSION version)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_TSS_VERSION(&b, &version);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_UnloadBlob_TCPA_VERSION(UINT16 * offset, BYTE * blob, TCPA_VERSION * out)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_TCPA_VERSION(&b, out);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_TCPA_VERSION(UINT16 * offset, BYTE * blob, TCPA_VERSION version)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_TCPA_VERSION(&b, &version);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_KEY(UINT16 * offset, BYTE * blob, TCPA_KEY * key)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_KEY(&b, key);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_KEY_PARMS(UINT16 * offset, BYTE * blob, TCPA_KEY_PARMS * keyInfo)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_KEY_PARMS(&b, keyInfo);
+	blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_STORE_PUBKEY(UINT16 * offset, BYTE * blob, TCPA_STORE_PUBKEY * store)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_STORE_PUBKEY(&b, store);
+	blob_unwrap(&b, offset);
+}
+
+TSS_RESULT
+TestSuite_UnloadBlob_KEY_PARMS(UINT16 * offset, BYTE * blob, TCPA_KEY_PARMS * keyParms)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_KEY_PARMS(&b, keyParms);
+	return blob_unwrap(&b, offset);
+}
+
+TSS_RESULT
+TestSuite_UnloadBlob_KEY12(UINT16 * offset, BYTE * blob, TPM_KEY12 * key)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_KEY12(&b, key);
+	return blob_unwrap(&b, offset);
+}
+
+TSS_RESULT
+TestSuite_UnloadBlob_KEY(UINT16 * offset, BYTE * blob, TCPA_KEY * key)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_KEY(&b, key);
+	return blob_unwrap(&b, offset);
+}
+
+TSS_RESULT
+TestSuite_UnloadBlob_STORE_PUBKEY(UINT16 * offset, BYTE * blob, TCPA_STORE_PUBKEY * store)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_STORE_PUBKEY(&b, store);
+	return blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_UnloadBlob_VERSION(UINT16 * offset, BYTE * blob, TCPA_VERSION * out)
+{
+	TestSuite_UnloadBlob_TCPA_VERSION(offset, blob, out);
+}
+
+void
+TestSuite_LoadBlob_SYMMETRIC_KEY(UINT16 *offset, BYTE *blob, TCPA_SYMMETRIC_KEY *key)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_SYMMETRIC_KEY(&b, key);
+	blob_unwrap(&b, offset);
+}
+
+TSS_RESULT
+TestSuite_UnloadBlob_IDENTITY_PROOF(UINT16 *offset, BYTE *blob, TCPA_IDENTITY_PROOF *proof)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_IDENTITY_PROOF(&b, proof);
+	return blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_SYM_CA_ATTESTATION(UINT16 *offset, BYTE *blob,
+				  TCPA_SYM_CA_ATTESTATION *sym)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_SYM_CA_ATTESTATION(&b, sym);
+	blob_unwrap(&b, offset);
+}
+
+TSS_RESULT
+TestSuite_UnloadBlob_SYM_CA_ATTESTATION(UINT16 *offset, BYTE *blob,
+				    TCPA_SYM_CA_ATTESTATION *sym)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_SYM_CA_ATTESTATION(&b, sym);
+	return blob_unwrap(&b, offset);
+}
+
+void
+TestSuite_LoadBlob_ASYM_CA_CONTENTS(UINT16 *offset, BYTE *blob,
+				TCPA_ASYM_CA_CONTENTS *asym)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Put_ASYM_CA_CONTENTS(&b, asym);
+	blob_unwrap(&b, offset);
+}
+
+TSS_RESULT
+TestSuite_UnloadBlob_ASYM_CA_CONTENTS(UINT16 *offset, BYTE *blob,
+				  TCPA_ASYM_CA_CONTENTS *asym)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_ASYM_CA_CONTENTS(&b, asym);
+	return blob_unwrap(&b, offset);
+}
+
+TSS_RESULT
+TestSuite_UnloadBlob_IDENTITY_REQ(UINT16 *offset, BYTE *blob, TCPA_IDENTITY_REQ *req)
+{
+	struct testsuite_blob b;
+
+	blob_wrap(&b, offset, blob);
+	TestSuite_Blob_Get_IDENTITY_REQ(&b, req);
+	return blob_unwrap(&b, offset);
+}
+
+static int
+hacky_strlen(char *codeset, BYTE *string)
+{
+	BYTE *ptr = string;
+	int len = 0;
+
+	if (strcmp("UTF-16", codeset) == 0) {
+		while (!(ptr[0] == '\0' && ptr[1] == '\0')) {
+			len += 2;
+			ptr += 2;
+		}
+	} else if (strcmp("UTF-32", codeset) == 0) {
+		while (!(ptr[0] == '\0' && ptr[1] == '\0' &&
+			 ptr[2] == '\0' && ptr[3] == '\0')) {
+			len += 4;
+			ptr += 4;
+		}
+	} else {
+		/* default to 8bit chars */
+		while (*ptr++ != '\0') {
+			len++;
+		}
+	}
+
+	return len;
+}
+
+static inline int
+char_width(char *codeset)
+{
+	if (strcmp("UTF-16", codeset) == 0) {
+		return 2;
+	} else if (strcmp("UTF-32", codeset) == 0) {
+		return 4;
+	}
+
+	return 1;
+}
+
+/* iconv descriptors are opened once per thread and direction, and reopened
+ * only when the locale's codeset changes. Each thread has its own, since a
+ * descriptor carries conversion state. They are thread specific data, so
+ * that a thread's descriptors are closed when it exits. */
+struct unicode_cd
+{
+	iconv_t	cd;
+	char	codeset[64];
+};
+
+static pthread_key_t unicode_cd_keys[2];
+static pthread_once_t unicode_cd_once = PTHREAD_ONCE_INIT;
+static int unicode_cd_keys_ok;
+
+static void
+unicode_cd_free(void *arg)
+{
+	struct unicode_cd *c = arg;
+
+	if (c->cd != (iconv_t)-1)
+		iconv_close(c->cd);
+	free(c);
+}
+
+static void
+unicode_cd_keys_init(void)
+{
+	unicode_cd_keys_ok = !pthread_key_create(&unicode_cd_keys[0], unicode_cd_free) &&
+			     !pthread_key_create(&unicode_cd_keys[1], unicode_cd_free);
+}
+
+static iconv_t
+unicode_cd_get(char *codeset, int to_unicode)
+{
+	struct unicode_cd *c;
+
+	pthread_once(&unicode_cd_once, unicode_cd_keys_init);
+	if (!unicode_cd_keys_ok) {
+		fprintf(stderr, "pthread_key_create failed\n");
+		return (iconv_t)-1;
+	}
+
+	if ((c = pthread_getspecific(unicode_cd_keys[to_unicode])) == NULL) {
+		if ((c = malloc(sizeof(struct unicode_cd))) == NULL) {
+			fprintf(stderr, "malloc of %zu bytes failed.", sizeof(struct unicode_cd));
+			return (iconv_t)-1;
+		}
+		c->cd = (iconv_t)-1;
+		if (pthread_setspecific(unicode_cd_keys[to_unicode], c)) {
+			free(c);
+			return (iconv_t)-1;
+		}
+	}
+
+	if (c->cd != (iconv_t)-1) {
+		if (strcmp(c->codeset, codeset) == 0) {
+			/* reset the shift state left by the last conversion */
+			iconv(c->cd, NULL, NULL, NULL, NULL);
+			return c->cd;
+		}
+		iconv_close(c->cd);
+		c->cd = (iconv_t)-1;
+	}
+
+	if (to_unicode)
+		c->cd = iconv_open("UTF-16LE", codeset);
+	else
+		c->cd = iconv_open(codeset, "UTF-16LE");
+	if (c->cd == (iconv_t)-1) {
+		fprintf(stderr, "iconv_open: %s", strerror(errno));
+		return c->cd;
+	}
+	strncpy(c->codeset, codeset, sizeof(c->codeset) - 1);
+	c->codeset[sizeof(c->codeset) - 1] = '\0';
+
+	return c->cd;
+}
+
+#define CODESET_OTHER	0
+#define CODESET_ASCII	1
+#define CODESET_UTF8	2
+
+static int
+codeset_type(char *codeset)
+{
+	if (strcmp(codeset, "UTF-8") == 0)
+		return CODESET_UTF8;
+	/* the C locale */
+	if (strcmp(codeset, "ANSI_X3.4-1968") == 0 || strcmp(codeset, "ASCII") == 0)
+		return CODESET_ASCII;
+
+	return CODESET_OTHER;
+}
+
+/* Decode UTF-8 straight into UTF-16LE. out must hold 2 * len bytes, which is
+ * enough since no sequence encodes to more than 2 bytes per input byte.
+ * Returns the number of bytes written, or -1 on a sequence iconv would
+ * reject, or which is not ASCII when ascii_only is set. */
+static long
+utf8_to_utf16le(BYTE *in, size_t len, BYTE *out, int ascii_only)
+{
+	BYTE *end = in + len, *o = out;
+	UINT32 c, min;
+	int n;
+
+	while (in < end) {
+		c = *in++;
+		if (c < 0x80) {
+			*o++ = c;
+			*o++ = 0;
+			continue;
+		}
+		if (ascii_only)
+			return -1;
+
+		if ((c & 0xe0) == 0xc0) {
+			n = 1;
+			c &= 0x1f;
+			min = 0x80;
+		} else if ((c & 0xf0) == 0xe0) {
+			n = 2;
+			c &= 0x0f;
+			min = 0x800;
+		} else if ((c & 0xf8) == 0xf0) {
+			n = 3;
+			c &= 0x07;
+			min = 0x10000;
+		} else
+			return -1;
+
+		if (end - in < n)
+			return -1;
+		while (n--) {
+			if ((*in & 0xc0) != 0x80)
+				return -1;
+			c = (c << 6) | (*in++ & 0x3f);
+		}
+		/* overlong forms, surrogates and values past U+10FFFF */
+		if (c < min || (c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+			return -1;
+
+		if (c >= 0x10000) {
+			c -= 0x10000;
+			*o++ = (0xd800 | (c >> 10)) & 0xff;
+			*o++ = (0xd800 | (c >> 10)) >> 8;
+			c = 0xdc00 | (c & 0x3ff);
+		}
+		*o++ = c & 0xff;
+		*o++ = c >> 8;
+	}
+
+	return o - out;
+}
+
+/* Encode UTF-16LE as UTF-8. out must hold 3 * len / 2 bytes. Returns the
+ * number of bytes written, or -1 on an unpaired surrogate, or on a character
+ * which is not ASCII when ascii_only is set. */
+static long
+utf16le_to_utf8(BYTE *in, size_t len, BYTE *out, int ascii_only)
+{
+	BYTE *end = in + len, *o = out;
+	UINT32 c, c2;
+
+	while (in < end) {
+		c = in[0] | (in[1] << 8);
+		in += 2;
+		if (c < 0x80) {
+			*o++ = c;
+			continue;
+		}
+		if (ascii_only)
+			return -1;
+
+		if (c < 0x800) {
+			*o++ = 0xc0 | (c >> 6);
+			*o++ = 0x80 | (c & 0x3f);
+			continue;
+		}
+		if (c >= 0xdc00 && c <= 0xdfff)
+			return -1;
+		if (c >= 0xd800 && c <= 0xdbff) {
+			if (in == end)
+				return -1;
+			c2 = in[0] | (in[1] << 8);
+			if (c2 < 0xdc00 || c2 > 0xdfff)
+				return -1;
+			in += 2;
+			c = 0x10000 + (((c & 0x3ff) << 10) | (c2 & 0x3ff));
+			*o++ = 0xf0 | (c >> 18);
+			*o++ = 0x80 | ((c >> 12) & 0x3f);
+		} else
+			*o++ = 0xe0 | (c >> 12);
+		*o++ = 0x80 | ((c >> 6) & 0x3f);
+		*o++ = 0x80 | (c & 0x3f);
+	}
+
+	return o - out;
+}
+
+/* Convert len bytes of in with cd into a new buffer, followed by term zero
+ * bytes. The buffer starts at alloc bytes, the expected worst case, and
+ * only grows for codesets that don't fit it. */
+static BYTE *
+iconv_convert(iconv_t cd, BYTE *in, size_t len, size_t alloc, unsigned term,
+	      unsigned *size)
+{
+	char *ptr = (char *)in, *outbuf, *ret, *tmp;
+	size_t rc, inbytesleft = len, outbytesleft, used;
+
+	if ((ret = malloc(alloc + term)) == NULL) {
+		fprintf(stderr, "malloc of %zu bytes failed.", alloc + term);
+		return NULL;
+	}
+	outbuf = ret;
+	outbytesleft = alloc;
+
+	for (;;) {
+		rc = iconv(cd, &ptr, &inbytesleft, &outbuf, &outbytesleft);
+		if (rc != (size_t)-1)
+			rc = iconv(cd, NULL, NULL, &outbuf, &outbytesleft);
+		if (rc != (size_t)-1)
+			break;
+		if (errno != E2BIG) {
+			fprintf(stderr, "iconv: %s", strerror(errno));
+			free(ret);
+			return NULL;
+		}
+
+		used = outbuf - ret;
+		alloc = alloc ? alloc * 2 : 64;
+		if ((tmp = realloc(ret, alloc + term)) == NULL) {
+			fprintf(stderr, "realloc of %zu bytes failed.", alloc + term);
+			free(ret);
+			return NULL;
+		}
+		ret = tmp;
+		outbuf = ret + used;
+		outbytesleft = alloc - used;
+	}
+
+	used = outbuf - ret;
+	memset(outbuf, 0, term);
+	if (size)
+		*size = used + term;
+
+	return (BYTE *)ret;
+}
+
+BYTE *
+TestSuite_Native_To_UNICODE(BYTE *string, unsigned *size)
+{
+	char *codeset = nl_langinfo(CODESET);
+	unsigned term = char_width("UTF-16");
+	size_t len = 0;
+	BYTE *ret;
+	iconv_t cd;
+	long n;
+	int type;
+
+	if (string)
+		len = hacky_strlen(codeset, string);
+
+	type = codeset_type(codeset);
+	if (type != CODESET_OTHER || len == 0) {
+		if ((ret = malloc(2 * len + term)) == NULL) {
+			fprintf(stderr, "malloc of %zu bytes failed.", 2 * len + term);
+			return NULL;
+		}
+
+		n = utf8_to_utf16le(string, len, ret, type == CODESET_ASCII);
+		if (n >= 0) {
+			memset(ret + n, 0, term);
+			if (size)
+				*size = n + term;
+			return ret;
+		}
+		/* let iconv decide, and report, what's wrong with it */
+		free(ret);
+	}
+
+	if ((cd = unicode_cd_get(codeset, 1)) == (iconv_t)-1)
+		return NULL;
+
+	/* every UTF-16 code unit takes at least one byte of input */
+	return iconv_convert(cd, string, len, 2 * len, term, size);
+}
+
+BYTE *
+TestSuite_UNICODE_To_Native(BYTE *string, unsigned *size)
+{
+	char *codeset = nl_langinfo(CODESET);
+	unsigned term = char_width(codeset);
+	size_t len;
+	BYTE *ret;
+	iconv_t cd;
+	long n;
+	int type;
+
+	if (string == NULL) {
+		if (size)
+			*size = 0;
+		return NULL;
+	}
+
+	len = hacky_strlen("UTF-16", string);
+
+	type = codeset_type(codeset);
+	if (type != CODESET_OTHER || len == 0) {
+		if ((ret = malloc(3 * len / 2 + term)) == NULL) {
+			fprintf(stderr, "malloc of %zu bytes failed.", 3 * len / 2 + term);
+			return NULL;
+		}
+
+		n = utf16le_to_utf8(string, len, ret, type == CODESET_ASCII);
+		if (n >= 0) {
+			memset(ret + n, 0, term);
+			if (size)
+				*size = n + term;
+			return ret;
+		}
+		free(ret);
+	}
+
+	if ((cd = unicode_cd_get(codeset, 0)) == (iconv_t)-1)
+		return NULL;
+
+	/* enough for any BMP character in UTF-8 and the double byte codesets */
+	return iconv_convert(cd, string, len, 2 * len, term, size);
+}
+
+#define EVP_SUCCESS 1
+
+void
+print_openssl_errors()
+{
+	ERR_load_crypto_strings();
+	ERR_print_errors_fp(stderr);
+}
+#ifdef TESTSUITE_HASH
+TSS_RESULT
+TestSuite_Hash(UINT32 HashType, UINT32 BufSize, BYTE* Buf, BYTE* Digest)
+{
+	EVP_MD_CTX md_ctx;
+	unsigned int result_size;
+	int rv;
+
+	switch (HashType) {
+		case TSS_HASH_SHA1:
+			rv = EVP_DigestInit(&md_ctx, EVP_sha1());
+			break;
+		default:
+			rv = TSS_E_BAD_PARAMETER;
+			goto out;
+			break;
+	}
+
+	if (rv != EVP_SUCCESS) {
+		rv = TSS_E_INTERNAL_ERROR;
+		goto err;
+	}
+
+	rv = EVP_DigestUpdate(&md_ctx, Buf, BufSize);
+	if (rv != EVP_SUCCESS) {
+		rv = TSS_E_INTERNAL_ERROR;
+		goto err;
+	}
+
+	result_size = EVP_MD_CTX_size(&md_ctx);
+	rv = EVP_DigestFinal(&md_ctx, Digest, &result_size);
+	if (rv != EVP_SUCCESS) {
+		rv = TSS_E_INTERNAL_ERROR;
+		goto err;
+	} else
+		rv = TSS_SUCCESS;
+
+	goto out;
+
+err:
+	print_openssl_errors();
+out:
+	return rv;
+}
+#endif
+TSS_RESULT
+TestSuite_SymEncrypt(UINT16 alg, BYTE mode, BYTE *key, BYTE *iv, BYTE *in, UINT32 in_len, BYTE *out,
+		     UINT32 *out_len)
+{
+	TSS_RESULT result = TSS_SUCCESS;
+	EVP_CIPHER_CTX ctx;
+	EVP_CIPHER *cipher;
+	BYTE *def_iv = NULL, *outiv_ptr;
+	UINT32 tmp;
+	int iv_len, outiv_len;
+
+	if (*out_len > INT_MAX)
+		outiv_len = INT_MAX;
+	else
+		outiv_len = *(int *)out_len;
+
+	/* TPM 1.1 had no defines for symmetric encryption modes, must use CBC */
+	switch (mode) {
+		case TCPA_ES_NONE:
+		case TSS_ES_NONE:
+			break;
+		default:
+			fprintf(stderr, "Invalid mode in doing symmetric decryption");
+			return TSS_E_INTERNAL_ERROR;
+	}
+
+	switch (alg) {
+		case TSS_ALG_AES:
+		case TCPA_ALG_AES:
+			cipher = (EVP_CIPHER *)EVP_aes_128_cbc();
+			break;
+		case TSS_ALG_DES:
+		case TCPA_ALG_DES:
+			cipher = (EVP_CIPHER *)EVP_des_cbc();
+			break;
+		case TSS_ALG_3DES:
+		case TCPA_ALG_3DES:
+			cipher = (EVP_CIPHER *)EVP_des_ede3_cbc();
+			break;
+		default:
+			return TSS_E_INTERNAL_ERROR;
+			break;
+	}
+
+	EVP_CIPHER_CTX_init(&ctx);
+
+	/* If the iv passed in is NULL, create a new random iv and prepend it to the ciphertext */
+	iv_len = EVP_CIPHER_iv_length(cipher);
+	if (iv == NULL) {
+		def_iv = malloc(iv_len);
+		if (def_iv == NULL) {
+			fprintf(stderr, "malloc of %d bytes failed.", iv_len);
+			return TSS_E_OUTOFMEMORY;
+		}
+		RAND_bytes(def_iv, iv_len);
+
+		memcpy(out, def_iv, iv_len);
+		outiv_ptr = &out[iv_len];
+		outiv_len -= iv_len;
+	} else {
+		def_iv = iv;
+		outiv_ptr = out;
+	}
+
+	if (!EVP_EncryptInit(&ctx, (const EVP_CIPHER *)cipher, key, def_iv)) {
+		result = TSS_E_INTERNAL_ERROR;
+		print_openssl_errors();
+		goto done;
+	}
+
+	if ((UINT32)outiv_len < in_len + (EVP_CIPHER_CTX_block_size(&ctx) * 2) - 1) {
+		fprintf(stderr, "Not enough space to do symmetric encryption");
+		result = TSS_E_INTERNAL_ERROR;
+		goto done;
+	}
+
+	if (!EVP_EncryptUpdate(&ctx, outiv_ptr, &outiv_len, in, in_len)) {
+		result = TSS_E_INTERNAL_ERROR;
+		print_openssl_errors();
+		goto done;
+	}
+
+	if (!EVP_EncryptFinal(&ctx, outiv_ptr + outiv_len, (int *)&tmp)) {
+		result = TSS_E_INTERNAL_ERROR;
+		print_openssl_errors();
+		goto done;
+	}
+
+	outiv_len += tmp;
+	*out_len = outiv_len;
+done:
+	if (def_iv != iv) {
+		*out_len += iv_len;
+		free(def_iv);
+	}
+	EVP_CIPHER_CTX_cleanup(&ctx);
+	return result;
+}
+
+TSS_RESULT
+TestSuite_SymDecrypt(UINT16 alg, BYTE mode, BYTE *key, BYTE *iv, BYTE *in, UINT32 in_len, BYTE *out,
+		     UINT32 *out_len)
+{
+	TSS_RESULT result = TSS_SUCCESS;
+	EVP_CIPHER_CTX ctx;
+	EVP_CIPHER *cipher;
+	BYTE *def_iv = NULL, *iniv_ptr;
+	UINT32 tmp;
+	int iv_len, iniv_len;
+
+	if (in_len > INT_MAX)
+		return TSS_E_BAD_PARAMETER;
+
+	/* TPM 1.1 had no defines for symmetric encryption modes, must use CBC */
+	switch (mode) {
+		case TCPA_ES_NONE:
+		case TSS_ES_NONE:
+			break;
+		default:
+			fprintf(stderr, "Invalid mode in doing symmetric decryption");
+			return TSS_E_INTERNAL_ERROR;
+	}
+
+	switch (alg) {
+		case TSS_ALG_AES:
+		case TCPA_ALG_AES:
+			cipher = (EVP_CIPHER *)EVP_aes_128_cbc();
+			break;
+		case TSS_ALG_DES:
+		case TCPA_ALG_DES:
+			cipher = (EVP_CIPHER *)EVP_des_cbc();
+			break;
+		case TSS_ALG_3DES:
+		case TCPA_ALG_3DES:
+			cipher = (EVP_CIPHER *)EVP_des_ede3_cbc();
+			break;
+		default:
+			return TSS_E_INTERNAL_ERROR;
+			break;
+	}
+
+	EVP_CIPHER_CTX_init(&ctx);
+
+	/* If the iv is NULL, assume that its prepended to the ciphertext */
+	if (iv == NULL) {
+		iv_len = EVP_CIPHER_iv_length(cipher);
+		def_iv = malloc(iv_len);
+		if (def_iv == NULL) {
+			fprintf(stderr, "malloc of %d bytes failed.", iv_len);
+			return TSS_E_OUTOFMEMORY;
+		}
+
+		memcpy(def_iv, in, iv_len);
+		iniv_ptr = &in[iv_len];
+		iniv_len = in_len - iv_len;
+	} else {
+		def_iv = iv;
+		iniv_ptr = in;
+		iniv_len = in_len;
+	}
+
+	if (!EVP_DecryptInit(&ctx, cipher, key, def_iv)) {
+		result = TSS_E_INTERNAL_ERROR;
+		print_openssl_errors();
+		goto done;
+	}
+
+	if (!EVP_DecryptUpdate(&ctx, out, (int *)out_len, iniv_ptr, iniv_len)) {
+		result = TSS_E_INTERNAL_ERROR;
+		print_openssl_errors();
+		goto done;
+	}
+
+	if (!EVP_DecryptFinal(&ctx, out + *out_len, (int *)&tmp)) {
+		result = TSS_E_INTERNAL_ERROR;
+		print_openssl_errors();
+		goto done;
+	}
+
+	*out_len += tmp;
+done:
+	if (def_iv != iv)
+		free(def_iv);
+	EVP_CIPHER_CTX_cleanup(&ctx);
+	return result;
+}
+
+/*
+ * RSA public key contexts.
+ *
+ * A struct testsuite_rsa_key holds an OpenSSL key and an encryption context
+ * set up for one padding scheme, so that encrypting many blobs to the same
+ * key (binding, migration, identity requests, benchmarks) parses the key and
+ * sets up OpenSSL once. Any modulus OpenSSL accepts up to 16384 bits can be
+ * used. A context must only be used by one thread at a time.
+ */
+
+#define RSA_KEY_MAX_BYTES	(16384 / 8)
+
+/* a public key with modulus n and exponent e */
+static EVP_PKEY *
+rsa_pkey_new(BYTE *n, UINT32 n_size, BYTE *e, UINT32 e_size)
+{
+	BIGNUM *bn_n, *bn_e;
+	EVP_PKEY *pkey = NULL;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM_BLD *bld = NULL;
+	OSSL_PARAM *params = NULL;
+	EVP_PKEY_CTX *ctx = NULL;
+#else
+	RSA *rsa = NULL;
+#endif
+
+	bn_n = BN_bin2bn(n, n_size, NULL);
+	bn_e = BN_bin2bn(e, e_size, NULL);
+	if (bn_n == NULL || bn_e == NULL)
+		goto done;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if ((bld = OSSL_PARAM_BLD_new()) == NULL ||
+	    !OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_N, bn_n) ||
+	    !OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_E, bn_e) ||
+	    (params = OSSL_PARAM_BLD_to_param(bld)) == NULL ||
+	    (ctx = EVP_PKEY_CTX_new_from_name(NULL, "RSA", NULL)) == NULL ||
+	    EVP_PKEY_fromdata_init(ctx) <= 0 ||
+	    EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) <= 0)
+		pkey = NULL;
+
+	EVP_PKEY_CTX_free(ctx);
+	OSSL_PARAM_free(params);
+	OSSL_PARAM_BLD_free(bld);
+#else
+	if ((rsa = RSA_new()) == NULL)
+		goto done;
+
+	/* set the public key value and exponent in the OpenSSL object */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	RSA_set0_key(rsa, bn_n, bn_e, NULL);
+#else
+	rsa->n = bn_n;
+	rsa->e = bn_e;
+#endif
+	bn_n = bn_e = NULL;
+
+	if ((pkey = EVP_PKEY_new()) == NULL)
+		goto done;
+	if (!EVP_PKEY_assign_RSA(pkey, rsa)) {
+		EVP_PKEY_free(pkey);
+		pkey = NULL;
+		goto done;
+	}
+	rsa = NULL;
+#endif
+
+done:
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+	RSA_free(rsa);
+#endif
+	BN_free(bn_n);
+	BN_free(bn_e);
+
+	return pkey;
+}
+
+static TSS_RESULT
+rsa_key_init(struct testsuite_rsa_key *key, BYTE *n, UINT32 n_size, BYTE *e, UINT32 e_size,
+	     int padding, BYTE *label, UINT32 label_len)
+{
+	unsigned char exp[] = { 0x01, 0x00, 0x01 }; /* 65537 hex */
+	BYTE *l;
+
+	memset(key, 0, sizeof(struct testsuite_rsa_key));
+
+	if (n_size == 0 || n_size > RSA_KEY_MAX_BYTES)
+		return TSS_E_BAD_PARAMETER;
+	if (e_size == 0) {
+		e = exp;
+		e_size = sizeof(exp);
+	}
+
+	if ((key->pkey = rsa_pkey_new(n, n_size, e, e_size)) == NULL)
+		goto err;
+	key->size = EVP_PKEY_size(key->pkey);
+
+	if ((key->ctx = EVP_PKEY_CTX_new(key->pkey, NULL)) == NULL ||
+	    EVP_PKEY_encrypt_init(key->ctx) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_padding(key->ctx, padding) <= 0)
+		goto err;
+
+	if (label_len) {
+		/* the context takes ownership of the label */
+		if ((l = OPENSSL_malloc(label_len)) == NULL)
+			goto err;
+		memcpy(l, label, label_len);
+		if (EVP_PKEY_CTX_set0_rsa_oaep_label(key->ctx, l, label_len) <= 0) {
+			OPENSSL_free(l);
+			goto err;
+		}
+	}
+
+	return TSS_SUCCESS;
+
+err:
+	print_openssl_errors();
+	TestSuite_RSA_Key_Free(key);
+	return TSS_E_INTERNAL_ERROR;
+}
+
+/* set up key for encryption with modulus n and exponent e (0 for 65537)
+ * using enc_scheme, one of TCPA_ES_NONE, TCPA_ES_RSAESPKCSv15 and
+ * TCPA_ES_RSAESOAEP_SHA1_MGF1. OAEP uses the "TCPA" label, as the TPM does */
+TSS_RESULT
+TestSuite_RSA_Key_Init(struct testsuite_rsa_key *key, BYTE *n, UINT32 n_size, UINT32 e,
+		       TCPA_ENC_SCHEME enc_scheme)
+{
+	BYTE exp[4], label[] = "TCPA";
+	UINT32 e_size = 0;
+	int padding;
+
+	switch (enc_scheme) {
+		case TCPA_ES_NONE:
+			padding = RSA_NO_PADDING;
+			break;
+		case TCPA_ES_RSAESPKCSv15:
+			padding = RSA_PKCS1_PADDING;
+			break;
+		case TCPA_ES_RSAESOAEP_SHA1_MGF1:
+			padding = RSA_PKCS1_OAEP_PADDING;
+			break;
+		default:
+			return TSS_E_BAD_PARAMETER;
+	}
+
+	/* big endian, without leading zeroes */
+	for (; e; e >>= 8)
+		exp[3 - e_size++] = e & 0xff;
+
+	return rsa_key_init(key, n, n_size, &exp[4 - e_size], e_size, padding, label,
+			    padding == RSA_PKCS1_OAEP_PADDING ? 4 : 0);
+}
+
+/* set up key from a TCPA_PUBKEY, e.g. one unloaded from the blob returned for
+ * TSS_TSPATTRIB_KEYBLOB_PUBLIC_KEY, with the key's own encryption scheme */
+TSS_RESULT
+TestSuite_RSA_Key_From_PUBKEY(struct testsuite_rsa_key *key, TCPA_PUBKEY *pubKey)
+{
+	struct testsuite_blob b;
+	TCPA_RSA_KEY_PARMS parms;
+	BYTE label[] = "TCPA";
+	int padding;
+
+	if (pubKey->algorithmParms.algorithmID != TCPA_ALG_RSA)
+		return TSS_E_BAD_PARAMETER;
+
+	switch (pubKey->algorithmParms.encScheme) {
+		case TCPA_ES_NONE:
+			padding = RSA_NO_PADDING;
+			break;
+		case TCPA_ES_RSAESPKCSv15:
+			padding = RSA_PKCS1_PADDING;
+			break;
+		case TCPA_ES_RSAESOAEP_SHA1_MGF1:
+			padding = RSA_PKCS1_OAEP_PADDING;
+			break;
+		default:
+			return TSS_E_BAD_PARAMETER;
+	}
+
+	TestSuite_Blob_Init(&b, pubKey->algorithmParms.parms, pubKey->algorithmParms.parmSize);
+	if (TestSuite_Blob_Get_RSA_KEY_PARMS(&b, &parms))
+		return b.result;
+
+	return rsa_key_init(key, pubKey->pubKey.key, pubKey->pubKey.keyLength, parms.exponent,
+			    parms.exponentSize, padding, label,
+			    padding == RSA_PKCS1_OAEP_PADDING ? 4 : 0);
+}
+
+/* set up key from a marshalled TCPA_PUBKEY */
+TSS_RESULT
+TestSuite_RSA_Key_From_Blob(struct testsuite_rsa_key *key, BYTE *blob, UINT32 size)
+{
+	struct testsuite_blob b;
+	TCPA_PUBKEY pubKey;
+
+	TestSuite_Blob_Init(&b, blob, size);
+	if (TestSuite_Blob_Get_PUBKEY(&b, &pubKey))
+		return b.result;
+
+	return TestSuite_RSA_Key_From_PUBKEY(key, &pubKey);
+}
+
+/* out must hold key->size bytes, which is also what *out_len is set to */
+TSS_RESULT
+TestSuite_RSA_Key_Encrypt(struct testsuite_rsa_key *key, BYTE *in, UINT32 in_len, BYTE *out,
+			  UINT32 *out_len)
+{
+	size_t len = key->size;
+
+	if (EVP_PKEY_encrypt(key->ctx, out, &len, in, in_len) <= 0) {
+		print_openssl_errors();
+		return TSS_E_INTERNAL_ERROR;
+	}
+	*out_len = len;
+
+	return TSS_SUCCESS;
+}
+
+/* encrypt num blobs, writing the i'th to out + i * key->size. Stops at the
+ * first failure, with *done set to the number encrypted */
+TSS_RESULT
+TestSuite_RSA_Key_Encrypt_Batch(struct testsuite_rsa_key *key, UINT32 num, BYTE **in,
+				UINT32 *in_len, BYTE *out, UINT32 *done)
+{
+	TSS_RESULT result = TSS_SUCCESS;
+	UINT32 i, len;
+
+	for (i = 0; i < num; i++) {
+		result = TestSuite_RSA_Key_Encrypt(key, in[i], in_len[i], out + i * key->size,
+						   &len);
+		if (result)
+			break;
+	}
+	if (done)
+		*done = i;
+
+	return result;
+}
+
+void
+TestSuite_RSA_Key_Free(struct testsuite_rsa_key *key)
+{
+	EVP_PKEY_CTX_free(key->ctx);
+	EVP_PKEY_free(key->pkey);
+	key->ctx = NULL;
+	key->pkey = NULL;
+}
+
+int
+TestSuite_RSA_Public_Encrypt(unsigned char *in, unsigned int inlen,
+			     unsigned char *out, unsigned int *outlen,
+			     unsigned char *pubkey, unsigned int pubsize,
+			     unsigned int e, int padding)
+{
+	struct testsuite_rsa_key key;
+	BYTE exp = e;
+	int rv;
+
+	switch (e) {
+		case 0:
+			/* fall through */
+		case 65537:
+			break;
+		case 17:
+		case 3:
+			break;
+		default:
+			return TSS_E_INTERNAL_ERROR;
+	}
+
+	switch (padding) {
+		case RSA_PKCS1_OAEP_PADDING:
+		case RSA_PKCS1_PADDING:
+		case RSA_NO_PADDING:
+			break;
+		default:
+			return TSS_E_INTERNAL_ERROR;
+	}
+
+	/* OAEP here is without the TPM's label */
+	if ((rv = rsa_key_init(&key, pubkey, pubsize, &exp, (e == 3 || e == 17) ? 1 : 0,
+			       padding, NULL, 0)))
+		return rv;
+
+	rv = TestSuite_RSA_Key_Encrypt(&key, in, inlen, out, outlen);
+	TestSuite_RSA_Key_Free(&key);
+
+	return rv;
+}
+
+int
+TestSuite_TPM_RSA_Encrypt(unsigned char *dataToEncrypt,
+			  unsigned int dataToEncryptLen,
+			  unsigned char *encryptedData,
+			  unsigned int *encryptedDataLen,
+			  unsigned char *publicKey,
+			  unsigned int keysize)
+{
+	struct testsuite_rsa_key key;
+	int rv;
+
+	if ((rv = TestSuite_RSA_Key_Init(&key, publicKey, keysize, 0,
+					 TCPA_ES_RSAESOAEP_SHA1_MGF1)))
+		return rv;
+
+	rv = TestSuite_RSA_Key_Encrypt(&key, dataToEncrypt, dataToEncryptLen, encryptedData,
+				       encryptedDataLen);
+	TestSuite_RSA_Key_Free(&key);
+
+	return rv;
+}
+
+/* Testsuite_Transport_Init/Final: wrappers for executing APIs inside a logged transport session */
+TSS_RESULT
+Testsuite_Transport_Init(TSS_HCONTEXT hContext,
+			 TSS_HKEY hSRK,
+			 TSS_HTPM hTPM,
+			 TSS_BOOL useKeys,
+			 TSS_BOOL encrypt,
+			 TSS_HKEY *hWrappingKey,
+			 TSS_HKEY *hSigningKey)
+{
+	TSS_RESULT result;
+	TSS_HPOLICY hTPMPolicy, hPolicy;
+	UINT32 pubSRKLen;
+	BYTE* pubSRK;
+
+        result = Tspi_GetPolicyObject( hTPM, TSS_POLICY_USAGE, &hTPMPolicy );
+        if ( result != TSS_SUCCESS )
+        {
+                print_error( "Tspi_GetPolicyObject", result );
+		return result;
+        }
+
+        result = Tspi_Policy_SetSecret( hTPMPolicy, TESTSUITE_OWNER_SECRET_MODE,
+                                        TESTSUITE_OWNER_SECRET_LEN, TESTSUITE_OWNER_SECRET);
+        if ( result != TSS_SUCCESS )
+        {
+                print_error( "Tspi_Policy_SetSecret", result );
+		return result;
+        }
+
+	/* if the code executing in the transport session uses keys, we must get the SRK pub
+	 * from the TPM to avoid errors when closing the session */
+	if (useKeys) {
+		result = Tspi_TPM_OwnerGetSRKPubKey(hTPM, &pubSRKLen, &pubSRK);
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_TPM_OwnerGetSRKPubKey", result );
+			return result;
+		}
+
+		result = Tspi_Context_FreeMemory(hContext, pubSRK);
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_Context_FreeMemory", result );
+			return result;
+		}
+	}
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_RSAKEY,
+					   TSS_KEY_SIZE_512 | TSS_KEY_TYPE_LEGACY |
+					   TSS_KEY_AUTHORIZATION, hWrappingKey);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_POLICY, TSS_POLICY_USAGE,
+					   &hPolicy);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	result = Tspi_Policy_SetSecret(hPolicy, TESTSUITE_KEY_SECRET_MODE, TESTSUITE_KEY_SECRET_LEN,
+				       TESTSUITE_KEY_SECRET);
+	if ( result != TSS_SUCCESS )
+	{
+		print_error("Tspi_Policy_SetSecret", result);
+		return result;
+	}
+
+	result = Tspi_Policy_AssignToObject(hPolicy, *hWrappingKey);
+	if ( result != TSS_SUCCESS )
+	{
+		print_error("Tspi_Policy_AssignToObject", result);
+		return result;
+	}
 
-	if ((cd = iconv_open("UTF-16LE", nl_langinfo(CODESET))) == (iconv_t)-1) {
-		fprintf(stderr, "iconv_open: %s", strerror(errno));
+	result = Tspi_Key_CreateKey(*hWrappingKey, hSRK, 0);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Key_CreateKey", result);
+		return result;
+	}
+
+	result = Tspi_Key_LoadKey(*hWrappingKey, hSRK);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Key_LoadKey", result);
+		return result;
+	}
+
+	if (hSigningKey) {
+		// Create the key used to sign the transport session
+		result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_RSAKEY,
+				TSS_KEY_SIZE_512 | TSS_KEY_TYPE_SIGNING |
+				TSS_KEY_NO_AUTHORIZATION, hSigningKey);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Context_CreateObject", result);
+			return result;
+		}
+
+		result = Tspi_Key_CreateKey(*hSigningKey, hSRK, 0);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Key_CreateKey", result);
+			return result;
+		}
+
+		result = Tspi_Key_LoadKey(*hSigningKey, hSRK);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Key_LoadKey", result);
+			return result;
+		}
+	}
+
+	// Set the encryption key to use to be hWrappingKey
+	result = Tspi_Context_SetTransEncryptionKey(hContext, *hWrappingKey);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_SetTransEncryptionKey", result);
+		return result;
+	}
+
+	// Enable the transport session
+	result = Tspi_SetAttribUint32(hContext, TSS_TSPATTRIB_CONTEXT_TRANSPORT,
+				      TSS_TSPATTRIB_CONTEXTTRANS_CONTROL,
+				      TSS_TSPATTRIB_ENABLE_TRANSPORT);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_SetAttribUint32", result);
+		return result;
+	}
+
+	/* Turn logging on. Skipping this step would give us TPM_BAD_MODE when we call
+	 * CloseSignTransport */
+	result = Tspi_SetAttribUint32(hContext, TSS_TSPATTRIB_CONTEXT_TRANSPORT,
+				      TSS_TSPATTRIB_CONTEXTTRANS_MODE,
+				      TSS_TSPATTRIB_TRANSPORT_AUTHENTIC_CHANNEL);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_SetAttribUint32", result);
+		return result;
+	}
+
+	if (encrypt) {
+		result = Tspi_SetAttribUint32(hContext, TSS_TSPATTRIB_CONTEXT_TRANSPORT,
+					      TSS_TSPATTRIB_CONTEXTTRANS_MODE,
+					      TSS_TSPATTRIB_TRANSPORT_DEFAULT_ENCRYPTION);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_SetAttribUint32", result);
+			return result;
+		}
+	}
+
+	return TSS_SUCCESS;
+}
+
+
+TSS_RESULT
+Testsuite_Transport_Final(TSS_HCONTEXT hContext, TSS_HKEY hSigningKey)
+{
+	TSS_RESULT result;
+
+	if (hSigningKey) {
+		result = Tspi_Context_CloseSignTransport(hContext, hSigningKey, NULL);
+	} else {
+		result = Tspi_SetAttribUint32(hContext, TSS_TSPATTRIB_CONTEXT_TRANSPORT,
+					      TSS_TSPATTRIB_CONTEXTTRANS_CONTROL,
+					      TSS_TSPATTRIB_DISABLE_TRANSPORT);
+	}
+
+	return result;
+}
+
+/*
+ * Software verification of TSS_VALIDATION signatures.
+ *
+ * A struct testsuite_verifier holds the public key of a signing key, taken
+ * once from its TCPA_PUBKEY blob, and checks RSASSA-PKCS1-v1_5 SHA1
+ * signatures over rgbData with OpenSSL, without creating TSS hash objects.
+ * With cross_check set, each result is also compared with the one of
+ * Tspi_Hash_VerifySignature, and a disagreement is a failure.
+ */
+
+/* the old path: a TSS hash object per validation */
+static TSS_RESULT
+tss_verify_signature(TSS_HCONTEXT hContext, TSS_HKEY hIdentKey, TSS_VALIDATION *valData)
+{
+	TSS_RESULT	result;
+	TSS_HHASH	hHash;
+
+	// create hash
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_HASH, TSS_HASH_SHA1, &hHash);
+	if (result != TSS_SUCCESS) {
+		print_error("Testsuite_Verify_Signature : Tspi_Context_CreateObject (hash)",
+			    result);
+		return result;
+	}
+
+	result = Tspi_Hash_UpdateHashValue(hHash, valData->ulDataLength, valData->rgbData);
+	if (result != TSS_SUCCESS) {
+		print_error("Testsuite_Verify_Signature : Tspi_Hash_SetHashValue", result);
+		Tspi_Context_CloseObject(hContext, hHash);
+		return result;
+	}
+
+	result = Tspi_Hash_VerifySignature(hHash, hIdentKey, valData->ulValidationDataLength,
+					   valData->rgbValidationData);
+	Tspi_Context_CloseObject(hContext, hHash);
+
+	return result;
+}
+
+/* An EVP_PKEY_CTX can't be shared between threads, each makes its own.
+ * TCPA_SS_RSASSAPKCS1v15_SHA1 keys sign the SHA1 of the data in a DigestInfo,
+ * TCPA_SS_RSASSAPKCS1v15_DER keys sign the data as it is given to them. */
+static EVP_PKEY_CTX *
+verify_ctx_new(EVP_PKEY *pkey, TCPA_SIG_SCHEME sigScheme)
+{
+	EVP_PKEY_CTX *ctx;
+
+	if ((ctx = EVP_PKEY_CTX_new(pkey, NULL)) == NULL ||
+	    EVP_PKEY_verify_init(ctx) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0 ||
+	    (sigScheme == TCPA_SS_RSASSAPKCS1v15_SHA1 &&
+	     EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha1()) <= 0)) {
+		print_openssl_errors();
+		EVP_PKEY_CTX_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static TSS_RESULT
+verify_one(EVP_PKEY_CTX *ctx, TCPA_SIG_SCHEME sigScheme, TSS_VALIDATION *valData)
+{
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	BYTE *tbs = valData->rgbData;
+	UINT32 tbs_len = valData->ulDataLength;
+
+	if (sigScheme == TCPA_SS_RSASSAPKCS1v15_SHA1) {
+		SHA1(valData->rgbData, valData->ulDataLength, digest);
+		tbs = digest;
+		tbs_len = sizeof(digest);
+	}
+
+	if (EVP_PKEY_verify(ctx, valData->rgbValidationData, valData->ulValidationDataLength,
+			    tbs, tbs_len) == 1)
+		return TSS_SUCCESS;
+
+	/* a bad signature leaves an error on the queue */
+	ERR_clear_error();
+	return TSS_E_FAIL;
+}
+
+/* verify an RSASSA-PKCS1-v1_5 SHA1 signature over 'data' in software, as the
+ * TPM produces for TSS_SS_RSASSAPKCS1V15_SHA1 keys, quotes and certifications.
+ * 'pubkey' is the modulus, the exponent is 65537. Returns TSS_E_FAIL if the
+ * signature doesn't match. Safe to call from several threads at once.
+ * Verifying many signatures of one key is cheaper with TestSuite_Verifier. */
+TSS_RESULT
+TestSuite_RSA_Verify(unsigned char *data, unsigned int datalen,
+		     unsigned char *sig, unsigned int siglen,
+		     unsigned char *pubkey, unsigned int pubsize)
+{
+	struct testsuite_rsa_key key;
+	TSS_VALIDATION valData;
+	EVP_PKEY_CTX *ctx;
+	TSS_RESULT result;
+
+	if ((result = TestSuite_RSA_Key_Init(&key, pubkey, pubsize, 0, TCPA_ES_NONE)))
+		return result;
+
+	if ((ctx = verify_ctx_new(key.pkey, TCPA_SS_RSASSAPKCS1v15_SHA1))) {
+		memset(&valData, 0, sizeof(valData));
+		valData.rgbData = data;
+		valData.ulDataLength = datalen;
+		valData.rgbValidationData = sig;
+		valData.ulValidationDataLength = siglen;
+		result = verify_one(ctx, TCPA_SS_RSASSAPKCS1v15_SHA1, &valData);
+		EVP_PKEY_CTX_free(ctx);
+	} else
+		result = TSS_E_INTERNAL_ERROR;
+	TestSuite_RSA_Key_Free(&key);
+
+	return result;
+}
+
+/* compare a software result with the TSS's */
+static TSS_RESULT
+verify_cross_check(struct testsuite_verifier *v, TSS_VALIDATION *valData, TSS_RESULT result)
+{
+	TSS_RESULT tss_result = tss_verify_signature(v->hContext, v->hKey, valData);
+
+	if ((result == TSS_SUCCESS) != (tss_result == TSS_SUCCESS)) {
+		fprintf(stderr, "Testsuite_Verify_Signature: software result 0x%x, TSS result "
+			"0x%x\n", result, tss_result);
+		return TSS_E_FAIL;
+	}
+
+	return result;
+}
+
+static TSS_RESULT
+verifier_init(struct testsuite_verifier *v, TSS_HCONTEXT hContext, TSS_HKEY hKey,
+	      BYTE *pubKey, UINT32 pubKeySize)
+{
+	struct testsuite_blob b;
+	TCPA_PUBKEY pub;
+	TSS_RESULT result;
+
+	memset(v, 0, sizeof(struct testsuite_verifier));
+	v->hContext = hContext;
+	v->hKey = hKey;
+
+	TestSuite_Blob_Init(&b, pubKey, pubKeySize);
+	if ((result = TestSuite_Blob_Get_PUBKEY(&b, &pub)))
+		return result;
+
+	v->sigScheme = pub.algorithmParms.sigScheme;
+	if (v->sigScheme != TCPA_SS_RSASSAPKCS1v15_SHA1 &&
+	    v->sigScheme != TCPA_SS_RSASSAPKCS1v15_DER) {
+		fprintf(stderr, "Signature scheme 0x%x can't be verified in software\n",
+			v->sigScheme);
+		return TSS_E_BAD_PARAMETER;
+	}
+
+	if ((v->pubKey = malloc(pubKeySize)) == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.", pubKeySize);
+		return TSS_E_OUTOFMEMORY;
+	}
+	memcpy(v->pubKey, pubKey, pubKeySize);
+	v->pubKeySize = pubKeySize;
+
+	if ((result = TestSuite_RSA_Key_From_PUBKEY(&v->key, &pub))) {
+		TestSuite_Verifier_Free(v);
+		return result;
+	}
+
+	if ((v->ctx = verify_ctx_new(v->key.pkey, v->sigScheme)) == NULL) {
+		TestSuite_Verifier_Free(v);
+		return TSS_E_INTERNAL_ERROR;
+	}
+
+	return TSS_SUCCESS;
+}
+
+/* set up v to verify signatures made by hKey with the key's signature
+ * scheme, TSS_SS_RSASSAPKCS1V15_SHA1 or _DER. hContext and hKey are only
+ * used again with v->cross_check set */
+TSS_RESULT
+TestSuite_Verifier_Init(struct testsuite_verifier *v, TSS_HCONTEXT hContext, TSS_HKEY hKey)
+{
+	TSS_RESULT result;
+	UINT32 size;
+	BYTE *blob;
+
+	result = Tspi_GetAttribData(hKey, TSS_TSPATTRIB_KEY_BLOB, TSS_TSPATTRIB_KEYBLOB_PUBLIC_KEY,
+				    &size, &blob);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_GetAttribData", result);
+		return result;
+	}
+
+	result = verifier_init(v, hContext, hKey, blob, size);
+	Tspi_Context_FreeMemory(hContext, blob);
+
+	return result;
+}
+
+/* TSS_E_FAIL if the signature doesn't match */
+TSS_RESULT
+TestSuite_Verifier_Verify(struct testsuite_verifier *v, TSS_VALIDATION *valData)
+{
+	TSS_RESULT result = verify_one(v->ctx, v->sigScheme, valData);
+
+	if (v->cross_check)
+		result = verify_cross_check(v, valData, result);
+
+	return result;
+}
+
+struct verify_batch
+{
+	struct testsuite_verifier	*v;
+	TSS_VALIDATION			*valData;
+	TSS_RESULT			*results;
+	UINT32				num;
+	UINT32				next;
+	pthread_mutex_t			lock;
+};
+
+static void *
+verify_batch_thread(void *arg)
+{
+	struct verify_batch *b = arg;
+	EVP_PKEY_CTX *ctx;
+	UINT32 i;
+
+	ctx = verify_ctx_new(b->v->key.pkey, b->v->sigScheme);
+
+	for (;;) {
+		pthread_mutex_lock(&b->lock);
+		i = b->next++;
+		pthread_mutex_unlock(&b->lock);
+		if (i >= b->num)
+			break;
+
+		b->results[i] = ctx ? verify_one(ctx, b->v->sigScheme, &b->valData[i]) :
+				      TSS_E_INTERNAL_ERROR;
+	}
+	EVP_PKEY_CTX_free(ctx);
+
+	return NULL;
+}
+
+/* Verify num validations on up to num_threads threads, setting results[i]
+ * for valData[i] if results isn't NULL. Returns the first failure in the
+ * order of valData. The TSS cross check, if set, is done by the calling
+ * thread afterwards. */
+TSS_RESULT
+TestSuite_Verifier_Verify_Batch(struct testsuite_verifier *v, UINT32 num,
+				TSS_VALIDATION *valData, TSS_RESULT *results,
+				UINT32 num_threads)
+{
+	struct verify_batch b;
+	pthread_t *threads = NULL;
+	TSS_RESULT result = TSS_SUCCESS;
+	UINT32 i, started = 0;
+
+	if (num == 0)
+		return TSS_SUCCESS;
+
+	b.v = v;
+	b.valData = valData;
+	b.num = num;
+	b.next = 0;
+	b.results = results ? results : malloc(num * sizeof(TSS_RESULT));
+	if (b.results == NULL) {
+		fprintf(stderr, "malloc of %zu bytes failed.", num * sizeof(TSS_RESULT));
+		return TSS_E_OUTOFMEMORY;
+	}
+	pthread_mutex_init(&b.lock, NULL);
+
+	if (num_threads > num)
+		num_threads = num;
+	if (num_threads > 1 && (threads = calloc(num_threads, sizeof(pthread_t)))) {
+		for (; started < num_threads; started++) {
+			if (pthread_create(&threads[started], NULL, verify_batch_thread, &b))
+				break;
+		}
+	}
+	/* the calling thread works too, and alone if no thread could start */
+	verify_batch_thread(&b);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&b.lock);
+
+	for (i = 0; i < num; i++) {
+		if (v->cross_check)
+			b.results[i] = verify_cross_check(v, &valData[i], b.results[i]);
+		if (result == TSS_SUCCESS)
+			result = b.results[i];
+	}
+
+	if (results == NULL)
+		free(b.results);
+
+	return result;
+}
+
+void
+TestSuite_Verifier_Free(struct testsuite_verifier *v)
+{
+	EVP_PKEY_CTX_free(v->ctx);
+	TestSuite_RSA_Key_Free(&v->key);
+	free(v->pubKey);
+	v->ctx = NULL;
+	v->pubKey = NULL;
+	v->pubKeySize = 0;
+}
+
+/* tests verify in loops with the same key, so the last verifier is kept per
+ * thread, and reused while the key's public key blob is the same. It is
+ * thread specific data, freed when the thread exits */
+static pthread_key_t last_verifier_key;
+static pthread_once_t last_verifier_once = PTHREAD_ONCE_INIT;
+static int last_verifier_key_ok;
+
+static void
+last_verifier_free(void *arg)
+{
+	TestSuite_Verifier_Free(arg);
+	free(arg);
+}
+
+static void
+last_verifier_key_init(void)
+{
+	last_verifier_key_ok = !pthread_key_create(&last_verifier_key, last_verifier_free);
+}
+
+static struct testsuite_verifier *
+last_verifier_get(void)
+{
+	struct testsuite_verifier *v;
+
+	pthread_once(&last_verifier_once, last_verifier_key_init);
+	if (!last_verifier_key_ok) {
+		fprintf(stderr, "pthread_key_create failed\n");
 		return NULL;
 	}
 
-	if ((tmplen = hacky_strlen(nl_langinfo(CODESET), string)) == 0) {
-		fprintf(stderr, "hacky_strlen returned 0");
-		goto alloc_string;
+	if ((v = pthread_getspecific(last_verifier_key)) == NULL) {
+		if ((v = calloc(1, sizeof(struct testsuite_verifier))) == NULL) {
+			fprintf(stderr, "malloc of %zu bytes failed.",
+				sizeof(struct testsuite_verifier));
+			return NULL;
+		}
+		if (pthread_setspecific(last_verifier_key, v)) {
+			free(v);
+			return NULL;
+		}
+	}
+
+	return v;
+}
+
+/* Checks a command's resulting TPM signature against validation data. Set
+ * TESTSUITE_VERIFY_CROSS_CHECK in the environment to also check it with
+ * Tspi_Hash_VerifySignature */
+TSS_RESULT
+Testsuite_Verify_Signature(TSS_HCONTEXT hContext, TSS_HKEY hIdentKey, TSS_VALIDATION *valData)
+{
+	struct testsuite_verifier *v;
+	TSS_RESULT result;
+	UINT32 size;
+	BYTE *blob;
+
+	if ((v = last_verifier_get()) == NULL)
+		return TSS_E_OUTOFMEMORY;
+
+	result = Tspi_GetAttribData(hIdentKey, TSS_TSPATTRIB_KEY_BLOB,
+				    TSS_TSPATTRIB_KEYBLOB_PUBLIC_KEY, &size, &blob);
+	if (result != TSS_SUCCESS) {
+		print_error("Testsuite_Verify_Signature : Tspi_GetAttribData", result);
+		return result;
+	}
+
+	if (v->pubKey == NULL || v->hContext != hContext || v->pubKeySize != size ||
+	    memcmp(v->pubKey, blob, size)) {
+		TestSuite_Verifier_Free(v);
+		result = verifier_init(v, hContext, hIdentKey, blob, size);
+	}
+	Tspi_Context_FreeMemory(hContext, blob);
+	if (result != TSS_SUCCESS) {
+		print_error("Testsuite_Verify_Signature", result);
+		return result;
+	}
+
+	v->hKey = hIdentKey;
+	v->cross_check = getenv("TESTSUITE_VERIFY_CROSS_CHECK") != NULL;
+
+	result = TestSuite_Verifier_Verify(v, valData);
+	if (result != TSS_SUCCESS)
+		print_error("Testsuite_Verify_Signature", result);
+
+	return result;
+}
+
+/*
+ * Software model of PCR composites.
+ *
+ * A struct testsuite_pcr_composite is a PCR selection with a value for each
+ * PCR, from which the digests the TSS and TPM compute for TPM_PCR_INFO,
+ * TPM_PCR_INFO_SHORT and TPM_PCR_INFO_LONG can be worked out locally: the
+ * SHA1 of the TPM_PCR_COMPOSITE of the selected PCRs. Tests use it to check
+ * exact composite hashes, and benchmarks to know the digest a seal will
+ * carry without reading the PCRs back from the TPM.
+ */
+
+/* the number of PCRs of the TPM, TSS_TPMCAP_PROP_PCR */
+TSS_RESULT
+TestSuite_Get_Num_PCRs(TSS_HCONTEXT hContext, TSS_HTPM hTPM, UINT32 *numPcrs)
+{
+	UINT32 subCap = TSS_TPMCAP_PROP_PCR, respLen;
+	TSS_RESULT result;
+	BYTE *resp;
+
+	result = Tspi_TPM_GetCapability(hTPM, TSS_TPMCAP_PROPERTY, sizeof(UINT32),
+					(BYTE *)&subCap, &respLen, &resp);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_GetCapability", result);
+		return result;
 	}
 
-	do {
-		len++;
-		outbytesleft = len;
-		inbytesleft = tmplen;
-		outbuf = tmpbuf;
-		ptr = (char *)string;
-		errno = 0;
+	if (respLen != sizeof(UINT32)) {
+		fprintf(stderr, "Tspi_TPM_GetCapability: %u bytes returned\n", respLen);
+		result = TSS_E_FAIL;
+	} else
+		*numPcrs = *(UINT32 *)resp;
+	Tspi_Context_FreeMemory(hContext, resp);
 
-		rc = iconv(cd, &ptr, &inbytesleft, &outbuf, &outbytesleft);
-	} while (rc == (size_t)-1 && errno == E2BIG);
+	return result;
+}
 
-	if (len > MAX_BUF_SIZE) {
-		fprintf(stderr, "string too long.");
-		iconv_close(cd);
-		return NULL;
+/* sizeOfSelect of a TSS PCR object on a TPM with num_pcrs PCRs */
+void
+TestSuite_Pcr_Composite_Init(struct testsuite_pcr_composite *c, UINT32 num_pcrs)
+{
+	memset(c, 0, sizeof(struct testsuite_pcr_composite));
+	if (num_pcrs > TESTSUITE_PCR_MAX)
+		num_pcrs = TESTSUITE_PCR_MAX;
+	c->sizeOfSelect = (num_pcrs + 7) / 8;
+}
+
+TSS_RESULT
+TestSuite_Pcr_Composite_Select(struct testsuite_pcr_composite *c, UINT32 index)
+{
+	if (index >= TESTSUITE_PCR_MAX)
+		return TSS_E_BAD_PARAMETER;
+
+	/* the TSS grows the selection to fit, as this does */
+	if (index / 8 >= c->sizeOfSelect)
+		c->sizeOfSelect = index / 8 + 1;
+	c->select[index / 8] |= 1 << (index % 8);
+
+	return TSS_SUCCESS;
+}
+
+/* select index and set its value, as Tspi_PcrComposite_SetPcrValue does */
+TSS_RESULT
+TestSuite_Pcr_Composite_Set_Value(struct testsuite_pcr_composite *c, UINT32 index, BYTE *value)
+{
+	TSS_RESULT result;
+
+	if ((result = TestSuite_Pcr_Composite_Select(c, index)))
+		return result;
+	memcpy(c->value[index], value, TPM_SHA1_160_HASH_LEN);
+
+	return TSS_SUCCESS;
+}
+
+/* the new value of a PCR after TPM_Extend with digest */
+TSS_RESULT
+TestSuite_Pcr_Composite_Extend(struct testsuite_pcr_composite *c, UINT32 index, BYTE *digest)
+{
+	BYTE buf[2 * TPM_SHA1_160_HASH_LEN];
+
+	if (index >= TESTSUITE_PCR_MAX)
+		return TSS_E_BAD_PARAMETER;
+
+	memcpy(buf, c->value[index], TPM_SHA1_160_HASH_LEN);
+	memcpy(&buf[TPM_SHA1_160_HASH_LEN], digest, TPM_SHA1_160_HASH_LEN);
+	SHA1(buf, sizeof(buf), c->value[index]);
+
+	return TSS_SUCCESS;
+}
+
+void
+TestSuite_Blob_Put_PCR_SELECTION(struct testsuite_blob *blob, struct testsuite_pcr_composite *c)
+{
+	TestSuite_Blob_Put_UINT16(blob, c->sizeOfSelect);
+	TestSuite_Blob_Put(blob, c->select, c->sizeOfSelect);
+}
+
+/* TPM_PCR_COMPOSITE: the selection, then the values of the selected PCRs in
+ * order of index */
+void
+TestSuite_Blob_Put_PCR_COMPOSITE(struct testsuite_blob *blob, struct testsuite_pcr_composite *c)
+{
+	UINT32 i, num = 0;
+
+	for (i = 0; i < c->sizeOfSelect * 8U; i++) {
+		if (c->select[i / 8] & (1 << (i % 8)))
+			num++;
 	}
 
-alloc_string:
-	/* add terminating bytes of the correct width */
-	len += char_width("UTF-16");
-	if ((ret = calloc(1, len)) == NULL) {
-		fprintf(stderr, "malloc of %u bytes failed.", len);
-		iconv_close(cd);
-		return NULL;
+	TestSuite_Blob_Put_PCR_SELECTION(blob, c);
+	TestSuite_Blob_Put_UINT32(blob, num * TPM_SHA1_160_HASH_LEN);
+	for (i = 0; i < c->sizeOfSelect * 8U; i++) {
+		if (c->select[i / 8] & (1 << (i % 8)))
+			TestSuite_Blob_Put(blob, c->value[i], TPM_SHA1_160_HASH_LEN);
 	}
+}
 
-	memcpy(ret, &tmpbuf, len);
-	if (size)
-		*size = len;
+/* the composite hash, as in digestAtRelease and digestAtCreation */
+TSS_RESULT
+TestSuite_Pcr_Composite_Hash(struct testsuite_pcr_composite *c, BYTE *digest)
+{
+	BYTE buf[2 + TESTSUITE_PCR_MAX / 8 + 4 + TESTSUITE_PCR_MAX * TPM_SHA1_160_HASH_LEN];
+	struct testsuite_blob b;
 
-	if (cd)
-		iconv_close(cd);
+	TestSuite_Blob_Init(&b, buf, sizeof(buf));
+	TestSuite_Blob_Put_PCR_COMPOSITE(&b, c);
+	if (b.result)
+		return b.result;
 
-	return (BYTE *)ret;
+	SHA1(buf, b.offset, digest);
 
+	return TSS_SUCCESS;
 }
 
-BYTE *
-TestSuite_UNICODE_To_Native(BYTE *string, unsigned *size)
+/* TPM_PCR_INFO, the 1.1 structure */
+void
+TestSuite_Blob_Put_PCR_INFO(struct testsuite_blob *blob, struct testsuite_pcr_composite *release,
+			    BYTE *digestAtCreation)
 {
-	char *ret, *ptr, *outbuf, tmpbuf[MAX_BUF_SIZE] = { 0, };
-	unsigned len = 0, tmplen;
-	iconv_t cd;
-	size_t rc, outbytesleft, inbytesleft;
+	BYTE digest[TPM_SHA1_160_HASH_LEN];
 
-	if (string == NULL) {
-		if (size)
-			*size = 0;
-		return NULL;
+	if (blob->result || (blob->result = TestSuite_Pcr_Composite_Hash(release, digest)))
+		return;
+
+	TestSuite_Blob_Put_PCR_SELECTION(blob, release);
+	TestSuite_Blob_Put(blob, digest, TPM_SHA1_160_HASH_LEN);
+	TestSuite_Blob_Put(blob, digestAtCreation, TPM_SHA1_160_HASH_LEN);
+}
+
+/* TPM_PCR_INFO_SHORT. localityAtRelease is a TPM_LOC_* mask */
+void
+TestSuite_Blob_Put_PCR_INFO_SHORT(struct testsuite_blob *blob,
+				  struct testsuite_pcr_composite *release, BYTE localityAtRelease)
+{
+	BYTE digest[TPM_SHA1_160_HASH_LEN];
+
+	if (blob->result || (blob->result = TestSuite_Pcr_Composite_Hash(release, digest)))
+		return;
+
+	TestSuite_Blob_Put_PCR_SELECTION(blob, release);
+	TestSuite_Blob_Put_BYTE(blob, localityAtRelease);
+	TestSuite_Blob_Put(blob, digest, TPM_SHA1_160_HASH_LEN);
+}
+
+/* TPM_PCR_INFO_LONG. creation holds the PCR values at the time of creation,
+ * which the TPM hashes into digestAtCreation */
+void
+TestSuite_Blob_Put_PCR_INFO_LONG(struct testsuite_blob *blob,
+				 struct testsuite_pcr_composite *creation,
+				 struct testsuite_pcr_composite *release,
+				 BYTE localityAtCreation, BYTE localityAtRelease)
+{
+	BYTE atCreation[TPM_SHA1_160_HASH_LEN], atRelease[TPM_SHA1_160_HASH_LEN];
+
+	if (blob->result || (blob->result = TestSuite_Pcr_Composite_Hash(creation, atCreation)))
+		return;
+	if ((blob->result = TestSuite_Pcr_Composite_Hash(release, atRelease)))
+		return;
+
+	TestSuite_Blob_Put_UINT16(blob, TPM_TAG_PCR_INFO_LONG);
+	TestSuite_Blob_Put_BYTE(blob, localityAtCreation);
+	TestSuite_Blob_Put_BYTE(blob, localityAtRelease);
+	TestSuite_Blob_Put_PCR_SELECTION(blob, creation);
+	TestSuite_Blob_Put_PCR_SELECTION(blob, release);
+	TestSuite_Blob_Put(blob, atCreation, TPM_SHA1_160_HASH_LEN);
+	TestSuite_Blob_Put(blob, atRelease, TPM_SHA1_160_HASH_LEN);
+}
+
+/*
+ * Paged reads of the event log.
+ *
+ * Tspi_TPM_GetEventLog returns the whole log in one allocation. A struct
+ * testsuite_event_iter instead walks the events of one PCR, or of each PCR
+ * in turn, with Tspi_TPM_GetEvents a page at a time, and frees each page
+ * before reading the next, so a log of any length is read in the memory of
+ * one page.
+ */
+
+/* Iterate over the events of pcr, or with TESTSUITE_EVENT_ALL_PCRS over those
+ * of every PCR in order of index, page events at a time (0 for
+ * TESTSUITE_EVENT_PAGE). Events of different PCRs aren't returned in the
+ * order they were logged in, only the events of each PCR are. */
+TSS_RESULT
+TestSuite_Event_Iter_Init(struct testsuite_event_iter *it, TSS_HCONTEXT hContext, TSS_HTPM hTPM,
+			  UINT32 pcr, UINT32 page)
+{
+	memset(it, 0, sizeof(struct testsuite_event_iter));
+	it->hContext = hContext;
+	it->hTPM = hTPM;
+	it->page = page ? page : TESTSUITE_EVENT_PAGE;
+
+	if (pcr != TESTSUITE_EVENT_ALL_PCRS) {
+		it->pcr = pcr;
+		it->end = pcr + 1;
+		return TSS_SUCCESS;
 	}
 
-	if ((cd = iconv_open(nl_langinfo(CODESET), "UTF-16LE")) == (iconv_t)-1) {
-		fprintf(stderr, "iconv_open: %s", strerror(errno));
-		return NULL;
+	return TestSuite_Get_Num_PCRs(hContext, hTPM, &it->end);
+}
+
+/* Set *event to the next event, or to NULL after the last one. The event is
+ * valid until the next call; it is number it->start + it->next - 1 of PCR
+ * it->pcr. Calling again after NULL asks the TCS for events logged to the
+ * last PCR since. */
+TSS_RESULT
+TestSuite_Event_Iter_Next(struct testsuite_event_iter *it, TSS_PCR_EVENT **event)
+{
+	TSS_RESULT result;
+	UINT32 num;
+
+	while (it->next == it->num) {
+		if (it->events) {
+			Tspi_Context_FreeMemory(it->hContext, (BYTE *)it->events);
+			it->events = NULL;
+		}
+		it->start += it->num;
+		it->num = it->next = 0;
+
+		if (it->last_page) {
+			it->last_page = 0;
+			if (it->pcr + 1 >= it->end) {
+				*event = NULL;
+				return TSS_SUCCESS;
+			}
+			it->pcr++;
+			it->start = 0;
+		}
+
+		num = it->page;
+		result = Tspi_TPM_GetEvents(it->hTPM, it->pcr, it->start, &num, &it->events);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_TPM_GetEvents", result);
+			it->events = NULL;
+			return result;
+		}
+		it->num = num;
+		it->last_page = num < it->page;
 	}
 
-	if ((tmplen = hacky_strlen("UTF-16", string)) == 0) {
-		fprintf(stderr, "hacky_strlen returned 0");
-		return 0;
+	*event = &it->events[it->next++];
+
+	return TSS_SUCCESS;
+}
+
+void
+TestSuite_Event_Iter_Free(struct testsuite_event_iter *it)
+{
+	if (it->events)
+		Tspi_Context_FreeMemory(it->hContext, (BYTE *)it->events);
+	it->events = NULL;
+	it->num = it->next = 0;
+}
+
+/*
+ * Registered keys with their ancestors pinned.
+ *
+ * Tspi_Context_LoadKeyByUUID loads every ancestor of a key it doesn't find
+ * loaded, and the TCS may have evicted them since the last load, so loading
+ * many keys under a deep hierarchy loads the same parents again and again.
+ * A struct testsuite_key_cache loads the ancestors of a registered key
+ * itself, with Tspi_Key_LoadKey from the closest ancestor it already has,
+ * and keeps their handles open for as long as the cache lives. An open
+ * handle keeps a key in the TCS's key cache, so if the TCS evicts it from
+ * the TPM, it swaps it back in without the TSP reading it from persistent
+ * storage or authorizing its load again.
+ */
+
+/* hPolicy is given to the ancestors which need authorization; it may be 0 if
+ * none do */
+void
+TestSuite_Key_Cache_Init(struct testsuite_key_cache *c, TSS_HCONTEXT hContext, TSS_HKEY hSRK,
+			 TSS_HPOLICY hPolicy)
+{
+	memset(c, 0, sizeof(struct testsuite_key_cache));
+	c->hContext = hContext;
+	c->hSRK = hSRK;
+	c->hPolicy = hPolicy;
+}
+
+static TSS_HKEY
+key_cache_find(struct testsuite_key_cache *c, TSS_FLAG ps, TSS_UUID *uuid)
+{
+	UINT32 i;
+
+	if (ps == TSS_PS_TYPE_SYSTEM && !memcmp(uuid, &SRK_UUID, sizeof(TSS_UUID)))
+		return c->hSRK;
+
+	for (i = 0; i < c->count; i++) {
+		if (c->keys[i].ps == ps && !memcmp(&c->keys[i].uuid, uuid, sizeof(TSS_UUID)))
+			return c->keys[i].hKey;
 	}
 
-	do {
-		len++;
-		outbytesleft = len;
-		inbytesleft = tmplen;
-		outbuf = tmpbuf;
-		ptr = (char *)string;
-		errno = 0;
+	return 0;
+}
 
-		rc = iconv(cd, &ptr, &inbytesleft, &outbuf, &outbytesleft);
-	} while (rc == (size_t)-1 && errno == E2BIG);
+/* load the registered key info under hParent */
+static TSS_RESULT
+key_cache_load_one(struct testsuite_key_cache *c, TSS_KM_KEYINFO2 *info, TSS_HKEY hParent,
+		   TSS_HKEY *hKey)
+{
+	TSS_RESULT result;
 
-	/* add terminating bytes of the correct width */
-	len += char_width(nl_langinfo(CODESET));
-	if (len > MAX_BUF_SIZE) {
-		fprintf(stderr, "string too long.");
-		iconv_close(cd);
-		return NULL;
+	result = Tspi_Context_GetKeyByUUID(c->hContext, info->persistentStorageType,
+					   info->keyUUID, hKey);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_GetKeyByUUID", result);
+		return result;
 	}
 
-	if ((ret = calloc(1, len)) == NULL) {
-		fprintf(stderr, "malloc of %d bytes failed.", len);
-		iconv_close(cd);
-		return NULL;
+	if (info->bAuthDataUsage && c->hPolicy) {
+		result = Tspi_Policy_AssignToObject(c->hPolicy, *hKey);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Policy_AssignToObject", result);
+			goto error;
+		}
 	}
 
-	memcpy(ret, &tmpbuf, len);
-	if (size)
-		*size = len;
-	iconv_close(cd);
+	result = Tspi_Key_LoadKey(*hKey, hParent);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Key_LoadKey", result);
+		goto error;
+	}
 
-	return (BYTE *)ret;
+	return TSS_SUCCESS;
+error:
+	Tspi_Context_CloseObject(c->hContext, *hKey);
+	return result;
 }
 
-TSS_RESULT
-TestSuite_UnloadBlob_IDENTITY_REQ(UINT16 *offset, BYTE *blob, TCPA_IDENTITY_REQ *req)
+static TSS_RESULT
+key_cache_pin(struct testsuite_key_cache *c, TSS_KM_KEYINFO2 *info, TSS_HKEY hKey)
 {
-	TestSuite_UnloadBlob_UINT32(offset, &req->asymSize, blob);
-	TestSuite_UnloadBlob_UINT32(offset, &req->symSize, blob);
-	/* XXX */
-	TestSuite_UnloadBlob_KEY_PARMS(offset, blob, &req->asymAlgorithm);
-	TestSuite_UnloadBlob_KEY_PARMS(offset, blob, &req->symAlgorithm);
+	struct testsuite_cached_key *keys;
 
-	if (req->asymSize > 0) {
-		req->asymBlob = malloc(req->asymSize);
-		if (req->asymBlob == NULL) {
-			req->asymSize = 0;
+	if (c->count == c->size) {
+		keys = realloc(c->keys, (c->size ? 2 * c->size : 16) *
+				       sizeof(struct testsuite_cached_key));
+		if (keys == NULL)
 			return TSS_E_OUTOFMEMORY;
+		c->keys = keys;
+		c->size = c->size ? 2 * c->size : 16;
+	}
+
+	c->keys[c->count].uuid = info->keyUUID;
+	c->keys[c->count].ps = info->persistentStorageType;
+	c->keys[c->count].hKey = hKey;
+	c->count++;
+	c->misses++;
+
+	return TSS_SUCCESS;
+}
+
+/* Load the key registered in ps under uuid into *hKey, loading and pinning
+ * the ancestors which aren't pinned yet. *hKey itself isn't pinned; it is
+ * the caller's to unload and close. */
+TSS_RESULT
+TestSuite_Key_Cache_Load(struct testsuite_key_cache *c, TSS_FLAG ps, TSS_UUID uuid,
+			 TSS_HKEY *hKey)
+{
+	TSS_KM_KEYINFO2 *info;
+	TSS_HKEY hParent = 0, hAncestor;
+	TSS_RESULT result;
+	UINT32 num, i, depth = 0, *chain;
+
+	/* the key and its ancestors, up to the SRK */
+	result = Tspi_Context_GetRegisteredKeysByUUID2(c->hContext, ps, &uuid, &num, &info);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_GetRegisteredKeysByUUID2", result);
+		return result;
+	}
+	if ((chain = calloc(num ? num : 1, sizeof(UINT32))) == NULL) {
+		Tspi_Context_FreeMemory(c->hContext, (BYTE *)info);
+		return TSS_E_OUTOFMEMORY;
+	}
+
+	/* walk up from the key to its closest ancestor which is loaded */
+	while (depth < num) {
+		for (i = 0; i < num; i++) {
+			if (info[i].persistentStorageType == ps &&
+			    !memcmp(&info[i].keyUUID, &uuid, sizeof(TSS_UUID)))
+				break;
 		}
-		TestSuite_UnloadBlob(offset, req->asymSize, blob, req->asymBlob);
-	} else {
-		req->asymBlob = NULL;
+		if (i == num)
+			break;
+		chain[depth++] = i;
+
+		ps = info[i].persistentStorageTypeParent;
+		uuid = info[i].parentKeyUUID;
+		if ((hParent = key_cache_find(c, ps, &uuid))) {
+			if (hParent != c->hSRK)
+				c->hits++;
+			break;
+		}
+	}
+	if (hParent == 0) {
+		result = TSS_E_PS_KEY_NOTFOUND;
+		print_error("TestSuite_Key_Cache_Load", result);
+		goto done;
 	}
 
-	if (req->symSize > 0) {
-		req->symBlob = malloc(req->symSize);
-		if (req->symBlob == NULL) {
-			req->symSize = 0;
-			req->asymSize = 0;
-			free(req->asymBlob);
-			req->asymBlob = NULL;
-			return TSS_E_OUTOFMEMORY;
+	/* then down again, pinning each ancestor */
+	for (i = depth; i > 1; i--) {
+		if ((result = key_cache_load_one(c, &info[chain[i - 1]], hParent, &hAncestor)))
+			goto done;
+		if ((result = key_cache_pin(c, &info[chain[i - 1]], hAncestor))) {
+			Tspi_Key_UnloadKey(hAncestor);
+			Tspi_Context_CloseObject(c->hContext, hAncestor);
+			goto done;
 		}
-		TestSuite_UnloadBlob(offset, req->symSize, blob, req->symBlob);
-	} else {
-		req->symBlob = NULL;
+		hParent = hAncestor;
 	}
 
-	return TSS_SUCCESS;
-}
+	result = key_cache_load_one(c, &info[chain[0]], hParent, hKey);
+done:
+	free(chain);
+	Tspi_Context_FreeMemory(c->hContext, (BYTE *)info);
 
-#define EVP_SUCCESS 1
+	return result;
+}
 
+/* unload and close the pinned keys, children before their parents */
 void
-print_openssl_errors()
+TestSuite_Key_Cache_Free(struct testsuite_key_cache *c)
 {
-	ERR_load_crypto_strings();
-	ERR_print_errors_fp(stderr);
+	UINT32 i;
+
+	for (i = c->count; i > 0; i--) {
+		Tspi_Key_UnloadKey(c->keys[i - 1].hKey);
+		Tspi_Context_CloseObject(c->hContext, c->keys[i - 1].hKey);
+	}
+	free(c->keys);
+	c->keys = NULL;
+	c->count = c->size = 0;
 }
-#ifdef TESTSUITE_HASH
+
+/*
+ * Envelope encryption.
+ *
+ * Tspi_Data_Bind and Tspi_Data_Seal take no more than one RSA block, so
+ * larger payloads are protected the way they are on disk: a random AES-128
+ * data key is bound or sealed by the TPM, and the payload is encrypted in
+ * software with TestSuite_SymEncrypt, a chunk of up to
+ * TESTSUITE_ENVELOPE_CHUNK bytes at a time, each chunk with its own random
+ * IV in front of it. Only the data key goes through the TPM, so a larger
+ * payload costs AES and nothing else.
+ *
+ * TestSuite_Envelope_Write() writes an encrypted stream as
+ *
+ *	UINT32 type, UINT32 wrappedSize, the wrapped data key
+ *	UINT32 size, IV || ciphertext	for each chunk
+ *	UINT32 0			at the end of the payload
+ *
+ * all big endian. This gives confidentiality, not integrity: a changed
+ * chunk decrypts to garbage unless its padding gives it away, and nothing
+ * notices chunks swapped around.
+ */
+
+#define ENVELOPE_BLOCK		16	/* AES block and IV size */
+#define ENVELOPE_MAX_WRAPPED	4096
+
+/* Create a random data key in e and bind or seal it, as type, with hKey into
+ * hEncData, an encdata object of that type. hPcrs is the PCR composite to
+ * seal to, or 0. */
 TSS_RESULT
-TestSuite_Hash(UINT32 HashType, UINT32 BufSize, BYTE* Buf, BYTE* Digest)
+TestSuite_Envelope_Wrap(struct testsuite_envelope *e, TSS_HCONTEXT hContext, TSS_HKEY hKey,
+			TSS_HENCDATA hEncData, TSS_FLAG type, TSS_HPCRS hPcrs)
 {
-	EVP_MD_CTX md_ctx;
-	unsigned int result_size;
-	int rv;
+	TSS_RESULT result;
+	BYTE *blob;
+	UINT32 blobSize;
 
-	switch (HashType) {
-		case TSS_HASH_SHA1:
-			rv = EVP_DigestInit(&md_ctx, EVP_sha1());
-			break;
-		default:
-			rv = TSS_E_BAD_PARAMETER;
-			goto out;
-			break;
+	memset(e, 0, sizeof(struct testsuite_envelope));
+	e->type = type;
+
+	if (RAND_bytes(e->key, TESTSUITE_ENVELOPE_KEY_SIZE) != 1) {
+		print_openssl_errors();
+		return TSS_E_INTERNAL_ERROR;
 	}
 
-	if (rv != EVP_SUCCESS) {
-		rv = TSS_E_INTERNAL_ERROR;
-		goto err;
+	if (type == TSS_ENCDATA_SEAL) {
+		result = Tspi_Data_Seal(hEncData, hKey, TESTSUITE_ENVELOPE_KEY_SIZE, e->key,
+					hPcrs);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Data_Seal", result);
+			return result;
+		}
+	} else {
+		result = Tspi_Data_Bind(hEncData, hKey, TESTSUITE_ENVELOPE_KEY_SIZE, e->key);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Data_Bind", result);
+			return result;
+		}
 	}
 
-	rv = EVP_DigestUpdate(&md_ctx, Buf, BufSize);
-	if (rv != EVP_SUCCESS) {
-		rv = TSS_E_INTERNAL_ERROR;
-		goto err;
+	result = Tspi_GetAttribData(hEncData, TSS_TSPATTRIB_ENCDATA_BLOB,
+				    TSS_TSPATTRIB_ENCDATABLOB_BLOB, &blobSize, &blob);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_GetAttribData", result);
+		return result;
+	}
+
+	if ((e->wrapped = malloc(blobSize)) == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.\n", blobSize);
+		Tspi_Context_FreeMemory(hContext, blob);
+		return TSS_E_OUTOFMEMORY;
+	}
+	memcpy(e->wrapped, blob, blobSize);
+	e->wrappedSize = blobSize;
+	Tspi_Context_FreeMemory(hContext, blob);
+
+	return TSS_SUCCESS;
+}
+
+/* Recover the data key of e from its wrapped blob, unbinding or unsealing it
+ * with hKey through hEncData, an encdata object of e's type. */
+TSS_RESULT
+TestSuite_Envelope_Unwrap(struct testsuite_envelope *e, TSS_HCONTEXT hContext, TSS_HKEY hKey,
+			  TSS_HENCDATA hEncData)
+{
+	TSS_RESULT result;
+	BYTE *key;
+	UINT32 keySize;
+
+	result = Tspi_SetAttribData(hEncData, TSS_TSPATTRIB_ENCDATA_BLOB,
+				    TSS_TSPATTRIB_ENCDATABLOB_BLOB, e->wrappedSize, e->wrapped);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_SetAttribData", result);
+		return result;
+	}
+
+	if (e->type == TSS_ENCDATA_SEAL) {
+		result = Tspi_Data_Unseal(hEncData, hKey, &keySize, &key);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Data_Unseal", result);
+			return result;
+		}
+	} else {
+		result = Tspi_Data_Unbind(hEncData, hKey, &keySize, &key);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Data_Unbind", result);
+			return result;
+		}
 	}
 
-	result_size = EVP_MD_CTX_size(&md_ctx);
-	rv = EVP_DigestFinal(&md_ctx, Digest, &result_size);
-	if (rv != EVP_SUCCESS) {
-		rv = TSS_E_INTERNAL_ERROR;
-		goto err;
+	if (keySize != TESTSUITE_ENVELOPE_KEY_SIZE) {
+		fprintf(stderr, "Unwrapped a data key of %u bytes, expected %u\n", keySize,
+			TESTSUITE_ENVELOPE_KEY_SIZE);
+		result = TSS_E_FAIL;
 	} else
-		rv = TSS_SUCCESS;
+		memcpy(e->key, key, TESTSUITE_ENVELOPE_KEY_SIZE);
 
-	goto out;
+	memset(key, 0, keySize);
+	Tspi_Context_FreeMemory(hContext, key);
 
-err:
-	print_openssl_errors();
-out:
-	return rv;
+	return result;
 }
-#endif
+
+/* Encrypt a chunk of at most TESTSUITE_ENVELOPE_CHUNK bytes. On entry *outLen
+ * is the size of out, which must be at least inLen +
+ * TESTSUITE_ENVELOPE_OVERHEAD; on return it is the size of the encrypted
+ * chunk. */
 TSS_RESULT
-TestSuite_SymEncrypt(UINT16 alg, BYTE mode, BYTE *key, BYTE *iv, BYTE *in, UINT32 in_len, BYTE *out,
-		     UINT32 *out_len)
+TestSuite_Envelope_Encrypt(struct testsuite_envelope *e, BYTE *in, UINT32 inLen, BYTE *out,
+			   UINT32 *outLen)
 {
-	TSS_RESULT result = TSS_SUCCESS;
-	EVP_CIPHER_CTX ctx;
-	EVP_CIPHER *cipher;
-	BYTE *def_iv = NULL, *outiv_ptr;
-	UINT32 tmp;
-	int iv_len, outiv_len;
+	if (inLen > TESTSUITE_ENVELOPE_CHUNK || *outLen < inLen + TESTSUITE_ENVELOPE_OVERHEAD)
+		return TSS_E_BAD_PARAMETER;
 
-	if (*out_len > INT_MAX)
-		outiv_len = INT_MAX;
-	else
-		outiv_len = *(int *)out_len;
+	return TestSuite_SymEncrypt(TSS_ALG_AES, TSS_ES_NONE, e->key, NULL, in, inLen, out,
+				    outLen);
+}
 
-	/* TPM 1.1 had no defines for symmetric encryption modes, must use CBC */
-	switch (mode) {
-		case TCPA_ES_NONE:
-		case TSS_ES_NONE:
-			break;
-		default:
-			fprintf(stderr, "Invalid mode in doing symmetric decryption");
-			return TSS_E_INTERNAL_ERROR;
-	}
+/* Decrypt a chunk made by TestSuite_Envelope_Encrypt(). On entry *outLen is
+ * the size of out, which must be at least inLen. */
+TSS_RESULT
+TestSuite_Envelope_Decrypt(struct testsuite_envelope *e, BYTE *in, UINT32 inLen, BYTE *out,
+			   UINT32 *outLen)
+{
+	if (inLen < 2 * ENVELOPE_BLOCK || inLen % ENVELOPE_BLOCK ||
+	    inLen > TESTSUITE_ENVELOPE_CHUNK + TESTSUITE_ENVELOPE_OVERHEAD || *outLen < inLen)
+		return TSS_E_BAD_PARAMETER;
 
-	switch (alg) {
-		case TSS_ALG_AES:
-		case TCPA_ALG_AES:
-			cipher = (EVP_CIPHER *)EVP_aes_128_cbc();
-			break;
-		case TSS_ALG_DES:
-		case TCPA_ALG_DES:
-			cipher = (EVP_CIPHER *)EVP_des_cbc();
-			break;
-		case TSS_ALG_3DES:
-		case TCPA_ALG_3DES:
-			cipher = (EVP_CIPHER *)EVP_des_ede3_cbc();
-			break;
-		default:
-			return TSS_E_INTERNAL_ERROR;
-			break;
+	return TestSuite_SymDecrypt(TSS_ALG_AES, TSS_ES_NONE, e->key, NULL, in, inLen, out,
+				    outLen);
+}
+
+static TSS_RESULT
+envelope_put_uint32(FILE *out, UINT32 i)
+{
+	BYTE buf[sizeof(UINT32)];
+
+	UINT32ToArray(i, buf);
+	if (fwrite(buf, sizeof(buf), 1, out) != 1) {
+		fprintf(stderr, "Writing the envelope failed: %s\n", strerror(errno));
+		return TSS_E_INTERNAL_ERROR;
 	}
 
-	EVP_CIPHER_CTX_init(&ctx);
+	return TSS_SUCCESS;
+}
 
-	/* If the iv passed in is NULL, create a new random iv and prepend it to the ciphertext */
-	iv_len = EVP_CIPHER_iv_length(cipher);
-	if (iv == NULL) {
-		def_iv = malloc(iv_len);
-		if (def_iv == NULL) {
-			fprintf(stderr, "malloc of %d bytes failed.", iv_len);
-			return TSS_E_OUTOFMEMORY;
-		}
-		RAND_bytes(def_iv, iv_len);
+/* write size, then the size bytes of buf */
+static TSS_RESULT
+envelope_put(FILE *out, BYTE *buf, UINT32 size)
+{
+	TSS_RESULT result;
 
-		memcpy(out, def_iv, iv_len);
-		outiv_ptr = &out[iv_len];
-		outiv_len -= iv_len;
-	} else {
-		def_iv = iv;
-		outiv_ptr = out;
+	if ((result = envelope_put_uint32(out, size)))
+		return result;
+	if (fwrite(buf, size, 1, out) != 1) {
+		fprintf(stderr, "Writing the envelope failed: %s\n", strerror(errno));
+		return TSS_E_INTERNAL_ERROR;
 	}
 
-	if (!EVP_EncryptInit(&ctx, (const EVP_CIPHER *)cipher, key, def_iv)) {
-		result = TSS_E_INTERNAL_ERROR;
-		print_openssl_errors();
-		goto done;
+	return TSS_SUCCESS;
+}
+
+static TSS_RESULT
+envelope_get_uint32(FILE *in, UINT32 *i)
+{
+	BYTE buf[sizeof(UINT32)];
+
+	if (fread(buf, sizeof(buf), 1, in) != 1) {
+		fprintf(stderr, "The envelope is truncated\n");
+		return TSS_E_BAD_PARAMETER;
 	}
+	*i = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
 
-	if ((UINT32)outiv_len < in_len + (EVP_CIPHER_CTX_block_size(&ctx) * 2) - 1) {
-		fprintf(stderr, "Not enough space to do symmetric encryption");
-		result = TSS_E_INTERNAL_ERROR;
-		goto done;
+	return TSS_SUCCESS;
+}
+
+/* Write e's wrapped data key to out, then everything read from in, encrypted
+ * a chunk at a time. */
+TSS_RESULT
+TestSuite_Envelope_Write(struct testsuite_envelope *e, FILE *in, FILE *out)
+{
+	BYTE *plain, *cipher;
+	TSS_RESULT result;
+	UINT32 plainLen, cipherLen;
+
+	plain = malloc(2 * TESTSUITE_ENVELOPE_CHUNK + TESTSUITE_ENVELOPE_OVERHEAD);
+	if (plain == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.\n",
+			2 * TESTSUITE_ENVELOPE_CHUNK + TESTSUITE_ENVELOPE_OVERHEAD);
+		return TSS_E_OUTOFMEMORY;
 	}
+	cipher = plain + TESTSUITE_ENVELOPE_CHUNK;
 
-	if (!EVP_EncryptUpdate(&ctx, outiv_ptr, &outiv_len, in, in_len)) {
-		result = TSS_E_INTERNAL_ERROR;
-		print_openssl_errors();
+	if ((result = envelope_put_uint32(out, e->type)) ||
+	    (result = envelope_put(out, e->wrapped, e->wrappedSize)))
 		goto done;
-	}
 
-	if (!EVP_EncryptFinal(&ctx, outiv_ptr + outiv_len, (int *)&tmp)) {
+	while ((plainLen = fread(plain, 1, TESTSUITE_ENVELOPE_CHUNK, in)) > 0) {
+		cipherLen = TESTSUITE_ENVELOPE_CHUNK + TESTSUITE_ENVELOPE_OVERHEAD;
+		if ((result = TestSuite_Envelope_Encrypt(e, plain, plainLen, cipher,
+							 &cipherLen)) ||
+		    (result = envelope_put(out, cipher, cipherLen)))
+			goto done;
+	}
+	if (ferror(in)) {
+		fprintf(stderr, "Reading the payload failed: %s\n", strerror(errno));
 		result = TSS_E_INTERNAL_ERROR;
-		print_openssl_errors();
 		goto done;
 	}
 
-	outiv_len += tmp;
-	*out_len = outiv_len;
+	result = envelope_put_uint32(out, 0);
 done:
-	if (def_iv != iv) {
-		*out_len += iv_len;
-		free(def_iv);
-	}
-	EVP_CIPHER_CTX_cleanup(&ctx);
+	memset(plain, 0, TESTSUITE_ENVELOPE_CHUNK);
+	free(plain);
+
 	return result;
 }
 
+/* Read an envelope written by TestSuite_Envelope_Write() from in into e,
+ * unwrap its data key with hKey through hEncData and write the decrypted
+ * payload to out. A truncated or malformed envelope fails with
+ * TSS_E_BAD_PARAMETER, possibly after some of the payload was written. e is
+ * to be freed with TestSuite_Envelope_Free() whether this succeeds or not. */
 TSS_RESULT
-TestSuite_SymDecrypt(UINT16 alg, BYTE mode, BYTE *key, BYTE *iv, BYTE *in, UINT32 in_len, BYTE *out,
-		     UINT32 *out_len)
+TestSuite_Envelope_Read(struct testsuite_envelope *e, TSS_HCONTEXT hContext, TSS_HKEY hKey,
+			TSS_HENCDATA hEncData, FILE *in, FILE *out)
 {
-	TSS_RESULT result = TSS_SUCCESS;
-	EVP_CIPHER_CTX ctx;
-	EVP_CIPHER *cipher;
-	BYTE *def_iv = NULL, *iniv_ptr;
-	UINT32 tmp;
-	int iv_len, iniv_len;
+	BYTE *plain, *cipher;
+	TSS_RESULT result;
+	UINT32 plainLen, cipherLen;
 
-	if (in_len > INT_MAX)
+	memset(e, 0, sizeof(struct testsuite_envelope));
+	if ((result = envelope_get_uint32(in, &e->type)) ||
+	    (result = envelope_get_uint32(in, &e->wrappedSize)))
+		return result;
+	if ((e->type != TSS_ENCDATA_BIND && e->type != TSS_ENCDATA_SEAL) ||
+	    e->wrappedSize == 0 || e->wrappedSize > ENVELOPE_MAX_WRAPPED) {
+		fprintf(stderr, "The envelope's header is malformed\n");
+		return TSS_E_BAD_PARAMETER;
+	}
+	if ((e->wrapped = malloc(e->wrappedSize)) == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.\n", e->wrappedSize);
+		return TSS_E_OUTOFMEMORY;
+	}
+	if (fread(e->wrapped, e->wrappedSize, 1, in) != 1) {
+		fprintf(stderr, "The envelope is truncated\n");
 		return TSS_E_BAD_PARAMETER;
+	}
 
-	/* TPM 1.1 had no defines for symmetric encryption modes, must use CBC */
-	switch (mode) {
-		case TCPA_ES_NONE:
-		case TSS_ES_NONE:
-			break;
-		default:
-			fprintf(stderr, "Invalid mode in doing symmetric decryption");
-			return TSS_E_INTERNAL_ERROR;
+	if ((result = TestSuite_Envelope_Unwrap(e, hContext, hKey, hEncData)))
+		return result;
+
+	plain = malloc(2 * TESTSUITE_ENVELOPE_CHUNK + 2 * TESTSUITE_ENVELOPE_OVERHEAD);
+	if (plain == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.\n",
+			2 * TESTSUITE_ENVELOPE_CHUNK + 2 * TESTSUITE_ENVELOPE_OVERHEAD);
+		return TSS_E_OUTOFMEMORY;
 	}
+	cipher = plain + TESTSUITE_ENVELOPE_CHUNK + TESTSUITE_ENVELOPE_OVERHEAD;
 
-	switch (alg) {
-		case TSS_ALG_AES:
-		case TCPA_ALG_AES:
-			cipher = (EVP_CIPHER *)EVP_aes_128_cbc();
+	for (;;) {
+		if ((result = envelope_get_uint32(in, &cipherLen)) || cipherLen == 0)
 			break;
-		case TSS_ALG_DES:
-		case TCPA_ALG_DES:
-			cipher = (EVP_CIPHER *)EVP_des_cbc();
+		if (cipherLen > TESTSUITE_ENVELOPE_CHUNK + TESTSUITE_ENVELOPE_OVERHEAD) {
+			fprintf(stderr, "The envelope has a chunk of %u bytes\n", cipherLen);
+			result = TSS_E_BAD_PARAMETER;
 			break;
-		case TSS_ALG_3DES:
-		case TCPA_ALG_3DES:
-			cipher = (EVP_CIPHER *)EVP_des_ede3_cbc();
+		}
+		if (fread(cipher, cipherLen, 1, in) != 1) {
+			fprintf(stderr, "The envelope is truncated\n");
+			result = TSS_E_BAD_PARAMETER;
 			break;
-		default:
-			return TSS_E_INTERNAL_ERROR;
+		}
+
+		plainLen = TESTSUITE_ENVELOPE_CHUNK + TESTSUITE_ENVELOPE_OVERHEAD;
+		if ((result = TestSuite_Envelope_Decrypt(e, cipher, cipherLen, plain, &plainLen)))
+			break;
+		if (plainLen && fwrite(plain, plainLen, 1, out) != 1) {
+			fprintf(stderr, "Writing the payload failed: %s\n", strerror(errno));
+			result = TSS_E_INTERNAL_ERROR;
 			break;
+		}
 	}
 
-	EVP_CIPHER_CTX_init(&ctx);
+	memset(plain, 0, TESTSUITE_ENVELOPE_CHUNK + TESTSUITE_ENVELOPE_OVERHEAD);
+	free(plain);
 
-	/* If the iv is NULL, assume that its prepended to the ciphertext */
-	if (iv == NULL) {
-		iv_len = EVP_CIPHER_iv_length(cipher);
-		def_iv = malloc(iv_len);
-		if (def_iv == NULL) {
-			fprintf(stderr, "malloc of %d bytes failed.", iv_len);
-			return TSS_E_OUTOFMEMORY;
-		}
+	return result;
+}
 
-		memcpy(def_iv, in, iv_len);
-		iniv_ptr = &in[iv_len];
-		iniv_len = in_len - iv_len;
-	} else {
-		def_iv = iv;
-		iniv_ptr = in;
-		iniv_len = in_len;
-	}
+/* forget the data key and free the wrapped one */
+void
+TestSuite_Envelope_Free(struct testsuite_envelope *e)
+{
+	memset(e->key, 0, TESTSUITE_ENVELOPE_KEY_SIZE);
+	free(e->wrapped);
+	e->wrapped = NULL;
+	e->wrappedSize = 0;
+}
 
-	if (!EVP_DecryptInit(&ctx, cipher, key, def_iv)) {
-		result = TSS_E_INTERNAL_ERROR;
-		print_openssl_errors();
-		goto done;
+/*
+ * A local Privacy CA.
+ *
+ * A struct testsuite_privacy_ca stands in for a Privacy CA in identity tests
+ * and benchmarks. It owns a software RSA key, whose public half is a TSS key
+ * object to pass to Tspi_TPM_CollateIdentityRequest, and a pool of worker
+ * threads which take the resulting requests, decrypt them, verify the
+ * identity binding and issue a credential encrypted for the requesting TPM,
+ * all in software. Requests are submitted without waiting for them, so many
+ * can be in flight at once; only Tspi_TPM_ActivateIdentity needs the TPM
+ * again. The credential isn't a certificate, just bytes unique to the
+ * request to compare with what the TPM hands back.
+ */
+
+#define CA_KEY_SIZE_BITS	2048
+#define CA_CRED_FILL		0x5a
+
+/* the CA key's TCPA_PUBKEY, as the TSS hashes it into chosenId */
+static TSS_RESULT
+ca_get_pubkey(struct testsuite_privacy_ca *ca)
+{
+	struct testsuite_blob b;
+	TSS_RESULT result;
+	TCPA_KEY key;
+	UINT32 size;
+	BYTE *blob;
+
+	result = Tspi_GetAttribData(ca->hCAKey, TSS_TSPATTRIB_KEY_BLOB, TSS_TSPATTRIB_KEYBLOB_BLOB,
+				    &size, &blob);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_GetAttribData", result);
+		return result;
 	}
 
-	if (!EVP_DecryptUpdate(&ctx, out, (int *)out_len, iniv_ptr, iniv_len)) {
-		result = TSS_E_INTERNAL_ERROR;
-		print_openssl_errors();
+	TestSuite_Blob_Init(&b, blob, size);
+	if ((result = TestSuite_Blob_Get_KEY(&b, &key)))
 		goto done;
-	}
 
-	if (!EVP_DecryptFinal(&ctx, out + *out_len, (int *)&tmp)) {
-		result = TSS_E_INTERNAL_ERROR;
-		print_openssl_errors();
+	/* the public part is smaller than the whole key */
+	if ((ca->pubKey = malloc(size)) == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.", size);
+		result = TSS_E_OUTOFMEMORY;
 		goto done;
 	}
-
-	*out_len += tmp;
+	TestSuite_Blob_Init(&b, ca->pubKey, size);
+	TestSuite_Blob_Put_KEY_PARMS(&b, &key.algorithmParms);
+	TestSuite_Blob_Put_STORE_PUBKEY(&b, &key.pubKey);
+	ca->pubKeySize = b.offset;
+	result = b.result;
 done:
-	if (def_iv != iv)
-		free(def_iv);
-	EVP_CIPHER_CTX_cleanup(&ctx);
+	Tspi_Context_FreeMemory(ca->hContext, blob);
 	return result;
 }
 
-int
-TestSuite_RSA_Public_Encrypt(unsigned char *in, unsigned int inlen,
-			     unsigned char *out, unsigned int *outlen,
-			     unsigned char *pubkey, unsigned int pubsize,
-			     unsigned int e, int padding)
-{
-	int rv, e_size = 3;
-	unsigned char exp[] = { 0x01, 0x00, 0x01 };
-	RSA *rsa = RSA_new();
+static void *ca_worker(void *);
 
-	if (rsa == NULL) {
-		rv = TSS_E_OUTOFMEMORY;
-		goto err;
+/* Generate the CA's key and start num_threads workers. With none, or if no
+ * thread can be started, requests are processed when they're submitted. */
+TSS_RESULT
+TestSuite_Privacy_CA_Init(struct testsuite_privacy_ca *ca, TSS_HCONTEXT hContext,
+			  UINT32 num_threads)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	BIGNUM *bn_n = NULL;
+#else
+	const BIGNUM *bn_n;
+#endif
+	EVP_PKEY_CTX *ctx;
+	TSS_RESULT result;
+	BYTE n[CA_KEY_SIZE_BITS / 8];
+	UINT32 size_n;
+
+	memset(ca, 0, sizeof(struct testsuite_privacy_ca));
+	ca->hContext = hContext;
+	ca->symAlg = TCPA_ALG_3DES;
+	pthread_mutex_init(&ca->lock, NULL);
+	pthread_cond_init(&ca->cond, NULL);
+
+	if ((ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL)) == NULL ||
+	    EVP_PKEY_keygen_init(ctx) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, CA_KEY_SIZE_BITS) <= 0 ||
+	    EVP_PKEY_keygen(ctx, &ca->pkey) <= 0) {
+		print_openssl_errors();
+		EVP_PKEY_CTX_free(ctx);
+		TestSuite_Privacy_CA_Free(ca);
+		return TSS_E_INTERNAL_ERROR;
 	}
+	EVP_PKEY_CTX_free(ctx);
 
-	switch (e) {
-		case 0:
-			/* fall through */
-		case 65537:
-			break;
-		case 17:
-			exp[0] = 17;
-			e_size = 1;
-			break;
-		case 3:
-			exp[0] = 3;
-			e_size = 1;
-			break;
-		default:
-			rv = TSS_E_INTERNAL_ERROR;
-			goto out;
-			break;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if (!EVP_PKEY_get_bn_param(ca->pkey, OSSL_PKEY_PARAM_RSA_N, &bn_n)) {
+		print_openssl_errors();
+		TestSuite_Privacy_CA_Free(ca);
+		return TSS_E_INTERNAL_ERROR;
 	}
+	size_n = BN_bn2bin(bn_n, n);
+	BN_free(bn_n);
+#else
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	RSA_get0_key(EVP_PKEY_get0_RSA(ca->pkey), &bn_n, NULL, NULL);
+#else
+	bn_n = ca->pkey->pkey.rsa->n;
+#endif
+	size_n = BN_bn2bin(bn_n, n);
+#endif
 
-	switch (padding) {
-		case RSA_PKCS1_OAEP_PADDING:
-		case RSA_PKCS1_PADDING:
-		case RSA_NO_PADDING:
-			break;
-		default:
-			rv = TSS_E_INTERNAL_ERROR;
-			goto out;
-			break;
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_RSAKEY,
+					   TSS_KEY_TYPE_LEGACY | TSS_KEY_SIZE_2048, &ca->hCAKey);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		ca->hCAKey = 0;
+		TestSuite_Privacy_CA_Free(ca);
+		return result;
 	}
 
-	/* set the public key value in the OpenSSL object */
-	rsa->n = BN_bin2bn(pubkey, pubsize, rsa->n);
-	/* set the public exponent */
-	rsa->e = BN_bin2bn(exp, e_size, rsa->e);
-
-	if (rsa->n == NULL || rsa->e == NULL) {
-		rv = TSS_E_OUTOFMEMORY;
-		goto err;
+	if ((result = set_public_modulus(hContext, ca->hCAKey, size_n, n)) ||
+	    (result = Tspi_SetAttribUint32(ca->hCAKey, TSS_TSPATTRIB_KEY_INFO,
+					   TSS_TSPATTRIB_KEYINFO_ALGORITHM, TSS_ALG_RSA)) ||
+	    (result = Tspi_SetAttribUint32(ca->hCAKey, TSS_TSPATTRIB_RSAKEY_INFO,
+					   TSS_TSPATTRIB_KEYINFO_RSA_PRIMES, 2)) ||
+	    (result = Tspi_SetAttribUint32(ca->hCAKey, TSS_TSPATTRIB_KEY_INFO,
+					   TSS_TSPATTRIB_KEYINFO_ENCSCHEME,
+					   TSS_ES_RSAESOAEP_SHA1_MGF1)) ||
+	    (result = ca_get_pubkey(ca))) {
+		print_error("TestSuite_Privacy_CA_Init", result);
+		TestSuite_Privacy_CA_Free(ca);
+		return result;
 	}
 
-	rv = RSA_public_encrypt(inlen, in, out, rsa, padding);
-	if (rv == -1) {
-		rv = TSS_E_INTERNAL_ERROR;
-		goto err;
+	if (num_threads && (ca->threads = calloc(num_threads, sizeof(pthread_t)))) {
+		for (; ca->num_threads < num_threads; ca->num_threads++) {
+			if (pthread_create(&ca->threads[ca->num_threads], NULL, ca_worker, ca))
+				break;
+		}
 	}
 
-	/* RSA_public_encrypt returns the size of the encrypted data */
-	*outlen = rv;
-	rv = TSS_SUCCESS;
-	goto out;
-
-err:
-	print_openssl_errors();
-out:
-	if (rsa)
-		RSA_free(rsa);
-	return rv;
+	return TSS_SUCCESS;
 }
 
-int
-TestSuite_TPM_RSA_Encrypt(unsigned char *dataToEncrypt,
-			  unsigned int dataToEncryptLen,
-			  unsigned char *encryptedData,
-			  unsigned int *encryptedDataLen,
-			  unsigned char *publicKey,
-			  unsigned int keysize)
+/* the modulus of the TPM's EK, which the credentials are encrypted for. It
+ * is TSS memory, and the TPM's policy must hold the owner secret */
+TSS_RESULT
+TestSuite_Privacy_CA_Get_EK(TSS_HCONTEXT hContext, TSS_HTPM hTPM, BYTE **n, UINT32 *size)
 {
-	int rv;
-	unsigned char exp[] = { 0x01, 0x00, 0x01 }; /* 65537 hex */
-	unsigned char oaepPad[] = "TCPA";
-	int oaepPadLen = 4;
-	RSA *rsa = RSA_new();
-	BYTE encodedData[256];
-	int encodedDataLen;
-
-	if (rsa == NULL) {
-		rv = TSS_E_OUTOFMEMORY;
-		goto err;
+	TSS_HKEY hPubEK;
+	TSS_RESULT result;
+
+	result = Tspi_TPM_GetPubEndorsementKey(hTPM, TRUE, NULL, &hPubEK);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_GetPubEndorsementKey", result);
+		return result;
 	}
 
-	/* set the public key value in the OpenSSL object */
-	rsa->n = BN_bin2bn(publicKey, keysize, rsa->n);
-	/* set the public exponent */
-	rsa->e = BN_bin2bn(exp, sizeof(exp), rsa->e);
+	result = Tspi_GetAttribData(hPubEK, TSS_TSPATTRIB_RSAKEY_INFO,
+				    TSS_TSPATTRIB_KEYINFO_RSA_MODULUS, size, n);
+	if (result != TSS_SUCCESS)
+		print_error("Tspi_GetAttribData", result);
+	Tspi_Context_CloseObject(hContext, hPubEK);
 
-	if (rsa->n == NULL || rsa->e == NULL) {
-		rv = TSS_E_OUTOFMEMORY;
-		goto err;
-	}
+	return result;
+}
 
-	/* padding constraint for PKCS#1 OAEP padding */
-	if ((int)dataToEncryptLen >= (RSA_size(rsa) - ((2 * SHA_DIGEST_LENGTH) + 1))) {
-		rv = TSS_E_INTERNAL_ERROR;
-		goto err;
+/* the TSS encrypts the request's session key with OAEP without a label */
+static EVP_PKEY_CTX *
+ca_decrypt_ctx_new(EVP_PKEY *pkey)
+{
+	EVP_PKEY_CTX *ctx;
+
+	if ((ctx = EVP_PKEY_CTX_new(pkey, NULL)) == NULL ||
+	    EVP_PKEY_decrypt_init(ctx) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) <= 0) {
+		print_openssl_errors();
+		EVP_PKEY_CTX_free(ctx);
+		return NULL;
 	}
 
-	encodedDataLen = MIN(RSA_size(rsa), 256);
+	return ctx;
+}
 
-	/* perform our OAEP padding here with custom padding parameter */
-	rv = RSA_padding_add_PKCS1_OAEP(encodedData, encodedDataLen, dataToEncrypt,
-					dataToEncryptLen, oaepPad, oaepPadLen);
-	if (rv != EVP_SUCCESS) {
-		rv = TSS_E_INTERNAL_ERROR;
-		goto err;
+/* The identity binding is the AIK's signature of the TPM_IDENTITY_CONTENTS:
+ * the version, TPM_ORD_MakeIdentity, chosenId, which is SHA1(label ||
+ * TCPA_PUBKEY of the CA), and the AIK's TCPA_PUBKEY */
+static TSS_RESULT
+ca_verify_binding(struct testsuite_privacy_ca *ca, TCPA_IDENTITY_PROOF *proof)
+{
+	struct testsuite_rsa_key idKey;
+	struct testsuite_blob b;
+	TSS_VALIDATION valData;
+	EVP_PKEY_CTX *ctx;
+	TSS_RESULT result;
+	BYTE chosenId[TPM_SHA1_160_HASH_LEN], *buf;
+	UINT32 size;
+
+	size = proof->labelSize + ca->pubKeySize + 4 + 4 + sizeof(chosenId) + 16 +
+	       proof->identityKey.algorithmParms.parmSize + proof->identityKey.pubKey.keyLength;
+	if ((buf = malloc(size)) == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.", size);
+		return TSS_E_OUTOFMEMORY;
 	}
 
-	/* call OpenSSL with no additional padding */
-	rv = RSA_public_encrypt(encodedDataLen, encodedData, encryptedData, rsa, RSA_NO_PADDING);
-	if (rv == -1) {
-		rv = TSS_E_INTERNAL_ERROR;
-		goto err;
-	}
+	TestSuite_Blob_Init(&b, buf, size);
+	TestSuite_Blob_Put(&b, proof->labelArea, proof->labelSize);
+	TestSuite_Blob_Put(&b, ca->pubKey, ca->pubKeySize);
+	SHA1(buf, b.offset, chosenId);
+
+	/* the TPM's version, which the proof carries too */
+	TestSuite_Blob_Init(&b, buf, size);
+	TestSuite_Blob_Put_TCPA_VERSION(&b, (TCPA_VERSION *)&proof->ver);
+	TestSuite_Blob_Put_UINT32(&b, TPM_ORD_MakeIdentity);
+	TestSuite_Blob_Put(&b, chosenId, sizeof(chosenId));
+	TestSuite_Blob_Put_PUBKEY(&b, &proof->identityKey);
+	if ((result = b.result))
+		goto done;
 
-	/* RSA_public_encrypt returns the size of the encrypted data */
-	*encryptedDataLen = rv;
-	rv = TSS_SUCCESS;
-	goto out;
+	if ((result = TestSuite_RSA_Key_From_PUBKEY(&idKey, &proof->identityKey)))
+		goto done;
 
-err:
-	print_openssl_errors();
-out:
-	if (rsa)
-		RSA_free(rsa);
-	return rv;
+	if ((ctx = verify_ctx_new(idKey.pkey, TCPA_SS_RSASSAPKCS1v15_SHA1))) {
+		memset(&valData, 0, sizeof(valData));
+		valData.rgbData = buf;
+		valData.ulDataLength = b.offset;
+		valData.rgbValidationData = proof->identityBinding;
+		valData.ulValidationDataLength = proof->identityBindingSize;
+		if ((result = verify_one(ctx, TCPA_SS_RSASSAPKCS1v15_SHA1, &valData)))
+			fprintf(stderr, "Identity Binding signature doesn't match!\n");
+		EVP_PKEY_CTX_free(ctx);
+	} else
+		result = TSS_E_INTERNAL_ERROR;
+	TestSuite_RSA_Key_Free(&idKey);
+done:
+	free(buf);
+	return result;
 }
 
-/* Testsuite_Transport_Init/Final: wrappers for executing APIs inside a logged transport session */
-TSS_RESULT
-Testsuite_Transport_Init(TSS_HCONTEXT hContext,
-			 TSS_HKEY hSRK,
-			 TSS_HTPM hTPM,
-			 TSS_BOOL useKeys,
-			 TSS_BOOL encrypt,
-			 TSS_HKEY *hWrappingKey,
-			 TSS_HKEY *hSigningKey)
+/* issue a credential for the AIK of proof, encrypted with a new session key
+ * for the TPM's EK */
+static TSS_RESULT
+ca_issue(struct testsuite_privacy_ca *ca, struct testsuite_ca_request *req,
+	 TCPA_IDENTITY_PROOF *proof)
 {
+	TCPA_ASYM_CA_CONTENTS asymContents;
+	TCPA_SYM_CA_ATTESTATION symAttestation;
+	struct testsuite_rsa_key ek;
+	struct testsuite_blob b;
 	TSS_RESULT result;
-	TSS_HPOLICY hTPMPolicy, hPolicy;
-	UINT32 pubSRKLen;
-	BYTE* pubSRK;
-
-        result = Tspi_GetPolicyObject( hTPM, TSS_POLICY_USAGE, &hTPMPolicy );
-        if ( result != TSS_SUCCESS )
-        {
-                print_error( "Tspi_GetPolicyObject", result );
-		return result;
-        }
+	BYTE sessionKey[24], enc[TESTSUITE_CA_CRED_SIZE + 64], buf[1024];
+	UINT32 encLen = sizeof(enc), size, serial;
 
-        result = Tspi_Policy_SetSecret( hTPMPolicy, TESTSUITE_OWNER_SECRET_MODE,
-                                        TESTSUITE_OWNER_SECRET_LEN, TESTSUITE_OWNER_SECRET);
-        if ( result != TSS_SUCCESS )
-        {
-                print_error( "Tspi_Policy_SetSecret", result );
+	memset(&asymContents, 0, sizeof(asymContents));
+	asymContents.sessionKey.algId = ca->symAlg;
+	asymContents.sessionKey.encScheme = TCPA_ES_NONE;
+	switch (ca->symAlg) {
+		case TCPA_ALG_AES:
+			asymContents.sessionKey.size = 128/8;
+			break;
+		case TCPA_ALG_DES:
+			asymContents.sessionKey.size = 64/8;
+			break;
+		case TCPA_ALG_3DES:
+			asymContents.sessionKey.size = 192/8;
+			break;
+		default:
+			return TSS_E_BAD_PARAMETER;
+	}
+	if (RAND_bytes(sessionKey, asymContents.sessionKey.size) != 1) {
+		print_openssl_errors();
+		return TSS_E_INTERNAL_ERROR;
+	}
+	asymContents.sessionKey.data = sessionKey;
+
+	/* the TPM checks this against the AIK it activates */
+	TestSuite_Blob_Init(&b, buf, sizeof(buf));
+	TestSuite_Blob_Put_PUBKEY(&b, &proof->identityKey);
+	if (b.result)
+		return b.result;
+	SHA1(buf, b.offset, (BYTE *)&asymContents.idDigest.digest);
+
+	/* the credential: a serial number and the AIK's digest */
+	pthread_mutex_lock(&ca->lock);
+	serial = ++ca->serial;
+	pthread_mutex_unlock(&ca->lock);
+	memset(req->credential, CA_CRED_FILL, TESTSUITE_CA_CRED_SIZE);
+	TestSuite_Blob_Init(&b, req->credential, TESTSUITE_CA_CRED_SIZE);
+	TestSuite_Blob_Put_UINT32(&b, serial);
+	TestSuite_Blob_Put(&b, (BYTE *)&asymContents.idDigest.digest, TPM_SHA1_160_HASH_LEN);
+
+	/* TCPA_SYM_CA_ATTESTATION: the credential under the session key */
+	if ((result = TestSuite_SymEncrypt(ca->symAlg, TCPA_ES_NONE, sessionKey, NULL,
+					   req->credential, TESTSUITE_CA_CRED_SIZE, enc, &encLen)))
 		return result;
-        }
 
-	/* if the code executing in the transport session uses keys, we must get the SRK pub
-	 * from the TPM to avoid errors when closing the session */
-	if (useKeys) {
-		result = Tspi_TPM_OwnerGetSRKPubKey(hTPM, &pubSRKLen, &pubSRK);
-		if ( result != TSS_SUCCESS )
-		{
-			print_error( "Tspi_TPM_OwnerGetSRKPubKey", result );
-			return result;
-		}
+	memset(&symAttestation, 0, sizeof(symAttestation));
+	symAttestation.credSize = encLen;
+	symAttestation.credential = enc;
+	symAttestation.algorithm.algorithmID = ca->symAlg;
+	symAttestation.algorithm.encScheme = TCPA_ES_NONE;
 
-		result = Tspi_Context_FreeMemory(hContext, pubSRK);
-		if ( result != TSS_SUCCESS )
-		{
-			print_error( "Tspi_Context_FreeMemory", result );
-			return result;
-		}
+	size = 4 + 12 + encLen;
+	if ((req->symBlob = malloc(size)) == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.", size);
+		return TSS_E_OUTOFMEMORY;
 	}
-
-	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_RSAKEY,
-					   TSS_KEY_SIZE_512 | TSS_KEY_TYPE_LEGACY |
-					   TSS_KEY_AUTHORIZATION, hWrappingKey);
-	if (result != TSS_SUCCESS) {
-		print_error("Tspi_Context_CreateObject", result);
+	TestSuite_Blob_Init(&b, req->symBlob, size);
+	TestSuite_Blob_Put_SYM_CA_ATTESTATION(&b, &symAttestation);
+	if (b.result)
+		return b.result;
+	req->symBlobSize = b.offset;
+
+	/* TCPA_ASYM_CA_CONTENTS: the session key, under the EK */
+	TestSuite_Blob_Init(&b, buf, sizeof(buf));
+	TestSuite_Blob_Put_ASYM_CA_CONTENTS(&b, &asymContents);
+	if (b.result)
+		return b.result;
+
+	if ((result = TestSuite_RSA_Key_Init(&ek, req->ekModulus, req->ekModulusSize, 0,
+					     TCPA_ES_RSAESOAEP_SHA1_MGF1)))
 		return result;
-	}
+	if ((req->asymBlob = malloc(ek.size)) == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.", ek.size);
+		result = TSS_E_OUTOFMEMORY;
+	} else
+		result = TestSuite_RSA_Key_Encrypt(&ek, buf, b.offset, req->asymBlob,
+						   &req->asymBlobSize);
+	TestSuite_RSA_Key_Free(&ek);
 
-	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_POLICY, TSS_POLICY_USAGE,
-					   &hPolicy);
-	if (result != TSS_SUCCESS) {
-		print_error("Tspi_Context_CreateObject", result);
-		return result;
-	}
+	return result;
+}
 
-	result = Tspi_Policy_SetSecret(hPolicy, TESTSUITE_KEY_SECRET_MODE, TESTSUITE_KEY_SECRET_LEN,
-				       TESTSUITE_KEY_SECRET);
-	if ( result != TSS_SUCCESS )
-	{
-		print_error("Tspi_Policy_SetSecret", result);
-		return result;
-	}
+/* decrypt and verify req, then issue its credential. ctx decrypts with the
+ * CA's key and belongs to the calling thread */
+static TSS_RESULT
+ca_process(struct testsuite_privacy_ca *ca, EVP_PKEY_CTX *ctx, struct testsuite_ca_request *req)
+{
+	TCPA_IDENTITY_REQ idReq;
+	TCPA_SYMMETRIC_KEY symKey;
+	TCPA_IDENTITY_PROOF proof;
+	struct testsuite_blob b;
+	TSS_RESULT result;
+	BYTE asym[CA_KEY_SIZE_BITS / 8], *sym;
+	size_t asymLen = sizeof(asym);
+	UINT32 symLen;
 
-	result = Tspi_Policy_AssignToObject(hPolicy, *hWrappingKey);
-	if ( result != TSS_SUCCESS )
-	{
-		print_error("Tspi_Policy_AssignToObject", result);
+	TestSuite_Blob_Init(&b, req->identityReq, req->identityReqSize);
+	if ((result = TestSuite_Blob_Get_IDENTITY_REQ(&b, &idReq)))
 		return result;
-	}
 
-	result = Tspi_Key_CreateKey(*hWrappingKey, hSRK, 0);
-	if (result != TSS_SUCCESS) {
-		print_error("Tspi_Key_CreateKey", result);
-		return result;
+	if (EVP_PKEY_decrypt(ctx, asym, &asymLen, idReq.asymBlob, idReq.asymSize) <= 0) {
+		print_openssl_errors();
+		return TSS_E_FAIL;
 	}
-
-	result = Tspi_Key_LoadKey(*hWrappingKey, hSRK);
-	if (result != TSS_SUCCESS) {
-		print_error("Tspi_Key_LoadKey", result);
+	TestSuite_Blob_Init(&b, asym, asymLen);
+	if ((result = TestSuite_Blob_Get_SYMMETRIC_KEY(&b, &symKey)))
 		return result;
+
+	/* the plaintext is no longer than the ciphertext */
+	symLen = idReq.symSize;
+	if ((sym = malloc(symLen)) == NULL) {
+		fprintf(stderr, "malloc of %u bytes failed.", symLen);
+		return TSS_E_OUTOFMEMORY;
 	}
+	if ((result = TestSuite_SymDecrypt(symKey.algId, symKey.encScheme, symKey.data, NULL,
+					   idReq.symBlob, idReq.symSize, sym, &symLen)))
+		goto done;
 
-	if (hSigningKey) {
-		// Create the key used to sign the transport session
-		result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_RSAKEY,
-				TSS_KEY_SIZE_512 | TSS_KEY_TYPE_SIGNING |
-				TSS_KEY_NO_AUTHORIZATION, hSigningKey);
-		if (result != TSS_SUCCESS) {
-			print_error("Tspi_Context_CreateObject", result);
-			return result;
-		}
+	TestSuite_Blob_Init(&b, sym, symLen);
+	if ((result = TestSuite_Blob_Get_IDENTITY_PROOF(&b, &proof)))
+		goto done;
 
-		result = Tspi_Key_CreateKey(*hSigningKey, hSRK, 0);
-		if (result != TSS_SUCCESS) {
-			print_error("Tspi_Key_CreateKey", result);
-			return result;
-		}
+	/* the endorsement, platform and conformance credentials aren't checked:
+	 * the TPMs this runs against rarely have any, and the credential is
+	 * encrypted for the EK read from the TPM, not for a certified one */
+	if ((result = ca_verify_binding(ca, &proof)))
+		goto done;
 
-		result = Tspi_Key_LoadKey(*hSigningKey, hSRK);
-		if (result != TSS_SUCCESS) {
-			print_error("Tspi_Key_LoadKey", result);
-			return result;
-		}
-	}
+	result = ca_issue(ca, req, &proof);
+done:
+	free(sym);
+	return result;
+}
 
-	// Set the encryption key to use to be hWrappingKey
-	result = Tspi_Context_SetTransEncryptionKey(hContext, *hWrappingKey);
-	if (result != TSS_SUCCESS) {
-		print_error("Tspi_Context_SetTransEncryptionKey", result);
-		return result;
-	}
+/* process req on the calling thread, without the workers */
+TSS_RESULT
+TestSuite_Privacy_CA_Process(struct testsuite_privacy_ca *ca, struct testsuite_ca_request *req)
+{
+	EVP_PKEY_CTX *ctx = ca_decrypt_ctx_new(ca->pkey);
 
-	// Enable the transport session
-	result = Tspi_SetAttribUint32(hContext, TSS_TSPATTRIB_CONTEXT_TRANSPORT,
-				      TSS_TSPATTRIB_CONTEXTTRANS_CONTROL,
-				      TSS_TSPATTRIB_ENABLE_TRANSPORT);
-	if (result != TSS_SUCCESS) {
-		print_error("Tspi_SetAttribUint32", result);
-		return result;
-	}
+	TestSuite_Privacy_CA_Free_Request(req);
+	req->result = ctx ? ca_process(ca, ctx, req) : TSS_E_INTERNAL_ERROR;
+	req->done = 1;
+	EVP_PKEY_CTX_free(ctx);
 
-	/* Turn logging on. Skipping this step would give us TPM_BAD_MODE when we call
-	 * CloseSignTransport */
-	result = Tspi_SetAttribUint32(hContext, TSS_TSPATTRIB_CONTEXT_TRANSPORT,
-				      TSS_TSPATTRIB_CONTEXTTRANS_MODE,
-				      TSS_TSPATTRIB_TRANSPORT_AUTHENTIC_CHANNEL);
-	if (result != TSS_SUCCESS) {
-		print_error("Tspi_SetAttribUint32", result);
-		return result;
-	}
+	return req->result;
+}
 
-	if (encrypt) {
-		result = Tspi_SetAttribUint32(hContext, TSS_TSPATTRIB_CONTEXT_TRANSPORT,
-					      TSS_TSPATTRIB_CONTEXTTRANS_MODE,
-					      TSS_TSPATTRIB_TRANSPORT_DEFAULT_ENCRYPTION);
-		if (result != TSS_SUCCESS) {
-			print_error("Tspi_SetAttribUint32", result);
-			return result;
+static void *
+ca_worker(void *arg)
+{
+	struct testsuite_privacy_ca *ca = arg;
+	struct testsuite_ca_request *req;
+	EVP_PKEY_CTX *ctx = ca_decrypt_ctx_new(ca->pkey);
+	TSS_RESULT result;
+
+	for (;;) {
+		pthread_mutex_lock(&ca->lock);
+		while (ca->count == 0 && !ca->stop)
+			pthread_cond_wait(&ca->cond, &ca->lock);
+		if (ca->count == 0) {
+			pthread_mutex_unlock(&ca->lock);
+			break;
 		}
+		req = ca->queue[ca->head];
+		ca->head = (ca->head + 1) % TESTSUITE_CA_QUEUE_SIZE;
+		ca->count--;
+		pthread_cond_broadcast(&ca->cond);
+		pthread_mutex_unlock(&ca->lock);
+
+		TestSuite_Privacy_CA_Free_Request(req);
+		result = ctx ? ca_process(ca, ctx, req) : TSS_E_INTERNAL_ERROR;
+
+		pthread_mutex_lock(&ca->lock);
+		req->result = result;
+		req->done = 1;
+		pthread_cond_broadcast(&ca->cond);
+		pthread_mutex_unlock(&ca->lock);
 	}
+	EVP_PKEY_CTX_free(ctx);
 
-	return TSS_SUCCESS;
+	return NULL;
 }
 
+/* Queue req for the workers, waiting only while the queue is full. req must
+ * have been zeroed before its inputs were set, and it and its inputs must
+ * stay valid until TestSuite_Privacy_CA_Wait returns */
+void
+TestSuite_Privacy_CA_Submit(struct testsuite_privacy_ca *ca, struct testsuite_ca_request *req)
+{
+	if (ca->num_threads == 0) {
+		TestSuite_Privacy_CA_Process(ca, req);
+		return;
+	}
+
+	pthread_mutex_lock(&ca->lock);
+	req->done = 0;
+	while (ca->count == TESTSUITE_CA_QUEUE_SIZE)
+		pthread_cond_wait(&ca->cond, &ca->lock);
+	ca->queue[(ca->head + ca->count) % TESTSUITE_CA_QUEUE_SIZE] = req;
+	ca->count++;
+	pthread_cond_broadcast(&ca->cond);
+	pthread_mutex_unlock(&ca->lock);
+}
 
 TSS_RESULT
-Testsuite_Transport_Final(TSS_HCONTEXT hContext, TSS_HKEY hSigningKey)
+TestSuite_Privacy_CA_Wait(struct testsuite_privacy_ca *ca, struct testsuite_ca_request *req)
 {
 	TSS_RESULT result;
 
-	if (hSigningKey) {
-		result = Tspi_Context_CloseSignTransport(hContext, hSigningKey, NULL);
-	} else {
-		result = Tspi_SetAttribUint32(hContext, TSS_TSPATTRIB_CONTEXT_TRANSPORT,
-					      TSS_TSPATTRIB_CONTEXTTRANS_CONTROL,
-					      TSS_TSPATTRIB_DISABLE_TRANSPORT);
-	}
+	pthread_mutex_lock(&ca->lock);
+	while (!req->done)
+		pthread_cond_wait(&ca->cond, &ca->lock);
+	result = req->result;
+	pthread_mutex_unlock(&ca->lock);
 
 	return result;
 }
 
-/* Checks a command's resulting TPM signature against validation data */
+/* activate the loaded identity key hIdentKey with the CA's answer to req, and
+ * check that the TPM hands back the credential that was issued */
 TSS_RESULT
-Testsuite_Verify_Signature(TSS_HCONTEXT hContext, TSS_HKEY hIdentKey, TSS_VALIDATION *valData)
+TestSuite_Privacy_CA_Activate(TSS_HCONTEXT hContext, TSS_HTPM hTPM, TSS_HKEY hIdentKey,
+			      struct testsuite_ca_request *req)
 {
-	TSS_RESULT	result;
-	TSS_HHASH	hHash;
-
-	// create hash
-	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_HASH, TSS_HASH_SHA1, &hHash);
-	if (result != TSS_SUCCESS) {
-		print_error("Testsuite_Verify_Signature : Tspi_Context_CreateObject (hash)",
-			    result);
-		return result;
-	}
+	TSS_RESULT result;
+	UINT32 credLen;
+	BYTE *cred;
 
-	result = Tspi_Hash_UpdateHashValue(hHash, valData->ulDataLength, valData->rgbData);
+	result = Tspi_TPM_ActivateIdentity(hTPM, hIdentKey, req->asymBlobSize, req->asymBlob,
+					   req->symBlobSize, req->symBlob, &credLen, &cred);
 	if (result != TSS_SUCCESS) {
-		print_error("Testsuite_Verify_Signature : Tspi_Hash_SetHashValue", result);
-		Tspi_Context_CloseObject(hContext, hHash);
+		print_error("Tspi_TPM_ActivateIdentity", result);
 		return result;
 	}
 
-	result = Tspi_Hash_VerifySignature(hHash, hIdentKey, valData->ulValidationDataLength,
-					   valData->rgbValidationData);
-	if (result != TSS_SUCCESS) {
-		print_error("Testsuite_Verify_Signature : Tspi_Hash_Verify_Signature", result);
-		Tspi_Context_CloseObject(hContext, hHash);
-		return result;
+	if (credLen != TESTSUITE_CA_CRED_SIZE ||
+	    memcmp(cred, req->credential, TESTSUITE_CA_CRED_SIZE)) {
+		fprintf(stderr, "credential doesn't match!\n");
+		result = TSS_E_FAIL;
 	}
+	Tspi_Context_FreeMemory(hContext, cred);
 
-	Tspi_Context_CloseObject(hContext, hHash);
 	return result;
 }
 
+/* free what the CA set in req */
+void
+TestSuite_Privacy_CA_Free_Request(struct testsuite_ca_request *req)
+{
+	free(req->asymBlob);
+	free(req->symBlob);
+	req->asymBlob = NULL;
+	req->symBlob = NULL;
+	req->asymBlobSize = 0;
+	req->symBlobSize = 0;
+}
+
+/* stop the workers, once they have processed what was submitted, and free
+ * the CA */
+void
+TestSuite_Privacy_CA_Free(struct testsuite_privacy_ca *ca)
+{
+	UINT32 i;
+
+	pthread_mutex_lock(&ca->lock);
+	ca->stop = 1;
+	pthread_cond_broadcast(&ca->cond);
+	pthread_mutex_unlock(&ca->lock);
+	for (i = 0; i < ca->num_threads; i++)
+		pthread_join(ca->threads[i], NULL);
+	free(ca->threads);
+	ca->threads = NULL;
+	ca->num_threads = 0;
+
+	if (ca->hCAKey)
+		Tspi_Context_CloseObject(ca->hContext, ca->hCAKey);
+	ca->hCAKey = 0;
+	EVP_PKEY_free(ca->pkey);
+	ca->pkey = NULL;
+	free(ca->pubKey);
+	ca->pubKey = NULL;
+
+	pthread_cond_destroy(&ca->cond);
+	pthread_mutex_destroy(&ca->lock);
+}
+
 TSS_RESULT
 Testsuite_Is_Ordinal_Supported(TSS_HTPM hTPM, TPM_COMMAND_CODE ordinal)
 {
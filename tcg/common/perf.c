@@ -0,0 +1,473 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *      perf.c
+ *
+ * DESCRIPTION
+ *      This file contains the helpers used by the benchmarks: argument
+ *	parsing, a monotonic clock, latency sample sets and a reporter
+ *	which prints one summary line per measured case.
+ *
+ *	The migration benchmarks also share the queue that takes blobs from
+ *	the source to the converter threads, and the check that a migrated
+ *	key signs with the public key it had on the source.
+ *
+ *	Every summary line has the form:
+ *
+ *	PERF <case> n=<samples> min_us=.. p50_us=.. p95_us=.. max_us=..
+ *		mean_us=.. ops_per_s=.. [mb_per_s=..]
+ *
+ *	and single values are printed as "PERF <case> <key>=<value>", so
+ *	that the output of a run can be post-processed with awk. With -r,
+ *	every sample is also printed as "SAMPLE <case> <nanoseconds>".
+ *
+ * ALGORITHM
+ *      None.
+ *
+ * USAGE
+ *      Include perf.o in compile arguments
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *      None.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "perf.h"
+
+static void
+perf_usage(char *argv0)
+{
+	fprintf(stderr, "Usage: %s [options]\n", argv0);
+	fprintf(stderr, "\t-v <version>\tThe version of the TSS you would like to test (default 1.1).\n");
+	fprintf(stderr, "\t-n <count>\tNumber of samples to take per measured case.\n");
+	fprintf(stderr, "\t-t <count>\tNumber of worker threads, where the benchmark uses them.\n");
+	fprintf(stderr, "\t-m <count>\tUpper bound on the benchmark's scale (see its header).\n");
+	fprintf(stderr, "\t-r\t\tPrint every sample in addition to the summaries.\n");
+}
+
+/* parse the options common to all benchmarks. 'max' is the benchmark's
+ * default for -m. */
+void
+perf_parse_args(int argc, char **argv, struct perf_opts *opts, UINT64 max)
+{
+	int c;
+
+	opts->version = TESTSUITE_TEST_TSS_1_1;
+	opts->iterations = PERF_DEFAULT_ITERATIONS;
+	opts->threads = 1;
+	opts->max = max;
+	opts->raw = 0;
+
+	while ((c = getopt(argc, argv, "v:n:t:m:rh")) != EOF) {
+		switch (c) {
+			case 'v':
+				if (!strncmp("1.1", optarg, 3))
+					opts->version = TESTSUITE_TEST_TSS_1_1;
+				else if (!strncmp("1.2", optarg, 3))
+					opts->version = TESTSUITE_TEST_TSS_1_2;
+				else
+					opts->version = TESTSUITE_UNSUPPORTED_TSS_VERSION;
+				break;
+			case 'n':
+				opts->iterations = strtoul(optarg, NULL, 0);
+				break;
+			case 't':
+				opts->threads = strtoul(optarg, NULL, 0);
+				break;
+			case 'm':
+				opts->max = strtoull(optarg, NULL, 0);
+				break;
+			case 'r':
+				opts->raw = 1;
+				break;
+			case 'h':
+				perf_usage(argv[0]);
+				exit(0);
+			default:
+				perf_usage(argv[0]);
+				exit(1);
+		}
+	}
+
+	if (opts->version == TESTSUITE_UNSUPPORTED_TSS_VERSION)
+		print_wrongVersion();
+
+	if (opts->iterations == 0 || opts->threads == 0) {
+		perf_usage(argv[0]);
+		exit(1);
+	}
+}
+
+/* nanoseconds from an arbitrary, monotonic origin */
+UINT64
+perf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((UINT64)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+int
+perf_samples_init(struct perf_samples *s, UINT32 size, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(s->name, sizeof(s->name), fmt, ap);
+	va_end(ap);
+
+	if (size == 0)
+		size = PERF_DEFAULT_ITERATIONS;
+
+	s->count = 0;
+	s->bytes = 0;
+	s->size = size;
+	if ((s->ns = malloc(size * sizeof(UINT64))) == NULL) {
+		fprintf(stderr, "malloc of %zu bytes failed.\n", size * sizeof(UINT64));
+		s->size = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+perf_samples_add(struct perf_samples *s, UINT64 ns)
+{
+	UINT64 *tmp;
+
+	if (s->count == s->size) {
+		if ((tmp = realloc(s->ns, 2 * s->size * sizeof(UINT64))) == NULL) {
+			fprintf(stderr, "realloc of %zu bytes failed.\n",
+				2 * s->size * sizeof(UINT64));
+			return -1;
+		}
+		s->ns = tmp;
+		s->size *= 2;
+	}
+
+	s->ns[s->count++] = ns;
+
+	return 0;
+}
+
+void
+perf_samples_reset(struct perf_samples *s)
+{
+	s->count = 0;
+}
+
+void
+perf_samples_free(struct perf_samples *s)
+{
+	free(s->ns);
+	s->ns = NULL;
+	s->count = s->size = 0;
+}
+
+static int
+perf_cmp(const void *a, const void *b)
+{
+	UINT64 x = *(const UINT64 *)a, y = *(const UINT64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* nearest-rank percentile, 'pct' in [0, 100]. Sorts the samples in place. */
+UINT64
+perf_samples_percentile(struct perf_samples *s, UINT32 pct)
+{
+	UINT32 rank;
+
+	if (s->count == 0)
+		return 0;
+
+	qsort(s->ns, s->count, sizeof(UINT64), perf_cmp);
+
+	rank = (UINT32)(((UINT64)pct * s->count + 99) / 100);
+	if (rank > 0)
+		rank--;
+	if (rank >= s->count)
+		rank = s->count - 1;
+
+	return s->ns[rank];
+}
+
+void
+perf_report(struct perf_samples *s, struct perf_opts *opts)
+{
+	UINT64 total = 0;
+	double mean;
+	UINT32 i;
+
+	if (s->count == 0) {
+		printf("PERF %s n=0\n", s->name);
+		return;
+	}
+
+	if (opts && opts->raw) {
+		for (i = 0; i < s->count; i++)
+			printf("SAMPLE %s %llu\n", s->name, (unsigned long long)s->ns[i]);
+	}
+
+	for (i = 0; i < s->count; i++)
+		total += s->ns[i];
+	mean = (double)total / s->count;
+
+	printf("PERF %s n=%u min_us=%.3f p50_us=%.3f p95_us=%.3f max_us=%.3f "
+	       "mean_us=%.3f ops_per_s=%.1f",
+	       s->name, s->count,
+	       perf_samples_percentile(s, 0) / 1000.0,
+	       perf_samples_percentile(s, 50) / 1000.0,
+	       perf_samples_percentile(s, 95) / 1000.0,
+	       perf_samples_percentile(s, 100) / 1000.0,
+	       mean / 1000.0,
+	       mean > 0 ? 1000000000.0 / mean : 0.0);
+
+	if (s->bytes)
+		printf(" mb_per_s=%.3f", mean > 0 ?
+		       (s->bytes * 1000000000.0 / mean) / (1024.0 * 1024.0) : 0.0);
+	printf("\n");
+	fflush(stdout);
+}
+
+void
+perf_metric(const char *name, const char *key, double value)
+{
+	printf("PERF %s %s=%.3f\n", name, key, value);
+	fflush(stdout);
+}
+
+static long
+perf_status_kb(const char *field)
+{
+	FILE *f;
+	char line[128];
+	size_t len = strlen(field);
+	long kb = -1;
+
+	if ((f = fopen("/proc/self/status", "r")) == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, field, len) && line[len] == ':') {
+			kb = strtol(&line[len + 1], NULL, 10);
+			break;
+		}
+	}
+	fclose(f);
+
+	return kb;
+}
+
+/* resident set size of this process in KiB, -1 if unknown */
+long
+perf_rss_kb(void)
+{
+	return perf_status_kb("VmRSS");
+}
+
+/* peak resident set size since start or the last perf_reset_peak_rss() */
+long
+perf_peak_rss_kb(void)
+{
+	return perf_status_kb("VmHWM");
+}
+
+/* reset the kernel's peak RSS counter so that one phase of a benchmark can
+ * be measured on its own. Silently does nothing on kernels older than 4.0 */
+void
+perf_reset_peak_rss(void)
+{
+	FILE *f;
+
+	if ((f = fopen("/proc/self/clear_refs", "w")) == NULL)
+		return;
+
+	fputs("5", f);
+	fclose(f);
+}
+
+/* a queue of up to size jobs of job_size bytes each. Jobs are copied in and
+ * out, so the caller's job structure can be on its stack */
+int
+perf_queue_init(struct perf_queue *q, UINT32 size, size_t job_size)
+{
+	memset(q, 0, sizeof(struct perf_queue));
+	if (size == 0)
+		size = 1;
+
+	if ((q->jobs = calloc(size, job_size)) == NULL) {
+		fprintf(stderr, "malloc of %zu bytes failed.\n", size * job_size);
+		return -1;
+	}
+	q->job_size = job_size;
+	q->size = size;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+
+	return 0;
+}
+
+/* queue a job, waiting for room. Returns the time spent waiting */
+UINT64
+perf_queue_put(struct perf_queue *q, void *job)
+{
+	UINT64 start = perf_now();
+
+	pthread_mutex_lock(&q->lock);
+	while (q->count == q->size)
+		pthread_cond_wait(&q->cond, &q->lock);
+	memcpy(q->jobs + ((q->head + q->count) % q->size) * q->job_size, job, q->job_size);
+	q->count++;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+
+	return perf_now() - start;
+}
+
+/* take the next job, waiting for one. Returns 0 once the queue is stopped
+ * and empty. Each job taken must be followed by perf_queue_done() */
+int
+perf_queue_get(struct perf_queue *q, void *job)
+{
+	pthread_mutex_lock(&q->lock);
+	while (q->count == 0 && !q->stop)
+		pthread_cond_wait(&q->cond, &q->lock);
+	if (q->count == 0) {
+		pthread_mutex_unlock(&q->lock);
+		return 0;
+	}
+	memcpy(job, q->jobs + q->head * q->job_size, q->job_size);
+	q->head = (q->head + 1) % q->size;
+	q->count--;
+	q->busy++;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+
+	return 1;
+}
+
+void
+perf_queue_done(struct perf_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->busy--;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* wait until every job queued so far is done */
+void
+perf_queue_drain(struct perf_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	while (q->count || q->busy)
+		pthread_cond_wait(&q->cond, &q->lock);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* wake the workers up to return once the queue is empty */
+void
+perf_queue_stop(struct perf_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->stop = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void
+perf_queue_free(struct perf_queue *q)
+{
+	if (q->jobs == NULL)
+		return;
+
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->lock);
+	free(q->jobs);
+	q->jobs = NULL;
+}
+
+/* Sign 'what' with hKey, loaded in hContext, and check the signature in
+ * software with v, the verifier of the public key hKey is expected to
+ * have. Only strlen(what) bytes are signed. Returns TSS_E_FAIL if the
+ * signature doesn't match. v can be used by one thread at a time. */
+TSS_RESULT
+perf_sign_verify(TSS_HCONTEXT hContext, TSS_HKEY hKey, struct testsuite_verifier *v,
+		 const char *what)
+{
+	TSS_VALIDATION valData;
+	TSS_HHASH hHash;
+	TSS_RESULT result;
+
+	memset(&valData, 0, sizeof(valData));
+	valData.rgbData = (BYTE *)what;
+	valData.ulDataLength = strlen(what);
+
+	/* a DER key signs what it is given, a SHA1 key the SHA1 of it */
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_HASH,
+					   v->sigScheme == TCPA_SS_RSASSAPKCS1v15_DER ?
+					   TSS_HASH_OTHER : TSS_HASH_SHA1, &hHash);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	if (v->sigScheme == TCPA_SS_RSASSAPKCS1v15_DER) {
+		result = Tspi_Hash_SetHashValue(hHash, valData.ulDataLength, valData.rgbData);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Hash_SetHashValue", result);
+			goto done;
+		}
+	} else {
+		result = Tspi_Hash_UpdateHashValue(hHash, valData.ulDataLength, valData.rgbData);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Hash_UpdateHashValue", result);
+			goto done;
+		}
+	}
+
+	result = Tspi_Hash_Sign(hHash, hKey, &valData.ulValidationDataLength,
+				&valData.rgbValidationData);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Hash_Sign", result);
+		goto done;
+	}
+
+	if ((result = TestSuite_Verifier_Verify(v, &valData)))
+		fprintf(stderr, "The signature of \"%s\" doesn't match\n", what);
+	Tspi_Context_FreeMemory(hContext, valData.rgbValidationData);
+done:
+	Tspi_Context_CloseObject(hContext, hHash);
+
+	return result;
+}
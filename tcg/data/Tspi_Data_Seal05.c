@@ -0,0 +1,296 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2004, 2005, 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	Tspi_Data_Seal05.c
+ *
+ * DESCRIPTION
+ *	This test will verify the PCR info Tspi_Data_Seal puts in a sealed
+ *	blob. With a TSS_PCRS_STRUCT_INFO composite, the TPM_STORED_DATA
+ *	must carry the TPM_PCR_INFO built by TestSuite_Blob_Put_PCR_INFO
+ *	from the release values and the values of the same PCRs at
+ *	creation. On 1.2, a TSS_PCRS_STRUCT_INFO_LONG composite with
+ *	different creation and release selections and a release locality
+ *	must give the TPM_PCR_INFO_LONG of TestSuite_Blob_Put_PCR_INFO_LONG,
+ *	created at locality zero.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK, get the TPM object
+ *		Get the number of PCRs
+ *
+ *	Test:
+ *		For each structure type the version supports:
+ *		Create a PCR composite, set the release values, and on 1.2
+ *		the creation selection and release locality
+ *		Read the PCRs the TPM digests at creation
+ *		Seal data and get the sealed blob
+ *		Compare its PCR info with the one built in software
+ *
+ *	Cleanup:
+ *		Free memory related to hContext
+ *		Close context
+ *		Print error/success message
+ *
+ * USAGE
+ *      First parameter is --options
+ *                         -v or --version
+ *      Second parameter is the version of the test case to be run
+ *      This test case is currently implemented for v1.1 and v1.2
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	None.
+ */
+
+#include <stdio.h>
+#include "common.h"
+
+
+char *function = "Tspi_Data_Seal05";
+
+#define NUM_RELEASE	2
+#define NUM_CREATION	2
+
+UINT32 release_pcrs[NUM_RELEASE] = { 8, 10 };
+UINT32 creation_pcrs[NUM_CREATION] = { 9, 11 };
+
+#define RELEASE_LOCALITY	(TPM_LOC_ZERO | TPM_LOC_THREE)
+
+int
+main( int argc, char **argv )
+{
+	char		version;
+
+	version = parseArgs( argc, argv );
+	if (version == TESTSUITE_TEST_TSS_1_2 || version == TESTSUITE_TEST_TSS_1_1)
+		main_v1_2(version);
+	else
+		print_wrongVersion();
+}
+
+/* select pcr in model with the value it has in the TPM now */
+TSS_RESULT
+read_pcr(TSS_HCONTEXT hContext, TSS_HTPM hTPM, struct testsuite_pcr_composite *model,
+	 UINT32 pcr)
+{
+	UINT32		valueLen;
+	BYTE		*value;
+	TSS_RESULT	result;
+
+	result = Tspi_TPM_PcrRead( hTPM, pcr, &valueLen, &value );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_TPM_PcrRead", result );
+		return result;
+	}
+
+	result = TestSuite_Pcr_Composite_Set_Value( model, pcr, value );
+	Tspi_Context_FreeMemory( hContext, value );
+
+	return result;
+}
+
+/* Get the PCR info of a sealed blob: after the version of a TPM_STORED_DATA,
+ * or the tag and entity type of a TPM_STORED_DATA12 */
+TSS_RESULT
+get_seal_info(TSS_HCONTEXT hContext, TSS_HENCDATA hEncData, BYTE *out, UINT32 *outLen)
+{
+	struct testsuite_blob b;
+	UINT32		blobLen, sealInfoSize;
+	BYTE		*blob, *sealInfo;
+	TSS_RESULT	result;
+
+	result = Tspi_GetAttribData( hEncData, TSS_TSPATTRIB_ENCDATA_BLOB,
+				     TSS_TSPATTRIB_ENCDATABLOB_BLOB, &blobLen, &blob );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_GetAttribData", result );
+		return result;
+	}
+
+	TestSuite_Blob_Init( &b, blob, blobLen );
+	b.offset = 4;
+	TestSuite_Blob_Get_UINT32( &b, &sealInfoSize );
+	TestSuite_Blob_Get_View( &b, &sealInfo, sealInfoSize );
+	if ((result = b.result) == TSS_SUCCESS) {
+		if (sealInfoSize > *outLen) {
+			result = TSS_E_FAIL;
+		} else {
+			memcpy(out, sealInfo, sealInfoSize);
+			*outLen = sealInfoSize;
+		}
+	}
+	if ( result != TSS_SUCCESS )
+		fprintf( stderr, "Sealed blob of %u bytes has no PCR info\n", blobLen );
+
+	Tspi_Context_FreeMemory( hContext, blob );
+
+	return result;
+}
+
+TSS_RESULT
+check_seal(TSS_HCONTEXT hContext, TSS_HKEY hSRK, TSS_HTPM hTPM, UINT32 numPcrs,
+	   TSS_FLAG type)
+{
+	struct testsuite_pcr_composite	release, creation;
+	struct testsuite_blob		b;
+	BYTE		value[TPM_SHA1_160_HASH_LEN], digestAtCreation[TPM_SHA1_160_HASH_LEN];
+	BYTE		expected[256], actual[256];
+	BYTE		*rgbDataToSeal = "This is a test.  1 2 3.";
+	UINT32		i, actualLen = sizeof(actual);
+	TSS_HENCDATA	hEncData;
+	TSS_HPCRS	hPcrs = 0;
+	TSS_RESULT	result;
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_ENCDATA,
+					    TSS_ENCDATA_SEAL, &hEncData );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hEncData)", result );
+		return result;
+	}
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_PCRS, type, &hPcrs );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hPcrComposite)", result );
+		goto done;
+	}
+
+	TestSuite_Pcr_Composite_Init( &release, numPcrs );
+	TestSuite_Pcr_Composite_Init( &creation, numPcrs );
+
+	for (i = 0; i < NUM_RELEASE; i++) {
+		memset(value, 0x5a + i, sizeof(value));
+		result = Tspi_PcrComposite_SetPcrValue( hPcrs, release_pcrs[i], sizeof(value),
+							value );
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_PcrComposite_SetPcrValue", result );
+			goto done;
+		}
+		TestSuite_Pcr_Composite_Set_Value( &release, release_pcrs[i], value );
+	}
+
+	if (type == TSS_PCRS_STRUCT_INFO_LONG) {
+		for (i = 0; i < NUM_CREATION; i++) {
+			result = Tspi_PcrComposite_SelectPcrIndexEx( hPcrs, creation_pcrs[i],
+								     TSS_PCRS_DIRECTION_CREATION );
+			if ( result != TSS_SUCCESS )
+			{
+				print_error( "Tspi_PcrComposite_SelectPcrIndexEx", result );
+				goto done;
+			}
+			if ((result = read_pcr( hContext, hTPM, &creation, creation_pcrs[i] )))
+				goto done;
+		}
+
+		result = Tspi_PcrComposite_SetPcrLocality( hPcrs, RELEASE_LOCALITY );
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_PcrComposite_SetPcrLocality", result );
+			goto done;
+		}
+	} else {
+		/* a TPM_PCR_INFO digests the release selection at creation */
+		for (i = 0; i < NUM_RELEASE; i++) {
+			if ((result = read_pcr( hContext, hTPM, &creation, release_pcrs[i] )))
+				goto done;
+		}
+	}
+
+	result = Tspi_Data_Seal( hEncData, hSRK, strlen(rgbDataToSeal), rgbDataToSeal, hPcrs );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Data_Seal", result );
+		goto done;
+	}
+
+	if ((result = get_seal_info( hContext, hEncData, actual, &actualLen )))
+		goto done;
+
+	TestSuite_Blob_Init( &b, expected, sizeof(expected) );
+	if (type == TSS_PCRS_STRUCT_INFO_LONG) {
+		TestSuite_Blob_Put_PCR_INFO_LONG( &b, &creation, &release, TPM_LOC_ZERO,
+						  RELEASE_LOCALITY );
+	} else {
+		if ((result = TestSuite_Pcr_Composite_Hash( &creation, digestAtCreation )))
+			goto done;
+		TestSuite_Blob_Put_PCR_INFO( &b, &release, digestAtCreation );
+	}
+	if ((result = b.result))
+		goto done;
+
+	if (actualLen != b.offset || memcmp(actual, expected, actualLen)) {
+		fprintf( stderr, "%s of the sealed blob doesn't match\nActual (%u bytes):\n",
+			 type == TSS_PCRS_STRUCT_INFO_LONG ? "TPM_PCR_INFO_LONG" : "TPM_PCR_INFO",
+			 actualLen );
+		print_hex( actual, actualLen );
+		fprintf( stderr, "Expected (%u bytes):\n", b.offset );
+		print_hex( expected, b.offset );
+		result = TSS_E_FAIL;
+	}
+
+done:
+	if (hPcrs)
+		Tspi_Context_CloseObject( hContext, hPcrs );
+	Tspi_Context_CloseObject( hContext, hEncData );
+
+	return result;
+}
+
+int
+main_v1_2( char version )
+{
+	TSS_HCONTEXT	hContext;
+	TSS_HKEY	hSRK;
+	TSS_HTPM	hTPM;
+	UINT32		numPcrs;
+	TSS_RESULT	result;
+
+	print_begin_test( function );
+
+	result = connect_load_all( &hContext, &hSRK, &hTPM );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "connect_load_all", result );
+		print_error_exit( function, err_string(result) );
+		exit( result );
+	}
+
+	if ((result = TestSuite_Get_Num_PCRs( hContext, hTPM, &numPcrs )))
+		goto cleanup;
+
+	result = check_seal( hContext, hSRK, hTPM, numPcrs, TSS_PCRS_STRUCT_INFO );
+	if ( result == TSS_SUCCESS && version == TESTSUITE_TEST_TSS_1_2 )
+		result = check_seal( hContext, hSRK, hTPM, numPcrs, TSS_PCRS_STRUCT_INFO_LONG );
+
+cleanup:
+	if ( result != TSS_SUCCESS )
+		print_error( function, result );
+	else
+		print_success( function, result );
+	print_end_test( function );
+	Tspi_Context_FreeMemory( hContext, NULL );
+	Tspi_Context_Close( hContext );
+	exit( result );
+}
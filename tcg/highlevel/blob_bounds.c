@@ -0,0 +1,305 @@
+/*
+ * blob bounds test
+ *
+ * Marshal a TCPA_KEY, a TCPA_PUBKEY and a TCPA_SYMMETRIC_KEY with the
+ * TestSuite_Blob_Put_* functions, then parse every truncation of them with
+ * TestSuite_Blob_Get_*, both pointing into the blob and copying out of it.
+ * Each truncated blob is copied into a buffer of exactly its size, so an
+ * over-read shows up under valgrind or -fsanitize=address. Every parse of
+ * a truncated blob must fail with the cursor still inside the buffer and
+ * no fields left set, and the whole blob must parse back to what was
+ * marshalled. Length fields claiming more bytes than the blob holds,
+ * up to 0xffffffff, must fail the same way.
+ *
+ * (C) IBM Corp. 2007
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#define ERR(x, ...)	fprintf(stderr, x "\n", ##__VA_ARGS__)
+
+#define TEST_KEY_SIZE	256
+#define TEST_ENC_SIZE	256
+
+BYTE test_modulus[TEST_KEY_SIZE];
+BYTE test_enc_data[TEST_ENC_SIZE];
+BYTE test_pcr_info[] = { 0x00, 0x03, 0x81, 0x00, 0x00 };
+BYTE test_sym_key[] = "0123456789abcdef";
+
+/* marshal an RSA storage key with a PCR_INFO */
+UINT32
+build_key(BYTE *buf, UINT32 size)
+{
+	struct testsuite_blob blob;
+	BYTE parms[12];
+	TCPA_RSA_KEY_PARMS rsa;
+	TCPA_KEY key;
+
+	memset(&rsa, 0, sizeof(rsa));
+	rsa.keyLength = TEST_KEY_SIZE * 8;
+	rsa.numPrimes = 2;
+	TestSuite_Blob_Init(&blob, parms, sizeof(parms));
+	TestSuite_Blob_Put_RSA_KEY_PARMS(&blob, &rsa);
+
+	memset(&key, 0, sizeof(key));
+	key.ver.major = 1;
+	key.ver.minor = 1;
+	key.keyUsage = TPM_KEY_STORAGE;
+	key.authDataUsage = TPM_AUTH_ALWAYS;
+	key.algorithmParms.algorithmID = TCPA_ALG_RSA;
+	key.algorithmParms.encScheme = TCPA_ES_RSAESOAEP_SHA1_MGF1;
+	key.algorithmParms.sigScheme = TCPA_SS_NONE;
+	key.algorithmParms.parmSize = blob.offset;
+	key.algorithmParms.parms = parms;
+	key.PCRInfoSize = sizeof(test_pcr_info);
+	key.PCRInfo = test_pcr_info;
+	key.pubKey.keyLength = TEST_KEY_SIZE;
+	key.pubKey.key = test_modulus;
+	key.encSize = TEST_ENC_SIZE;
+	key.encData = test_enc_data;
+
+	TestSuite_Blob_Init(&blob, buf, size);
+	TestSuite_Blob_Put_KEY(&blob, &key);
+
+	return blob.result ? 0 : blob.offset;
+}
+
+/* the key's public part, as the tail of the blob from build_key() */
+UINT32
+build_pubkey(BYTE *buf, UINT32 size)
+{
+	struct testsuite_blob blob;
+	TCPA_KEY key;
+	TCPA_PUBKEY pub;
+	BYTE tmp[1024];
+	UINT32 len;
+
+	if ((len = build_key(tmp, sizeof(tmp))) == 0)
+		return 0;
+	TestSuite_Blob_Init(&blob, tmp, len);
+	if (TestSuite_Blob_Get_KEY(&blob, &key))
+		return 0;
+
+	pub.algorithmParms = key.algorithmParms;
+	pub.pubKey = key.pubKey;
+	TestSuite_Blob_Init(&blob, buf, size);
+	TestSuite_Blob_Put_PUBKEY(&blob, &pub);
+
+	return blob.result ? 0 : blob.offset;
+}
+
+UINT32
+build_sym_key(BYTE *buf, UINT32 size)
+{
+	struct testsuite_blob blob;
+	TCPA_SYMMETRIC_KEY key;
+
+	key.algId = TCPA_ALG_AES;
+	key.encScheme = TCPA_ES_NONE;
+	key.size = sizeof(test_sym_key) - 1;
+	key.data = test_sym_key;
+
+	TestSuite_Blob_Init(&blob, buf, size);
+	TestSuite_Blob_Put_SYMMETRIC_KEY(&blob, &key);
+
+	return blob.result ? 0 : blob.offset;
+}
+
+/* parse one blob of size bytes as type. Returns the result, sets *fields if
+ * any pointer was left set, and frees what a copying parse allocated */
+TSS_RESULT
+parse(int type, BYTE *buf, UINT32 size, int copy, UINT32 *offset, int *fields)
+{
+	struct testsuite_blob blob;
+	TCPA_KEY key;
+	TCPA_PUBKEY pub;
+	TCPA_SYMMETRIC_KEY sym;
+	TSS_RESULT result;
+
+	TestSuite_Blob_Init(&blob, buf, size);
+	blob.copy = copy;
+	*fields = 0;
+
+	switch (type) {
+	case 0:
+		result = TestSuite_Blob_Get_KEY(&blob, &key);
+		*fields = key.algorithmParms.parms || key.PCRInfo || key.pubKey.key ||
+			  key.encData;
+		if (!result && copy) {
+			free(key.algorithmParms.parms);
+			free(key.PCRInfo);
+			free(key.pubKey.key);
+			free(key.encData);
+		}
+		break;
+	case 1:
+		result = TestSuite_Blob_Get_PUBKEY(&blob, &pub);
+		*fields = pub.algorithmParms.parms || pub.pubKey.key;
+		if (!result && copy) {
+			free(pub.algorithmParms.parms);
+			free(pub.pubKey.key);
+		}
+		break;
+	default:
+		sym.data = NULL;
+		result = TestSuite_Blob_Get_SYMMETRIC_KEY(&blob, &sym);
+		*fields = sym.size != 0;
+		if (!result && copy)
+			free(sym.data);
+		break;
+	}
+
+	*offset = blob.offset;
+
+	return result;
+}
+
+const char *type_names[] = { "TCPA_KEY", "TCPA_PUBKEY", "TCPA_SYMMETRIC_KEY" };
+#define NUM_TYPES 3
+
+/* every truncation of a blob of size bytes must fail inside the buffer */
+int
+truncation_test(int type, BYTE *full, UINT32 size)
+{
+	UINT32 n, offset;
+	TSS_RESULT result;
+	int copy, fields;
+	BYTE *buf;
+
+	for (n = 0; n < size; n++) {
+		/* at least one byte, so that the copy isn't a zero sized malloc */
+		if ((buf = malloc(n ? n : 1)) == NULL) {
+			ERR("malloc of %u bytes failed", n);
+			return 1;
+		}
+		memcpy(buf, full, n);
+
+		for (copy = 0; copy < 2; copy++) {
+			result = parse(type, buf, n, copy, &offset, &fields);
+			if (result == TSS_SUCCESS || offset > n || fields) {
+				ERR("%s truncated to %u of %u bytes (copy=%d): result 0x%x, "
+				    "offset %u, fields %s", type_names[type], n, size, copy,
+				    result, offset, fields ? "set" : "clear");
+				free(buf);
+				return 1;
+			}
+		}
+		free(buf);
+	}
+
+	for (copy = 0; copy < 2; copy++) {
+		result = parse(type, full, size, copy, &offset, &fields);
+		if (result != TSS_SUCCESS || offset != size) {
+			ERR("%s of %u bytes (copy=%d): result 0x%x, offset %u",
+			    type_names[type], size, copy, result, offset);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* the length fields of a TCPA_KEY, as offsets into the blob of build_key() */
+UINT32
+length_offsets(BYTE *buf, UINT32 size, UINT32 *offsets)
+{
+	struct testsuite_blob blob;
+	TCPA_KEY key;
+	UINT32 n = 0;
+
+	TestSuite_Blob_Init(&blob, buf, size);
+	TestSuite_Blob_Get_KEY(&blob, &key);
+
+	/* version 4, usage 2, flags 4, auth 1, algorithm 4, schemes 2 + 2 */
+	offsets[n++] = 19;
+	offsets[n++] = 23 + key.algorithmParms.parmSize;
+	offsets[n++] = offsets[1] + 4 + key.PCRInfoSize;
+	offsets[n++] = offsets[2] + 4 + key.pubKey.keyLength;
+
+	return n;
+}
+
+/* a length one past the end of the blob, and the largest one */
+int
+length_test(BYTE *full, UINT32 size)
+{
+	UINT32 offsets[4], lengths[2], n, i, j, offset;
+	TSS_RESULT result;
+	int copy, fields;
+	BYTE *buf;
+
+	if ((buf = malloc(size)) == NULL) {
+		ERR("malloc of %u bytes failed", size);
+		return 1;
+	}
+
+	n = length_offsets(full, size, offsets);
+	for (i = 0; i < n; i++) {
+		lengths[0] = size - offsets[i] - 4 + 1;
+		lengths[1] = 0xffffffff;
+
+		for (j = 0; j < 2; j++) {
+			memcpy(buf, full, size);
+			UINT32ToArray(lengths[j], &buf[offsets[i]]);
+
+			for (copy = 0; copy < 2; copy++) {
+				result = parse(0, buf, size, copy, &offset, &fields);
+				if (result == TSS_SUCCESS || offset > size || fields) {
+					ERR("TCPA_KEY with length 0x%x at offset %u (copy=%d): "
+					    "result 0x%x, offset %u, fields %s", lengths[j],
+					    offsets[i], copy, result, offset,
+					    fields ? "set" : "clear");
+					free(buf);
+					return 1;
+				}
+			}
+		}
+	}
+
+	free(buf);
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	BYTE buf[1024];
+	UINT32 size, i;
+	int rc = 0;
+
+	for (i = 0; i < TEST_KEY_SIZE; i++)
+		test_modulus[i] = (BYTE)(0xff - i);
+	for (i = 0; i < TEST_ENC_SIZE; i++)
+		test_enc_data[i] = (BYTE)i;
+
+	for (i = 0; i < NUM_TYPES; i++) {
+		if (i == 0)
+			size = build_key(buf, sizeof(buf));
+		else if (i == 1)
+			size = build_pubkey(buf, sizeof(buf));
+		else
+			size = build_sym_key(buf, sizeof(buf));
+
+		if (size == 0) {
+			ERR("marshalling %s failed", type_names[i]);
+			return 1;
+		}
+		if ((rc = truncation_test(i, buf, size)))
+			break;
+		printf("%s truncation test (%u bytes): Success\n", type_names[i], size);
+	}
+
+	if (!rc) {
+		size = build_key(buf, sizeof(buf));
+		if (!(rc = length_test(buf, size)))
+			printf("TCPA_KEY length test: Success\n");
+	}
+
+	return rc;
+}
@@ -0,0 +1,250 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	Tspi_Context_LoadKeyByUUID09.c
+ *
+ * DESCRIPTION
+ *	This test registers a chain of DEPTH storage keys in system PS, the
+ *	middle of which requires auth, with NUM_LEAVES binding keys under
+ *	the last, and loads the leaves through TestSuite_Key_Cache_Load.
+ *	The first leaf must load the whole chain and pin it, the others
+ *	must find their parent pinned and load nothing else, and every leaf
+ *	must bind and unbind.
+ *
+ *	SRK
+ *	 \
+ *	  key 1 (no auth)
+ *	   \
+ *	    key 2 (auth)
+ *	     \
+ *	      key 3 (no auth)
+ *	     /  \
+ *	 leaf 1  leaf 2 (no auth)
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK
+ *		Create and register the storage keys and the leaves
+ *		Create a policy with the key secret
+ *
+ *	Test:
+ *		Load each leaf through the key cache, then bind and unbind
+ *		data with it
+ *		Check the ancestors loaded and found pinned
+ *
+ *	Cleanup:
+ *		Free the key cache
+ *		Unregister the keys
+ *		Free memory associated with the context
+ *		Close the context
+ *		Print error/success message
+ *
+ * USAGE
+ *      First parameter is --options
+ *                         -v or --version
+ *      Second parameter is the version of the test case to be run
+ *      This test case is currently only implemented for v1.2
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	None.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+
+#define DEPTH		3
+#define NUM_LEAVES	2
+
+char *function = "Tspi_Context_LoadKeyByUUID09";
+
+int
+main( int argc, char **argv )
+{
+	char version;
+
+	version = parseArgs( argc, argv );
+	if (version == TESTSUITE_TEST_TSS_1_2)
+		main_v1_2(version);
+	else if (version == TESTSUITE_TEST_TSS_1_1)
+		print_NA();
+	else
+		print_wrongVersion();
+}
+
+/* storage key d is { d, 0, ... }, leaf l { DEPTH, l, ... } */
+TSS_UUID
+test_uuid(UINT32 d, UINT32 leaf)
+{
+	TSS_UUID uuid = { 0, 0, 0, 0, 0, { 0x4c, 0x4b, 0x55, 0x09, 0, 0 } };
+
+	uuid.ulTimeLow = d;
+	uuid.usTimeMid = leaf;
+
+	return uuid;
+}
+
+void
+unregister_keys(TSS_HCONTEXT hContext)
+{
+	TSS_HKEY	hKey;
+	UINT32		i;
+
+	for (i = NUM_LEAVES; i > 0; i--) {
+		if (Tspi_Context_UnregisterKey(hContext, TSS_PS_TYPE_SYSTEM, test_uuid(DEPTH, i),
+					       &hKey) == TSS_SUCCESS)
+			Tspi_Context_CloseObject(hContext, hKey);
+	}
+	for (i = DEPTH; i > 0; i--) {
+		if (Tspi_Context_UnregisterKey(hContext, TSS_PS_TYPE_SYSTEM, test_uuid(i, 0),
+					       &hKey) == TSS_SUCCESS)
+			Tspi_Context_CloseObject(hContext, hKey);
+	}
+}
+
+TSS_RESULT
+create_register(TSS_HCONTEXT hContext, TSS_FLAG initFlags, TSS_HKEY hParent,
+		TSS_UUID uuid, TSS_UUID parentUuid, TSS_HKEY *hKey)
+{
+	TSS_RESULT	result;
+
+	if (initFlags & TSS_KEY_TYPE_STORAGE)
+		result = create_load_key(hContext, initFlags, hParent, hKey);
+	else
+		result = create_key(hContext, initFlags, hParent, hKey);
+	if (result != TSS_SUCCESS)
+		return result;
+
+	result = Tspi_Context_RegisterKey( hContext, *hKey, TSS_PS_TYPE_SYSTEM, uuid,
+					   TSS_PS_TYPE_SYSTEM, parentUuid );
+	if ( result != TSS_SUCCESS )
+		print_error( "Tspi_Context_RegisterKey", result );
+
+	return result;
+}
+
+int
+main_v1_2( char version )
+{
+	struct testsuite_key_cache cache;
+	TSS_FLAG	storageFlags = TSS_KEY_TYPE_STORAGE | TSS_KEY_SIZE_2048;
+	TSS_FLAG	leafFlags = TSS_KEY_TYPE_BIND | TSS_KEY_SIZE_2048 |
+				    TSS_KEY_NO_AUTHORIZATION;
+	TSS_HCONTEXT	hContext;
+	TSS_HKEY	hSRK, hKeys[DEPTH + 1], hLeaf;
+	TSS_HPOLICY	hPolicy;
+	TSS_RESULT	result;
+	UINT32		i;
+
+	print_begin_test( function );
+
+	result = connect_load_srk(&hContext, &hSRK);
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "connect_load_srk", result );
+		print_error_exit( function, err_string(result) );
+		exit( result );
+	}
+
+	unregister_keys(hContext);
+
+	hKeys[0] = hSRK;
+	for (i = 1; i <= DEPTH; i++) {
+		result = create_register(hContext, storageFlags | (i == 2 ? TSS_KEY_AUTHORIZATION :
+								  TSS_KEY_NO_AUTHORIZATION),
+					 hKeys[i - 1], test_uuid(i, 0),
+					 i == 1 ? SRK_UUID : test_uuid(i - 1, 0), &hKeys[i]);
+		if ( result != TSS_SUCCESS )
+			goto cleanup;
+	}
+	for (i = 1; i <= NUM_LEAVES; i++) {
+		result = create_register(hContext, leafFlags, hKeys[DEPTH], test_uuid(DEPTH, i),
+					 test_uuid(DEPTH, 0), &hLeaf);
+		Tspi_Context_CloseObject(hContext, hLeaf);
+		if ( result != TSS_SUCCESS )
+			goto cleanup;
+	}
+	/* the cache must load the chain itself */
+	for (i = DEPTH; i > 0; i--) {
+		Tspi_Key_UnloadKey(hKeys[i]);
+		Tspi_Context_CloseObject(hContext, hKeys[i]);
+	}
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_POLICY, TSS_POLICY_USAGE,
+					    &hPolicy );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject", result );
+		goto cleanup;
+	}
+	result = Tspi_Policy_SetSecret( hPolicy, TESTSUITE_KEY_SECRET_MODE,
+					TESTSUITE_KEY_SECRET_LEN, TESTSUITE_KEY_SECRET );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Policy_SetSecret", result );
+		goto cleanup;
+	}
+
+	TestSuite_Key_Cache_Init(&cache, hContext, hSRK, hPolicy);
+
+	for (i = 1; i <= NUM_LEAVES; i++) {
+		result = TestSuite_Key_Cache_Load(&cache, TSS_PS_TYPE_SYSTEM, test_uuid(DEPTH, i),
+						  &hLeaf);
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "TestSuite_Key_Cache_Load", result );
+			goto free;
+		}
+
+		result = bind_and_unbind(hContext, hLeaf);
+		Tspi_Key_UnloadKey(hLeaf);
+		Tspi_Context_CloseObject(hContext, hLeaf);
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "bind_and_unbind", result );
+			goto free;
+		}
+	}
+
+	if (cache.misses != DEPTH || cache.hits != NUM_LEAVES - 1) {
+		fprintf(stderr, "%u ancestors loaded and %u found pinned, expected %u and %u\n",
+			cache.misses, cache.hits, DEPTH, NUM_LEAVES - 1);
+		result = TSS_E_FAIL;
+	}
+
+free:
+	TestSuite_Key_Cache_Free(&cache);
+cleanup:
+	unregister_keys(hContext);
+
+	if ( result != TSS_SUCCESS )
+		print_error( function, result );
+	else
+		print_success( function, result );
+	print_end_test( function );
+	Tspi_Context_FreeMemory( hContext, NULL );
+	Tspi_Context_Close( hContext );
+	exit( result );
+}
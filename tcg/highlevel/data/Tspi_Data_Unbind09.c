@@ -0,0 +1,297 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2004, 2005
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+/*
+ * NAME
+ *	Tspi_Data_Unbind09.c
+ *
+ * DESCRIPTION
+ *	This test verifies envelope encryption of payloads larger than a
+ *	bind key can take: TestSuite_Envelope_Write binds a random data key
+ *	and encrypts the payload with it a chunk at a time, and
+ *	TestSuite_Envelope_Read must unbind the key and give back the
+ *	payload, for payloads of no bytes, around the chunk size and of many
+ *	chunks. A wrapped data key with a byte changed must not unbind.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK
+ *		Create and load a binding key
+ *
+ *	Test:
+ *		For each payload size, write the payload to a temporary file,
+ *		encrypt it into an envelope, decrypt the envelope and compare
+ *		Change a byte of a wrapped data key and unwrap it
+ *
+ *	Cleanup:
+ *		Free memory related to hContext
+ *		Close context
+ *		Print error/success message
+ *
+ * USAGE
+ *      First parameter is --options
+ *                         -v or --version
+ *      Second parameter is the version of the test case to be run
+ *      This test case is currently implemented for v1.1 and v1.2
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	The payloads and envelopes are written to temporary files, about
+ *	2MB at most.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+
+char *function = "Tspi_Data_Unbind09";
+
+UINT32 payload_sizes[] = {
+	0,
+	1,
+	TESTSUITE_ENVELOPE_CHUNK - 1,
+	TESTSUITE_ENVELOPE_CHUNK,
+	TESTSUITE_ENVELOPE_CHUNK + 1,
+	16 * TESTSUITE_ENVELOPE_CHUNK + 17,
+};
+
+int
+main( int argc, char **argv )
+{
+	char version;
+
+	version = parseArgs( argc, argv );
+	if (version)
+		main_v1_1();
+	else
+		print_wrongVersion();
+}
+
+/* a payload which differs from chunk to chunk */
+FILE *
+make_payload(UINT32 size)
+{
+	FILE *f;
+	UINT32 i;
+
+	if ((f = tmpfile()) == NULL)
+		return NULL;
+
+	for (i = 0; i < size; i++)
+		fputc((i * 7 + i / TESTSUITE_ENVELOPE_CHUNK) & 0xff, f);
+
+	rewind(f);
+
+	return f;
+}
+
+/* compare the rest of two files */
+int
+same_file(FILE *a, FILE *b)
+{
+	int c;
+
+	rewind(a);
+	rewind(b);
+	do {
+		if ((c = fgetc(a)) != fgetc(b))
+			return 0;
+	} while (c != EOF);
+
+	return 1;
+}
+
+TSS_RESULT
+round_trip(TSS_HCONTEXT hContext, TSS_HKEY hKey, UINT32 size)
+{
+	struct testsuite_envelope sealed, opened;
+	TSS_HENCDATA	hEncData;
+	TSS_RESULT	result;
+	FILE		*payload, *envelope = NULL, *decrypted = NULL;
+	long		envelopeSize, expected;
+	UINT32		left, chunk;
+
+	memset(&opened, 0, sizeof(opened));
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_ENCDATA,
+					    TSS_ENCDATA_BIND, &hEncData );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hEncData)", result );
+		return result;
+	}
+
+	if ((payload = make_payload(size)) == NULL ||
+	    (envelope = tmpfile()) == NULL ||
+	    (decrypted = tmpfile()) == NULL)
+	{
+		fprintf( stderr, "tmpfile failed\n" );
+		result = TSS_E_INTERNAL_ERROR;
+		goto done;
+	}
+
+	result = TestSuite_Envelope_Wrap( &sealed, hContext, hKey, hEncData, TSS_ENCDATA_BIND,
+					  0 );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_Envelope_Wrap", result );
+		goto done;
+	}
+
+	result = TestSuite_Envelope_Write( &sealed, payload, envelope );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_Envelope_Write", result );
+		goto free;
+	}
+
+	/* the header and end marker, and each chunk with its size, IV and
+	 * padding up to the next block */
+	envelopeSize = ftell(envelope);
+	expected = 3 * sizeof(UINT32) + sealed.wrappedSize;
+	for (left = size; left > 0; left -= chunk) {
+		chunk = left < TESTSUITE_ENVELOPE_CHUNK ? left : TESTSUITE_ENVELOPE_CHUNK;
+		expected += sizeof(UINT32) + 16 + (chunk / 16 + 1) * 16;
+	}
+	if (envelopeSize != expected)
+	{
+		fprintf( stderr, "%u byte payload: envelope of %ld bytes, expected %ld\n",
+			 size, envelopeSize, expected );
+		result = TSS_E_FAIL;
+		goto free;
+	}
+
+	rewind(envelope);
+	result = TestSuite_Envelope_Read( &opened, hContext, hKey, hEncData, envelope,
+					  decrypted );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_Envelope_Read", result );
+		goto free;
+	}
+
+	if (memcmp(opened.key, sealed.key, TESTSUITE_ENVELOPE_KEY_SIZE) ||
+	    ftell(decrypted) != (long)size || !same_file(payload, decrypted))
+	{
+		fprintf( stderr, "%u byte payload: decrypted payload doesn't match\n", size );
+		result = TSS_E_FAIL;
+	}
+
+free:
+	TestSuite_Envelope_Free( &opened );
+	TestSuite_Envelope_Free( &sealed );
+done:
+	if (decrypted)
+		fclose(decrypted);
+	if (envelope)
+		fclose(envelope);
+	if (payload)
+		fclose(payload);
+	Tspi_Context_CloseObject( hContext, hEncData );
+
+	return result;
+}
+
+/* a wrapped data key with a byte changed must fail OAEP decoding */
+TSS_RESULT
+tampered_key(TSS_HCONTEXT hContext, TSS_HKEY hKey)
+{
+	struct testsuite_envelope e;
+	TSS_HENCDATA	hEncData;
+	TSS_RESULT	result;
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_ENCDATA,
+					    TSS_ENCDATA_BIND, &hEncData );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hEncData)", result );
+		return result;
+	}
+
+	result = TestSuite_Envelope_Wrap( &e, hContext, hKey, hEncData, TSS_ENCDATA_BIND, 0 );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_Envelope_Wrap", result );
+		goto done;
+	}
+
+	e.wrapped[e.wrappedSize / 2] ^= 0x01;
+	result = TestSuite_Envelope_Unwrap( &e, hContext, hKey, hEncData );
+	if ( result == TSS_SUCCESS )
+	{
+		fprintf( stderr, "A changed wrapped data key was unwrapped\n" );
+		result = TSS_E_FAIL;
+	}
+	else
+		result = TSS_SUCCESS;
+
+	TestSuite_Envelope_Free( &e );
+done:
+	Tspi_Context_CloseObject( hContext, hEncData );
+
+	return result;
+}
+
+int
+main_v1_1( void )
+{
+	TSS_HCONTEXT	hContext;
+	TSS_HKEY	hSRK, hKey;
+	TSS_RESULT	result;
+	UINT32		i;
+
+	print_begin_test( function );
+
+	result = connect_load_srk( &hContext, &hSRK );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "connect_load_srk", result );
+		print_error_exit( function, err_string(result) );
+		exit( result );
+	}
+
+	result = create_load_key( hContext, TSS_KEY_TYPE_BIND | TSS_KEY_SIZE_2048 |
+				  TSS_KEY_NO_AUTHORIZATION, hSRK, &hKey );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "create_load_key", result );
+		goto cleanup;
+	}
+
+	for (i = 0; i < sizeof(payload_sizes) / sizeof(UINT32); i++) {
+		if ((result = round_trip( hContext, hKey, payload_sizes[i] )))
+			goto cleanup;
+	}
+
+	result = tampered_key( hContext, hKey );
+
+cleanup:
+	if ( result != TSS_SUCCESS )
+		print_error( function, result );
+	else
+		print_success( function, result );
+	print_end_test( function );
+	Tspi_Context_FreeMemory( hContext, NULL );
+	Tspi_Context_Close( hContext );
+	exit( result );
+}
@@ -0,0 +1,285 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2004, 2005
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+/*
+ * NAME
+ *	Tspi_Data_Unbind10.c
+ *
+ * DESCRIPTION
+ *	This test verifies that data bound in software, without the TSP,
+ *	unbinds in the TPM. The binding key's public key blob is set up
+ *	once with TestSuite_RSA_Key_From_Blob, and TCPA_BOUND_DATA
+ *	structures of several sizes, up to the largest OAEP takes with a
+ *	2048 bit key, are encrypted to it with
+ *	TestSuite_RSA_Key_Encrypt_Batch. Each must unbind to its data. A
+ *	batch with a structure too large for the key must stop at it.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK
+ *		Create and load a binding key
+ *		Get the key's public key blob and set up a software key
+ *
+ *	Test:
+ *		Encrypt a TCPA_BOUND_DATA of each size in one batch
+ *		Set each as the blob of an encrypted data object and unbind it
+ *		Encrypt a batch with one structure too large for the key
+ *
+ *	Cleanup:
+ *		Free memory related to hContext
+ *		Close context
+ *		Print error/success message
+ *
+ * USAGE
+ *      First parameter is --options
+ *                         -v or --version
+ *      Second parameter is the version of the test case to be run
+ *      This test case is currently implemented for v1.1 and v1.2
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	None.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+
+char *function = "Tspi_Data_Unbind10";
+
+/* OAEP with SHA1 leaves 256 - 2 * 20 - 2 bytes of a 2048 bit key, less the
+ * version and payload type of TCPA_BOUND_DATA */
+#define BIND_DATA_MAX	(256 - 2 * 20 - 2 - 5)
+
+UINT32 data_sizes[] = {
+	1,
+	16,
+	100,
+	BIND_DATA_MAX,
+};
+
+#define NUM_SIZES	(sizeof(data_sizes) / sizeof(UINT32))
+
+int
+main( int argc, char **argv )
+{
+	char version;
+
+	version = parseArgs( argc, argv );
+	if (version)
+		main_v1_1();
+	else
+		print_wrongVersion();
+}
+
+/* marshal a TCPA_BOUND_DATA of size bytes of data into a new buffer */
+BYTE *
+bound_data(UINT32 size, UINT32 *len)
+{
+	struct testsuite_blob blob;
+	TCPA_VERSION ver = { 1, 1, 0, 0 };
+	BYTE *buf;
+	UINT32 i;
+
+	if ((buf = malloc(size + 5)) == NULL)
+		return NULL;
+
+	TestSuite_Blob_Init(&blob, buf, size + 5);
+	TestSuite_Blob_Put_TCPA_VERSION(&blob, &ver);
+	TestSuite_Blob_Put_BYTE(&blob, TCPA_PT_BIND);
+	for (i = 0; i < size; i++)
+		TestSuite_Blob_Put_BYTE(&blob, (BYTE)(size + i));
+	*len = blob.offset;
+
+	return buf;
+}
+
+/* unbind each of the num blobs in enc, of key->size bytes each */
+TSS_RESULT
+unbind_all(TSS_HCONTEXT hContext, TSS_HKEY hKey, struct testsuite_rsa_key *key,
+	   BYTE **in, UINT32 *in_len, BYTE *enc, UINT32 num)
+{
+	TSS_HENCDATA	hEncData;
+	TSS_RESULT	result;
+	BYTE		*data;
+	UINT32		i, dataLen;
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_ENCDATA,
+					    TSS_ENCDATA_BIND, &hEncData );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hEncData)", result );
+		return result;
+	}
+
+	for (i = 0; i < num; i++) {
+		result = Tspi_SetAttribData( hEncData, TSS_TSPATTRIB_ENCDATA_BLOB,
+					     TSS_TSPATTRIB_ENCDATABLOB_BLOB, key->size,
+					     enc + i * key->size );
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_SetAttribData", result );
+			break;
+		}
+
+		result = Tspi_Data_Unbind( hEncData, hKey, &dataLen, &data );
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_Data_Unbind", result );
+			break;
+		}
+
+		/* only the data of the TCPA_BOUND_DATA comes back */
+		if (dataLen != in_len[i] - 5 || memcmp(data, in[i] + 5, dataLen)) {
+			fprintf( stderr, "%u bytes bound in software unbound to %u bytes "
+				 "which don't match\n", in_len[i] - 5, dataLen );
+			result = TSS_E_FAIL;
+		}
+		Tspi_Context_FreeMemory( hContext, data );
+		if (result)
+			break;
+	}
+
+	Tspi_Context_CloseObject( hContext, hEncData );
+
+	return result;
+}
+
+/* the batch must stop at the structure which doesn't fit */
+TSS_RESULT
+too_large(struct testsuite_rsa_key *key)
+{
+	BYTE		*in[3] = { NULL, NULL, NULL }, *enc = NULL;
+	UINT32		in_len[3], done;
+	TSS_RESULT	result;
+	int		i;
+
+	in[0] = bound_data(1, &in_len[0]);
+	in[1] = bound_data(BIND_DATA_MAX + 1, &in_len[1]);
+	in[2] = bound_data(1, &in_len[2]);
+	if (!in[0] || !in[1] || !in[2] || (enc = malloc(3 * key->size)) == NULL) {
+		result = TSS_E_OUTOFMEMORY;
+		goto done;
+	}
+
+	result = TestSuite_RSA_Key_Encrypt_Batch( key, 3, in, in_len, enc, &done );
+	if ( result == TSS_SUCCESS || done != 1 )
+	{
+		fprintf( stderr, "A batch with a blob too large for the key encrypted "
+			 "%u of 3 blobs, result 0x%x\n", done, result );
+		result = TSS_E_FAIL;
+	}
+	else
+		result = TSS_SUCCESS;
+
+done:
+	for (i = 0; i < 3; i++)
+		free(in[i]);
+	free(enc);
+
+	return result;
+}
+
+int
+main_v1_1( void )
+{
+	struct testsuite_rsa_key key;
+	TSS_HCONTEXT	hContext;
+	TSS_HKEY	hSRK, hKey;
+	TSS_RESULT	result;
+	BYTE		*pubKey, *in[NUM_SIZES], *enc = NULL;
+	UINT32		i, pubKeySize, in_len[NUM_SIZES], done;
+
+	print_begin_test( function );
+
+	memset(in, 0, sizeof(in));
+	memset(&key, 0, sizeof(key));
+
+	result = connect_load_srk( &hContext, &hSRK );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "connect_load_srk", result );
+		print_error_exit( function, err_string(result) );
+		exit( result );
+	}
+
+	result = create_load_key( hContext, TSS_KEY_TYPE_BIND | TSS_KEY_SIZE_2048 |
+				  TSS_KEY_NO_AUTHORIZATION, hSRK, &hKey );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "create_load_key", result );
+		goto cleanup;
+	}
+
+	result = Tspi_GetAttribData( hKey, TSS_TSPATTRIB_KEY_BLOB,
+				     TSS_TSPATTRIB_KEYBLOB_PUBLIC_KEY, &pubKeySize, &pubKey );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_GetAttribData", result );
+		goto cleanup;
+	}
+
+	result = TestSuite_RSA_Key_From_Blob( &key, pubKey, pubKeySize );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_RSA_Key_From_Blob", result );
+		goto cleanup;
+	}
+
+	for (i = 0; i < NUM_SIZES; i++) {
+		if ((in[i] = bound_data(data_sizes[i], &in_len[i])) == NULL) {
+			result = TSS_E_OUTOFMEMORY;
+			goto cleanup;
+		}
+	}
+	if ((enc = malloc(NUM_SIZES * key.size)) == NULL) {
+		result = TSS_E_OUTOFMEMORY;
+		goto cleanup;
+	}
+
+	result = TestSuite_RSA_Key_Encrypt_Batch( &key, NUM_SIZES, in, in_len, enc, &done );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_RSA_Key_Encrypt_Batch", result );
+		goto cleanup;
+	}
+
+	if ((result = unbind_all( hContext, hKey, &key, in, in_len, enc, NUM_SIZES )))
+		goto cleanup;
+
+	result = too_large( &key );
+
+cleanup:
+	if ( result != TSS_SUCCESS )
+		print_error( function, result );
+	else
+		print_success( function, result );
+	print_end_test( function );
+	for (i = 0; i < NUM_SIZES; i++)
+		free(in[i]);
+	free(enc);
+	TestSuite_RSA_Key_Free( &key );
+	Tspi_Context_FreeMemory( hContext, NULL );
+	Tspi_Context_Close( hContext );
+	exit( result );
+}
@@ -0,0 +1,410 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2004, 2005
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+/*
+ * NAME
+ *	Tspi_Data_Unseal08.c
+ *
+ * DESCRIPTION
+ *	This test verifies envelope encryption with a sealed data key:
+ *	TestSuite_Envelope_Write seals a random data key to the current
+ *	value of a PCR and encrypts the payload with it a chunk at a time,
+ *	and TestSuite_Envelope_Read must unseal the key and give back the
+ *	payload, for payloads of no bytes, around the chunk size and of many
+ *	chunks. A sealed data key with a byte changed must not unseal, and
+ *	neither must a data key sealed to a PCR which is then extended.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK
+ *		Create and load a storage key
+ *		Create PCR Composite
+ *		Set PCR Value to the current one
+ *
+ *	Test:
+ *		For each payload size, write the payload to a temporary file,
+ *		encrypt it into an envelope sealed to the PCR composite,
+ *		decrypt the envelope and compare
+ *		Change a byte of a sealed data key and unseal it
+ *		Seal a data key to the current value of EXTEND_PCR, extend
+ *		the PCR and unseal the key
+ *
+ *	Cleanup:
+ *		Free memory related to hContext
+ *		Close context
+ *		Print error/success message
+ *
+ * USAGE
+ *      First parameter is --options
+ *                         -v or --version
+ *      Second parameter is the version of the test case to be run
+ *      This test case is currently implemented for v1.1 and v1.2
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	The payloads and envelopes are written to temporary files, about
+ *	2MB at most. PCR 15 is extended.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+
+#define PCR_NUM		5
+#define EXTEND_PCR	15
+
+char *function = "Tspi_Data_Unseal08";
+
+UINT32 payload_sizes[] = {
+	0,
+	1,
+	TESTSUITE_ENVELOPE_CHUNK - 1,
+	TESTSUITE_ENVELOPE_CHUNK,
+	TESTSUITE_ENVELOPE_CHUNK + 1,
+	16 * TESTSUITE_ENVELOPE_CHUNK + 17,
+};
+
+int
+main( int argc, char **argv )
+{
+	char version;
+
+	version = parseArgs( argc, argv );
+	if (version)
+		main_v1_1();
+	else
+		print_wrongVersion();
+}
+
+/* a PCR composite selecting pcr with its current value */
+TSS_RESULT
+create_pcrs(TSS_HCONTEXT hContext, TSS_HTPM hTPM, UINT32 pcr, TSS_HPCRS *hPcrs)
+{
+	TSS_RESULT	result;
+	BYTE		*rgbPcrValue;
+	UINT32		ulPcrLen;
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_PCRS, 0, hPcrs );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hPcrs)", result );
+		return result;
+	}
+
+	result = Tspi_TPM_PcrRead( hTPM, pcr, &ulPcrLen, &rgbPcrValue );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_TPM_PcrRead", result );
+		return result;
+	}
+
+	result = Tspi_PcrComposite_SetPcrValue( *hPcrs, pcr, ulPcrLen, rgbPcrValue );
+	if ( result != TSS_SUCCESS )
+		print_error( "Tspi_PcrComposite_SetPcrValue", result );
+
+	Tspi_Context_FreeMemory( hContext, rgbPcrValue );
+
+	return result;
+}
+
+/* an encrypted data object for sealing, with a usage secret */
+TSS_RESULT
+create_encdata(TSS_HCONTEXT hContext, TSS_HENCDATA *hEncData)
+{
+	TSS_HPOLICY	hEncUsagePolicy;
+	TSS_RESULT	result;
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_ENCDATA,
+					    TSS_ENCDATA_SEAL, hEncData );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hEncData)", result );
+		return result;
+	}
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_POLICY, TSS_POLICY_USAGE,
+					    &hEncUsagePolicy );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hEncUsagePolicy)", result );
+		return result;
+	}
+
+	result = Tspi_Policy_SetSecret( hEncUsagePolicy, TESTSUITE_ENCDATA_SECRET_MODE,
+					TESTSUITE_ENCDATA_SECRET_LEN, TESTSUITE_ENCDATA_SECRET );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Policy_SetSecret (hEncUsagePolicy)", result );
+		return result;
+	}
+
+	result = Tspi_Policy_AssignToObject( hEncUsagePolicy, *hEncData );
+	if ( result != TSS_SUCCESS )
+		print_error( "Tspi_Policy_AssignToObject", result );
+
+	return result;
+}
+
+/* a payload which differs from chunk to chunk */
+FILE *
+make_payload(UINT32 size)
+{
+	FILE *f;
+	UINT32 i;
+
+	if ((f = tmpfile()) == NULL)
+		return NULL;
+
+	for (i = 0; i < size; i++)
+		fputc((i * 13 + i / TESTSUITE_ENVELOPE_CHUNK) & 0xff, f);
+
+	rewind(f);
+
+	return f;
+}
+
+/* compare the rest of two files */
+int
+same_file(FILE *a, FILE *b)
+{
+	int c;
+
+	rewind(a);
+	rewind(b);
+	do {
+		if ((c = fgetc(a)) != fgetc(b))
+			return 0;
+	} while (c != EOF);
+
+	return 1;
+}
+
+TSS_RESULT
+round_trip(TSS_HCONTEXT hContext, TSS_HKEY hKey, TSS_HPCRS hPcrs, UINT32 size)
+{
+	struct testsuite_envelope sealed, opened;
+	TSS_HENCDATA	hEncData;
+	TSS_RESULT	result;
+	FILE		*payload = NULL, *envelope = NULL, *decrypted = NULL;
+
+	memset(&sealed, 0, sizeof(sealed));
+	memset(&opened, 0, sizeof(opened));
+
+	if ((result = create_encdata( hContext, &hEncData )))
+		return result;
+
+	if ((payload = make_payload(size)) == NULL ||
+	    (envelope = tmpfile()) == NULL ||
+	    (decrypted = tmpfile()) == NULL)
+	{
+		fprintf( stderr, "tmpfile failed\n" );
+		result = TSS_E_INTERNAL_ERROR;
+		goto done;
+	}
+
+	result = TestSuite_Envelope_Wrap( &sealed, hContext, hKey, hEncData, TSS_ENCDATA_SEAL,
+					  hPcrs );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_Envelope_Wrap", result );
+		goto done;
+	}
+
+	result = TestSuite_Envelope_Write( &sealed, payload, envelope );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_Envelope_Write", result );
+		goto done;
+	}
+
+	rewind(envelope);
+	result = TestSuite_Envelope_Read( &opened, hContext, hKey, hEncData, envelope,
+					  decrypted );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_Envelope_Read", result );
+		goto done;
+	}
+
+	if (opened.type != TSS_ENCDATA_SEAL ||
+	    memcmp(opened.key, sealed.key, TESTSUITE_ENVELOPE_KEY_SIZE) ||
+	    ftell(decrypted) != (long)size || !same_file(payload, decrypted))
+	{
+		fprintf( stderr, "%u byte payload: decrypted %ld bytes which don't match\n",
+			 size, ftell(decrypted) );
+		result = TSS_E_FAIL;
+	}
+
+done:
+	TestSuite_Envelope_Free( &opened );
+	TestSuite_Envelope_Free( &sealed );
+	if (decrypted)
+		fclose(decrypted);
+	if (envelope)
+		fclose(envelope);
+	if (payload)
+		fclose(payload);
+	Tspi_Context_CloseObject( hContext, hEncData );
+
+	return result;
+}
+
+/* the last byte of a sealed data key is in its encrypted part, so with it
+ * changed the TPM must fail to decrypt the key */
+TSS_RESULT
+tampered_key(TSS_HCONTEXT hContext, TSS_HKEY hKey, TSS_HPCRS hPcrs)
+{
+	struct testsuite_envelope e;
+	TSS_HENCDATA	hEncData;
+	TSS_RESULT	result;
+
+	if ((result = create_encdata( hContext, &hEncData )))
+		return result;
+
+	result = TestSuite_Envelope_Wrap( &e, hContext, hKey, hEncData, TSS_ENCDATA_SEAL, hPcrs );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_Envelope_Wrap", result );
+		goto done;
+	}
+
+	e.wrapped[e.wrappedSize - 1] ^= 0x01;
+	result = TestSuite_Envelope_Unwrap( &e, hContext, hKey, hEncData );
+	if ( result == TSS_SUCCESS )
+	{
+		fprintf( stderr, "A changed sealed data key was unsealed\n" );
+		result = TSS_E_FAIL;
+	}
+	else
+		result = TSS_SUCCESS;
+
+	TestSuite_Envelope_Free( &e );
+done:
+	Tspi_Context_CloseObject( hContext, hEncData );
+
+	return result;
+}
+
+/* a data key sealed to EXTEND_PCR must not unseal once the PCR changed */
+TSS_RESULT
+pcr_extended(TSS_HCONTEXT hContext, TSS_HTPM hTPM, TSS_HKEY hKey)
+{
+	struct testsuite_envelope e;
+	TSS_HENCDATA	hEncData;
+	TSS_HPCRS	hPcrs;
+	TSS_RESULT	result;
+	BYTE		pcrData[20], *pcrValue;
+	UINT32		pcrLen;
+
+	if ((result = create_encdata( hContext, &hEncData )))
+		return result;
+
+	if ((result = create_pcrs( hContext, hTPM, EXTEND_PCR, &hPcrs )))
+		goto done;
+
+	result = TestSuite_Envelope_Wrap( &e, hContext, hKey, hEncData, TSS_ENCDATA_SEAL, hPcrs );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_Envelope_Wrap", result );
+		goto done;
+	}
+
+	memset(pcrData, 0x5a, sizeof(pcrData));
+	result = Tspi_TPM_PcrExtend( hTPM, EXTEND_PCR, sizeof(pcrData), pcrData, NULL,
+				     &pcrLen, &pcrValue );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_TPM_PcrExtend", result );
+		goto free;
+	}
+	Tspi_Context_FreeMemory( hContext, pcrValue );
+
+	result = TestSuite_Envelope_Unwrap( &e, hContext, hKey, hEncData );
+	if ( result != TCPA_E_WRONGPCRVAL )
+	{
+		fprintf( stderr, "Unsealing a data key after its PCR was extended returned "
+			 "0x%x, expected TCPA_E_WRONGPCRVAL\n", result );
+		result = TSS_E_FAIL;
+	}
+	else
+		result = TSS_SUCCESS;
+
+free:
+	TestSuite_Envelope_Free( &e );
+done:
+	Tspi_Context_CloseObject( hContext, hEncData );
+
+	return result;
+}
+
+int
+main_v1_1( void )
+{
+	TSS_HCONTEXT	hContext;
+	TSS_HKEY	hSRK, hKey;
+	TSS_HTPM	hTPM;
+	TSS_HPCRS	hPcrs;
+	TSS_RESULT	result;
+	UINT32		i;
+
+	print_begin_test( function );
+
+	result = connect_load_all( &hContext, &hSRK, &hTPM );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "connect_load_all", result );
+		print_error_exit( function, err_string(result) );
+		exit( result );
+	}
+
+	result = create_load_key( hContext, TSS_KEY_TYPE_STORAGE | TSS_KEY_SIZE_2048 |
+				  TSS_KEY_AUTHORIZATION, hSRK, &hKey );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "create_load_key", result );
+		goto cleanup;
+	}
+
+	if ((result = create_pcrs( hContext, hTPM, PCR_NUM, &hPcrs )))
+		goto cleanup;
+
+	for (i = 0; i < sizeof(payload_sizes) / sizeof(UINT32); i++) {
+		if ((result = round_trip( hContext, hKey, hPcrs, payload_sizes[i] )))
+			goto cleanup;
+	}
+
+	if ((result = tampered_key( hContext, hKey, hPcrs )))
+		goto cleanup;
+
+	result = pcr_extended( hContext, hTPM, hKey );
+
+cleanup:
+	if ( result != TSS_SUCCESS )
+		print_error( function, result );
+	else
+		print_success( function, result );
+	print_end_test( function );
+	Tspi_Context_FreeMemory( hContext, NULL );
+	Tspi_Context_Close( hContext );
+	exit( result );
+}
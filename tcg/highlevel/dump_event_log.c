@@ -22,7 +22,9 @@
  *	Tspi_TPM_GetEventLog01.c
  *
  * DESCRIPTION
- *	This test will verify Tspi_TPM_GetEventLog.
+ *	This test will verify Tspi_TPM_GetEvents, by printing the events
+ *	of each PCR in turn. The log is read a page at a time, so a log of
+ *	any length can be dumped.
  *	The purpose of this test case is to return TSS_SUCCESS.
  *		To ensure that this return code is properly returned
  *		it is necessary to follow the algorithm described
@@ -34,7 +36,8 @@
  *		Connect Context
  *		GetTPMObject
  *
- *	Test:	Call TPM_GetEventLog. If this is unsuccessful check for 
+ *	Test:	Iterate over the events of every PCR with
+ *		TestSuite_Event_Iter_Next. If this is unsuccessful check for 
  *		type of error, and make sure it returns the proper return code
  * 
  *	Cleanup:
@@ -76,8 +79,9 @@ main_v1_1(void){
 	TSS_HCONTEXT	hContext;
 	TSS_RESULT	result;
 	TSS_HTPM	hTPM;
-	UINT32		ulEventNumber, i, j;
-	TSS_PCR_EVENT*	PCREvents;
+	UINT32		ulEventNumber, j;
+	TSS_PCR_EVENT*	PCREvent;
+	struct testsuite_event_iter iter;
 
 	print_begin_test(nameOfFunction);
 
@@ -104,39 +108,52 @@ main_v1_1(void){
 		Tspi_Context_Close(hContext);
 		exit(result);
 	}
-		//Get Event
-	result = Tspi_TPM_GetEventLog(hTPM, &ulEventNumber,
-				&PCREvents);
+	result = TestSuite_Event_Iter_Init(&iter, hContext, hTPM, TESTSUITE_EVENT_ALL_PCRS, 0);
 	if (result != TSS_SUCCESS) {
-		if(!checkNonAPI(result)){
-			print_error(nameOfFunction, result);
-			print_end_test(nameOfFunction);
-		}
-		else{
-			print_error_nonapi(nameOfFunction, result);
-			print_end_test(nameOfFunction);
-		}
+		print_error_exit(nameOfFunction, err_string(result));
+		Tspi_Context_Close(hContext);
+		exit(result);
 	}
-	printf("There are %d events:\n", ulEventNumber);
+
 	printf("PCR SHA1\t\t\t\t     Type Name\n");
 
-	for (i = 0; i < ulEventNumber; i++) {
-		printf("%*d ", 3, PCREvents[i].ulPcrIndex);
-		for (j=0; j<PCREvents[i].ulPcrValueLength; j++)
-			printf("%02x", PCREvents[i].rgbPcrValue[j] & 0xff);
+		//Get Events, a page at a time
+	ulEventNumber = 0;
+	while ((result = TestSuite_Event_Iter_Next(&iter, &PCREvent)) == TSS_SUCCESS &&
+	       PCREvent != NULL) {
+		ulEventNumber++;
+		printf("%*d ", 3, PCREvent->ulPcrIndex);
+		for (j=0; j<PCREvent->ulPcrValueLength; j++)
+			printf("%02x", PCREvent->rgbPcrValue[j] & 0xff);
 		if (j < 20)
 			while (j < 20) {
 				printf(" ");
 				j++;
 			}
 
-		printf(" %*d ", 4, PCREvents[i].eventType);
-		if (PCREvents[i].ulEventLength == 0)
+		printf(" %*d ", 4, PCREvent->eventType);
+		if (PCREvent->ulEventLength == 0)
 			printf("NONE\n");
 		else
-			for (j=0; j<PCREvents[i].ulEventLength; j++)
-				printf("%c", PCREvents[i].rgbEvent[j] & 0xff);
+			for (j=0; j<PCREvent->ulEventLength; j++)
+				printf("%c", PCREvent->rgbEvent[j] & 0xff);
 
 			printf("\n");
 	}
+	TestSuite_Event_Iter_Free(&iter);
+	if (result != TSS_SUCCESS) {
+		if(!checkNonAPI(result)){
+			print_error(nameOfFunction, result);
+			print_end_test(nameOfFunction);
+		}
+		else{
+			print_error_nonapi(nameOfFunction, result);
+			print_end_test(nameOfFunction);
+		}
+	}
+	printf("There are %d events.\n", ulEventNumber);
+
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+	exit(result);
 }
@@ -0,0 +1,273 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2004, 2005
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+/*
+ * NAME
+ *	Tspi_Hash_Sign05.c
+ *
+ * DESCRIPTION
+ *	This test verifies signatures made by Tspi_Hash_Sign in software with
+ *	TestSuite_Verifier_Verify_Batch, for a TSS_SS_RSASSAPKCS1V15_SHA1 key,
+ *	which signs the SHA1 of the data, and a TSS_SS_RSASSAPKCS1V15_DER
+ *	key, which signs the data as given. One signature of each batch has
+ *	a byte changed: the batch must fail on it alone. The SHA1 key's
+ *	signatures are also checked with TestSuite_RSA_Verify.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK
+ *		Create and load a signing key with each signature scheme
+ *		Set up a software verifier for the key
+ *
+ *	Test:
+ *		Sign NUM_SIGS different values
+ *		Change a byte of one signature
+ *		Verify all of them on NUM_THREADS threads
+ *		Check that only the changed signature failed
+ *
+ *	Cleanup:
+ *		Free memory related to hContext
+ *		Close context
+ *		Print error/success message
+ *
+ * USAGE
+ *      First parameter is --options
+ *                         -v or --version
+ *      Second parameter is the version of the test case to be run
+ *      This test case is currently implemented for v1.1 and v1.2
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	None.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+
+char *function = "Tspi_Hash_Sign05";
+
+#define NUM_SIGS	16
+#define NUM_THREADS	4
+#define DATA_SIZE	32
+#define BAD_SIG		5
+
+int
+main( int argc, char **argv )
+{
+	char version;
+
+	version = parseArgs( argc, argv );
+	if (version)
+		main_v1_1();
+	else
+		print_wrongVersion();
+}
+
+/* sign data with hKey: its SHA1 for a SHA1 key, as it is for a DER key */
+TSS_RESULT
+sign(TSS_HCONTEXT hContext, TSS_HKEY hKey, UINT32 sigScheme, BYTE *data,
+     UINT32 *sigLen, BYTE **sig)
+{
+	TSS_HHASH	hHash;
+	TSS_RESULT	result;
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_HASH,
+					    sigScheme == TSS_SS_RSASSAPKCS1V15_SHA1 ?
+					    TSS_HASH_SHA1 : TSS_HASH_OTHER, &hHash );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hash)", result );
+		return result;
+	}
+
+	if (sigScheme == TSS_SS_RSASSAPKCS1V15_SHA1)
+		result = Tspi_Hash_UpdateHashValue( hHash, DATA_SIZE, data );
+	else
+		result = Tspi_Hash_SetHashValue( hHash, DATA_SIZE, data );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Hash_UpdateHashValue/SetHashValue", result );
+		goto done;
+	}
+
+	result = Tspi_Hash_Sign( hHash, hKey, sigLen, sig );
+	if ( result != TSS_SUCCESS )
+		print_error( "Tspi_Hash_Sign", result );
+
+done:
+	Tspi_Context_CloseObject( hContext, hHash );
+
+	return result;
+}
+
+/* check the signatures with TestSuite_RSA_Verify, given the key's modulus */
+TSS_RESULT
+rsa_verify_all(struct testsuite_verifier *v, TSS_VALIDATION *valData)
+{
+	struct testsuite_blob b;
+	TCPA_PUBKEY	pub;
+	TSS_RESULT	result;
+	UINT32		i;
+
+	TestSuite_Blob_Init( &b, v->pubKey, v->pubKeySize );
+	if ((result = TestSuite_Blob_Get_PUBKEY( &b, &pub )))
+		return result;
+
+	for (i = 0; i < NUM_SIGS; i++) {
+		result = TestSuite_RSA_Verify( valData[i].rgbData, valData[i].ulDataLength,
+					       valData[i].rgbValidationData,
+					       valData[i].ulValidationDataLength,
+					       pub.pubKey.key, pub.pubKey.keyLength );
+		if ((i == BAD_SIG) != (result != TSS_SUCCESS)) {
+			fprintf( stderr, "TestSuite_RSA_Verify of signature %u: result 0x%x\n",
+				 i, result );
+			return TSS_E_FAIL;
+		}
+	}
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+sign_and_verify_batch(TSS_HCONTEXT hContext, TSS_HKEY hSRK, UINT32 sigScheme)
+{
+	struct testsuite_verifier v;
+	TSS_VALIDATION	valData[NUM_SIGS];
+	TSS_RESULT	result, results[NUM_SIGS];
+	TSS_HKEY	hKey;
+	BYTE		data[NUM_SIGS][DATA_SIZE];
+	UINT32		i, j;
+
+	memset(valData, 0, sizeof(valData));
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_RSAKEY,
+					    TSS_KEY_TYPE_SIGNING | TSS_KEY_SIZE_2048 |
+					    TSS_KEY_NO_AUTHORIZATION, &hKey );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (signing key)", result );
+		return result;
+	}
+
+	result = Tspi_SetAttribUint32( hKey, TSS_TSPATTRIB_KEY_INFO,
+				       TSS_TSPATTRIB_KEYINFO_SIGSCHEME, sigScheme );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_SetAttribUint32", result );
+		return result;
+	}
+
+	result = Tspi_Key_CreateKey( hKey, hSRK, 0 );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Key_CreateKey (signing key)", result );
+		return result;
+	}
+
+	result = Tspi_Key_LoadKey( hKey, hSRK );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Key_LoadKey (signing key)", result );
+		return result;
+	}
+
+	result = TestSuite_Verifier_Init( &v, hContext, hKey );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "TestSuite_Verifier_Init", result );
+		return result;
+	}
+
+	for (i = 0; i < NUM_SIGS; i++) {
+		for (j = 0; j < DATA_SIZE; j++)
+			data[i][j] = (BYTE)(i * DATA_SIZE + j);
+
+		valData[i].rgbData = data[i];
+		valData[i].ulDataLength = DATA_SIZE;
+		result = sign( hContext, hKey, sigScheme, data[i],
+			       &valData[i].ulValidationDataLength,
+			       &valData[i].rgbValidationData );
+		if ( result != TSS_SUCCESS )
+			goto done;
+	}
+	valData[BAD_SIG].rgbValidationData[valData[BAD_SIG].ulValidationDataLength / 2] ^= 0x01;
+
+	result = TestSuite_Verifier_Verify_Batch( &v, NUM_SIGS, valData, results, NUM_THREADS );
+	if ( result != TSS_E_FAIL )
+	{
+		fprintf( stderr, "Batch with a changed signature returned 0x%x\n", result );
+		result = TSS_E_FAIL;
+		goto done;
+	}
+
+	for (i = 0; i < NUM_SIGS; i++) {
+		if ((i == BAD_SIG) != (results[i] != TSS_SUCCESS)) {
+			fprintf( stderr, "Signature %u of scheme 0x%x: result 0x%x\n", i,
+				 sigScheme, results[i] );
+			result = TSS_E_FAIL;
+			goto done;
+		}
+	}
+	result = TSS_SUCCESS;
+
+	/* the per call verifier must agree */
+	if (sigScheme == TSS_SS_RSASSAPKCS1V15_SHA1)
+		result = rsa_verify_all( &v, valData );
+
+done:
+	TestSuite_Verifier_Free( &v );
+
+	return result;
+}
+
+int
+main_v1_1( void )
+{
+	TSS_HCONTEXT	hContext;
+	TSS_HKEY	hSRK;
+	TSS_RESULT	result;
+
+	print_begin_test( function );
+
+	result = connect_load_srk( &hContext, &hSRK );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "connect_load_srk", result );
+		print_error_exit( function, err_string(result) );
+		exit( result );
+	}
+
+	result = sign_and_verify_batch( hContext, hSRK, TSS_SS_RSASSAPKCS1V15_SHA1 );
+	if ( result == TSS_SUCCESS )
+		result = sign_and_verify_batch( hContext, hSRK, TSS_SS_RSASSAPKCS1V15_DER );
+
+	if ( result != TSS_SUCCESS )
+		print_error( function, result );
+	else
+		print_success( function, result );
+	print_end_test( function );
+	Tspi_Context_FreeMemory( hContext, NULL );
+	Tspi_Context_Close( hContext );
+	exit( result );
+}
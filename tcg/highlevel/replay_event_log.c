@@ -0,0 +1,338 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	replay_event_log.c
+ *
+ * DESCRIPTION
+ *	Verifies the TCS event log against the TPM: for every PCR, the
+ *	digests of its events are extended in software, in log order,
+ *	starting from the PCR's reset value, and the result is compared with
+ *	Tspi_TPM_PcrRead. Prints one line per PCR,
+ *
+ *	PCR <index> events=<n> replayed=<sha1> read=<sha1> <OK|MISMATCH>
+ *
+ *	and a summary line with the events replayed per second. The exit
+ *	status is 0 if every PCR matches.
+ *
+ *	The log is read -p events at a time with TestSuite_Event_Iter_Next,
+ *	which frees each page before reading the next, so memory use doesn't
+ *	grow with the log. PCRs are replayed by -t threads, each with its
+ *	own context.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context
+ *		Connect Context
+ *		Get the number of PCRs
+ *		Start the worker threads
+ *
+ *	Each worker, while there are PCRs left:
+ *		Take the next PCR
+ *		Iterate over its events a page at a time, extending each
+ *		event's digest into the replayed value
+ *		Tspi_TPM_PcrRead and compare; on a mismatch, replay events
+ *		logged in the meantime and read again, up to RETRIES times
+ *
+ *	Cleanup:
+ *		Join the workers
+ *		Close the contexts
+ *		Print results
+ *
+ * USAGE
+ *	replay_event_log -v <version> [-t <threads>] [-p <events per page>]
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	On 1.2 TPMs the dynamic PCRs 17-22 read all ones until a dynamic
+ *	launch resets them to zero; with no events logged either is
+ *	accepted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "common.h"
+
+#define RETRIES		3
+
+char *nameOfFunction = "replay_event_log";
+
+struct pcr_result
+{
+	UINT32		events;
+	int		match;
+	TSS_RESULT	result;
+	BYTE		read[TPM_SHA1_160_HASH_LEN];
+};
+
+/* each worker writes only the slots of the PCRs it took */
+struct testsuite_pcr_composite replayed;
+struct pcr_result results[TESTSUITE_PCR_MAX];
+
+UINT32 numPcrs, pageSize = TESTSUITE_EVENT_PAGE, nextPcr;
+pthread_mutex_t nextPcr_lock = PTHREAD_MUTEX_INITIALIZER;
+char version;
+
+/* extend the events the iterator hasn't returned yet into replayed */
+TSS_RESULT
+replay_events(struct testsuite_event_iter *it, UINT32 *done)
+{
+	TSS_PCR_EVENT *event;
+	TSS_RESULT result;
+
+	while (!(result = TestSuite_Event_Iter_Next(it, &event)) && event) {
+		if (event->ulPcrValueLength != TPM_SHA1_160_HASH_LEN) {
+			fprintf(stderr, "PCR %u event %u: digest of %u bytes\n", it->pcr,
+				*done, event->ulPcrValueLength);
+			return TSS_E_FAIL;
+		}
+		TestSuite_Pcr_Composite_Extend(&replayed, it->pcr, event->rgbPcrValue);
+		(*done)++;
+	}
+
+	return result;
+}
+
+int
+is_reset_value(UINT32 pcr, BYTE *value)
+{
+	BYTE ones[TPM_SHA1_160_HASH_LEN];
+
+	memset(ones, 0xff, sizeof(ones));
+
+	return version == TESTSUITE_TEST_TSS_1_2 && pcr >= 17 && pcr <= 22 &&
+	       !memcmp(value, ones, sizeof(ones));
+}
+
+void
+replay_pcr(TSS_HCONTEXT hContext, TSS_HTPM hTPM, UINT32 pcr)
+{
+	struct pcr_result *r = &results[pcr];
+	struct testsuite_event_iter it;
+	UINT32 len, tries;
+	BYTE *value;
+
+	if ((r->result = TestSuite_Event_Iter_Init(&it, hContext, hTPM, pcr, pageSize)))
+		return;
+
+	/* after the last event, the iterator asks again for any logged since */
+	for (tries = 0; tries < RETRIES; tries++) {
+		if ((r->result = replay_events(&it, &r->events)))
+			break;
+
+		r->result = Tspi_TPM_PcrRead(hTPM, pcr, &len, &value);
+		if (r->result != TSS_SUCCESS) {
+			print_error("Tspi_TPM_PcrRead", r->result);
+			break;
+		}
+		if (len != TPM_SHA1_160_HASH_LEN) {
+			fprintf(stderr, "PCR %u: read %u bytes\n", pcr, len);
+			r->result = TSS_E_FAIL;
+		} else
+			memcpy(r->read, value, len);
+		Tspi_Context_FreeMemory(hContext, value);
+		if (r->result)
+			break;
+
+		r->match = !memcmp(r->read, replayed.value[pcr], TPM_SHA1_160_HASH_LEN) ||
+			   (r->events == 0 && is_reset_value(pcr, r->read));
+		if (r->match)
+			break;
+	}
+
+	TestSuite_Event_Iter_Free(&it);
+}
+
+void *
+worker(void *arg)
+{
+	TSS_HCONTEXT hContext;
+	TSS_HTPM hTPM;
+	TSS_RESULT result;
+	UINT32 pcr;
+
+	if ((result = Tspi_Context_Create(&hContext))) {
+		print_error("Tspi_Context_Create", result);
+		return NULL;
+	}
+	if ((result = Tspi_Context_Connect(hContext, get_server(GLOBALSERVER))) ||
+	    (result = Tspi_Context_GetTpmObject(hContext, &hTPM))) {
+		print_error("Tspi_Context_Connect", result);
+		Tspi_Context_Close(hContext);
+		return NULL;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&nextPcr_lock);
+		pcr = nextPcr++;
+		pthread_mutex_unlock(&nextPcr_lock);
+		if (pcr >= numPcrs)
+			break;
+
+		replay_pcr(hContext, hTPM, pcr);
+	}
+
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+
+	return NULL;
+}
+
+void
+print_sha1(BYTE *digest)
+{
+	UINT32 i;
+
+	for (i = 0; i < TPM_SHA1_160_HASH_LEN; i++)
+		printf("%02x", digest[i]);
+}
+
+void
+usage(char *argv0)
+{
+	fprintf(stderr, "Usage: %s -v <version> [-t <threads>] [-p <events per page>]\n",
+		argv0);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	TSS_HCONTEXT	hContext;
+	TSS_HTPM	hTPM;
+	TSS_RESULT	result;
+	UINT32		i, events = 0, failed = 0;
+	long		numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t	*threads;
+	struct timeval	start, end;
+	double		secs;
+	int		c;
+
+	while ((c = getopt(argc, argv, "v:t:p:h")) != -1) {
+		switch (c) {
+			case 'v':
+				if (!strcmp(optarg, "1.2"))
+					version = TESTSUITE_TEST_TSS_1_2;
+				else if (!strcmp(optarg, "1.1"))
+					version = TESTSUITE_TEST_TSS_1_1;
+				else
+					print_wrongChar();
+				break;
+			case 't':
+				numThreads = atoi(optarg);
+				break;
+			case 'p':
+				pageSize = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (!version || numThreads < 1 || pageSize < 1)
+		usage(argv[0]);
+
+	print_begin_test(nameOfFunction);
+
+	result = Tspi_Context_Create(&hContext);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_Create ", result);
+		print_error_exit(nameOfFunction, err_string(result));
+		exit(result);
+	}
+	result = Tspi_Context_Connect(hContext, get_server(GLOBALSERVER));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_Connect ", result);
+		print_error_exit(nameOfFunction, err_string(result));
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+	result = Tspi_Context_GetTpmObject(hContext, &hTPM);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_GetTpmObject ", result);
+		print_error_exit(nameOfFunction, err_string(result));
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+	result = TestSuite_Get_Num_PCRs(hContext, hTPM, &numPcrs);
+	if (result != TSS_SUCCESS) {
+		print_error_exit(nameOfFunction, err_string(result));
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+	if (numPcrs > TESTSUITE_PCR_MAX)
+		numPcrs = TESTSUITE_PCR_MAX;
+
+	/* until a worker gets to them */
+	for (i = 0; i < numPcrs; i++)
+		results[i].result = TSS_E_FAIL;
+
+	TestSuite_Pcr_Composite_Init(&replayed, numPcrs);
+	if (numThreads > numPcrs)
+		numThreads = numPcrs;
+	if ((threads = calloc(numThreads, sizeof(pthread_t))) == NULL) {
+		fprintf(stderr, "calloc failed\n");
+		Tspi_Context_Close(hContext);
+		exit(TSS_E_OUTOFMEMORY);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < numThreads; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+	for (i = 0; i < numThreads; i++)
+		pthread_join(threads[i], NULL);
+	gettimeofday(&end, NULL);
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+	for (i = 0; i < numPcrs; i++) {
+		events += results[i].events;
+		printf("PCR %2u events=%u replayed=", i, results[i].events);
+		print_sha1(replayed.value[i]);
+		printf(" read=");
+		print_sha1(results[i].read);
+		if (results[i].result) {
+			printf(" ERROR %s\n", err_string(results[i].result));
+			failed++;
+		} else if (!results[i].match) {
+			printf(" MISMATCH\n");
+			failed++;
+		} else
+			printf(" OK\n");
+	}
+	printf("%u events in %.3f s, %.0f events/s, %ld threads, %u PCRs failed\n", events,
+	       secs, secs > 0 ? events / secs : 0.0, numThreads, failed);
+
+	result = failed ? TSS_E_FAIL : TSS_SUCCESS;
+	if (result)
+		print_error(nameOfFunction, result);
+	else
+		print_success(nameOfFunction, result);
+	print_end_test(nameOfFunction);
+	free(threads);
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
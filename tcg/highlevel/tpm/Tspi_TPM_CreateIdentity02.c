@@ -0,0 +1,255 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	Tspi_TPM_CreateIdentity02.c
+ *
+ * DESCRIPTION
+ *	This test will create several TPM identities at once against the
+ *	local Privacy CA of common.c: every identity request is handed to
+ *	the CA's workers as soon as it is collated, so the CA processes
+ *	them while the TPM makes the next identity. Each identity must
+ *	activate to the credential issued for it, and a request whose
+ *	encrypted session key has been tampered with must be refused.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK and get a TPM handle
+ *		Put the owner secret in the TPM's policy
+ *		Start the Privacy CA with NUM_WORKERS workers
+ *		Get the public EK
+ *
+ *	Test:
+ *		For each identity: create the key object, call
+ *		Tspi_TPM_CollateIdentityRequest and submit the request
+ *		Submit a tampered copy of the first request
+ *		For each identity: wait for the CA, load the identity key,
+ *		call Tspi_TPM_ActivateIdentity and compare the credential
+ *		Check that the tampered request was refused
+ *
+ *	Cleanup:
+ *		Stop the Privacy CA
+ *		Free memory associated with the context
+ *		Print error/success message
+ *
+ * USAGE
+ *      First parameter is --options
+ *                         -v or --version
+ *      Second parameter is the version of the test case to be run
+ *      This test case is currently implemented for v1.1 and v1.2
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	None.
+ */
+
+#include <stdio.h>
+#include "common.h"
+
+
+#define NUM_IDENTITIES	4
+#define NUM_WORKERS	4
+
+char *function = "Tspi_TPM_CreateIdentity02";
+
+int
+main( int argc, char **argv )
+{
+	char		version;
+
+	version = parseArgs( argc, argv );
+	if (version == TESTSUITE_TEST_TSS_1_2 || version == TESTSUITE_TEST_TSS_1_1)
+		main_v1_2(version);
+	else
+		print_wrongVersion();
+}
+
+/* collate a request for a new identity key and submit it to the CA */
+TSS_RESULT
+request_identity(TSS_HCONTEXT hContext, TSS_HTPM hTPM, TSS_HKEY hSRK,
+		 struct testsuite_privacy_ca *ca, UINT32 i, TSS_HKEY *hIdentKey,
+		 struct testsuite_ca_request *req)
+{
+	TSS_FLAG	initFlags = TSS_KEY_TYPE_IDENTITY | TSS_KEY_SIZE_2048 |
+				    TSS_KEY_VOLATILE | TSS_KEY_NO_AUTHORIZATION |
+				    TSS_KEY_NOT_MIGRATABLE;
+	char		label[32];
+	BYTE		*labelData;
+	UINT32		labelLen;
+	TSS_RESULT	result;
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_RSAKEY, initFlags,
+					    hIdentKey );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject", result );
+		return result;
+	}
+
+	snprintf(label, sizeof(label), "Identity %u", i);
+	labelLen = strlen(label) + 1;
+	labelData = TestSuite_Native_To_UNICODE((BYTE *)label, &labelLen);
+	if (labelData == NULL) {
+		fprintf(stderr, "TestSuite_Native_To_UNICODE failed\n");
+		return TSS_E_FAIL;
+	}
+
+	result = Tspi_TPM_CollateIdentityRequest( hTPM, hSRK, ca->hCAKey, labelLen, labelData,
+						  *hIdentKey, TSS_ALG_3DES,
+						  &req->identityReqSize, &req->identityReq );
+	free(labelData);
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_TPM_CollateIdentityRequest", result );
+		return result;
+	}
+
+	TestSuite_Privacy_CA_Submit(ca, req);
+
+	return TSS_SUCCESS;
+}
+
+int
+main_v1_2(char version)
+{
+	TSS_HCONTEXT			hContext;
+	TSS_HTPM			hTPM;
+	TSS_HKEY			hSRK, hIdentKey[NUM_IDENTITIES];
+	TSS_HPOLICY			hTPMPolicy;
+	TSS_RESULT			result;
+	struct testsuite_privacy_ca	ca;
+	struct testsuite_ca_request	req[NUM_IDENTITIES], bad;
+	struct testsuite_blob		b;
+	TCPA_IDENTITY_REQ		idReq;
+	BYTE				*ekModulus;
+	UINT32				ekModulusSize, i;
+
+	print_begin_test( function );
+
+		// Create Context
+	result = connect_load_all( &hContext, &hSRK, &hTPM );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "connect_load_all", result );
+		print_error_exit( function, err_string(result) );
+		exit( result );
+	}
+
+		// Insert the owner auth into the TPM's policy
+	result = Tspi_GetPolicyObject( hTPM, TSS_POLICY_USAGE, &hTPMPolicy );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_GetPolicyObject", result );
+		print_error_exit( function, err_string(result) );
+		Tspi_Context_Close( hContext );
+		exit( result );
+	}
+
+	result = Tspi_Policy_SetSecret( hTPMPolicy, TESTSUITE_OWNER_SECRET_MODE,
+					TESTSUITE_OWNER_SECRET_LEN, TESTSUITE_OWNER_SECRET );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Policy_SetSecret", result );
+		print_error_exit( function, err_string(result) );
+		Tspi_Context_Close( hContext );
+		exit( result );
+	}
+
+	result = TestSuite_Privacy_CA_Init( &ca, hContext, NUM_WORKERS );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error_exit( function, err_string(result) );
+		Tspi_Context_Close( hContext );
+		exit( result );
+	}
+
+	memset(req, 0, sizeof(req));
+	memset(&bad, 0, sizeof(bad));
+
+	result = TestSuite_Privacy_CA_Get_EK( hContext, hTPM, &ekModulus, &ekModulusSize );
+	if ( result != TSS_SUCCESS )
+		goto done;
+
+	for (i = 0; i < NUM_IDENTITIES; i++) {
+		req[i].ekModulus = ekModulus;
+		req[i].ekModulusSize = ekModulusSize;
+		if ((result = request_identity(hContext, hTPM, hSRK, &ca, i, &hIdentKey[i],
+					       &req[i])))
+			goto done;
+	}
+
+	/* the first request, with a byte of its encrypted session key changed */
+	bad.ekModulus = ekModulus;
+	bad.ekModulusSize = ekModulusSize;
+	bad.identityReqSize = req[0].identityReqSize;
+	if ((bad.identityReq = malloc(bad.identityReqSize)) == NULL) {
+		result = TSS_E_OUTOFMEMORY;
+		goto done;
+	}
+	memcpy(bad.identityReq, req[0].identityReq, bad.identityReqSize);
+	TestSuite_Blob_Init(&b, bad.identityReq, bad.identityReqSize);
+	if ((result = TestSuite_Blob_Get_IDENTITY_REQ(&b, &idReq)) || idReq.asymSize == 0) {
+		fprintf(stderr, "%s: can't parse the identity request\n", function);
+		result = TSS_E_FAIL;
+		goto done;
+	}
+	idReq.asymBlob[idReq.asymSize / 2] ^= 0x01;
+	TestSuite_Privacy_CA_Submit(&ca, &bad);
+
+	for (i = 0; i < NUM_IDENTITIES; i++) {
+		if ((result = TestSuite_Privacy_CA_Wait(&ca, &req[i]))) {
+			print_error( "TestSuite_Privacy_CA_Wait", result );
+			goto done;
+		}
+
+		result = Tspi_Key_LoadKey( hIdentKey[i], hSRK );
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_Key_LoadKey", result );
+			goto done;
+		}
+
+		if ((result = TestSuite_Privacy_CA_Activate(hContext, hTPM, hIdentKey[i], &req[i])))
+			goto done;
+	}
+
+	if (TestSuite_Privacy_CA_Wait(&ca, &bad) == TSS_SUCCESS) {
+		fprintf(stderr, "%s: the CA accepted a tampered request\n", function);
+		result = TSS_E_FAIL;
+	}
+
+done:
+	/* once the workers are done with what was submitted */
+	TestSuite_Privacy_CA_Free(&ca);
+	for (i = 0; i < NUM_IDENTITIES; i++)
+		TestSuite_Privacy_CA_Free_Request(&req[i]);
+	TestSuite_Privacy_CA_Free_Request(&bad);
+	free(bad.identityReq);
+
+	if (result == TSS_SUCCESS)
+		print_success( function, result );
+	else
+		print_error( function, result );
+	print_end_test( function );
+	Tspi_Context_FreeMemory( hContext, NULL );
+	Tspi_Context_Close( hContext );
+	exit( result );
+}
@@ -0,0 +1,294 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	Tspi_TPM_GetEvents08.c
+ *
+ * DESCRIPTION
+ *	This test will verify that reading the event log a page at a time
+ *	with Tspi_TPM_GetEvents, through TestSuite_Event_Iter_Next, returns
+ *	the same events as Tspi_TPM_GetEventLog, for pages of one event,
+ *	of a few events and of the default size. Pages of one event make
+ *	the TCS answer a ranged query for every event in the log. Once an
+ *	iterator has returned the end of the log, polling it again must
+ *	return no event, until an event is extended to its PCR: then it
+ *	must return that event, and the end again.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context
+ *		Connect Context
+ *		GetTPMObject
+ *		Get the whole log with Tspi_TPM_GetEventLog
+ *
+ *	Test, for each page size:
+ *		Iterate over the events of every PCR, checking that each is
+ *		the next event of its PCR in the whole log
+ *		Check that as many events were returned as are in the log
+ *		Poll the iterator again and check that it returns no event
+ *
+ *	Test, after the end of the log of PCR EXTEND_PCR:
+ *		Poll the iterator again and check that it returns no event
+ *		Extend the PCR with an event
+ *		Check that the iterator returns that event, then no event
+ *
+ *	Cleanup:
+ *		Free memory associated with the context
+ *		Close Context
+ *		Print error/success message.
+ *
+ * USAGE
+ *      First parameter is --options
+ *                         -v or --version
+ *      Second parameter is the version of the test case to be run
+ *      This test case is currently implemented for v1.1 and v1.2
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	Nothing else may extend PCRs while the test runs. PCR EXTEND_PCR
+ *	is extended.
+ */
+
+#include <stdio.h>
+#include "common.h"
+
+
+char *function = "Tspi_TPM_GetEvents08";
+
+#define EXTEND_PCR	9
+
+int
+main( int argc, char **argv )
+{
+	char		version;
+
+	version = parseArgs( argc, argv );
+	if (version == TESTSUITE_TEST_TSS_1_2 || version == TESTSUITE_TEST_TSS_1_1)
+		main_v1_2(version);
+	else
+		print_wrongVersion();
+}
+
+int
+same_event(TSS_PCR_EVENT *a, TSS_PCR_EVENT *b)
+{
+	return a->ulPcrIndex == b->ulPcrIndex && a->eventType == b->eventType &&
+	       a->ulPcrValueLength == b->ulPcrValueLength &&
+	       !memcmp(a->rgbPcrValue, b->rgbPcrValue, a->ulPcrValueLength) &&
+	       a->ulEventLength == b->ulEventLength &&
+	       !memcmp(a->rgbEvent, b->rgbEvent, a->ulEventLength);
+}
+
+/* walk the log page events at a time, matching each event against log, the
+ * whole log of num events */
+TSS_RESULT
+check_pages(TSS_HCONTEXT hContext, TSS_HTPM hTPM, UINT32 page, TSS_PCR_EVENT *log, UINT32 num)
+{
+	struct testsuite_event_iter	iter;
+	UINT32				next[TESTSUITE_PCR_MAX] = { 0 }, count = 0, pcr, i;
+	TSS_PCR_EVENT			*event;
+	TSS_RESULT			result;
+
+	result = TestSuite_Event_Iter_Init(&iter, hContext, hTPM, TESTSUITE_EVENT_ALL_PCRS, page);
+	if (result != TSS_SUCCESS)
+		return result;
+
+	while ((result = TestSuite_Event_Iter_Next(&iter, &event)) == TSS_SUCCESS && event) {
+		pcr = event->ulPcrIndex;
+		if (pcr != iter.pcr || pcr >= TESTSUITE_PCR_MAX) {
+			fprintf(stderr, "page size %u: event of PCR %u returned for PCR %u\n",
+				page, pcr, iter.pcr);
+			result = TSS_E_FAIL;
+			break;
+		}
+
+		/* the next event of the same PCR in the whole log */
+		for (i = next[pcr]; i < num && log[i].ulPcrIndex != pcr; i++)
+			;
+		if (i == num || !same_event(event, &log[i])) {
+			fprintf(stderr, "page size %u: event %u of PCR %u differs from the log\n",
+				page, iter.start + iter.next - 1, pcr);
+			result = TSS_E_FAIL;
+			break;
+		}
+		next[pcr] = i + 1;
+		count++;
+	}
+
+	if (result == TSS_SUCCESS && count != num) {
+		fprintf(stderr, "page size %u: %u events returned, the log has %u\n", page, count,
+			num);
+		result = TSS_E_FAIL;
+	}
+
+	/* nothing was logged since, polling again must return the end again */
+	if (result == TSS_SUCCESS &&
+	    (result = TestSuite_Event_Iter_Next(&iter, &event)) == TSS_SUCCESS && event) {
+		fprintf(stderr, "page size %u: event of PCR %u returned after the end of the "
+			"log\n", page, event->ulPcrIndex);
+		result = TSS_E_FAIL;
+	}
+	TestSuite_Event_Iter_Free(&iter);
+
+	return result;
+}
+
+/* expect the end of the log of the iterator's PCR */
+TSS_RESULT
+check_end(struct testsuite_event_iter *iter, const char *when)
+{
+	TSS_PCR_EVENT	*event;
+	TSS_RESULT	result;
+
+	if ((result = TestSuite_Event_Iter_Next(iter, &event)))
+		return result;
+	if (event) {
+		fprintf(stderr, "%s: event %u of PCR %u returned, expected the end of the log\n",
+			when, iter->start + iter->next - 1, event->ulPcrIndex);
+		return TSS_E_FAIL;
+	}
+
+	return TSS_SUCCESS;
+}
+
+/* read the log of EXTEND_PCR to its end, poll again, then extend the PCR and
+ * check that the iterator picks up the new event and nothing more */
+TSS_RESULT
+check_after_end(TSS_HCONTEXT hContext, TSS_HTPM hTPM)
+{
+	struct testsuite_event_iter	iter;
+	TSS_PCR_EVENT			new_event, *event;
+	BYTE				digest[TPM_SHA1_160_HASH_LEN], *value;
+	BYTE				data[] = "Tspi_TPM_GetEvents08 event";
+	UINT32				valueLen;
+	TSS_RESULT			result;
+
+	result = TestSuite_Event_Iter_Init(&iter, hContext, hTPM, EXTEND_PCR, 7);
+	if (result != TSS_SUCCESS)
+		return result;
+
+	while ((result = TestSuite_Event_Iter_Next(&iter, &event)) == TSS_SUCCESS && event)
+		;
+	if (result == TSS_SUCCESS)
+		result = check_end(&iter, "polling after the end");
+	if (result != TSS_SUCCESS)
+		goto done;
+
+	memset(digest, 0x08, sizeof(digest));
+	memset(&new_event, 0, sizeof(new_event));
+	new_event.ulPcrIndex = EXTEND_PCR;
+	new_event.eventType = TSS_EV_ACTION;
+	new_event.ulEventLength = sizeof(data);
+	new_event.rgbEvent = data;
+
+	result = Tspi_TPM_PcrExtend(hTPM, EXTEND_PCR, sizeof(digest), digest, &new_event,
+				    &valueLen, &value);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_PcrExtend", result);
+		goto done;
+	}
+	Tspi_Context_FreeMemory(hContext, value);
+
+	if ((result = TestSuite_Event_Iter_Next(&iter, &event)))
+		goto done;
+	if (event == NULL || event->ulPcrIndex != EXTEND_PCR ||
+	    event->eventType != TSS_EV_ACTION || event->ulEventLength != sizeof(data) ||
+	    memcmp(event->rgbEvent, data, sizeof(data))) {
+		fprintf(stderr, "polling after an extend: %s\n",
+			event ? "the event returned isn't the one extended" : "no event returned");
+		result = TSS_E_FAIL;
+		goto done;
+	}
+
+	result = check_end(&iter, "polling after the extended event");
+done:
+	TestSuite_Event_Iter_Free(&iter);
+
+	return result;
+}
+
+int
+main_v1_2(char version)
+{
+	TSS_HCONTEXT	hContext;
+	TSS_HTPM	hTPM;
+	TSS_RESULT	result;
+	TSS_PCR_EVENT	*log;
+	UINT32		num, pages[] = { 1, 7, TESTSUITE_EVENT_PAGE }, i;
+
+	print_begin_test( function );
+
+		// Create Context
+	result = Tspi_Context_Create( &hContext );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_Create", result );
+		print_error_exit( function, err_string(result) );
+		exit( result );
+	}
+
+		// Connect Context
+	result = Tspi_Context_Connect( hContext, get_server(GLOBALSERVER) );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_Connect", result );
+		print_error_exit( function, err_string(result) );
+		Tspi_Context_Close( hContext );
+		exit( result );
+	}
+
+		// Get TPM Object
+	result = Tspi_Context_GetTpmObject( hContext, &hTPM );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_GetTpmObject", result );
+		print_error_exit( function, err_string(result) );
+		Tspi_Context_Close( hContext );
+		exit( result );
+	}
+
+		// Get the whole log to compare with
+	result = Tspi_TPM_GetEventLog( hTPM, &num, &log );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_TPM_GetEventLog", result );
+		print_error_exit( function, err_string(result) );
+		Tspi_Context_Close( hContext );
+		exit( result );
+	}
+
+	for (i = 0; i < sizeof(pages) / sizeof(pages[0]); i++) {
+		if ((result = check_pages(hContext, hTPM, pages[i], log, num)))
+			break;
+	}
+
+	if (result == TSS_SUCCESS)
+		result = check_after_end(hContext, hTPM);
+
+	if (result == TSS_SUCCESS)
+		print_success( function, result );
+	else
+		print_error( function, result );
+	print_end_test( function );
+	Tspi_Context_FreeMemory( hContext, NULL );
+	Tspi_Context_Close( hContext );
+	exit( result );
+}
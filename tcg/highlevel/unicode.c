@@ -3,7 +3,10 @@
  * unicode test
  *
  * Using the trousers unicode functions, test a variety of strings, comparing them
- * to known good values
+ * to known good values, then round trip strings of up to 1MB.
+ *
+ * With -b, also time the conversions for server name and secret sized
+ * strings.
  *
  * (C) IBM Corp. 2006
  *
@@ -12,8 +15,10 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <locale.h>
 #include <sys/time.h>
 
 #include "common.h"
@@ -40,11 +45,147 @@ struct data utf16le_strings[] = {
 
 #define NUM_STRINGS 3
 
+/* "h\u00e9llo \u20ac\U0001f511": 2, 3 and 4 byte UTF-8 sequences */
+BYTE utf8_string[] = "h\xc3\xa9llo \xe2\x82\xac\xf0\x9f\x94\x91";
+BYTE utf8_utf16le[] = "h\0\xe9\0l\0l\0o\0 \0\xac\x20\x3d\xd8\x11\xdd\0\0";
+#define UTF8_UTF16LE_SIZE	20
+
+/* lengths of the strings timed: server names, then secrets */
+unsigned bench_lengths[] = { 9, 253, 1024, 65536, 1048576 };
+#define NUM_BENCH 5
+
+/* convert a string of len characters to UTF-16LE and back, checking both */
 int
-main(int argc, char **argv)
+round_trip(BYTE *s, unsigned len)
 {
 	unsigned i, size;
-	BYTE *u;
+	BYTE *u, *n;
+
+	u = TestSuite_Native_To_UNICODE(s, &size);
+	if (u == NULL || size != 2 * len + 2) {
+		ERR("%u byte string: UTF-16LE size %u, expected %u", len, u ? size : 0,
+		    2 * len + 2);
+		free(u);
+		return 1;
+	}
+	for (i = 0; i < len; i++) {
+		if (u[2 * i] != s[i] || u[2 * i + 1] != 0)
+			break;
+	}
+	if (i != len || u[2 * len] || u[2 * len + 1]) {
+		ERR("%u byte string: UTF-16LE differs at character %u", len, i);
+		free(u);
+		return 1;
+	}
+
+	n = TestSuite_UNICODE_To_Native(u, &size);
+	free(u);
+	if (n == NULL || size != len + 1 || memcmp(n, s, len + 1)) {
+		ERR("%u byte string: round trip doesn't match", len);
+		free(n);
+		return 1;
+	}
+	free(n);
+
+	return 0;
+}
+
+/* multibyte characters, if a UTF-8 locale is installed */
+int
+utf8_test(void)
+{
+	unsigned size;
+	BYTE *u, *n;
+	int rc = 0;
+
+	if (setlocale(LC_CTYPE, "C.UTF-8") == NULL &&
+	    setlocale(LC_CTYPE, "en_US.UTF-8") == NULL) {
+		printf("UTF-8 test: no UTF-8 locale, skipped\n");
+		return 0;
+	}
+
+	u = TestSuite_Native_To_UNICODE(utf8_string, &size);
+	if (u == NULL || size != UTF8_UTF16LE_SIZE ||
+	    memcmp(u, utf8_utf16le, UTF8_UTF16LE_SIZE)) {
+		ERR("UTF-8 string doesn't match");
+		if (u) {
+			ERR("Actual (%u bytes):", size);
+			print_hex(u, size);
+		}
+		ERR("Expected (%u bytes):", UTF8_UTF16LE_SIZE);
+		print_hex(utf8_utf16le, UTF8_UTF16LE_SIZE);
+		rc = 1;
+	} else {
+		n = TestSuite_UNICODE_To_Native(u, &size);
+		if (n == NULL || size != sizeof(utf8_string) ||
+		    memcmp(n, utf8_string, size)) {
+			ERR("UTF-8 round trip doesn't match");
+			rc = 1;
+		}
+		free(n);
+	}
+	free(u);
+
+	setlocale(LC_CTYPE, "C");
+	if (!rc)
+		printf("UTF-8 test: Success\n");
+
+	return rc;
+}
+
+double
+elapsed_ns(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_usec - start->tv_usec) * 1e3;
+}
+
+/* time both directions for each length, converting about 64MB each */
+void
+bench(BYTE *s)
+{
+	struct timeval start, end;
+	unsigned i, j, len, iters;
+	BYTE *u, *n, c;
+	double ns;
+
+	for (i = 0; i < NUM_BENCH; i++) {
+		len = bench_lengths[i];
+		iters = (64 << 20) / len;
+		if (iters > 100000)
+			iters = 100000;
+
+		c = s[len];
+		s[len] = '\0';
+		gettimeofday(&start, NULL);
+		for (j = 0; j < iters; j++)
+			free(TestSuite_Native_To_UNICODE(s, NULL));
+		gettimeofday(&end, NULL);
+		ns = elapsed_ns(&start, &end) / iters;
+		printf("PERF unicode/native_to_unicode/%u ns_per_op=%.1f mb_per_s=%.1f\n",
+		       len, ns, len / ns * 1e3);
+
+		u = TestSuite_Native_To_UNICODE(s, NULL);
+		gettimeofday(&start, NULL);
+		for (j = 0; j < iters; j++) {
+			n = TestSuite_UNICODE_To_Native(u, NULL);
+			free(n);
+		}
+		gettimeofday(&end, NULL);
+		free(u);
+		ns = elapsed_ns(&start, &end) / iters;
+		printf("PERF unicode/unicode_to_native/%u ns_per_op=%.1f mb_per_s=%.1f\n",
+		       len, ns, len / ns * 1e3);
+
+		s[len] = c;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned i, size, max = bench_lengths[NUM_BENCH - 1];
+	BYTE *u, *s;
+	int rc = 0;
 
 	for (i = 0; i < NUM_STRINGS; i++) {
 		size = ascii_strings[i].size;
@@ -56,6 +197,7 @@ main(int argc, char **argv)
 			print_hex(u, size);
 			ERR("Expected (%u bytes):", utf16le_strings[i].size);
 			print_hex(utf16le_strings[i].data, utf16le_strings[i].size);
+			free(u);
 			break;
 		}
 
@@ -65,11 +207,39 @@ main(int argc, char **argv)
 			print_hex(u, size);
 			ERR("Expected:");
 			print_hex(utf16le_strings[i].data, size);
+			free(u);
 			break;
 		}
+		free(u);
 
 		printf("Test %u: Success\n", i);
 	}
+	if (i != NUM_STRINGS)
+		return 1;
 
-	return 0;
+	/* printable ASCII, longer than any fixed buffer */
+	if ((s = malloc(max + 1)) == NULL) {
+		ERR("malloc of %u bytes failed", max + 1);
+		return 1;
+	}
+	for (i = 0; i < max; i++)
+		s[i] = ' ' + i % 95;
+	s[max] = '\0';
+
+	for (i = 0; i < NUM_BENCH; i++) {
+		size = bench_lengths[i];
+		u = &s[max - size];
+		if ((rc = round_trip(u, size)))
+			break;
+		printf("Long string test %u: Success\n", size);
+	}
+
+	if (!rc)
+		rc = utf8_test();
+	if (!rc && argc > 1 && !strcmp(argv[1], "-b"))
+		bench(s);
+
+	free(s);
+
+	return rc;
 }
@@ -44,6 +44,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
+
+#include <openssl/evp.h>
 
 #include "tss/tddl_error.h"
 #include "tss/tcs_error.h"
@@ -71,6 +74,56 @@ TSS_RESULT set_public_modulus(TSS_HCONTEXT, TSS_HKEY, UINT32, BYTE *);
 TSS_RESULT set_srk_readable(TSS_HCONTEXT);
 
 
+/* cursor over a marshalled blob, see TestSuite_Blob_Init() in common.c */
+struct testsuite_blob
+{
+	BYTE		*buf;
+	UINT32		size;		/* bytes in buf */
+	UINT32		offset;		/* next byte to read or write */
+	TSS_RESULT	result;		/* first error, later operations do nothing */
+	int		copy;		/* Get_View copies instead of pointing into buf */
+};
+
+void TestSuite_Blob_Init(struct testsuite_blob *, BYTE *, UINT32);
+void TestSuite_Blob_Put_BYTE(struct testsuite_blob *, BYTE);
+void TestSuite_Blob_Get_BYTE(struct testsuite_blob *, BYTE *);
+void TestSuite_Blob_Put_UINT16(struct testsuite_blob *, UINT16);
+void TestSuite_Blob_Get_UINT16(struct testsuite_blob *, UINT16 *);
+void TestSuite_Blob_Put_UINT32(struct testsuite_blob *, UINT32);
+void TestSuite_Blob_Get_UINT32(struct testsuite_blob *, UINT32 *);
+void TestSuite_Blob_Put_UINT16s(struct testsuite_blob *, const UINT16 *, UINT32);
+void TestSuite_Blob_Get_UINT16s(struct testsuite_blob *, UINT16 *, UINT32);
+void TestSuite_Blob_Put_UINT32s(struct testsuite_blob *, const UINT32 *, UINT32);
+void TestSuite_Blob_Get_UINT32s(struct testsuite_blob *, UINT32 *, UINT32);
+void TestSuite_Blob_Put(struct testsuite_blob *, const BYTE *, UINT32);
+void TestSuite_Blob_Get(struct testsuite_blob *, BYTE *, UINT32);
+void TestSuite_Blob_Get_View(struct testsuite_blob *, BYTE **, UINT32);
+void TestSuite_Blob_Put_TCPA_VERSION(struct testsuite_blob *, TCPA_VERSION *);
+void TestSuite_Blob_Get_TCPA_VERSION(struct testsuite_blob *, TCPA_VERSION *);
+void TestSuite_Blob_Put_TSS_VERSION(struct testsuite_blob *, TSS_VERSION *);
+void TestSuite_Blob_Put_KEY_FLAGS(struct testsuite_blob *, TCPA_KEY_FLAGS *);
+void TestSuite_Blob_Get_KEY_FLAGS(struct testsuite_blob *, TCPA_KEY_FLAGS *);
+void TestSuite_Blob_Put_RSA_KEY_PARMS(struct testsuite_blob *, TCPA_RSA_KEY_PARMS *);
+TSS_RESULT TestSuite_Blob_Get_RSA_KEY_PARMS(struct testsuite_blob *, TCPA_RSA_KEY_PARMS *);
+void TestSuite_Blob_Put_KEY_PARMS(struct testsuite_blob *, TCPA_KEY_PARMS *);
+TSS_RESULT TestSuite_Blob_Get_KEY_PARMS(struct testsuite_blob *, TCPA_KEY_PARMS *);
+void TestSuite_Blob_Put_STORE_PUBKEY(struct testsuite_blob *, TCPA_STORE_PUBKEY *);
+TSS_RESULT TestSuite_Blob_Get_STORE_PUBKEY(struct testsuite_blob *, TCPA_STORE_PUBKEY *);
+void TestSuite_Blob_Put_PUBKEY(struct testsuite_blob *, TCPA_PUBKEY *);
+TSS_RESULT TestSuite_Blob_Get_PUBKEY(struct testsuite_blob *, TCPA_PUBKEY *);
+void TestSuite_Blob_Put_KEY(struct testsuite_blob *, TCPA_KEY *);
+TSS_RESULT TestSuite_Blob_Get_KEY(struct testsuite_blob *, TCPA_KEY *);
+TSS_RESULT TestSuite_Blob_Get_KEY12(struct testsuite_blob *, TPM_KEY12 *);
+void TestSuite_Blob_Put_SYMMETRIC_KEY(struct testsuite_blob *, TCPA_SYMMETRIC_KEY *);
+TSS_RESULT TestSuite_Blob_Get_SYMMETRIC_KEY(struct testsuite_blob *, TCPA_SYMMETRIC_KEY *);
+TSS_RESULT TestSuite_Blob_Get_IDENTITY_PROOF(struct testsuite_blob *, TCPA_IDENTITY_PROOF *);
+void TestSuite_Blob_Put_SYM_CA_ATTESTATION(struct testsuite_blob *, TCPA_SYM_CA_ATTESTATION *);
+TSS_RESULT TestSuite_Blob_Get_SYM_CA_ATTESTATION(struct testsuite_blob *, TCPA_SYM_CA_ATTESTATION *);
+void TestSuite_Blob_Put_ASYM_CA_CONTENTS(struct testsuite_blob *, TCPA_ASYM_CA_CONTENTS *);
+TSS_RESULT TestSuite_Blob_Get_ASYM_CA_CONTENTS(struct testsuite_blob *, TCPA_ASYM_CA_CONTENTS *);
+TSS_RESULT TestSuite_Blob_Get_IDENTITY_REQ(struct testsuite_blob *, TCPA_IDENTITY_REQ *);
+
+/* the older helpers below wrap the cursor; their offsets wrap at 64 KiB */
 void TestSuite_LoadBlob_PUBKEY(UINT16 *, BYTE *, TCPA_PUBKEY *);
 void TestSuite_LoadBlob(UINT16 *, UINT32, BYTE *, BYTE *);
 void TestSuite_UnloadBlob(UINT16 *, UINT32, BYTE *, BYTE *);
@@ -112,12 +165,203 @@ TSS_RESULT TestSuite_SymEncrypt(UINT16 alg, BYTE mode, BYTE *key, BYTE *iv, BYTE
 				BYTE *out, UINT32 *out_len);
 TSS_RESULT TestSuite_SymDecrypt(UINT16 alg, BYTE mode, BYTE *key, BYTE *iv, BYTE *in, UINT32 in_len,
 				BYTE *out, UINT32 *out_len);
+/* RSA public key context, see TestSuite_RSA_Key_Init() in common.c */
+struct testsuite_rsa_key
+{
+	EVP_PKEY	*pkey;
+	EVP_PKEY_CTX	*ctx;		/* set up for the key's padding */
+	UINT32		size;		/* bytes of the modulus and of each ciphertext */
+};
+
+TSS_RESULT TestSuite_RSA_Key_Init(struct testsuite_rsa_key *, BYTE *, UINT32, UINT32,
+				  TCPA_ENC_SCHEME);
+TSS_RESULT TestSuite_RSA_Key_From_PUBKEY(struct testsuite_rsa_key *, TCPA_PUBKEY *);
+TSS_RESULT TestSuite_RSA_Key_From_Blob(struct testsuite_rsa_key *, BYTE *, UINT32);
+TSS_RESULT TestSuite_RSA_Key_Encrypt(struct testsuite_rsa_key *, BYTE *, UINT32, BYTE *, UINT32 *);
+TSS_RESULT TestSuite_RSA_Key_Encrypt_Batch(struct testsuite_rsa_key *, UINT32, BYTE **, UINT32 *,
+					   BYTE *, UINT32 *);
+void TestSuite_RSA_Key_Free(struct testsuite_rsa_key *);
 int TestSuite_RSA_Public_Encrypt(unsigned char *in, unsigned int inlen, unsigned char *out,
 				 unsigned int *outlen, unsigned char *pubkey, unsigned int pubsize,
 				 unsigned int e, int padding);
 int TestSuite_TPM_RSA_Encrypt(unsigned char *in, unsigned int inlen, unsigned char *out,
 			      unsigned int *outlen, unsigned char *pubkey, unsigned int pubsize);
+TSS_RESULT TestSuite_RSA_Verify(unsigned char *data, unsigned int datalen, unsigned char *sig,
+				unsigned int siglen, unsigned char *pubkey, unsigned int pubsize);
 TSS_RESULT Testsuite_Verify_Signature(TSS_HCONTEXT, TSS_HKEY, TSS_VALIDATION *);
+
+/* software verifier of TSS_VALIDATION signatures, see TestSuite_Verifier_Init()
+ * in common.c */
+struct testsuite_verifier
+{
+	struct testsuite_rsa_key	key;
+	EVP_PKEY_CTX			*ctx;		/* for the owning thread */
+	BYTE				*pubKey;	/* the TCPA_PUBKEY blob of the key */
+	UINT32				pubKeySize;
+	TCPA_SIG_SCHEME			sigScheme;	/* of the key, SHA1 or DER */
+	TSS_HCONTEXT			hContext;
+	TSS_HKEY			hKey;
+	int				cross_check;	/* also ask Tspi_Hash_VerifySignature */
+};
+
+TSS_RESULT TestSuite_Verifier_Init(struct testsuite_verifier *, TSS_HCONTEXT, TSS_HKEY);
+TSS_RESULT TestSuite_Verifier_Verify(struct testsuite_verifier *, TSS_VALIDATION *);
+TSS_RESULT TestSuite_Verifier_Verify_Batch(struct testsuite_verifier *, UINT32, TSS_VALIDATION *,
+					   TSS_RESULT *, UINT32);
+void TestSuite_Verifier_Free(struct testsuite_verifier *);
+/* software model of a PCR composite, see TestSuite_Pcr_Composite_Init() in
+ * common.c */
+#define TESTSUITE_PCR_MAX	24
+
+struct testsuite_pcr_composite
+{
+	UINT16	sizeOfSelect;
+	BYTE	select[TESTSUITE_PCR_MAX / 8];
+	BYTE	value[TESTSUITE_PCR_MAX][TPM_SHA1_160_HASH_LEN];
+};
+
+TSS_RESULT TestSuite_Get_Num_PCRs(TSS_HCONTEXT, TSS_HTPM, UINT32 *);
+void TestSuite_Pcr_Composite_Init(struct testsuite_pcr_composite *, UINT32);
+TSS_RESULT TestSuite_Pcr_Composite_Select(struct testsuite_pcr_composite *, UINT32);
+TSS_RESULT TestSuite_Pcr_Composite_Set_Value(struct testsuite_pcr_composite *, UINT32, BYTE *);
+TSS_RESULT TestSuite_Pcr_Composite_Extend(struct testsuite_pcr_composite *, UINT32, BYTE *);
+TSS_RESULT TestSuite_Pcr_Composite_Hash(struct testsuite_pcr_composite *, BYTE *);
+void TestSuite_Blob_Put_PCR_SELECTION(struct testsuite_blob *, struct testsuite_pcr_composite *);
+void TestSuite_Blob_Put_PCR_COMPOSITE(struct testsuite_blob *, struct testsuite_pcr_composite *);
+void TestSuite_Blob_Put_PCR_INFO(struct testsuite_blob *, struct testsuite_pcr_composite *, BYTE *);
+void TestSuite_Blob_Put_PCR_INFO_SHORT(struct testsuite_blob *, struct testsuite_pcr_composite *,
+				       BYTE);
+void TestSuite_Blob_Put_PCR_INFO_LONG(struct testsuite_blob *, struct testsuite_pcr_composite *,
+				      struct testsuite_pcr_composite *, BYTE, BYTE);
+/* iterator over the TCS event log a page at a time, see
+ * TestSuite_Event_Iter_Init() in common.c */
+#define TESTSUITE_EVENT_PAGE		1024
+#define TESTSUITE_EVENT_ALL_PCRS	((UINT32)-1)
+
+struct testsuite_event_iter
+{
+	TSS_HCONTEXT	hContext;
+	TSS_HTPM	hTPM;
+	UINT32		pcr;		/* PCR of the current page */
+	UINT32		end;		/* one past the last PCR */
+	UINT32		page;		/* events asked for per page */
+	UINT32		start;		/* number of the page's first event in its PCR */
+	UINT32		num;		/* events in the page */
+	UINT32		next;		/* index in the page of the next event */
+	int		last_page;	/* the page was short, the PCR has no more */
+	TSS_PCR_EVENT	*events;
+};
+
+TSS_RESULT TestSuite_Event_Iter_Init(struct testsuite_event_iter *, TSS_HCONTEXT, TSS_HTPM,
+				     UINT32, UINT32);
+TSS_RESULT TestSuite_Event_Iter_Next(struct testsuite_event_iter *, TSS_PCR_EVENT **);
+void TestSuite_Event_Iter_Free(struct testsuite_event_iter *);
+/* registered keys loaded with their ancestors kept loaded, see
+ * TestSuite_Key_Cache_Init() in common.c */
+struct testsuite_cached_key
+{
+	TSS_UUID	uuid;
+	TSS_FLAG	ps;
+	TSS_HKEY	hKey;
+};
+
+struct testsuite_key_cache
+{
+	TSS_HCONTEXT	hContext;
+	TSS_HKEY	hSRK;
+	TSS_HPOLICY	hPolicy;	/* for the ancestors which need authorization */
+	struct testsuite_cached_key *keys;	/* parents before their children */
+	UINT32		count;
+	UINT32		size;
+	UINT32		hits;		/* loads which found an ancestor pinned */
+	UINT32		misses;		/* ancestors loaded and pinned */
+};
+
+void TestSuite_Key_Cache_Init(struct testsuite_key_cache *, TSS_HCONTEXT, TSS_HKEY,
+			      TSS_HPOLICY);
+TSS_RESULT TestSuite_Key_Cache_Load(struct testsuite_key_cache *, TSS_FLAG, TSS_UUID,
+				    TSS_HKEY *);
+void TestSuite_Key_Cache_Free(struct testsuite_key_cache *);
+/* envelope encryption of payloads of any size, see TestSuite_Envelope_Wrap()
+ * in common.c */
+#define TESTSUITE_ENVELOPE_KEY_SIZE	16
+#define TESTSUITE_ENVELOPE_CHUNK	65536
+/* the IV and padding added to a chunk, with the slack TestSuite_SymEncrypt
+ * asks for */
+#define TESTSUITE_ENVELOPE_OVERHEAD	48
+
+struct testsuite_envelope
+{
+	TSS_FLAG	type;		/* TSS_ENCDATA_BIND or TSS_ENCDATA_SEAL */
+	BYTE		key[TESTSUITE_ENVELOPE_KEY_SIZE];	/* the AES-128 data key */
+	BYTE		*wrapped;	/* the data key, bound or sealed */
+	UINT32		wrappedSize;
+};
+
+TSS_RESULT TestSuite_Envelope_Wrap(struct testsuite_envelope *, TSS_HCONTEXT, TSS_HKEY,
+				   TSS_HENCDATA, TSS_FLAG, TSS_HPCRS);
+TSS_RESULT TestSuite_Envelope_Unwrap(struct testsuite_envelope *, TSS_HCONTEXT, TSS_HKEY,
+				     TSS_HENCDATA);
+TSS_RESULT TestSuite_Envelope_Encrypt(struct testsuite_envelope *, BYTE *, UINT32, BYTE *,
+				      UINT32 *);
+TSS_RESULT TestSuite_Envelope_Decrypt(struct testsuite_envelope *, BYTE *, UINT32, BYTE *,
+				      UINT32 *);
+TSS_RESULT TestSuite_Envelope_Write(struct testsuite_envelope *, FILE *, FILE *);
+TSS_RESULT TestSuite_Envelope_Read(struct testsuite_envelope *, TSS_HCONTEXT, TSS_HKEY,
+				   TSS_HENCDATA, FILE *, FILE *);
+void TestSuite_Envelope_Free(struct testsuite_envelope *);
+/* local Privacy CA, see TestSuite_Privacy_CA_Init() in common.c */
+#define TESTSUITE_CA_CRED_SIZE		64
+#define TESTSUITE_CA_QUEUE_SIZE		64
+
+struct testsuite_ca_request
+{
+	BYTE		*identityReq;	/* from Tspi_TPM_CollateIdentityRequest */
+	UINT32		identityReqSize;
+	BYTE		*ekModulus;	/* of the TPM the request came from */
+	UINT32		ekModulusSize;
+
+	/* set by the CA */
+	TSS_RESULT	result;
+	BYTE		*asymBlob;	/* for Tspi_TPM_ActivateIdentity */
+	UINT32		asymBlobSize;
+	BYTE		*symBlob;
+	UINT32		symBlobSize;
+	BYTE		credential[TESTSUITE_CA_CRED_SIZE];
+	int		done;
+};
+
+struct testsuite_privacy_ca
+{
+	EVP_PKEY		*pkey;		/* the CA's key pair */
+	TSS_HCONTEXT		hContext;
+	TSS_HKEY		hCAKey;		/* its public key, to collate requests for */
+	BYTE			*pubKey;	/* its TCPA_PUBKEY, hashed into chosenId */
+	UINT32			pubKeySize;
+	TCPA_ALGORITHM_ID	symAlg;		/* credentials are encrypted with */
+	UINT32			serial;		/* of the last credential issued */
+
+	pthread_t		*threads;
+	UINT32			num_threads;
+	struct testsuite_ca_request *queue[TESTSUITE_CA_QUEUE_SIZE];
+	UINT32			head;
+	UINT32			count;
+	int			stop;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+};
+
+TSS_RESULT TestSuite_Privacy_CA_Init(struct testsuite_privacy_ca *, TSS_HCONTEXT, UINT32);
+TSS_RESULT TestSuite_Privacy_CA_Get_EK(TSS_HCONTEXT, TSS_HTPM, BYTE **, UINT32 *);
+TSS_RESULT TestSuite_Privacy_CA_Process(struct testsuite_privacy_ca *,
+					struct testsuite_ca_request *);
+void TestSuite_Privacy_CA_Submit(struct testsuite_privacy_ca *, struct testsuite_ca_request *);
+TSS_RESULT TestSuite_Privacy_CA_Wait(struct testsuite_privacy_ca *,
+				     struct testsuite_ca_request *);
+TSS_RESULT TestSuite_Privacy_CA_Activate(TSS_HCONTEXT, TSS_HTPM, TSS_HKEY,
+					 struct testsuite_ca_request *);
+void TestSuite_Privacy_CA_Free_Request(struct testsuite_ca_request *);
+void TestSuite_Privacy_CA_Free(struct testsuite_privacy_ca *);
 TSS_RESULT Testsuite_Is_Ordinal_Supported(TSS_HTPM, TPM_COMMAND_CODE);
 
 int main_v1_1();
@@ -203,6 +447,10 @@ extern TSS_UUID SRK_UUID;
 
 #define GLOBALSERVER	NULL
 
+/* the tcsd of a second TPM, for tests that move keys from the local TPM to
+ * another. Unset, the local TPM is both ends */
+#define TESTSUITE_DEST_SERVER	getenv("TESTSUITE_DEST_SERVER")
+
 #define TSS_ERROR_CODE(x)	(x & 0xFFF)
 #define TSS_ERROR_LAYER(x)	(x & 0x3000)
 
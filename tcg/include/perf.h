@@ -0,0 +1,118 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *      perf.h
+ *
+ * DESCRIPTION
+ *      Timing, sample collection and reporting helpers shared by the
+ *	benchmarks in the perf directory, and the job queue and signature
+ *	check of the migration benchmarks.
+ *
+ * ALGORITHM
+ *      None.
+ *
+ * USAGE
+ *      Include perf.h in benchmarks and link with common/perf.o
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *      None.
+ */
+
+#ifndef _PERF_H_
+#define _PERF_H_
+
+#include <pthread.h>
+
+#include "common.h"
+
+#define PERF_DEFAULT_ITERATIONS		100
+#define PERF_NAME_LEN			128
+
+/* options common to all benchmarks, see perf_parse_args() */
+struct perf_opts
+{
+	char	version;	/* TESTSUITE_TEST_TSS_1_x, from -v */
+	UINT32	iterations;	/* -n: samples taken per measured case */
+	UINT32	threads;	/* -t: worker threads, for benchmarks that use them */
+	UINT64	max;		/* -m: benchmark specific upper bound on the scale */
+	int	raw;		/* -r: print every sample as well as the summary */
+};
+
+/* a set of latency samples for one measured case */
+struct perf_samples
+{
+	char	name[PERF_NAME_LEN];
+	UINT64	*ns;
+	UINT32	count;
+	UINT32	size;
+	UINT64	bytes;		/* payload bytes per sample, 0 for latency-only cases */
+};
+
+void perf_parse_args(int, char **, struct perf_opts *, UINT64);
+UINT64 perf_now(void);
+
+int perf_samples_init(struct perf_samples *, UINT32, const char *, ...);
+int perf_samples_add(struct perf_samples *, UINT64);
+void perf_samples_reset(struct perf_samples *);
+void perf_samples_free(struct perf_samples *);
+UINT64 perf_samples_percentile(struct perf_samples *, UINT32);
+void perf_report(struct perf_samples *, struct perf_opts *);
+void perf_metric(const char *, const char *, double);
+
+long perf_rss_kb(void);
+long perf_peak_rss_kb(void);
+void perf_reset_peak_rss(void);
+
+/* a bounded queue of fixed size jobs, from one producer to worker threads,
+ * see perf_queue_init() */
+struct perf_queue
+{
+	BYTE		*jobs;
+	size_t		job_size;
+	UINT32		size;
+	UINT32		head, count;
+	UINT32		busy;		/* jobs taken and not done yet */
+	int		stop;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+};
+
+int perf_queue_init(struct perf_queue *, UINT32, size_t);
+UINT64 perf_queue_put(struct perf_queue *, void *);
+int perf_queue_get(struct perf_queue *, void *);
+void perf_queue_done(struct perf_queue *);
+void perf_queue_drain(struct perf_queue *);
+void perf_queue_stop(struct perf_queue *);
+void perf_queue_free(struct perf_queue *);
+
+TSS_RESULT perf_sign_verify(TSS_HCONTEXT, TSS_HKEY, struct testsuite_verifier *, const char *);
+
+/* time a single expression, adding the sample to 's' */
+#define PERF_TIME(s, expr)					\
+	do {							\
+		UINT64 perf_time_start = perf_now();		\
+		expr;						\
+		perf_samples_add((s), perf_now() - perf_time_start);	\
+	} while (0)
+
+#endif
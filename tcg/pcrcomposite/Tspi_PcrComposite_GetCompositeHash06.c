@@ -0,0 +1,225 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	Tspi_PcrComposite_GetCompositeHash06.c
+ *
+ * DESCRIPTION
+ *	This test will verify that Tspi_PcrComposite_GetCompositeHash
+ *		returns the exact composite hash of the PCR values set with
+ *		Tspi_PcrComposite_SetPcrValue, as computed in software by
+ *		TestSuite_Pcr_Composite_Hash, for each PCR structure type,
+ *		and that the release locality of INFO_SHORT and INFO_LONG
+ *		objects doesn't change it.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context
+ *		Connect Context
+ *		Get the number of PCRs from the TPM
+ *
+ *	Test, for TSS_PCRS_STRUCT_INFO (and on 1.2 INFO_SHORT and INFO_LONG):
+ *		Create PCR Composite
+ *		Set the values of the first, the ninth and the last PCR
+ *		Set the release locality (1.2)
+ *		Compare the composite hash with the software one
+ *		Set the ninth PCR again to a new value and compare again
+ *
+ *	Cleanup:
+ *		Free memory associated with the context
+ *		Close the context
+ *		Print results
+ *
+ * USAGE
+ *      First parameter is --options
+ *                         -v or --version
+ *      Second parameter is the version of the test case to be run
+ *      This test case is currently implemented for v1.1 and v1.2
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	None.
+ */
+
+#include <stdio.h>
+#include "common.h"
+
+
+char *function = "Tspi_PcrComposite_GetCompositeHash06";
+
+int
+main( int argc, char **argv )
+{
+	char		version;
+
+	version = parseArgs( argc, argv );
+	if (version == TESTSUITE_TEST_TSS_1_2 || version == TESTSUITE_TEST_TSS_1_1)
+		main_v1_2(version);
+	else
+		print_wrongVersion();
+}
+
+TSS_RESULT
+compare_hash(TSS_HCONTEXT hContext, TSS_HPCRS hPcrs, struct testsuite_pcr_composite *model)
+{
+	BYTE		expected[TPM_SHA1_160_HASH_LEN], *hash;
+	UINT32		hashLen;
+	TSS_RESULT	result;
+
+	result = Tspi_PcrComposite_GetCompositeHash( hPcrs, &hashLen, &hash );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_PcrComposite_GetCompositeHash", result );
+		return result;
+	}
+
+	TestSuite_Pcr_Composite_Hash(model, expected);
+	if (hashLen != sizeof(expected) || memcmp(hash, expected, sizeof(expected))) {
+		fprintf(stderr, "composite hash doesn't match\nActual (%u bytes):\n", hashLen);
+		print_hex(hash, hashLen);
+		fprintf(stderr, "Expected:\n");
+		print_hex(expected, sizeof(expected));
+		result = TSS_E_FAIL;
+	}
+
+	Tspi_Context_FreeMemory( hContext, hash );
+
+	return result;
+}
+
+TSS_RESULT
+check_struct(TSS_HCONTEXT hContext, TSS_FLAG type, UINT32 numPcrs)
+{
+	struct testsuite_pcr_composite	model;
+	UINT32				pcrs[3] = { 0, 8, numPcrs - 1 }, i;
+	BYTE				value[TPM_SHA1_160_HASH_LEN];
+	TSS_HPCRS			hPcrs;
+	TSS_RESULT			result;
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_PCRS, type, &hPcrs );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hPcrComposite)", result );
+		return result;
+	}
+
+	TestSuite_Pcr_Composite_Init(&model, numPcrs);
+
+	for (i = 0; i < 3; i++) {
+		memset(value, 0x11 * (i + 1), sizeof(value));
+		result = Tspi_PcrComposite_SetPcrValue( hPcrs, pcrs[i], sizeof(value), value );
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_PcrComposite_SetPcrValue", result );
+			goto done;
+		}
+		TestSuite_Pcr_Composite_Set_Value(&model, pcrs[i], value);
+	}
+
+	if (type == TSS_PCRS_STRUCT_INFO_SHORT || type == TSS_PCRS_STRUCT_INFO_LONG) {
+		result = Tspi_PcrComposite_SetPcrLocality( hPcrs, TPM_LOC_ZERO | TPM_LOC_THREE );
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_PcrComposite_SetPcrLocality", result );
+			goto done;
+		}
+	}
+
+	if ((result = compare_hash(hContext, hPcrs, &model)))
+		goto done;
+
+	/* setting a PCR again replaces its value in the composite */
+	memset(value, 0x99, sizeof(value));
+	result = Tspi_PcrComposite_SetPcrValue( hPcrs, 8, sizeof(value), value );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_PcrComposite_SetPcrValue", result );
+		goto done;
+	}
+	TestSuite_Pcr_Composite_Set_Value(&model, 8, value);
+
+	result = compare_hash(hContext, hPcrs, &model);
+done:
+	Tspi_Context_CloseObject( hContext, hPcrs );
+	return result;
+}
+
+int
+main_v1_2(char version)
+{
+	TSS_HCONTEXT	hContext;
+	TSS_HTPM	hTPM;
+	TSS_RESULT	result;
+	UINT32		numPcrs;
+
+	print_begin_test( function );
+
+		// Create Context
+	result = Tspi_Context_Create( &hContext );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_Create", result );
+		print_error_exit( function, err_string(result) );
+		exit( result );
+	}
+
+		// Connect Context
+	result = Tspi_Context_Connect( hContext, get_server(GLOBALSERVER) );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_Connect", result );
+		print_error_exit( function, err_string(result) );
+		Tspi_Context_Close( hContext );
+		exit( result );
+	}
+
+	result = Tspi_Context_GetTpmObject( hContext, &hTPM );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_GetTpmObject", result );
+		goto done;
+	}
+
+	if ((result = TestSuite_Get_Num_PCRs(hContext, hTPM, &numPcrs)))
+		goto done;
+	if (numPcrs < 9 || numPcrs > TESTSUITE_PCR_MAX) {
+		fprintf(stderr, "%s: unexpected number of PCRs: %u\n", function, numPcrs);
+		result = TSS_E_FAIL;
+		goto done;
+	}
+
+	if (version == TESTSUITE_TEST_TSS_1_1) {
+		result = check_struct(hContext, 0, numPcrs);
+	} else if (!(result = check_struct(hContext, TSS_PCRS_STRUCT_INFO, numPcrs)) &&
+		   !(result = check_struct(hContext, TSS_PCRS_STRUCT_INFO_SHORT, numPcrs))) {
+		result = check_struct(hContext, TSS_PCRS_STRUCT_INFO_LONG, numPcrs);
+	}
+
+done:
+	if (result == TSS_SUCCESS)
+		print_success( function, result );
+	else
+		print_error( function, result );
+	print_end_test( function );
+	Tspi_Context_FreeMemory( hContext, NULL );
+	Tspi_Context_Close( hContext );
+	exit( result );
+}
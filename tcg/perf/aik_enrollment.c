@@ -0,0 +1,280 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	aik_enrollment.c
+ *
+ * DESCRIPTION
+ *	This benchmark measures AIK enrollment against the local Privacy CA
+ *	of common.c: Tspi_TPM_CollateIdentityRequest, the CA's decryption,
+ *	binding check and credential, then Tspi_Key_LoadKey and
+ *	Tspi_TPM_ActivateIdentity. Requests go to -t CA worker threads as
+ *	soon as they are collated, and up to -m of them are left with the
+ *	CA before the oldest is activated, so the CA works while the TPM
+ *	makes the next identity.
+ *
+ *	aik/collate		latency of Tspi_TPM_CollateIdentityRequest
+ *	aik/activate		latency of LoadKey and ActivateIdentity
+ *	aik/enroll		enrollments_per_min over the whole pipeline
+ *	aik/ca			latency of the CA's work for one request
+ *	aik/ca/threads=<t>	enrollments_per_min of the CA alone, all the
+ *				requests submitted at once to -t workers
+ *
+ *	The CA is in software, so the last two show how many TPMs one CA
+ *	host could keep up with.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK and get a TPM handle
+ *		Put the owner secret in the TPM's policy
+ *		Start the Privacy CA with -t workers
+ *		Get the public EK
+ *
+ *	Test:
+ *		-n times: collate an identity request and submit it; with
+ *		more than -m submitted, wait for the oldest and activate it
+ *		Activate the rest
+ *		Process every request again on one thread, then all at once
+ *		on the workers
+ *
+ *	Cleanup:
+ *		Stop the Privacy CA
+ *		Free memory associated with the context
+ *		Close the context
+ *
+ * USAGE
+ *	aik_enrollment -v 1.1|1.2 [-n <enrollments>] [-t <CA workers>]
+ *		[-m <requests in flight>] [-r]
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	The TPM makes a 2048 bit key for each identity, which takes seconds;
+ *	use a small -n.
+ */
+
+#include "perf.h"
+
+#define DEFAULT_IN_FLIGHT	2
+
+struct enrollment
+{
+	TSS_HKEY			hIdentKey;
+	struct testsuite_ca_request	req;
+	BYTE				*identityReq;	/* our copy, for the CA only cases */
+};
+
+char *fn = "aik_enrollment";
+struct perf_opts opts;
+TSS_HCONTEXT hContext;
+struct testsuite_privacy_ca ca;
+
+TSS_RESULT
+collate(TSS_HTPM hTPM, TSS_HKEY hSRK, UINT32 i, struct enrollment *e,
+	struct perf_samples *samples)
+{
+	char label[32];
+	BYTE *labelData;
+	UINT32 labelLen;
+	TSS_RESULT result;
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_RSAKEY,
+					   TSS_KEY_TYPE_IDENTITY | TSS_KEY_SIZE_2048 |
+					   TSS_KEY_VOLATILE | TSS_KEY_NO_AUTHORIZATION |
+					   TSS_KEY_NOT_MIGRATABLE, &e->hIdentKey);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	snprintf(label, sizeof(label), "AIK %u", i);
+	labelLen = strlen(label) + 1;
+	if ((labelData = TestSuite_Native_To_UNICODE((BYTE *)label, &labelLen)) == NULL)
+		return TSS_E_FAIL;
+
+	PERF_TIME(samples, result = Tspi_TPM_CollateIdentityRequest(hTPM, hSRK, ca.hCAKey,
+					labelLen, labelData, e->hIdentKey, TSS_ALG_3DES,
+					&e->req.identityReqSize, &e->req.identityReq));
+	free(labelData);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_CollateIdentityRequest", result);
+		return result;
+	}
+
+	if ((e->identityReq = malloc(e->req.identityReqSize)) == NULL)
+		return TSS_E_OUTOFMEMORY;
+	memcpy(e->identityReq, e->req.identityReq, e->req.identityReqSize);
+
+	TestSuite_Privacy_CA_Submit(&ca, &e->req);
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+activate(TSS_HTPM hTPM, TSS_HKEY hSRK, struct enrollment *e, struct perf_samples *samples)
+{
+	TSS_RESULT result;
+	UINT64 start;
+
+	if ((result = TestSuite_Privacy_CA_Wait(&ca, &e->req))) {
+		print_error("TestSuite_Privacy_CA_Wait", result);
+		return result;
+	}
+
+	start = perf_now();
+	result = Tspi_Key_LoadKey(e->hIdentKey, hSRK);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Key_LoadKey", result);
+		return result;
+	}
+	result = TestSuite_Privacy_CA_Activate(hContext, hTPM, e->hIdentKey, &e->req);
+	perf_samples_add(samples, perf_now() - start);
+
+	Tspi_Context_FreeMemory(hContext, e->req.identityReq);
+	e->req.identityReq = NULL;
+	Tspi_Context_CloseObject(hContext, e->hIdentKey);
+
+	return result;
+}
+
+/* the CA's side alone, on the requests collated before */
+TSS_RESULT
+bench_ca(struct enrollment *e)
+{
+	struct perf_samples samples;
+	char name[PERF_NAME_LEN];
+	TSS_RESULT result = TSS_SUCCESS;
+	UINT32 i;
+	UINT64 start;
+
+	perf_samples_init(&samples, opts.iterations, "aik/ca");
+	for (i = 0; i < opts.iterations && result == TSS_SUCCESS; i++) {
+		e[i].req.identityReq = e[i].identityReq;
+		PERF_TIME(&samples, result = TestSuite_Privacy_CA_Process(&ca, &e[i].req));
+	}
+	if (result == TSS_SUCCESS)
+		perf_report(&samples, &opts);
+	perf_samples_free(&samples);
+	if (result)
+		return result;
+
+	start = perf_now();
+	for (i = 0; i < opts.iterations; i++)
+		TestSuite_Privacy_CA_Submit(&ca, &e[i].req);
+	for (i = 0; i < opts.iterations; i++) {
+		if (TestSuite_Privacy_CA_Wait(&ca, &e[i].req) && result == TSS_SUCCESS)
+			result = e[i].req.result;
+	}
+	snprintf(name, sizeof(name), "aik/ca/threads=%u", opts.threads);
+	perf_metric(name, "enrollments_per_min",
+		    opts.iterations * 60e9 / (perf_now() - start));
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct perf_samples collateSamples, activateSamples;
+	struct enrollment *e;
+	TSS_HTPM hTPM;
+	TSS_HKEY hSRK;
+	TSS_HPOLICY hPolicy;
+	TSS_RESULT result;
+	BYTE *ekModulus;
+	UINT32 ekModulusSize, i, activated = 0, collated = 0;
+	UINT64 start, elapsed;
+
+	perf_parse_args(argc, argv, &opts, DEFAULT_IN_FLIGHT);
+
+	print_begin_test(fn);
+
+	if ((result = connect_load_all(&hContext, &hSRK, &hTPM))) {
+		print_error("connect_load_all", result);
+		exit(result);
+	}
+
+	if ((result = Tspi_GetPolicyObject(hTPM, TSS_POLICY_USAGE, &hPolicy)) ||
+	    (result = Tspi_Policy_SetSecret(hPolicy, TESTSUITE_OWNER_SECRET_MODE,
+					    TESTSUITE_OWNER_SECRET_LEN, TESTSUITE_OWNER_SECRET))) {
+		print_error("Tspi_Policy_SetSecret", result);
+		goto close;
+	}
+
+	if ((e = calloc(opts.iterations, sizeof(struct enrollment))) == NULL) {
+		result = TSS_E_OUTOFMEMORY;
+		goto close;
+	}
+
+	if ((result = TestSuite_Privacy_CA_Init(&ca, hContext, opts.threads)))
+		goto free;
+	if ((result = TestSuite_Privacy_CA_Get_EK(hContext, hTPM, &ekModulus, &ekModulusSize)))
+		goto stop;
+
+	perf_samples_init(&collateSamples, opts.iterations, "aik/collate");
+	perf_samples_init(&activateSamples, opts.iterations, "aik/activate");
+
+	start = perf_now();
+	for (collated = 0; collated < opts.iterations; collated++) {
+		e[collated].req.ekModulus = ekModulus;
+		e[collated].req.ekModulusSize = ekModulusSize;
+		if ((result = collate(hTPM, hSRK, collated, &e[collated], &collateSamples)))
+			break;
+
+		if (collated + 1 - activated > opts.max &&
+		    (result = activate(hTPM, hSRK, &e[activated++], &activateSamples)))
+			break;
+	}
+	for (; result == TSS_SUCCESS && activated < collated; activated++)
+		result = activate(hTPM, hSRK, &e[activated], &activateSamples);
+	elapsed = perf_now() - start;
+
+	if (result == TSS_SUCCESS) {
+		perf_report(&collateSamples, &opts);
+		perf_report(&activateSamples, &opts);
+		perf_metric("aik/enroll", "enrollments_per_min", opts.iterations * 60e9 / elapsed);
+
+		result = bench_ca(e);
+	}
+
+	perf_samples_free(&collateSamples);
+	perf_samples_free(&activateSamples);
+stop:
+	/* the workers finish what they were given before they stop */
+	TestSuite_Privacy_CA_Free(&ca);
+free:
+	for (i = 0; i < opts.iterations; i++) {
+		if (i >= activated && e[i].req.identityReq)
+			Tspi_Context_FreeMemory(hContext, e[i].req.identityReq);
+		TestSuite_Privacy_CA_Free_Request(&e[i].req);
+		free(e[i].identityReq);
+	}
+	free(e);
+close:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
@@ -0,0 +1,596 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	auth_rotation.c
+ *
+ * DESCRIPTION
+ *	This benchmark rotates the usage authorization of every key of a
+ *	registered hierarchy in user persistent storage, the way a periodic
+ *	rotation of key secrets would.
+ *
+ *	A rotation walks the hierarchy under its root key with
+ *	Tspi_Context_GetRegisteredKeysByUUID2 and changes the keys depth
+ *	first, children before their parent: each parent is loaded once,
+ *	with its old secret, for all of its children's Tspi_ChangeAuth and
+ *	unloaded after its own. Nothing is written to persistent storage
+ *	until every key has its new blob, so a failed Tspi_ChangeAuth leaves
+ *	the hierarchy as it was (the TPM keeps no state for ChangeAuth).
+ *	The new blobs then replace the registered ones, children first; if
+ *	one can't be registered, the keys replaced so far are registered
+ *	again with their old blobs and the rotation fails.
+ *
+ *	rotate/walk		Tspi_Context_GetRegisteredKeysByUUID2 and
+ *				finding the hierarchy in its result
+ *	rotate/load_parent	loading a parent key
+ *	rotate/change_auth	Tspi_ChangeAuth of one key
+ *	rotate/reregister	Tspi_Context_UnregisterKey and RegisterKey
+ *				of one key
+ *	rotate/pass		a rotation of the whole hierarchy
+ *	rotate			rotations_per_s over all the passes, and the
+ *				keys whose registered blob isn't their new
+ *				one afterwards
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK
+ *		Unregister what a previous run left behind
+ *		Create and register -m keys, each parent with FANOUT
+ *		children
+ *
+ *	Test, -n times:
+ *		Rotate the hierarchy from the key secret to the new secret
+ *		or back
+ *		Check that the registered blobs are the new ones
+ *
+ *	Cleanup:
+ *		Unregister the keys
+ *		Free memory associated with the context
+ *		Close the context
+ *
+ * USAGE
+ *	auth_rotation -v 1.2 [-n <rotations>] [-m <keys>] [-r]
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	1.2 only. The keys are registered in user persistent storage with
+ *	UUIDs tagged "rotate"; they are unregistered at the end and at the
+ *	start of the next run, if a run is interrupted.
+ */
+
+#include "perf.h"
+
+#define DEFAULT_KEYS		64
+#define FANOUT			4
+#define NO_KEY			((UINT32)-1)
+#define PARENT_FLAGS		(TSS_KEY_TYPE_STORAGE | TSS_KEY_SIZE_2048 | \
+				 TSS_KEY_AUTHORIZATION | TSS_KEY_NOT_MIGRATABLE)
+/* the child's size doesn't change the cost of ChangeAuth, which is the
+ * parent's decryption and encryption of the child's blob */
+#define LEAF_FLAGS		(TSS_KEY_TYPE_SIGNING | TSS_KEY_SIZE_512 | \
+				 TSS_KEY_AUTHORIZATION | TSS_KEY_NOT_MIGRATABLE)
+
+struct rotation_key
+{
+	TSS_KM_KEYINFO2	*info;		/* in the walk's TSS memory */
+	UINT32		parent;		/* NO_KEY for the root, whose parent is the SRK */
+	UINT32		child;		/* first child */
+	UINT32		sibling;	/* next child of the same parent */
+	TSS_HKEY	hKey;
+	int		loaded;
+	BYTE		*oldBlob;
+	UINT32		oldBlobSize;
+};
+
+struct rotation
+{
+	TSS_HCONTEXT		hContext;
+	TSS_HKEY		hSRK;
+	TSS_HPOLICY		hOldPolicy;
+	TSS_HPOLICY		hNewPolicy;
+	TSS_KM_KEYINFO2		*info;
+	UINT32			infoCount;
+	struct rotation_key	*keys;
+	UINT32			count;
+	UINT32			*order;		/* the keys, in the order they were changed */
+	UINT32			changed;
+	struct perf_samples	walk, load, change, reregister;
+};
+
+BYTE rotate_tag[6] = { 'r', 'o', 't', 'a', 't', 'e' };
+
+char *fn = "auth_rotation";
+struct perf_opts opts;
+
+void
+rotation_uuid(UINT32 i, TSS_UUID *uuid)
+{
+	memset(uuid, 0, sizeof(TSS_UUID));
+	uuid->ulTimeLow = i;
+	memcpy(uuid->rgbNode, rotate_tag, sizeof(rotate_tag));
+}
+
+/* unregister the keys of a previous run, children first */
+void
+unregister_all(TSS_HCONTEXT hContext, UINT32 max)
+{
+	TSS_UUID uuid;
+	TSS_HKEY hKey;
+	UINT32 i;
+
+	for (i = max; i > 0; i--) {
+		rotation_uuid(i - 1, &uuid);
+		if (Tspi_Context_UnregisterKey(hContext, TSS_PS_TYPE_USER, uuid, &hKey) ==
+		    TSS_SUCCESS)
+			Tspi_Context_CloseObject(hContext, hKey);
+	}
+}
+
+/* create key i of the hierarchy and register it; key i's parent is key
+ * (i - 1) / FANOUT, so the keys with children come first */
+TSS_RESULT
+create_hierarchy(TSS_HCONTEXT hContext, TSS_HKEY hSRK, UINT32 count)
+{
+	TSS_HKEY *hKeys;
+	TSS_HKEY hParent;
+	TSS_UUID uuid, parentUuid;
+	TSS_FLAG parentPs;
+	TSS_RESULT result = TSS_SUCCESS;
+	UINT32 i, parents = (count - 1 + FANOUT - 1) / FANOUT;
+
+	if ((hKeys = calloc(count, sizeof(TSS_HKEY))) == NULL)
+		return TSS_E_OUTOFMEMORY;
+
+	for (i = 0; i < count; i++) {
+		if (i == 0) {
+			hParent = hSRK;
+			parentUuid = SRK_UUID;
+			parentPs = TSS_PS_TYPE_SYSTEM;
+		} else {
+			hParent = hKeys[(i - 1) / FANOUT];
+			rotation_uuid((i - 1) / FANOUT, &parentUuid);
+			parentPs = TSS_PS_TYPE_USER;
+		}
+
+		if (i < parents)
+			result = create_load_key(hContext, PARENT_FLAGS, hParent, &hKeys[i]);
+		else
+			result = create_key(hContext, LEAF_FLAGS, hParent, &hKeys[i]);
+		if (result)
+			break;
+
+		rotation_uuid(i, &uuid);
+		result = Tspi_Context_RegisterKey(hContext, hKeys[i], TSS_PS_TYPE_USER, uuid,
+						  parentPs, parentUuid);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Context_RegisterKey", result);
+			break;
+		}
+	}
+
+	for (; i > 0; i--) {
+		if (i - 1 < parents)
+			Tspi_Key_UnloadKey(hKeys[i - 1]);
+		Tspi_Context_CloseObject(hContext, hKeys[i - 1]);
+	}
+	free(hKeys);
+
+	return result;
+}
+
+/* find the hierarchy under root in user persistent storage */
+TSS_RESULT
+rotation_walk(struct rotation *r, TSS_UUID *root)
+{
+	TSS_RESULT result;
+	struct rotation_key *k;
+	UINT32 i, j, last;
+
+	result = Tspi_Context_GetRegisteredKeysByUUID2(r->hContext, TSS_PS_TYPE_USER, NULL,
+						       &r->infoCount, &r->info);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_GetRegisteredKeysByUUID2", result);
+		return result;
+	}
+
+	r->keys = calloc(r->infoCount, sizeof(struct rotation_key));
+	r->order = calloc(r->infoCount, sizeof(UINT32));
+	if (r->keys == NULL || r->order == NULL)
+		return TSS_E_OUTOFMEMORY;
+
+	for (i = 0; i < r->infoCount; i++) {
+		if (r->info[i].persistentStorageType == TSS_PS_TYPE_USER &&
+		    !memcmp(&r->info[i].keyUUID, root, sizeof(TSS_UUID)))
+			break;
+	}
+	if (i == r->infoCount) {
+		fprintf(stderr, "%s: the root key isn't registered\n", fn);
+		return TSS_E_PS_KEY_NOTFOUND;
+	}
+	r->keys[0].info = &r->info[i];
+	r->keys[0].parent = r->keys[0].child = r->keys[0].sibling = NO_KEY;
+	r->count = 1;
+
+	/* breadth first: the children of each key found are found after it */
+	for (i = 0; i < r->count; i++) {
+		k = &r->keys[i];
+		for (j = 0, last = NO_KEY; j < r->infoCount && r->count < r->infoCount; j++) {
+			if (r->info[j].persistentStorageType != TSS_PS_TYPE_USER ||
+			    r->info[j].persistentStorageTypeParent != TSS_PS_TYPE_USER ||
+			    memcmp(&r->info[j].parentKeyUUID, &k->info->keyUUID, sizeof(TSS_UUID)))
+				continue;
+
+			r->keys[r->count].info = &r->info[j];
+			r->keys[r->count].parent = i;
+			r->keys[r->count].child = r->keys[r->count].sibling = NO_KEY;
+			if (last == NO_KEY)
+				k->child = r->count;
+			else
+				r->keys[last].sibling = r->count;
+			last = r->count++;
+		}
+	}
+
+	return TSS_SUCCESS;
+}
+
+/* key i's object, with its old secret */
+TSS_RESULT
+rotation_key_object(struct rotation *r, UINT32 i)
+{
+	struct rotation_key *k = &r->keys[i];
+	TSS_RESULT result;
+
+	if (k->hKey)
+		return TSS_SUCCESS;
+
+	result = Tspi_Context_GetKeyByUUID(r->hContext, TSS_PS_TYPE_USER, k->info->keyUUID,
+					   &k->hKey);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_GetKeyByUUID", result);
+		return result;
+	}
+
+	result = Tspi_Policy_AssignToObject(r->hOldPolicy, k->hKey);
+	if (result != TSS_SUCCESS)
+		print_error("Tspi_Policy_AssignToObject", result);
+
+	return result;
+}
+
+TSS_HKEY
+rotation_parent(struct rotation *r, UINT32 i)
+{
+	return r->keys[i].parent == NO_KEY ? r->hSRK : r->keys[r->keys[i].parent].hKey;
+}
+
+/* change key i and everything under it. Key i is loaded for its children,
+ * whose parents are all loaded already */
+TSS_RESULT
+rotate_subtree(struct rotation *r, UINT32 i)
+{
+	struct rotation_key *k = &r->keys[i];
+	TSS_RESULT result;
+	BYTE *blob;
+	UINT32 c;
+
+	if ((result = rotation_key_object(r, i)))
+		return result;
+
+	if (k->child != NO_KEY) {
+		PERF_TIME(&r->load, result = Tspi_Key_LoadKey(k->hKey, rotation_parent(r, i)));
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Key_LoadKey", result);
+			return result;
+		}
+		k->loaded = 1;
+
+		for (c = k->child; c != NO_KEY; c = r->keys[c].sibling) {
+			if ((result = rotate_subtree(r, c)))
+				return result;
+		}
+	}
+
+	result = Tspi_GetAttribData(k->hKey, TSS_TSPATTRIB_KEY_BLOB, TSS_TSPATTRIB_KEYBLOB_BLOB,
+				    &k->oldBlobSize, &blob);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_GetAttribData", result);
+		return result;
+	}
+	k->oldBlob = malloc(k->oldBlobSize);
+	if (k->oldBlob)
+		memcpy(k->oldBlob, blob, k->oldBlobSize);
+	Tspi_Context_FreeMemory(r->hContext, blob);
+	if (k->oldBlob == NULL)
+		return TSS_E_OUTOFMEMORY;
+
+	PERF_TIME(&r->change,
+		  result = Tspi_ChangeAuth(k->hKey, rotation_parent(r, i), r->hNewPolicy));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_ChangeAuth", result);
+		return result;
+	}
+	r->order[r->changed++] = i;
+
+	/* its children are done, and a parent is only needed for its children */
+	if (k->loaded) {
+		Tspi_Key_UnloadKey(k->hKey);
+		k->loaded = 0;
+	}
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+reregister(struct rotation *r, TSS_KM_KEYINFO2 *info, TSS_HKEY hKey)
+{
+	TSS_HKEY hPsKey;
+	TSS_RESULT result;
+
+	result = Tspi_Context_UnregisterKey(r->hContext, TSS_PS_TYPE_USER, info->keyUUID, &hPsKey);
+	if (result == TSS_SUCCESS)
+		Tspi_Context_CloseObject(r->hContext, hPsKey);
+	else if (TSS_ERROR_CODE(result) != TSS_E_PS_KEY_NOTFOUND) {
+		print_error("Tspi_Context_UnregisterKey", result);
+		return result;
+	}
+
+	result = Tspi_Context_RegisterKey(r->hContext, hKey, TSS_PS_TYPE_USER, info->keyUUID,
+					  info->persistentStorageTypeParent,
+					  info->parentKeyUUID);
+	if (result != TSS_SUCCESS)
+		print_error("Tspi_Context_RegisterKey", result);
+
+	return result;
+}
+
+/* register key i's old blob again */
+TSS_RESULT
+restore(struct rotation *r, UINT32 i)
+{
+	struct rotation_key *k = &r->keys[i];
+	TSS_HKEY hKey;
+	TSS_RESULT result;
+
+	result = Tspi_Context_CreateObject(r->hContext, TSS_OBJECT_TYPE_RSAKEY, TSS_KEY_EMPTY_KEY,
+					   &hKey);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	result = Tspi_SetAttribData(hKey, TSS_TSPATTRIB_KEY_BLOB, TSS_TSPATTRIB_KEYBLOB_BLOB,
+				    k->oldBlobSize, k->oldBlob);
+	if (result != TSS_SUCCESS)
+		print_error("Tspi_SetAttribData", result);
+	else
+		result = reregister(r, k->info, hKey);
+	Tspi_Context_CloseObject(r->hContext, hKey);
+
+	return result;
+}
+
+/* replace the registered blobs with the new ones, children first, or
+ * put back the old ones */
+TSS_RESULT
+rotation_commit(struct rotation *r)
+{
+	TSS_RESULT result = TSS_SUCCESS;
+	UINT32 i, j;
+
+	for (j = 0; j < r->changed; j++) {
+		i = r->order[j];
+		PERF_TIME(&r->reregister, result = reregister(r, r->keys[i].info, r->keys[i].hKey));
+		if (result)
+			break;
+	}
+	if (result == TSS_SUCCESS)
+		return result;
+
+	fprintf(stderr, "%s: rotation failed at key %u of %u, rolling back\n", fn, j + 1,
+		r->changed);
+	for (j++; j > 0; j--) {
+		if (restore(r, r->order[j - 1]))
+			fprintf(stderr, "%s: key %u couldn't be restored\n", fn,
+				r->keys[r->order[j - 1]].info->keyUUID.ulTimeLow);
+	}
+
+	return result;
+}
+
+/* the keys whose registered blob isn't the one they were changed to */
+UINT32
+rotation_check(struct rotation *r)
+{
+	TSS_HKEY hPsKey;
+	BYTE *blob, *psBlob;
+	UINT32 size, psSize, i, j, bad = 0;
+
+	for (j = 0; j < r->changed; j++) {
+		i = r->order[j];
+		if (Tspi_Context_GetKeyByUUID(r->hContext, TSS_PS_TYPE_USER,
+					      r->keys[i].info->keyUUID, &hPsKey)) {
+			bad++;
+			continue;
+		}
+		if (Tspi_GetAttribData(hPsKey, TSS_TSPATTRIB_KEY_BLOB, TSS_TSPATTRIB_KEYBLOB_BLOB,
+				       &psSize, &psBlob) == TSS_SUCCESS) {
+			if (Tspi_GetAttribData(r->keys[i].hKey, TSS_TSPATTRIB_KEY_BLOB,
+					       TSS_TSPATTRIB_KEYBLOB_BLOB, &size,
+					       &blob) == TSS_SUCCESS) {
+				if (size != psSize || memcmp(blob, psBlob, size))
+					bad++;
+				Tspi_Context_FreeMemory(r->hContext, blob);
+			} else
+				bad++;
+			Tspi_Context_FreeMemory(r->hContext, psBlob);
+		} else
+			bad++;
+		Tspi_Context_CloseObject(r->hContext, hPsKey);
+	}
+
+	return bad;
+}
+
+void
+rotation_free(struct rotation *r)
+{
+	UINT32 i;
+
+	for (i = 0; r->keys && i < r->count; i++) {
+		if (r->keys[i].loaded)
+			Tspi_Key_UnloadKey(r->keys[i].hKey);
+		if (r->keys[i].hKey)
+			Tspi_Context_CloseObject(r->hContext, r->keys[i].hKey);
+		free(r->keys[i].oldBlob);
+	}
+	free(r->keys);
+	free(r->order);
+	if (r->info)
+		Tspi_Context_FreeMemory(r->hContext, (BYTE *)r->info);
+
+	r->keys = NULL;
+	r->order = NULL;
+	r->info = NULL;
+	r->count = r->changed = 0;
+}
+
+/* rotate the hierarchy under root from hOldPolicy's secret to hNewPolicy's */
+TSS_RESULT
+rotate(struct rotation *r, TSS_UUID *root, UINT32 *bad)
+{
+	TSS_RESULT result;
+
+	PERF_TIME(&r->walk, result = rotation_walk(r, root));
+	if (result == TSS_SUCCESS && (result = rotate_subtree(r, 0)) == TSS_SUCCESS &&
+	    (result = rotation_commit(r)) == TSS_SUCCESS)
+		*bad += rotation_check(r);
+
+	rotation_free(r);
+
+	return result;
+}
+
+TSS_RESULT
+secret_policy(TSS_HCONTEXT hContext, TSS_FLAG mode, UINT32 len, BYTE *secret,
+	      TSS_HPOLICY *hPolicy)
+{
+	TSS_RESULT result;
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_POLICY, TSS_POLICY_USAGE,
+					   hPolicy);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	result = Tspi_Policy_SetSecret(*hPolicy, mode, len, secret);
+	if (result != TSS_SUCCESS)
+		print_error("Tspi_Policy_SetSecret", result);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct rotation r;
+	struct perf_samples pass;
+	TSS_HPOLICY hPolicies[2];
+	TSS_UUID root;
+	TSS_RESULT result;
+	UINT32 i, bad = 0;
+	UINT64 start, total = 0;
+
+	perf_parse_args(argc, argv, &opts, DEFAULT_KEYS);
+	if (opts.version == TESTSUITE_TEST_TSS_1_1)
+		print_NA();
+	if (opts.max == 0)
+		opts.max = 1;
+
+	print_begin_test(fn);
+
+	memset(&r, 0, sizeof(r));
+	if ((result = connect_load_srk(&r.hContext, &r.hSRK))) {
+		print_error("connect_load_srk", result);
+		exit(result);
+	}
+
+	if ((result = secret_policy(r.hContext, TESTSUITE_KEY_SECRET_MODE,
+				    TESTSUITE_KEY_SECRET_LEN, TESTSUITE_KEY_SECRET,
+				    &hPolicies[0])) ||
+	    (result = secret_policy(r.hContext, TESTSUITE_NEW_SECRET_MODE,
+				    TESTSUITE_NEW_SECRET_LEN, TESTSUITE_NEW_SECRET,
+				    &hPolicies[1])))
+		goto close;
+
+	unregister_all(r.hContext, opts.max);
+	if ((result = create_hierarchy(r.hContext, r.hSRK, opts.max)))
+		goto unregister;
+	rotation_uuid(0, &root);
+
+	perf_samples_init(&r.walk, opts.iterations, "rotate/walk");
+	perf_samples_init(&r.load, opts.iterations, "rotate/load_parent");
+	perf_samples_init(&r.change, opts.iterations, "rotate/change_auth");
+	perf_samples_init(&r.reregister, opts.iterations, "rotate/reregister");
+	perf_samples_init(&pass, opts.iterations, "rotate/pass");
+
+	for (i = 0; i < opts.iterations; i++) {
+		r.hOldPolicy = hPolicies[i % 2];
+		r.hNewPolicy = hPolicies[(i + 1) % 2];
+
+		start = perf_now();
+		if ((result = rotate(&r, &root, &bad)))
+			break;
+		perf_samples_add(&pass, perf_now() - start);
+		total += pass.ns[i];
+	}
+
+	if (result == TSS_SUCCESS) {
+		perf_report(&r.walk, &opts);
+		perf_report(&r.load, &opts);
+		perf_report(&r.change, &opts);
+		perf_report(&r.reregister, &opts);
+		perf_report(&pass, &opts);
+		perf_metric("rotate", "rotations_per_s", r.change.count * 1000000000.0 / total);
+		perf_metric("rotate", "bad_blobs", bad);
+		if (bad)
+			result = TSS_E_FAIL;
+	}
+
+	perf_samples_free(&r.walk);
+	perf_samples_free(&r.load);
+	perf_samples_free(&r.change);
+	perf_samples_free(&r.reregister);
+	perf_samples_free(&pass);
+unregister:
+	unregister_all(r.hContext, opts.max);
+close:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	Tspi_Context_FreeMemory(r.hContext, NULL);
+	Tspi_Context_Close(r.hContext);
+
+	return result;
+}
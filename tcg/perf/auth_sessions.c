@@ -0,0 +1,373 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	auth_sessions.c
+ *
+ * DESCRIPTION
+ *	This benchmark measures the per-command cost of authorization by
+ *	timing Tspi_Hash_Sign, Tspi_Data_Unbind, Tspi_Data_Seal and
+ *	Tspi_Data_Unseal with keys created with TSS_KEY_NO_AUTHORIZATION
+ *	and with keys created with TSS_KEY_AUTHORIZATION and
+ *	TESTSUITE_KEY_SECRET.
+ *
+ *	When TDDL_TIMER_FILE names the command log of a tcsd running under
+ *	libtddl_timer.so (see the README), the OIAP, OSAP and
+ *	TerminateHandle commands the TPM received during each case are
+ *	counted from the log and printed per Tspi call, which shows how much
+ *	the TSP gains by caching sessions. The TSP calls its session
+ *	functions internally, so the TPM ordinals are the only place they
+ *	can be counted. Without the log "session_counting available=0" is
+ *	printed and the counts are left out. The log holds the commands of
+ *	every client of the tcsd, so nothing else should use it meanwhile.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context
+ *		Connect Context
+ *		Load SRK
+ *
+ *	Test, for no-auth and auth keys:
+ *		Create and load a signing, a binding and a storage key
+ *		Time -n signatures, unbinds, seals and unseals
+ *		Print the session commands per call, if the command log is
+ *		available
+ *	Print the auth overhead of each operation (median auth - median no-auth)
+ *
+ *	Cleanup:
+ *		Free memory associated with the context
+ *		Close the context
+ *
+ * USAGE
+ *	[TDDL_TIMER_FILE=<tcsd's command log>] auth_sessions -v 1.1|1.2 [-n <samples>] [-r]
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	Creates six 2048 bit keys, which can take several minutes on real
+ *	hardware.
+ */
+
+#include "perf.h"
+#include "tss/tpm_ordinal.h"
+
+#define OP_SIGN		0
+#define OP_UNBIND	1
+#define OP_SEAL		2
+#define OP_UNSEAL	3
+#define OP_MAX		4
+
+char *op_names[OP_MAX] = { "sign", "unbind", "seal", "unseal" };
+
+struct auth_mode
+{
+	const char	*name;
+	TSS_FLAG	flags;
+};
+
+struct auth_mode auth_modes[] = {
+	{ "noauth", TSS_KEY_NO_AUTHORIZATION },
+	{ "auth", TSS_KEY_AUTHORIZATION },
+	{ NULL, 0 }
+};
+
+char *fn = "auth_sessions";
+struct perf_opts opts;
+TSS_HCONTEXT hContext;
+TSS_HKEY hSRK;
+
+/* tcsd's command log, if it runs under libtddl_timer.so */
+FILE *tddl_log;
+
+struct session_counts
+{
+	UINT32	oiap;
+	UINT32	osap;
+	UINT32	terminate;
+};
+
+void
+session_log_open()
+{
+	char *path;
+
+	if ((path = getenv("TDDL_TIMER_FILE")) == NULL || *path == '\0')
+		return;
+
+	if ((tddl_log = fopen(path, "r")) == NULL)
+		fprintf(stderr, "%s: can't open %s, not counting sessions\n", fn, path);
+}
+
+/* skip the commands logged so far */
+void
+session_log_skip()
+{
+	char line[256];
+
+	if (tddl_log == NULL)
+		return;
+
+	clearerr(tddl_log);
+	while (fgets(line, sizeof(line), tddl_log))
+		;
+}
+
+/* count the session commands logged since the last call */
+void
+session_log_count(struct session_counts *c)
+{
+	char line[256];
+	unsigned int ordinal;
+
+	memset(c, 0, sizeof(struct session_counts));
+	if (tddl_log == NULL)
+		return;
+
+	clearerr(tddl_log);
+	while (fgets(line, sizeof(line), tddl_log)) {
+		if (sscanf(line, "TPM %*u %*u %x", &ordinal) != 1)
+			continue;
+
+		switch (ordinal) {
+			case TPM_ORD_OIAP:
+				c->oiap++;
+				break;
+			case TPM_ORD_OSAP:
+				c->osap++;
+				break;
+			case TPM_ORD_Terminate_Handle:
+				c->terminate++;
+				break;
+		}
+	}
+}
+
+TSS_RESULT
+run_op(int op, TSS_HKEY hKey, TSS_HHASH hHash, TSS_HENCDATA hBound, TSS_HENCDATA hSealed,
+       BYTE *data, UINT32 len)
+{
+	TSS_RESULT result;
+	UINT32 outLen;
+	BYTE *out;
+
+	switch (op) {
+		case OP_SIGN:
+			result = Tspi_Hash_Sign(hHash, hKey, &outLen, &out);
+			break;
+		case OP_UNBIND:
+			result = Tspi_Data_Unbind(hBound, hKey, &outLen, &out);
+			break;
+		case OP_SEAL:
+			return Tspi_Data_Seal(hSealed, hKey, len, data, 0);
+		case OP_UNSEAL:
+			result = Tspi_Data_Unseal(hSealed, hKey, &outLen, &out);
+			break;
+		default:
+			return TSS_E_BAD_PARAMETER;
+	}
+
+	if (result == TSS_SUCCESS)
+		Tspi_Context_FreeMemory(hContext, out);
+
+	return result;
+}
+
+TSS_RESULT
+bench_mode(struct auth_mode *mode, UINT64 *p50)
+{
+	TSS_HKEY hKeys[OP_MAX];
+	TSS_HHASH hHash;
+	TSS_HENCDATA hBound, hSealed;
+	TSS_HPOLICY hPolicy;
+	TSS_RESULT result;
+	struct perf_samples s;
+	struct session_counts sessions;
+	UINT32 i;
+	BYTE data[] = "09876543210987654321";
+	int op;
+
+	/* one key per operation, so that each key's type matches what the
+	 * operation requires */
+	result = create_load_key(hContext, TSS_KEY_TYPE_SIGNING | TSS_KEY_SIZE_2048 |
+				 mode->flags, hSRK, &hKeys[OP_SIGN]);
+	if (result != TSS_SUCCESS)
+		return result;
+
+	result = create_load_key(hContext, TSS_KEY_TYPE_BIND | TSS_KEY_SIZE_2048 |
+				 mode->flags, hSRK, &hKeys[OP_UNBIND]);
+	if (result != TSS_SUCCESS)
+		return result;
+
+	result = create_load_key(hContext, TSS_KEY_TYPE_STORAGE | TSS_KEY_SIZE_2048 |
+				 mode->flags, hSRK, &hKeys[OP_SEAL]);
+	if (result != TSS_SUCCESS)
+		return result;
+	hKeys[OP_UNSEAL] = hKeys[OP_SEAL];
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_HASH, TSS_HASH_SHA1, &hHash);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	result = Tspi_Hash_SetHashValue(hHash, 20, data);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Hash_SetHashValue", result);
+		return result;
+	}
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_ENCDATA, TSS_ENCDATA_BIND,
+					   &hBound);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	result = Tspi_Data_Bind(hBound, hKeys[OP_UNBIND], sizeof(data), data);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Data_Bind", result);
+		return result;
+	}
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_ENCDATA, TSS_ENCDATA_SEAL,
+					   &hSealed);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_POLICY, TSS_POLICY_USAGE,
+					   &hPolicy);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	result = Tspi_Policy_SetSecret(hPolicy, TESTSUITE_ENCDATA_SECRET_MODE,
+				       TESTSUITE_ENCDATA_SECRET_LEN, TESTSUITE_ENCDATA_SECRET);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Policy_SetSecret", result);
+		return result;
+	}
+
+	result = Tspi_Policy_AssignToObject(hPolicy, hSealed);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Policy_AssignToObject", result);
+		return result;
+	}
+
+	if (perf_samples_init(&s, opts.iterations, "auth"))
+		return TSS_E_OUTOFMEMORY;
+
+	for (op = 0; op < OP_MAX; op++) {
+		snprintf(s.name, sizeof(s.name), "auth/%s/%s", mode->name, op_names[op]);
+		perf_samples_reset(&s);
+
+		/* the sealed blob has to exist before it can be unsealed */
+		if (op == OP_UNSEAL &&
+		    (result = run_op(OP_SEAL, hKeys[OP_SEAL], hHash, hBound, hSealed, data,
+				     sizeof(data)))) {
+			print_error("Tspi_Data_Seal", result);
+			break;
+		}
+
+		session_log_skip();
+
+		for (i = 0; i < opts.iterations; i++) {
+			PERF_TIME(&s, result = run_op(op, hKeys[op], hHash, hBound, hSealed,
+						      data, sizeof(data)));
+			if (result != TSS_SUCCESS) {
+				print_error(s.name, result);
+				goto done;
+			}
+		}
+
+		perf_report(&s, &opts);
+		p50[op] = perf_samples_percentile(&s, 50);
+
+		if (tddl_log) {
+			session_log_count(&sessions);
+			perf_metric(s.name, "oiap_per_call",
+				    (double)sessions.oiap / opts.iterations);
+			perf_metric(s.name, "osap_per_call",
+				    (double)sessions.osap / opts.iterations);
+			perf_metric(s.name, "terminate_per_call",
+				    (double)sessions.terminate / opts.iterations);
+		}
+	}
+
+done:
+	perf_samples_free(&s);
+	for (i = 0; i < OP_UNSEAL; i++) {
+		Tspi_Key_UnloadKey(hKeys[i]);
+		Tspi_Context_CloseObject(hContext, hKeys[i]);
+	}
+	Tspi_Context_CloseObject(hContext, hHash);
+	Tspi_Context_CloseObject(hContext, hBound);
+	Tspi_Context_CloseObject(hContext, hSealed);
+	Tspi_Context_CloseObject(hContext, hPolicy);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct auth_mode *mode;
+	UINT64 p50[2][OP_MAX];
+	char name[PERF_NAME_LEN];
+	TSS_RESULT result;
+	int m, op;
+
+	perf_parse_args(argc, argv, &opts, 0);
+
+	print_begin_test(fn);
+
+	if ((result = connect_load_srk(&hContext, &hSRK))) {
+		print_error("connect_load_srk", result);
+		exit(result);
+	}
+
+	session_log_open();
+	perf_metric("auth/session_counting", "available", tddl_log != NULL);
+
+	for (m = 0, mode = auth_modes; mode->name; m++, mode++) {
+		if ((result = bench_mode(mode, p50[m])))
+			goto done;
+	}
+
+	for (op = 0; op < OP_MAX; op++) {
+		snprintf(name, sizeof(name), "auth/overhead/%s", op_names[op]);
+		perf_metric(name, "p50_us", ((double)p50[1][op] - (double)p50[0][op]) / 1000.0);
+	}
+
+done:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+	if (tddl_log)
+		fclose(tddl_log);
+
+	return result;
+}
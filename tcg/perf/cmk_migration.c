@@ -0,0 +1,697 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	cmk_migration.c
+ *
+ * DESCRIPTION
+ *	This benchmark runs the certified migratable key workflow of the cmk
+ *	tests for -n keys and times each step, to show what CMK based key
+ *	escrow costs per key and which step dominates.
+ *
+ *	What the workflow allows to be done once is done once and reused
+ *	for every key: the owner's CMK restrictions, the approval of the
+ *	migration selection authority list (one MA key, whose digest and
+ *	approval HMAC go into every CMK) and the migration ticket for the
+ *	destination parent. Per key, this thread creates the CMK, has the MA
+ *	sign its ticket, turns that into a signature ticket with
+ *	Tspi_TPM_CMKCreateTicket and creates the migration blob. The blob
+ *	is queued, at most -m at a time, to -t converter threads which each
+ *	have their own context and run Tspi_Key_CMKConvertMigration under
+ *	the destination parent, then load the migrated key and check that
+ *	it signs as the CMK did.
+ *
+ *	cmk/restrict		Tspi_TPM_CMKSetRestrictions, once
+ *	cmk/approve_ma		Tspi_TPM_CMKApproveMA, once
+ *	cmk/authorize_ticket	Tspi_TPM_AuthorizeMigrationTicket, once
+ *	cmk/create_key		Tspi_Key_CreateKey of a CMK
+ *	cmk/sign_ticket		the MA's signature of the ticket digests
+ *	cmk/create_ticket	Tspi_TPM_CMKCreateTicket
+ *	cmk/create_blob		Tspi_Key_CMKCreateBlob
+ *	cmk/convert		Tspi_Key_CMKConvertMigration
+ *	cmk/verify		loading, signing with and verifying a
+ *				migrated key
+ *	cmk			keys_per_s over the pipeline, the time this
+ *				thread waited for room in the queue and the
+ *				keys that failed
+ *
+ *	Each per key step is also reported as total_ms, so the steps can be
+ *	compared directly.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK and get a TPM handle
+ *		Create the source and destination parents and the MA key
+ *		Set the CMK restrictions, approve the MA, authorize the
+ *		migration ticket to the destination parent
+ *		In each of -t contexts: load the destination parent and set
+ *		up a migration data object with the MA and the destination
+ *
+ *	Test, -n times:
+ *		Create a CMK, sign and create its ticket, create its blob,
+ *		queue the blob
+ *	Each converter:
+ *		Tspi_Key_CMKConvertMigration, load, sign and verify
+ *
+ *	Cleanup:
+ *		Stop the converter threads
+ *		Free memory associated with the contexts
+ *		Close the contexts
+ *
+ * USAGE
+ *	cmk_migration -v 1.2 [-n <keys>] [-t <converters>] [-m <queue size>]
+ *		[-r]
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	1.2 only. Like the cmk tests, the source and the destination are the
+ *	same TPM, so the signature ticket made on the source is good on the
+ *	destination. The CMK restrictions are set to 0.
+ */
+
+#include "perf.h"
+
+#define DEFAULT_QUEUE_SIZE	16
+#define PARENT_FLAGS		(TSS_KEY_STRUCT_KEY12 | TSS_KEY_TYPE_STORAGE | \
+				 TSS_KEY_SIZE_2048 | TSS_KEY_VOLATILE | TSS_KEY_AUTHORIZATION)
+#define CMK_FLAGS		(TSS_KEY_STRUCT_KEY12 | TSS_KEY_TYPE_SIGNING | \
+				 TSS_KEY_SIZE_2048 | TSS_KEY_VOLATILE | TSS_KEY_AUTHORIZATION | \
+				 TSS_KEY_MIGRATABLE | TSS_KEY_CERTIFIED_MIGRATABLE)
+
+enum { STEP_CREATE_KEY, STEP_SIGN_TICKET, STEP_CREATE_TICKET, STEP_CREATE_BLOB, STEP_CONVERT,
+       STEP_VERIFY, NUM_STEPS };
+
+char *step_names[NUM_STEPS] = { "create_key", "sign_ticket", "create_ticket", "create_blob",
+				"convert", "verify" };
+
+/* a public key blob, in malloc'd memory */
+struct pub
+{
+	BYTE	*blob;
+	UINT32	size;
+};
+
+struct cmk_job
+{
+	UINT32		index;
+	struct pub	source;		/* the CMK's public key */
+	BYTE		*random;
+	UINT32		randomSize;
+	BYTE		*blob;
+	UINT32		blobSize;
+	BYTE		*sigTicket;
+	UINT32		sigTicketSize;
+};
+
+struct converter
+{
+	pthread_t		thread;
+	TSS_HCONTEXT		hContext;
+	TSS_HKEY		hSRK;
+	TSS_HKEY		hParent;
+	TSS_HMIGDATA		hMigData;
+	TSS_HPOLICY		hUsagePolicy;
+	struct perf_samples	convert;
+	struct perf_samples	verify;
+	UINT32			failures;
+};
+
+/* the queue of cmk_jobs between the source steps and the converters */
+struct perf_queue queue;
+
+/* a verifier of each CMK, set up by the source and used by the converter
+ * its blob goes to */
+struct testsuite_verifier *verifiers;
+
+/* what every converter needs to set up, from the source's context */
+struct pub maPub, destPub;
+BYTE *destBlob;
+UINT32 destBlobSize;
+
+char *fn = "cmk_migration";
+struct perf_opts opts;
+
+/* copy an attribute out of TSS memory */
+TSS_RESULT
+get_attrib(TSS_HCONTEXT hContext, TSS_HOBJECT hObject, TSS_FLAG flag, TSS_FLAG subFlag,
+	   BYTE **out, UINT32 *size)
+{
+	TSS_RESULT result;
+	BYTE *data;
+
+	result = Tspi_GetAttribData(hObject, flag, subFlag, size, &data);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_GetAttribData", result);
+		return result;
+	}
+
+	if ((*out = malloc(*size ? *size : 1)) == NULL)
+		result = TSS_E_OUTOFMEMORY;
+	else
+		memcpy(*out, data, *size);
+	Tspi_Context_FreeMemory(hContext, data);
+
+	return result;
+}
+
+TSS_RESULT
+set_attrib(TSS_HOBJECT hObject, TSS_FLAG flag, TSS_FLAG subFlag, BYTE *data, UINT32 size)
+{
+	TSS_RESULT result = Tspi_SetAttribData(hObject, flag, subFlag, size, data);
+
+	if (result != TSS_SUCCESS)
+		print_error("Tspi_SetAttribData", result);
+
+	return result;
+}
+
+/* a policy with the key secret, for the keys of one context */
+TSS_RESULT
+key_policy(TSS_HCONTEXT hContext, TSS_FLAG type, TSS_HPOLICY *hPolicy)
+{
+	TSS_RESULT result;
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_POLICY, type, hPolicy);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	result = Tspi_Policy_SetSecret(*hPolicy, TESTSUITE_KEY_SECRET_MODE,
+				       TESTSUITE_KEY_SECRET_LEN, TESTSUITE_KEY_SECRET);
+	if (result != TSS_SUCCESS)
+		print_error("Tspi_Policy_SetSecret", result);
+
+	return result;
+}
+
+void
+free_job(struct cmk_job *job)
+{
+	free(job->source.blob);
+	free(job->random);
+	free(job->blob);
+	free(job->sigTicket);
+}
+
+/* convert one blob and check that the key signs as the CMK did */
+TSS_RESULT
+convert_one(struct converter *c, struct cmk_job *job)
+{
+	TSS_HKEY hKey;
+	TSS_RESULT result;
+	char what[32];
+	UINT64 start;
+
+	result = Tspi_Context_CreateObject(c->hContext, TSS_OBJECT_TYPE_RSAKEY, CMK_FLAGS, &hKey);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+	if ((result = Tspi_Policy_AssignToObject(c->hUsagePolicy, hKey))) {
+		print_error("Tspi_Policy_AssignToObject", result);
+		goto done;
+	}
+
+	if ((result = set_attrib(c->hMigData, TSS_MIGATTRIB_MIGRATIONBLOB,
+				 TSS_MIGATTRIB_MIG_SOURCE_PUBKEY_BLOB, job->source.blob,
+				 job->source.size)) ||
+	    (result = set_attrib(c->hMigData, TSS_MIGATTRIB_TICKET_DATA,
+				 TSS_MIGATTRIB_TICKET_SIG_TICKET, job->sigTicket,
+				 job->sigTicketSize)) ||
+	    (result = set_attrib(c->hMigData, TSS_MIGATTRIB_MIGRATIONBLOB,
+				 TSS_MIGATTRIB_MIG_XOR_BLOB, job->blob, job->blobSize)))
+		goto done;
+
+	PERF_TIME(&c->convert,
+		  result = Tspi_Key_CMKConvertMigration(hKey, c->hParent, c->hMigData,
+							job->randomSize, job->random));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Key_CMKConvertMigration", result);
+		goto done;
+	}
+
+	start = perf_now();
+	if ((result = Tspi_Key_LoadKey(hKey, c->hParent))) {
+		print_error("Tspi_Key_LoadKey", result);
+		goto done;
+	}
+
+	/* it must sign as the CMK did before migration */
+	snprintf(what, sizeof(what), "migrated CMK %u", job->index);
+	if ((result = perf_sign_verify(c->hContext, hKey, &verifiers[job->index], what)) ==
+	    TSS_SUCCESS)
+		perf_samples_add(&c->verify, perf_now() - start);
+	Tspi_Key_UnloadKey(hKey);
+done:
+	Tspi_Context_CloseObject(c->hContext, hKey);
+
+	return result;
+}
+
+void *
+converter_thread(void *arg)
+{
+	struct converter *c = arg;
+	struct cmk_job job;
+
+	while (perf_queue_get(&queue, &job)) {
+		if (convert_one(c, &job))
+			c->failures++;
+		free_job(&job);
+		perf_queue_done(&queue);
+	}
+
+	return NULL;
+}
+
+/* a converter's context: the destination parent, loaded, and a migration
+ * data object which has everything but the per key data */
+TSS_RESULT
+converter_init(struct converter *c)
+{
+	TSS_HPOLICY hPolicy;
+	TSS_RESULT result;
+
+	if ((result = connect_load_srk(&c->hContext, &c->hSRK))) {
+		c->hContext = 0;
+		return result;
+	}
+
+	result = Tspi_Context_LoadKeyByBlob(c->hContext, c->hSRK, destBlobSize, destBlob,
+					    &c->hParent);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_LoadKeyByBlob", result);
+		return result;
+	}
+	if ((result = key_policy(c->hContext, TSS_POLICY_USAGE, &hPolicy)) ||
+	    (result = Tspi_Policy_AssignToObject(hPolicy, c->hParent)) ||
+	    (result = key_policy(c->hContext, TSS_POLICY_USAGE, &c->hUsagePolicy)))
+		return result;
+
+	result = Tspi_Context_CreateObject(c->hContext, TSS_OBJECT_TYPE_MIGDATA, 0, &c->hMigData);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	if ((result = set_attrib(c->hMigData, TSS_MIGATTRIB_MIGRATIONBLOB,
+				 TSS_MIGATTRIB_MIG_MSALIST_PUBKEY_BLOB, maPub.blob, maPub.size)) ||
+	    (result = set_attrib(c->hMigData, TSS_MIGATTRIB_MIGRATIONBLOB,
+				 TSS_MIGATTRIB_MIG_AUTHORITY_PUBKEY_BLOB, maPub.blob, maPub.size)))
+		return result;
+
+	return set_attrib(c->hMigData, TSS_MIGATTRIB_MIGRATIONBLOB,
+			  TSS_MIGATTRIB_MIG_DESTINATION_PUBKEY_BLOB, destPub.blob, destPub.size);
+}
+
+/* the MA's signature of the ticket digests for the source key now set in
+ * hMigData */
+TSS_RESULT
+sign_ticket(TSS_HCONTEXT hContext, TSS_HKEY hMaKey, TSS_HMIGDATA hMigData)
+{
+	TSS_FLAG digests[] = { TSS_MIGATTRIB_MIG_AUTH_AUTHORITY_DIGEST,
+			       TSS_MIGATTRIB_MIG_AUTH_DESTINATION_DIGEST,
+			       TSS_MIGATTRIB_MIG_AUTH_SOURCE_DIGEST };
+	TSS_HHASH hHash;
+	TSS_RESULT result;
+	BYTE *data;
+	UINT32 size, i;
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_HASH, TSS_HASH_SHA1, &hHash);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	for (i = 0; i < 3; i++) {
+		result = Tspi_GetAttribData(hMigData, TSS_MIGATTRIB_MIG_AUTH_DATA, digests[i],
+					    &size, &data);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_GetAttribData", result);
+			goto done;
+		}
+		result = Tspi_Hash_UpdateHashValue(hHash, size, data);
+		Tspi_Context_FreeMemory(hContext, data);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Hash_UpdateHashValue", result);
+			goto done;
+		}
+	}
+
+	if ((result = Tspi_Hash_Sign(hHash, hMaKey, &size, &data))) {
+		print_error("Tspi_Hash_Sign", result);
+		goto done;
+	}
+	result = set_attrib(hMigData, TSS_MIGATTRIB_TICKET_DATA, TSS_MIGATTRIB_TICKET_SIG_VALUE,
+			    data, size);
+	Tspi_Context_FreeMemory(hContext, data);
+done:
+	Tspi_Context_CloseObject(hContext, hHash);
+
+	return result;
+}
+
+/* take one CMK through the source steps and queue it */
+TSS_RESULT
+migrate_one(TSS_HCONTEXT hContext, TSS_HTPM hTPM, TSS_HKEY hSrcParent, TSS_HKEY hMaKey,
+	    TSS_HMIGDATA hMigData, TSS_HPOLICY hUsagePolicy, TSS_HPOLICY hMigPolicy,
+	    struct pub *maDigest, struct pub *maApproval, UINT32 i, struct perf_samples *steps,
+	    UINT64 *waited)
+{
+	struct cmk_job job;
+	TSS_HKEY hCmk;
+	TSS_RESULT result;
+	BYTE *random;
+
+	memset(&job, 0, sizeof(job));
+	job.index = i;
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_RSAKEY, CMK_FLAGS, &hCmk);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+	if ((result = Tspi_Policy_AssignToObject(hUsagePolicy, hCmk)) ||
+	    (result = Tspi_Policy_AssignToObject(hMigPolicy, hCmk))) {
+		print_error("Tspi_Policy_AssignToObject", result);
+		goto done;
+	}
+
+	/* the one approval is good for every CMK */
+	if ((result = set_attrib(hCmk, TSS_TSPATTRIB_KEY_CMKINFO,
+				 TSS_TSPATTRIB_KEYINFO_CMK_MA_DIGEST, maDigest->blob,
+				 maDigest->size)) ||
+	    (result = set_attrib(hCmk, TSS_TSPATTRIB_KEY_CMKINFO,
+				 TSS_TSPATTRIB_KEYINFO_CMK_MA_APPROVAL, maApproval->blob,
+				 maApproval->size)))
+		goto done;
+
+	PERF_TIME(&steps[STEP_CREATE_KEY], result = Tspi_Key_CreateKey(hCmk, hSrcParent, 0));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Key_CreateKey", result);
+		goto done;
+	}
+
+	if ((result = TestSuite_Verifier_Init(&verifiers[i], hContext, hCmk))) {
+		print_error("TestSuite_Verifier_Init", result);
+		goto done;
+	}
+
+	if ((result = get_attrib(hContext, hCmk, TSS_TSPATTRIB_KEY_BLOB,
+				 TSS_TSPATTRIB_KEYBLOB_PUBLIC_KEY, &job.source.blob,
+				 &job.source.size)) ||
+	    (result = set_attrib(hMigData, TSS_MIGATTRIB_MIGRATIONBLOB,
+				 TSS_MIGATTRIB_MIG_SOURCE_PUBKEY_BLOB, job.source.blob,
+				 job.source.size)))
+		goto done;
+
+	PERF_TIME(&steps[STEP_SIGN_TICKET], result = sign_ticket(hContext, hMaKey, hMigData));
+	if (result)
+		goto done;
+
+	PERF_TIME(&steps[STEP_CREATE_TICKET], result = Tspi_TPM_CMKCreateTicket(hTPM, hMaKey,
+										 hMigData));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_CMKCreateTicket", result);
+		goto done;
+	}
+
+	PERF_TIME(&steps[STEP_CREATE_BLOB],
+		  result = Tspi_Key_CMKCreateBlob(hCmk, hSrcParent, hMigData, &job.randomSize,
+						  &random));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Key_CMKCreateBlob", result);
+		goto done;
+	}
+	job.random = malloc(job.randomSize ? job.randomSize : 1);
+	if (job.random == NULL) {
+		Tspi_Context_FreeMemory(hContext, random);
+		result = TSS_E_OUTOFMEMORY;
+		goto done;
+	}
+	memcpy(job.random, random, job.randomSize);
+	Tspi_Context_FreeMemory(hContext, random);
+
+	if ((result = get_attrib(hContext, hMigData, TSS_MIGATTRIB_MIGRATIONBLOB,
+				 TSS_MIGATTRIB_MIG_XOR_BLOB, &job.blob, &job.blobSize)) ||
+	    (result = get_attrib(hContext, hMigData, TSS_MIGATTRIB_TICKET_DATA,
+				 TSS_MIGATTRIB_TICKET_SIG_TICKET, &job.sigTicket,
+				 &job.sigTicketSize)))
+		goto done;
+
+	*waited += perf_queue_put(&queue, &job);
+	memset(&job, 0, sizeof(job));
+done:
+	free_job(&job);
+	Tspi_Context_CloseObject(hContext, hCmk);
+
+	return result;
+}
+
+/* print the per key steps, each merged from where it was measured */
+void
+report_steps(struct perf_samples *steps, struct converter *converters)
+{
+	UINT64 total;
+	UINT32 s, t, i;
+	char name[PERF_NAME_LEN];
+
+	for (t = 0; t < opts.threads; t++) {
+		for (i = 0; i < converters[t].convert.count; i++)
+			perf_samples_add(&steps[STEP_CONVERT], converters[t].convert.ns[i]);
+		for (i = 0; i < converters[t].verify.count; i++)
+			perf_samples_add(&steps[STEP_VERIFY], converters[t].verify.ns[i]);
+	}
+
+	for (s = 0; s < NUM_STEPS; s++) {
+		perf_report(&steps[s], &opts);
+
+		for (total = 0, i = 0; i < steps[s].count; i++)
+			total += steps[s].ns[i];
+		snprintf(name, sizeof(name), "cmk/%s", step_names[s]);
+		perf_metric(name, "total_ms", total / 1000000.0);
+	}
+}
+
+/* time a step that is done once */
+#define ONCE(name, expr)							\
+	do {									\
+		UINT64 once_start = perf_now();				\
+		expr;								\
+		if (result == TSS_SUCCESS)					\
+			perf_metric(name, "us", (perf_now() - once_start) / 1000.0);	\
+	} while (0)
+
+int
+main(int argc, char **argv)
+{
+	struct perf_samples steps[NUM_STEPS];
+	struct converter *converters = NULL;
+	struct pub maDigest = { NULL, 0 }, maApproval = { NULL, 0 };
+	TSS_HCONTEXT hContext;
+	TSS_HTPM hTPM;
+	TSS_HKEY hSRK, hSrcParent, hDestParent, hMaKey;
+	TSS_HPOLICY hPolicy, hUsagePolicy, hMigPolicy;
+	TSS_HMIGDATA hMigData;
+	TSS_RESULT result;
+	BYTE *ticket;
+	UINT32 ticketSize, i, s, t, started = 0, failures = 0;
+	UINT64 start, waited = 0;
+
+	perf_parse_args(argc, argv, &opts, DEFAULT_QUEUE_SIZE);
+	if (opts.version == TESTSUITE_TEST_TSS_1_1)
+		print_NA();
+	if (opts.max == 0)
+		opts.max = 1;
+
+	print_begin_test(fn);
+
+	if ((result = connect_load_all(&hContext, &hSRK, &hTPM))) {
+		print_error("connect_load_all", result);
+		exit(result);
+	}
+
+	if ((result = Tspi_GetPolicyObject(hTPM, TSS_POLICY_USAGE, &hPolicy)) ||
+	    (result = Tspi_Policy_SetSecret(hPolicy, TESTSUITE_OWNER_SECRET_MODE,
+					    TESTSUITE_OWNER_SECRET_LEN, TESTSUITE_OWNER_SECRET))) {
+		print_error("Tspi_Policy_SetSecret", result);
+		goto close;
+	}
+
+	verifiers = calloc(opts.iterations, sizeof(struct testsuite_verifier));
+	converters = calloc(opts.threads, sizeof(struct converter));
+	if (verifiers == NULL || converters == NULL ||
+	    perf_queue_init(&queue, opts.max, sizeof(struct cmk_job))) {
+		result = TSS_E_OUTOFMEMORY;
+		goto free;
+	}
+
+	/* the parents and the MA, as in the cmk tests */
+	if ((result = create_load_key(hContext, PARENT_FLAGS, hSRK, &hSrcParent)) ||
+	    (result = create_load_key(hContext, PARENT_FLAGS, hSRK, &hDestParent)) ||
+	    (result = create_key(hContext, TSS_KEY_STRUCT_KEY12 | TSS_KEY_TYPE_SIGNING |
+				 TSS_KEY_SIZE_2048 | TSS_KEY_VOLATILE | TSS_KEY_AUTHORIZATION,
+				 hSrcParent, &hMaKey)))
+		goto free;
+	if ((result = Tspi_Key_LoadKey(hMaKey, hSrcParent))) {
+		print_error("Tspi_Key_LoadKey", result);
+		goto free;
+	}
+	if ((result = get_attrib(hContext, hMaKey, TSS_TSPATTRIB_KEY_BLOB,
+				 TSS_TSPATTRIB_KEYBLOB_PUBLIC_KEY, &maPub.blob, &maPub.size)) ||
+	    (result = get_attrib(hContext, hDestParent, TSS_TSPATTRIB_KEY_BLOB,
+				 TSS_TSPATTRIB_KEYBLOB_PUBLIC_KEY, &destPub.blob, &destPub.size)) ||
+	    (result = get_attrib(hContext, hDestParent, TSS_TSPATTRIB_KEY_BLOB,
+				 TSS_TSPATTRIB_KEYBLOB_BLOB, &destBlob, &destBlobSize)))
+		goto free;
+
+	if ((result = key_policy(hContext, TSS_POLICY_USAGE, &hUsagePolicy)) ||
+	    (result = key_policy(hContext, TSS_POLICY_MIGRATION, &hMigPolicy)))
+		goto free;
+
+	/* the steps done once for all the keys */
+	ONCE("cmk/restrict", result = Tspi_TPM_CMKSetRestrictions(hTPM, 0));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_CMKSetRestrictions", result);
+		goto free;
+	}
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_MIGDATA, 0, &hMigData);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		goto free;
+	}
+	if ((result = set_attrib(hMigData, TSS_MIGATTRIB_MIGRATIONBLOB,
+				 TSS_MIGATTRIB_MIG_MSALIST_PUBKEY_BLOB, maPub.blob, maPub.size)))
+		goto free;
+
+	ONCE("cmk/approve_ma", result = Tspi_TPM_CMKApproveMA(hTPM, hMigData));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_CMKApproveMA", result);
+		goto free;
+	}
+	if ((result = get_attrib(hContext, hMigData, TSS_MIGATTRIB_AUTHORITY_DATA,
+				 TSS_MIGATTRIB_AUTHORITY_DIGEST, &maDigest.blob, &maDigest.size)) ||
+	    (result = get_attrib(hContext, hMigData, TSS_MIGATTRIB_AUTHORITY_DATA,
+				 TSS_MIGATTRIB_AUTHORITY_APPROVAL_HMAC, &maApproval.blob,
+				 &maApproval.size)))
+		goto free;
+
+	ONCE("cmk/authorize_ticket",
+	     result = Tspi_TPM_AuthorizeMigrationTicket(hTPM, hDestParent,
+							TSS_MS_RESTRICT_APPROVE_DOUBLE,
+							&ticketSize, &ticket));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_AuthorizeMigrationTicket", result);
+		goto free;
+	}
+	if ((result = set_attrib(hMigData, TSS_MIGATTRIB_MIGRATIONTICKET, 0, ticket,
+				 ticketSize)) ||
+	    (result = set_attrib(hMigData, TSS_MIGATTRIB_MIGRATIONBLOB,
+				 TSS_MIGATTRIB_MIG_DESTINATION_PUBKEY_BLOB, destPub.blob,
+				 destPub.size)) ||
+	    (result = set_attrib(hMigData, TSS_MIGATTRIB_MIGRATIONBLOB,
+				 TSS_MIGATTRIB_MIG_AUTHORITY_PUBKEY_BLOB, maPub.blob, maPub.size)))
+		goto free;
+
+	for (t = 0; t < opts.threads; t++) {
+		if ((result = converter_init(&converters[t])))
+			goto free;
+	}
+
+	for (s = 0; s < NUM_STEPS; s++)
+		perf_samples_init(&steps[s], opts.iterations, "cmk/%s", step_names[s]);
+
+	for (; started < opts.threads; started++) {
+		perf_samples_init(&converters[started].convert, opts.iterations,
+				  "converter %u", started);
+		perf_samples_init(&converters[started].verify, opts.iterations,
+				  "converter %u", started);
+		if (pthread_create(&converters[started].thread, NULL, converter_thread,
+				   &converters[started])) {
+			fprintf(stderr, "%s: pthread_create failed\n", fn);
+			perf_samples_free(&converters[started].convert);
+			perf_samples_free(&converters[started].verify);
+			result = TSS_E_INTERNAL_ERROR;
+			goto stop;
+		}
+	}
+
+	start = perf_now();
+	for (i = 0; i < opts.iterations; i++) {
+		if ((result = migrate_one(hContext, hTPM, hSrcParent, hMaKey, hMigData,
+					  hUsagePolicy, hMigPolicy, &maDigest, &maApproval, i,
+					  steps, &waited)))
+			break;
+	}
+	perf_queue_drain(&queue);
+
+	if (result == TSS_SUCCESS) {
+		report_steps(steps, converters);
+
+		for (t = 0; t < opts.threads; t++)
+			failures += converters[t].failures;
+		perf_metric("cmk", "keys_per_s",
+			    opts.iterations * 1000000000.0 / (perf_now() - start));
+		perf_metric("cmk", "source_wait_ms", waited / 1000000.0);
+		perf_metric("cmk", "failures", failures);
+		if (failures)
+			result = TSS_E_FAIL;
+	}
+
+stop:
+	perf_queue_stop(&queue);
+	for (t = 0; t < started; t++) {
+		pthread_join(converters[t].thread, NULL);
+		perf_samples_free(&converters[t].convert);
+		perf_samples_free(&converters[t].verify);
+	}
+	for (s = 0; s < NUM_STEPS; s++)
+		perf_samples_free(&steps[s]);
+free:
+	for (t = 0; converters && t < opts.threads; t++) {
+		if (converters[t].hContext) {
+			Tspi_Context_FreeMemory(converters[t].hContext, NULL);
+			Tspi_Context_Close(converters[t].hContext);
+		}
+	}
+	for (i = 0; verifiers && i < opts.iterations; i++)
+		TestSuite_Verifier_Free(&verifiers[i]);
+	free(converters);
+	perf_queue_free(&queue);
+	free(verifiers);
+	free(maPub.blob);
+	free(destPub.blob);
+	free(destBlob);
+	free(maDigest.blob);
+	free(maApproval.blob);
+close:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
@@ -0,0 +1,443 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	context_lifecycle.c
+ *
+ * DESCRIPTION
+ *	This benchmark measures the cost of the context and object lifecycle
+ *	calls of the TSP: Tspi_Context_Create, Connect and Close,
+ *	Tspi_Context_CreateObject and CloseObject for every object type, and
+ *	Tspi_Context_FreeMemory.
+ *
+ *	Object and memory calls are measured while a growing number of other
+ *	objects (or TSP allocations) are live in the same context, so that
+ *	handle lookups which are linear in the number of live objects show
+ *	up as per-call latency growing with the live count.
+ *
+ * ALGORITHM
+ *	Context:
+ *		Time Create, Connect and Close of a context, -n times
+ *
+ *	Objects, for each object type:
+ *		Create and connect a context
+ *		For live = 0, 10, 100, ... up to -m:
+ *			Grow the set of live objects to 'live', recording
+ *			the RSS growth per object
+ *			Time CreateObject of one more object and CloseObject
+ *			of that newest object
+ *			Time CloseObject of the oldest live object (replacing
+ *			it afterwards, untimed)
+ *		Time closing all live objects
+ *		Close the context
+ *
+ *	Memory:
+ *		Same as above, with live TSP allocations returned by
+ *		Tspi_Hash_GetHashValue, timing FreeMemory of the newest and
+ *		oldest allocation and finally FreeMemory(hContext, NULL)
+ *
+ * USAGE
+ *	context_lifecycle [-v <version>] [-n <samples>] [-m <max live>] [-r]
+ *
+ *	-m is the largest number of live objects to measure with (default
+ *	10000). NV and DELFAMILY objects are only measured for TSS 1.2.
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	None.
+ */
+
+#include "perf.h"
+
+#define DEFAULT_MAX_LIVE	10000
+
+struct object_type
+{
+	const char	*name;
+	TSS_FLAG	type;
+	TSS_FLAG	initFlags;
+	char		version;	/* lowest TSS version with this type */
+};
+
+struct object_type object_types[] = {
+	{ "RSAKEY", TSS_OBJECT_TYPE_RSAKEY, TSS_KEY_SIZE_2048 | TSS_KEY_TYPE_SIGNING,
+	  TESTSUITE_TEST_TSS_1_1 },
+	{ "POLICY", TSS_OBJECT_TYPE_POLICY, TSS_POLICY_USAGE, TESTSUITE_TEST_TSS_1_1 },
+	{ "ENCDATA", TSS_OBJECT_TYPE_ENCDATA, TSS_ENCDATA_SEAL, TESTSUITE_TEST_TSS_1_1 },
+	{ "PCRS", TSS_OBJECT_TYPE_PCRS, 0, TESTSUITE_TEST_TSS_1_1 },
+	{ "HASH", TSS_OBJECT_TYPE_HASH, TSS_HASH_SHA1, TESTSUITE_TEST_TSS_1_1 },
+	{ "NV", TSS_OBJECT_TYPE_NV, 0, TESTSUITE_TEST_TSS_1_2 },
+	{ "DELFAMILY", TSS_OBJECT_TYPE_DELFAMILY, 0, TESTSUITE_TEST_TSS_1_2 },
+	{ NULL, 0, 0, 0 }
+};
+
+char *fn = "context_lifecycle";
+struct perf_opts opts;
+
+TSS_RESULT
+connect_context(TSS_HCONTEXT *hContext)
+{
+	TSS_RESULT result;
+
+	result = Tspi_Context_Create(hContext);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_Create", result);
+		return result;
+	}
+
+	result = Tspi_Context_Connect(*hContext, get_server(GLOBALSERVER));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_Connect", result);
+		Tspi_Context_Close(*hContext);
+		return result;
+	}
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+bench_context(void)
+{
+	struct perf_samples create, connect, close;
+	TSS_HCONTEXT hContext;
+	TSS_RESULT result = TSS_SUCCESS;
+	UINT32 i;
+
+	perf_samples_init(&create, opts.iterations, "context/create");
+	perf_samples_init(&connect, opts.iterations, "context/connect");
+	perf_samples_init(&close, opts.iterations, "context/close");
+
+	for (i = 0; i < opts.iterations; i++) {
+		PERF_TIME(&create, result = Tspi_Context_Create(&hContext));
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Context_Create", result);
+			goto done;
+		}
+
+		PERF_TIME(&connect, result = Tspi_Context_Connect(hContext,
+								   get_server(GLOBALSERVER)));
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Context_Connect", result);
+			Tspi_Context_Close(hContext);
+			goto done;
+		}
+
+		PERF_TIME(&close, result = Tspi_Context_Close(hContext));
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Context_Close", result);
+			goto done;
+		}
+	}
+
+	perf_report(&create, &opts);
+	perf_report(&connect, &opts);
+	perf_report(&close, &opts);
+done:
+	perf_samples_free(&create);
+	perf_samples_free(&connect);
+	perf_samples_free(&close);
+
+	return result;
+}
+
+TSS_RESULT
+bench_object_type(struct object_type *t, TSS_HOBJECT *live)
+{
+	struct perf_samples create, close_new, close_old;
+	TSS_HCONTEXT hContext;
+	TSS_HOBJECT hObject;
+	TSS_RESULT result;
+	UINT64 level, count = 0, oldest = 0, grown, start;
+	long rss_prev, rss;
+	UINT32 i;
+
+	if ((result = connect_context(&hContext)))
+		return result;
+
+	/* some types (DELFAMILY in particular) can't be created directly by
+	 * all TSPs. Report that rather than failing the whole run */
+	result = Tspi_Context_CreateObject(hContext, t->type, t->initFlags, &hObject);
+	if (result != TSS_SUCCESS) {
+		printf("PERF object/%s skipped=1 result=0x%x (%s)\n", t->name, result,
+		       err_string(result));
+		Tspi_Context_Close(hContext);
+		return TSS_SUCCESS;
+	}
+	Tspi_Context_CloseObject(hContext, hObject);
+
+	perf_samples_init(&create, opts.iterations, "object/%s", t->name);
+	perf_samples_init(&close_new, opts.iterations, "object/%s", t->name);
+	perf_samples_init(&close_old, opts.iterations, "object/%s", t->name);
+
+	rss_prev = perf_rss_kb();
+	for (level = 0; level <= opts.max; level = level ? level * 10 : 10) {
+		/* grow the live set to 'level' objects */
+		for (grown = count; count < level; count++) {
+			result = Tspi_Context_CreateObject(hContext, t->type, t->initFlags,
+							   &live[count]);
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Context_CreateObject", result);
+				goto done;
+			}
+		}
+
+		rss = perf_rss_kb();
+		if (count > grown) {
+			snprintf(create.name, sizeof(create.name), "object/%s/live=%llu",
+				 t->name, (unsigned long long)level);
+			perf_metric(create.name, "rss_bytes_per_object",
+				    (rss - rss_prev) * 1024.0 / (count - grown));
+		}
+		rss_prev = rss;
+
+		snprintf(create.name, sizeof(create.name), "object/%s/live=%llu/create",
+			 t->name, (unsigned long long)level);
+		snprintf(close_new.name, sizeof(close_new.name), "object/%s/live=%llu/close_newest",
+			 t->name, (unsigned long long)level);
+		snprintf(close_old.name, sizeof(close_old.name), "object/%s/live=%llu/close_oldest",
+			 t->name, (unsigned long long)level);
+		perf_samples_reset(&create);
+		perf_samples_reset(&close_new);
+		perf_samples_reset(&close_old);
+
+		for (i = 0; i < opts.iterations; i++) {
+			PERF_TIME(&create, result = Tspi_Context_CreateObject(hContext, t->type,
+									       t->initFlags,
+									       &hObject));
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Context_CreateObject", result);
+				goto done;
+			}
+
+			PERF_TIME(&close_new, result = Tspi_Context_CloseObject(hContext, hObject));
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Context_CloseObject", result);
+				goto done;
+			}
+
+			if (count == 0)
+				continue;
+
+			/* close the oldest object, then replace it so that the live
+			 * count stays constant. 'oldest' walks the array as a ring */
+			PERF_TIME(&close_old, result = Tspi_Context_CloseObject(hContext,
+										live[oldest]));
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Context_CloseObject", result);
+				goto done;
+			}
+
+			result = Tspi_Context_CreateObject(hContext, t->type, t->initFlags,
+							   &live[oldest]);
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Context_CreateObject", result);
+				goto done;
+			}
+			oldest = (oldest + 1) % count;
+		}
+
+		perf_report(&create, &opts);
+		perf_report(&close_new, &opts);
+		if (count)
+			perf_report(&close_old, &opts);
+	}
+
+	/* tear down the live set in creation order, as a test would */
+	if (count) {
+		start = perf_now();
+		for (i = 0; i < count; i++) {
+			result = Tspi_Context_CloseObject(hContext, live[(oldest + i) % count]);
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Context_CloseObject", result);
+				goto done;
+			}
+		}
+		snprintf(create.name, sizeof(create.name), "object/%s/live=%llu/close_all",
+			 t->name, (unsigned long long)count);
+		perf_metric(create.name, "us_per_object",
+			    (perf_now() - start) / 1000.0 / count);
+	}
+
+done:
+	perf_samples_free(&create);
+	perf_samples_free(&close_new);
+	perf_samples_free(&close_old);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
+
+TSS_RESULT
+bench_free_memory(BYTE **live)
+{
+	struct perf_samples alloc, free_new, free_old;
+	TSS_HCONTEXT hContext;
+	TSS_HHASH hHash;
+	TSS_RESULT result;
+	BYTE digest[20] = { 0, }, *mem;
+	UINT32 i, size;
+	UINT64 level, count = 0, oldest = 0, start;
+
+	if ((result = connect_context(&hContext)))
+		return result;
+
+	/* Tspi_Hash_GetHashValue returns TSP allocated memory without a trip
+	 * to the TCS, so it isolates the TSP's memory tracking */
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_HASH, TSS_HASH_SHA1,
+					   &hHash);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		Tspi_Context_Close(hContext);
+		return result;
+	}
+
+	result = Tspi_Hash_SetHashValue(hHash, sizeof(digest), digest);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Hash_SetHashValue", result);
+		Tspi_Context_Close(hContext);
+		return result;
+	}
+
+	perf_samples_init(&alloc, opts.iterations, "memory");
+	perf_samples_init(&free_new, opts.iterations, "memory");
+	perf_samples_init(&free_old, opts.iterations, "memory");
+
+	for (level = 0; level <= opts.max; level = level ? level * 10 : 10) {
+		for (; count < level; count++) {
+			result = Tspi_Hash_GetHashValue(hHash, &size, &live[count]);
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Hash_GetHashValue", result);
+				goto done;
+			}
+		}
+
+		snprintf(alloc.name, sizeof(alloc.name), "memory/live=%llu/alloc",
+			 (unsigned long long)level);
+		snprintf(free_new.name, sizeof(free_new.name), "memory/live=%llu/free_newest",
+			 (unsigned long long)level);
+		snprintf(free_old.name, sizeof(free_old.name), "memory/live=%llu/free_oldest",
+			 (unsigned long long)level);
+		perf_samples_reset(&alloc);
+		perf_samples_reset(&free_new);
+		perf_samples_reset(&free_old);
+
+		for (i = 0; i < opts.iterations; i++) {
+			PERF_TIME(&alloc, result = Tspi_Hash_GetHashValue(hHash, &size, &mem));
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Hash_GetHashValue", result);
+				goto done;
+			}
+
+			PERF_TIME(&free_new, result = Tspi_Context_FreeMemory(hContext, mem));
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Context_FreeMemory", result);
+				goto done;
+			}
+
+			if (count == 0)
+				continue;
+
+			PERF_TIME(&free_old, result = Tspi_Context_FreeMemory(hContext,
+									       live[oldest]));
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Context_FreeMemory", result);
+				goto done;
+			}
+
+			result = Tspi_Hash_GetHashValue(hHash, &size, &live[oldest]);
+			if (result != TSS_SUCCESS) {
+				print_error("Tspi_Hash_GetHashValue", result);
+				goto done;
+			}
+			oldest = (oldest + 1) % count;
+		}
+
+		perf_report(&alloc, &opts);
+		perf_report(&free_new, &opts);
+		if (count)
+			perf_report(&free_old, &opts);
+	}
+
+	start = perf_now();
+	result = Tspi_Context_FreeMemory(hContext, NULL);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_FreeMemory", result);
+		goto done;
+	}
+	if (count) {
+		snprintf(alloc.name, sizeof(alloc.name), "memory/live=%llu/free_all",
+			 (unsigned long long)count);
+		perf_metric(alloc.name, "us_per_allocation",
+			    (perf_now() - start) / 1000.0 / count);
+	}
+
+done:
+	perf_samples_free(&alloc);
+	perf_samples_free(&free_new);
+	perf_samples_free(&free_old);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct object_type *t;
+	TSS_HOBJECT *live;
+	BYTE **mem;
+	TSS_RESULT result;
+
+	perf_parse_args(argc, argv, &opts, DEFAULT_MAX_LIVE);
+
+	print_begin_test(fn);
+
+	live = calloc(opts.max ? opts.max : 1, sizeof(TSS_HOBJECT));
+	mem = calloc(opts.max ? opts.max : 1, sizeof(BYTE *));
+	if (live == NULL || mem == NULL) {
+		fprintf(stderr, "calloc of %llu handles failed.\n",
+			(unsigned long long)opts.max);
+		exit(TSS_E_OUTOFMEMORY);
+	}
+
+	if ((result = bench_context()))
+		goto done;
+
+	for (t = object_types; t->name; t++) {
+		if (t->version > opts.version)
+			continue;
+
+		if ((result = bench_object_type(t, live)))
+			goto done;
+	}
+
+	result = bench_free_memory(mem);
+done:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	free(live);
+	free(mem);
+
+	return result;
+}
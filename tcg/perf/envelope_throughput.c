@@ -0,0 +1,312 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+/*
+ * NAME
+ *	envelope_throughput.c
+ *
+ * DESCRIPTION
+ *	This benchmark measures envelope encryption, the way payloads larger
+ *	than a bind or seal are protected: a random data key is bound or
+ *	sealed by the TPM and the payload is encrypted with it in software,
+ *	a chunk of TESTSUITE_ENVELOPE_CHUNK bytes at a time (see
+ *	TestSuite_Envelope_Wrap() in common.c). For payloads from 1KB up to
+ *	-m bytes, four times larger each time, it times
+ *
+ *	envelope/<wrap>/size=<s>/encrypt	a new data key bound (<wrap> is
+ *						bind) or sealed to the SRK (seal),
+ *						then every chunk encrypted
+ *	envelope/<wrap>/size=<s>/decrypt	the data key unbound or unsealed,
+ *						then every chunk decrypted
+ *
+ *	with mb_per_s for the payload, so the small payloads show the cost
+ *	of the TPM and the large ones that of AES. The wrap and unwrap
+ *	alone are reported as envelope/<wrap>/wrap and envelope/<wrap>/unwrap
+ *	over the samples of every size.
+ *
+ *	The payload is made a chunk at a time and each chunk is decrypted
+ *	and compared as soon as it is encrypted, so memory use doesn't grow
+ *	with the payload; the comparison isn't timed.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK
+ *		Create and load a binding key
+ *		Create Enc Data objects for binding and sealing
+ *
+ *	Test, for binding and sealing, for each payload size:
+ *		-n samples of wrap, unwrap, and encryption and decryption of
+ *		the payload, fewer above 1MB
+ *
+ *	Cleanup:
+ *		Free memory associated with the context
+ *		Close the context
+ *
+ * USAGE
+ *	envelope_throughput -v 1.1|1.2 [-n <samples>] [-m <bytes>] [-r]
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	Payloads above 1MB get fewer samples, as many as move -n MB through
+ *	each case but at least one, so the default -m of 1GB takes a
+ *	single sample of its largest payload.
+ */
+
+#include <openssl/rand.h>
+
+#include "perf.h"
+
+#define MIN_PAYLOAD		1024ULL
+#define DEFAULT_MAX_PAYLOAD	(1024ULL * 1024 * 1024)
+#define FULL_SAMPLES_PAYLOAD	(1024ULL * 1024)
+
+struct wrap_mode
+{
+	char		*name;
+	TSS_FLAG	type;
+	TSS_HKEY	hKey;
+	TSS_HENCDATA	hEncData;
+	struct perf_samples wrap, unwrap;
+};
+
+char *fn = "envelope_throughput";
+struct perf_opts opts;
+TSS_HCONTEXT hContext;
+
+BYTE plain[TESTSUITE_ENVELOPE_CHUNK];
+BYTE cipher[TESTSUITE_ENVELOPE_CHUNK + TESTSUITE_ENVELOPE_OVERHEAD];
+BYTE decrypted[TESTSUITE_ENVELOPE_CHUNK + TESTSUITE_ENVELOPE_OVERHEAD];
+
+UINT32
+samples_for(UINT64 size)
+{
+	UINT64 n;
+
+	if (size <= FULL_SAMPLES_PAYLOAD)
+		return opts.iterations;
+
+	n = opts.iterations * FULL_SAMPLES_PAYLOAD / size;
+
+	return n ? n : 1;
+}
+
+/* one envelope of size bytes, adding the time to encrypt and decrypt it to
+ * enc and dec */
+TSS_RESULT
+envelope_sample(struct wrap_mode *mode, UINT64 size, struct perf_samples *enc,
+		struct perf_samples *dec)
+{
+	struct testsuite_envelope e;
+	BYTE key[TESTSUITE_ENVELOPE_KEY_SIZE];
+	TSS_RESULT result;
+	UINT64 start, encNs, decNs, offset, chunk;
+	UINT32 cipherLen, decryptedLen;
+
+	start = perf_now();
+	result = TestSuite_Envelope_Wrap(&e, hContext, mode->hKey, mode->hEncData, mode->type, 0);
+	encNs = perf_now() - start;
+	if (result != TSS_SUCCESS)
+		goto done;
+	perf_samples_add(&mode->wrap, encNs);
+
+	/* the unwrap has to find the same key */
+	memcpy(key, e.key, sizeof(key));
+	memset(e.key, 0, sizeof(e.key));
+	start = perf_now();
+	result = TestSuite_Envelope_Unwrap(&e, hContext, mode->hKey, mode->hEncData);
+	decNs = perf_now() - start;
+	if (result != TSS_SUCCESS)
+		goto done;
+	perf_samples_add(&mode->unwrap, decNs);
+	if (memcmp(key, e.key, sizeof(key))) {
+		fprintf(stderr, "%s: the data key unwrapped doesn't match\n", enc->name);
+		result = TSS_E_FAIL;
+		goto done;
+	}
+
+	for (offset = 0; offset < size; offset += chunk) {
+		chunk = size - offset < TESTSUITE_ENVELOPE_CHUNK ? size - offset :
+								   TESTSUITE_ENVELOPE_CHUNK;
+		/* no two chunks alike */
+		memcpy(plain, &offset, sizeof(offset));
+
+		cipherLen = sizeof(cipher);
+		start = perf_now();
+		result = TestSuite_Envelope_Encrypt(&e, plain, chunk, cipher, &cipherLen);
+		encNs += perf_now() - start;
+		if (result != TSS_SUCCESS) {
+			print_error("TestSuite_Envelope_Encrypt", result);
+			goto done;
+		}
+
+		decryptedLen = sizeof(decrypted);
+		start = perf_now();
+		result = TestSuite_Envelope_Decrypt(&e, cipher, cipherLen, decrypted,
+						    &decryptedLen);
+		decNs += perf_now() - start;
+		if (result != TSS_SUCCESS) {
+			print_error("TestSuite_Envelope_Decrypt", result);
+			goto done;
+		}
+
+		if (decryptedLen != chunk || memcmp(decrypted, plain, chunk)) {
+			fprintf(stderr, "%s: the chunk at offset %llu doesn't decrypt to what "
+				"was encrypted\n", enc->name, (unsigned long long)offset);
+			result = TSS_E_FAIL;
+			goto done;
+		}
+	}
+
+	perf_samples_add(enc, encNs);
+	perf_samples_add(dec, decNs);
+done:
+	TestSuite_Envelope_Free(&e);
+
+	return result;
+}
+
+TSS_RESULT
+bench_mode(struct wrap_mode *mode)
+{
+	struct perf_samples enc, dec;
+	TSS_RESULT result = TSS_SUCCESS;
+	UINT64 size;
+	UINT32 i, n;
+
+	perf_samples_init(&mode->wrap, opts.iterations, "envelope/%s/wrap", mode->name);
+	perf_samples_init(&mode->unwrap, opts.iterations, "envelope/%s/unwrap", mode->name);
+	perf_samples_init(&enc, opts.iterations, "envelope");
+	perf_samples_init(&dec, opts.iterations, "envelope");
+
+	for (size = MIN_PAYLOAD; size <= opts.max && result == TSS_SUCCESS; size *= 4) {
+		snprintf(enc.name, sizeof(enc.name), "envelope/%s/size=%llu/encrypt", mode->name,
+			 (unsigned long long)size);
+		snprintf(dec.name, sizeof(dec.name), "envelope/%s/size=%llu/decrypt", mode->name,
+			 (unsigned long long)size);
+		perf_samples_reset(&enc);
+		perf_samples_reset(&dec);
+		enc.bytes = dec.bytes = size;
+
+		n = samples_for(size);
+		for (i = 0; i < n && result == TSS_SUCCESS; i++)
+			result = envelope_sample(mode, size, &enc, &dec);
+
+		if (result == TSS_SUCCESS) {
+			perf_report(&enc, &opts);
+			perf_report(&dec, &opts);
+		}
+	}
+
+	if (result == TSS_SUCCESS) {
+		perf_report(&mode->wrap, &opts);
+		perf_report(&mode->unwrap, &opts);
+	}
+
+	perf_samples_free(&enc);
+	perf_samples_free(&dec);
+	perf_samples_free(&mode->wrap);
+	perf_samples_free(&mode->unwrap);
+
+	return result;
+}
+
+TSS_RESULT
+create_encdata(TSS_FLAG type, TSS_HENCDATA *hEncData)
+{
+	TSS_HPOLICY hPolicy;
+	TSS_RESULT result;
+
+	if ((result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_ENCDATA, type,
+						hEncData))) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+	if (type != TSS_ENCDATA_SEAL)
+		return TSS_SUCCESS;
+
+	if ((result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_POLICY,
+						TSS_POLICY_USAGE, &hPolicy))) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+	if ((result = Tspi_Policy_SetSecret(hPolicy, TESTSUITE_ENCDATA_SECRET_MODE,
+					    TESTSUITE_ENCDATA_SECRET_LEN,
+					    TESTSUITE_ENCDATA_SECRET))) {
+		print_error("Tspi_Policy_SetSecret", result);
+		return result;
+	}
+	if ((result = Tspi_Policy_AssignToObject(hPolicy, *hEncData)))
+		print_error("Tspi_Policy_AssignToObject", result);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct wrap_mode modes[2];
+	TSS_HKEY hSRK, hBindKey;
+	TSS_RESULT result;
+	UINT32 i;
+
+	perf_parse_args(argc, argv, &opts, DEFAULT_MAX_PAYLOAD);
+	if (opts.max < MIN_PAYLOAD)
+		opts.max = MIN_PAYLOAD;
+
+	print_begin_test(fn);
+
+	if ((result = connect_load_srk(&hContext, &hSRK))) {
+		print_error("connect_load_srk", result);
+		exit(result);
+	}
+
+	if ((result = create_load_key(hContext, TSS_KEY_TYPE_BIND | TSS_KEY_SIZE_2048 |
+				      TSS_KEY_NO_AUTHORIZATION, hSRK, &hBindKey)))
+		goto done;
+
+	/* payload bytes, random but for the offset put in front of each chunk */
+	RAND_bytes(plain, sizeof(plain));
+
+	memset(modes, 0, sizeof(modes));
+	modes[0].name = "bind";
+	modes[0].type = TSS_ENCDATA_BIND;
+	modes[0].hKey = hBindKey;
+	modes[1].name = "seal";
+	modes[1].type = TSS_ENCDATA_SEAL;
+	modes[1].hKey = hSRK;
+
+	for (i = 0; i < 2 && result == TSS_SUCCESS; i++) {
+		if ((result = create_encdata(modes[i].type, &modes[i].hEncData)))
+			break;
+		result = bench_mode(&modes[i]);
+	}
+
+done:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
@@ -0,0 +1,378 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	event_log_scale.c
+ *
+ * DESCRIPTION
+ *	This benchmark measures how event log retrieval scales with the size
+ *	of the TCS event log. The log is grown with Tspi_TPM_PcrExtend
+ *	events of 0 to 1024 bytes, spread over PCRs 8 - 15, to 10^3, 10^4,
+ *	... entries up to -m. At each size the following are timed:
+ *
+ *	eventlog/<n>/extend		Tspi_TPM_PcrExtend with an event
+ *	eventlog/<n>/log		Tspi_TPM_GetEventLog of the whole log
+ *	eventlog/<n>/pcr		Tspi_TPM_GetEvents of all events of one PCR
+ *	eventlog/<n>/range=100		Tspi_TPM_GetEvents of 100 events of one PCR
+ *	eventlog/<n>/event		Tspi_TPM_GetEvent of one event
+ *
+ *	and for each query the growth of the client's peak RSS is printed
+ *	as peak_rss_kb. The per-PCR queries pick among the PCRs which have
+ *	events; if none has, because the log already had <n> events of
+ *	other PCRs, they are skipped and pcrs_with_events=0 is printed.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context
+ *		Connect Context
+ *		GetTPMObject
+ *		Count the events already in the log, per PCR
+ *
+ *	Test, for each log size 10^3 .. -m:
+ *		Extend PCRs 8 - 15 with events until the log has that size
+ *		Time each type of query -n times, at random positions
+ *
+ *	Cleanup:
+ *		Free memory associated with the context
+ *		Close the context
+ *
+ * USAGE
+ *	event_log_scale -v 1.1|1.2 [-n <samples>] [-m <largest log>] [-r]
+ *
+ *	-m defaults to 100000 events.
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	The events added can't be removed from the log, and PCRs 8 - 15 are
+ *	changed. Growing the log to 10^6 events takes hours on a hardware
+ *	TPM, run this against a TPM emulator. Nothing else should extend
+ *	PCRs while it runs, since the per-PCR event counts are tracked by
+ *	the benchmark.
+ */
+
+#include "perf.h"
+
+#define DEFAULT_MAX_EVENTS	100000
+#define FIRST_PCR		8
+#define NUM_PCRS		8
+#define RANGE			100
+
+UINT32 event_sizes[] = { 0, 16, 64, 256, 1024 };
+#define NUM_EVENT_SIZES		(sizeof(event_sizes) / sizeof(UINT32))
+
+char *fn = "event_log_scale";
+struct perf_opts opts;
+TSS_HCONTEXT hContext;
+TSS_HTPM hTPM;
+
+UINT32 total_events;
+UINT32 pcr_events[NUM_PCRS];
+unsigned int seed = 1;
+
+/* count the events in the log, and how many of them belong to our PCRs */
+TSS_RESULT
+count_events()
+{
+	TSS_PCR_EVENT *events;
+	TSS_RESULT result;
+	UINT32 i;
+
+	result = Tspi_TPM_GetEventLog(hTPM, &total_events, &events);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_GetEventLog", result);
+		return result;
+	}
+
+	for (i = 0; i < total_events; i++) {
+		if (events[i].ulPcrIndex >= FIRST_PCR &&
+		    events[i].ulPcrIndex < FIRST_PCR + NUM_PCRS)
+			pcr_events[events[i].ulPcrIndex - FIRST_PCR]++;
+	}
+	Tspi_Context_FreeMemory(hContext, (BYTE *)events);
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+grow_log(UINT32 target, struct perf_samples *s)
+{
+	TSS_PCR_EVENT event;
+	TSS_RESULT result;
+	BYTE data[20], payload[1024];
+	UINT32 pcr, len;
+	BYTE *value;
+
+	memset(data, 0x5a, sizeof(data));
+	memset(payload, 'e', sizeof(payload));
+
+	while (total_events < target) {
+		pcr = total_events % NUM_PCRS;
+
+		memset(&event, 0, sizeof(event));
+		event.ulPcrIndex = FIRST_PCR + pcr;
+		event.eventType = TSS_EV_ACTION;
+		event.ulEventLength = event_sizes[total_events % NUM_EVENT_SIZES];
+		event.rgbEvent = event.ulEventLength ? payload : NULL;
+
+		PERF_TIME(s, result = Tspi_TPM_PcrExtend(hTPM, FIRST_PCR + pcr, sizeof(data),
+							 data, &event, &len, &value));
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_TPM_PcrExtend", result);
+			return result;
+		}
+		Tspi_Context_FreeMemory(hContext, value);
+
+		pcr_events[pcr]++;
+		total_events++;
+	}
+
+	return TSS_SUCCESS;
+}
+
+/* peak RSS growth caused by one call of the query */
+#define PEAK_RSS(name, expr)							\
+	do {									\
+		long rss_before = perf_rss_kb();				\
+		perf_reset_peak_rss();						\
+		expr;								\
+		perf_metric(name, "peak_rss_kb", perf_peak_rss_kb() - rss_before);	\
+	} while (0)
+
+TSS_RESULT
+query_log(struct perf_samples *s)
+{
+	TSS_PCR_EVENT *events;
+	TSS_RESULT result;
+	UINT32 num;
+
+	PERF_TIME(s, result = Tspi_TPM_GetEventLog(hTPM, &num, &events));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_GetEventLog", result);
+		return result;
+	}
+	Tspi_Context_FreeMemory(hContext, (BYTE *)events);
+
+	return TSS_SUCCESS;
+}
+
+/* a random one of the PCRs which have events, NUM_PCRS if none has */
+UINT32
+pick_pcr()
+{
+	UINT32 pcr, with_events = 0, n;
+
+	for (pcr = 0; pcr < NUM_PCRS; pcr++) {
+		if (pcr_events[pcr])
+			with_events++;
+	}
+	if (with_events == 0)
+		return NUM_PCRS;
+
+	n = rand_r(&seed) % with_events;
+	for (pcr = 0; pcr < NUM_PCRS; pcr++) {
+		if (pcr_events[pcr] && n-- == 0)
+			break;
+	}
+
+	return pcr;
+}
+
+TSS_RESULT
+query_events(struct perf_samples *s, UINT32 range)
+{
+	TSS_PCR_EVENT *events;
+	TSS_RESULT result;
+	UINT32 pcr, start = 0, num;
+
+	if ((pcr = pick_pcr()) == NUM_PCRS)
+		return TSS_E_INTERNAL_ERROR;
+	num = pcr_events[pcr];
+	if (range && range < num) {
+		start = rand_r(&seed) % (num - range + 1);
+		num = range;
+	}
+
+	PERF_TIME(s, result = Tspi_TPM_GetEvents(hTPM, FIRST_PCR + pcr, start, &num, &events));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_GetEvents", result);
+		return result;
+	}
+	Tspi_Context_FreeMemory(hContext, (BYTE *)events);
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+query_event(struct perf_samples *s)
+{
+	TSS_PCR_EVENT event;
+	TSS_RESULT result;
+	UINT32 pcr;
+
+	if ((pcr = pick_pcr()) == NUM_PCRS)
+		return TSS_E_INTERNAL_ERROR;
+
+	PERF_TIME(s, result = Tspi_TPM_GetEvent(hTPM, FIRST_PCR + pcr,
+						rand_r(&seed) % pcr_events[pcr], &event));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_GetEvent", result);
+		return result;
+	}
+	Tspi_Context_FreeMemory(hContext, event.rgbPcrValue);
+	Tspi_Context_FreeMemory(hContext, event.rgbEvent);
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+bench_size(UINT32 size)
+{
+	struct perf_samples s;
+	TSS_RESULT result;
+	UINT32 i;
+
+	if (perf_samples_init(&s, opts.iterations, "eventlog/%u/extend", size))
+		return TSS_E_OUTOFMEMORY;
+
+	if ((result = grow_log(size, &s)))
+		goto done;
+	perf_report(&s, &opts);
+
+	/* whole log */
+	snprintf(s.name, sizeof(s.name), "eventlog/%u/log", size);
+	perf_samples_reset(&s);
+	for (i = 0; i < opts.iterations; i++) {
+		if (i == 0)
+			PEAK_RSS(s.name, result = query_log(&s));
+		else
+			result = query_log(&s);
+		if (result)
+			goto done;
+	}
+	perf_report(&s, &opts);
+
+	/* the per-PCR queries need events in PCRs 8 - 15, which there are
+	 * none of if the log already had size events of other PCRs */
+	if (pick_pcr() == NUM_PCRS) {
+		snprintf(s.name, sizeof(s.name), "eventlog/%u", size);
+		perf_metric(s.name, "pcrs_with_events", 0);
+		goto done;
+	}
+
+	/* all events of one PCR */
+	snprintf(s.name, sizeof(s.name), "eventlog/%u/pcr", size);
+	perf_samples_reset(&s);
+	for (i = 0; i < opts.iterations; i++) {
+		if (i == 0)
+			PEAK_RSS(s.name, result = query_events(&s, 0));
+		else
+			result = query_events(&s, 0);
+		if (result)
+			goto done;
+	}
+	perf_report(&s, &opts);
+
+	/* a range of one PCR's events */
+	snprintf(s.name, sizeof(s.name), "eventlog/%u/range=%u", size, RANGE);
+	perf_samples_reset(&s);
+	for (i = 0; i < opts.iterations; i++) {
+		if (i == 0)
+			PEAK_RSS(s.name, result = query_events(&s, RANGE));
+		else
+			result = query_events(&s, RANGE);
+		if (result)
+			goto done;
+	}
+	perf_report(&s, &opts);
+
+	/* a single event */
+	snprintf(s.name, sizeof(s.name), "eventlog/%u/event", size);
+	perf_samples_reset(&s);
+	for (i = 0; i < opts.iterations; i++) {
+		if (i == 0)
+			PEAK_RSS(s.name, result = query_event(&s));
+		else
+			result = query_event(&s);
+		if (result)
+			goto done;
+	}
+	perf_report(&s, &opts);
+
+done:
+	perf_samples_free(&s);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	TSS_RESULT result;
+	UINT64 size;
+
+	perf_parse_args(argc, argv, &opts, DEFAULT_MAX_EVENTS);
+
+	print_begin_test(fn);
+
+	result = Tspi_Context_Create(&hContext);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_Create", result);
+		exit(result);
+	}
+
+	result = Tspi_Context_Connect(hContext, get_server(GLOBALSERVER));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_Connect", result);
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+
+	result = Tspi_Context_GetTpmObject(hContext, &hTPM);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_GetTpmObject", result);
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+
+	if ((result = count_events()))
+		goto done;
+	perf_metric("eventlog/initial", "events", total_events);
+
+	for (size = 1000; size <= opts.max; size *= 10) {
+		/* an existing log may already be larger than the smaller sizes */
+		if (size < total_events)
+			continue;
+
+		if ((result = bench_size(size)))
+			goto done;
+	}
+
+done:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
@@ -0,0 +1,334 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	key_load_chain.c
+ *
+ * DESCRIPTION
+ *	This benchmark measures the load of a registered key against the
+ *	depth of its hierarchy. It registers a chain of -m storage keys
+ *	under the SRK with $TESTSUITE_KEY_FANOUT (default 4) leaf keys under
+ *	each, and loads the leaves
+ *	of each depth three ways:
+ *
+ *	keychain/cold/depth=<d>		Tspi_Context_LoadKeyByUUID in a new
+ *					context, so every ancestor is loaded
+ *	keychain/warm/depth=<d>		Tspi_Context_LoadKeyByUUID in a context
+ *					which holds a sibling of the leaf, so
+ *					the ancestors are in the TCS's key cache
+ *					unless it evicted them
+ *	keychain/pinned/depth=<d>	TestSuite_Key_Cache_Load, whose cache
+ *					keeps the ancestors loaded from the first
+ *					load on; its ancestor_loads must be d - 1
+ *
+ *	The warm and pinned cases also report first_us, the load which
+ *	warmed the cache.
+ *
+ *	<d> counts the SRK's children as depth 1, so the leaves under the
+ *	last storage key are at depth -m + 1.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context, load the SRK
+ *		Unregister what a previous run left behind
+ *		Create and register the storage keys and the leaves
+ *		Close the context
+ *
+ *	Test, for each depth:
+ *		-n cold loads, each in its own context
+ *		-n warm loads in one context
+ *		-n pinned loads in one context
+ *
+ *	Cleanup:
+ *		Unregister the keys
+ *		Free memory associated with the context
+ *		Close the context
+ *
+ * USAGE
+ *	key_load_chain -v 1.2 [-n <loads>] [-m <depth>] [-r]
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	1.2 only. The keys are registered in system persistent storage with
+ *	UUIDs tagged "kchain"; they are unregistered at the end and at the
+ *	start of the next run, if a run is interrupted, as long as that run
+ *	has the same TESTSUITE_KEY_FANOUT.
+ */
+
+#include "perf.h"
+
+#define DEFAULT_DEPTH		6
+#define DEFAULT_FANOUT		4
+#define STORAGE_FLAGS		(TSS_KEY_TYPE_STORAGE | TSS_KEY_SIZE_2048 | \
+				 TSS_KEY_NO_AUTHORIZATION | TSS_KEY_NOT_MIGRATABLE)
+/* the leaf's size hardly changes its load, which is the parent's decryption */
+#define LEAF_FLAGS		(TSS_KEY_TYPE_BIND | TSS_KEY_SIZE_512 | \
+				 TSS_KEY_NO_AUTHORIZATION | TSS_KEY_NOT_MIGRATABLE)
+
+enum { COLD, WARM, PINNED };
+
+char *mode_names[] = { "cold", "warm", "pinned" };
+
+BYTE chain_tag[6] = { 'k', 'c', 'h', 'a', 'i', 'n' };
+
+char *fn = "key_load_chain";
+struct perf_opts opts;
+/* leaves per storage key, from $TESTSUITE_KEY_FANOUT */
+UINT32 fanout = DEFAULT_FANOUT;
+
+/* storage key d of the chain is (d, 0), its leaves (d, 1) to (d, fanout) */
+TSS_UUID
+chain_uuid(UINT32 d, UINT32 leaf)
+{
+	TSS_UUID uuid;
+
+	memset(&uuid, 0, sizeof(TSS_UUID));
+	uuid.ulTimeLow = d;
+	uuid.usTimeMid = leaf;
+	memcpy(uuid.rgbNode, chain_tag, sizeof(chain_tag));
+
+	return uuid;
+}
+
+/* unregister the keys, leaves before their parents */
+void
+unregister_chain(TSS_HCONTEXT hContext, UINT32 depth)
+{
+	TSS_HKEY hKey;
+	UINT32 d, f;
+
+	for (d = depth; d > 0; d--) {
+		for (f = fanout + 1; f > 0; f--) {
+			if (Tspi_Context_UnregisterKey(hContext, TSS_PS_TYPE_SYSTEM,
+						       chain_uuid(d, f - 1), &hKey) == TSS_SUCCESS)
+				Tspi_Context_CloseObject(hContext, hKey);
+		}
+	}
+}
+
+TSS_RESULT
+register_key(TSS_HCONTEXT hContext, TSS_HKEY hKey, TSS_UUID uuid, TSS_UUID parentUuid)
+{
+	TSS_RESULT result;
+
+	result = Tspi_Context_RegisterKey(hContext, hKey, TSS_PS_TYPE_SYSTEM, uuid,
+					  TSS_PS_TYPE_SYSTEM, parentUuid);
+	if (result != TSS_SUCCESS)
+		print_error("Tspi_Context_RegisterKey", result);
+
+	return result;
+}
+
+TSS_RESULT
+create_chain(TSS_HCONTEXT hContext, TSS_HKEY hSRK, UINT32 depth)
+{
+	TSS_HKEY *hStorage, hLeaf;
+	TSS_RESULT result = TSS_SUCCESS;
+	UINT32 d, f;
+
+	if ((hStorage = calloc(depth + 1, sizeof(TSS_HKEY))) == NULL)
+		return TSS_E_OUTOFMEMORY;
+	hStorage[0] = hSRK;
+
+	for (d = 1; d <= depth && result == TSS_SUCCESS; d++) {
+		if ((result = create_load_key(hContext, STORAGE_FLAGS, hStorage[d - 1],
+					      &hStorage[d])) ||
+		    (result = register_key(hContext, hStorage[d], chain_uuid(d, 0),
+					   d == 1 ? SRK_UUID : chain_uuid(d - 1, 0))))
+			break;
+
+		for (f = 1; f <= fanout; f++) {
+			if ((result = create_key(hContext, LEAF_FLAGS, hStorage[d], &hLeaf)))
+				break;
+			result = register_key(hContext, hLeaf, chain_uuid(d, f), chain_uuid(d, 0));
+			Tspi_Context_CloseObject(hContext, hLeaf);
+			if (result)
+				break;
+		}
+	}
+
+	for (d = depth; d > 0; d--) {
+		if (hStorage[d]) {
+			Tspi_Key_UnloadKey(hStorage[d]);
+			Tspi_Context_CloseObject(hContext, hStorage[d]);
+		}
+	}
+	free(hStorage);
+
+	return result;
+}
+
+void
+close_key(TSS_HCONTEXT hContext, TSS_HKEY hKey)
+{
+	Tspi_Key_UnloadKey(hKey);
+	Tspi_Context_CloseObject(hContext, hKey);
+}
+
+void
+close_context(TSS_HCONTEXT hContext)
+{
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+}
+
+/* load a leaf of storage key d, the same way as the previous loads */
+TSS_RESULT
+load_leaf(TSS_HCONTEXT hContext, struct testsuite_key_cache *cache, UINT32 d, UINT32 i,
+	  TSS_HKEY *hKey, struct perf_samples *samples)
+{
+	TSS_UUID uuid = chain_uuid(d, i % fanout + 1);
+	TSS_RESULT result;
+
+	if (cache) {
+		PERF_TIME(samples, result = TestSuite_Key_Cache_Load(cache, TSS_PS_TYPE_SYSTEM,
+								     uuid, hKey));
+		return result;
+	}
+
+	PERF_TIME(samples, result = Tspi_Context_LoadKeyByUUID(hContext, TSS_PS_TYPE_SYSTEM, uuid,
+								hKey));
+	if (result != TSS_SUCCESS)
+		print_error("Tspi_Context_LoadKeyByUUID", result);
+
+	return result;
+}
+
+/* -n loads of the leaves of storage key d */
+TSS_RESULT
+bench_depth(UINT32 d, int mode)
+{
+	struct testsuite_key_cache cache;
+	struct perf_samples samples, first;
+	TSS_HCONTEXT hContext = 0;
+	TSS_HKEY hSRK, hKey, hHeld = 0;
+	TSS_RESULT result = TSS_SUCCESS;
+	char name[PERF_NAME_LEN];
+	UINT32 i;
+
+	snprintf(name, sizeof(name), "keychain/%s/depth=%u", mode_names[mode], d + 1);
+	perf_samples_init(&samples, opts.iterations, "%s", name);
+	perf_samples_init(&first, 1, "%s/first", name);
+
+	if (mode != COLD) {
+		if ((result = connect_load_srk(&hContext, &hSRK)))
+			goto done;
+		if (mode == PINNED)
+			TestSuite_Key_Cache_Init(&cache, hContext, hSRK, 0);
+
+		/* the load which warms the cache isn't a sample */
+		if ((result = load_leaf(hContext, mode == PINNED ? &cache : NULL, d, 0, &hHeld,
+					&first)))
+			goto close;
+		if (mode == PINNED) {
+			close_key(hContext, hHeld);
+			hHeld = 0;
+		}
+	}
+
+	for (i = 0; i < opts.iterations; i++) {
+		if (mode == COLD) {
+			if ((result = connect_load_srk(&hContext, &hSRK)))
+				break;
+			result = load_leaf(hContext, NULL, d, i, &hKey, &samples);
+			close_context(hContext);
+			hContext = 0;
+		} else if ((result = load_leaf(hContext, mode == PINNED ? &cache : NULL, d, i,
+					       &hKey, &samples)) == TSS_SUCCESS)
+			close_key(hContext, hKey);
+		if (result)
+			break;
+	}
+
+	if (result == TSS_SUCCESS) {
+		perf_report(&samples, &opts);
+		if (mode != COLD)
+			perf_metric(name, "first_us", first.ns[0] / 1000.0);
+		if (mode == PINNED)
+			perf_metric(name, "ancestor_loads", cache.misses);
+	}
+
+close:
+	if (hHeld)
+		close_key(hContext, hHeld);
+	if (mode == PINNED)
+		TestSuite_Key_Cache_Free(&cache);
+	if (hContext)
+		close_context(hContext);
+done:
+	perf_samples_free(&samples);
+	perf_samples_free(&first);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	TSS_HCONTEXT hContext;
+	TSS_HKEY hSRK;
+	TSS_RESULT result;
+	UINT32 d;
+	char *env;
+	int mode;
+
+	perf_parse_args(argc, argv, &opts, DEFAULT_DEPTH);
+	if (opts.version == TESTSUITE_TEST_TSS_1_1)
+		print_NA();
+	if (opts.max == 0)
+		opts.max = 1;
+
+	/* the leaf index is the UUID's usTimeMid */
+	if ((env = getenv("TESTSUITE_KEY_FANOUT")) != NULL && *env != '\0') {
+		fanout = strtoul(env, NULL, 0);
+		if (fanout == 0 || fanout >= 0xffff) {
+			fprintf(stderr, "%s: bad TESTSUITE_KEY_FANOUT: %s\n", fn, env);
+			exit(1);
+		}
+	}
+
+	print_begin_test(fn);
+
+	if ((result = connect_load_srk(&hContext, &hSRK))) {
+		print_error("connect_load_srk", result);
+		exit(result);
+	}
+
+	unregister_chain(hContext, opts.max);
+	if ((result = create_chain(hContext, hSRK, opts.max)))
+		goto unregister;
+
+	for (d = 1; d <= opts.max && result == TSS_SUCCESS; d++) {
+		for (mode = COLD; mode <= PINNED && result == TSS_SUCCESS; mode++)
+			result = bench_depth(d, mode);
+	}
+
+unregister:
+	unregister_chain(hContext, opts.max);
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	close_context(hContext);
+
+	return result;
+}
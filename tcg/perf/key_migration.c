@@ -0,0 +1,521 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	key_migration.c
+ *
+ * DESCRIPTION
+ *	This benchmark migrates -n keys from the local TPM to the TPM of the
+ *	tcsd named by TESTSUITE_DEST_SERVER (the local one again if unset),
+ *	the way a whole machine's keys would be moved to new hardware.
+ *
+ *	A storage key made on the destination is the migration authority:
+ *	the source's owner authorizes one TSS_MS_MIGRATE ticket for it, and
+ *	every key is then taken through Tspi_Key_CreateMigrationBlob on the
+ *	source, by this thread, and Tspi_Key_ConvertMigrationBlob under the
+ *	authority key on the destination, by -t converter threads with a
+ *	context each. Between the two is a queue of -m blobs, so the source
+ *	stops when the destination falls behind instead of piling up blobs.
+ *
+ *	Every migrated key is loaded on the destination and signs a digest,
+ *	which is verified in software with the public key the key had on
+ *	the source.
+ *
+ *	migrate/ticket		Tspi_TPM_AuthorizeMigrationTicket, once
+ *	migrate/create_key	making the keys on the source, not in the
+ *				pipeline
+ *	migrate/create_blob	latency of Tspi_Key_CreateMigrationBlob
+ *	migrate/convert		latency of Tspi_Key_ConvertMigrationBlob
+ *	migrate/verify		loading, signing with and verifying a
+ *				migrated key
+ *	migrate			keys_per_s over the pipeline, the time the
+ *				source waited for room in the queue and the
+ *				keys that failed to verify
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Connect to both TPMs and load their SRKs
+ *		Create the migration authority key on the destination and
+ *		load it in each converter's context
+ *		Authorize a migration ticket for it on the source
+ *		Create -n migratable signing keys on the source
+ *		Start -t converter threads
+ *
+ *	Test:
+ *		For each key: Tspi_Key_CreateMigrationBlob, queue the blob
+ *		Each converter: Tspi_Key_ConvertMigrationBlob, load the key,
+ *		sign and verify, unload the key
+ *		Wait for the converters to drain the queue
+ *
+ *	Cleanup:
+ *		Stop the converter threads
+ *		Free memory associated with the contexts
+ *		Close the contexts
+ *
+ * USAGE
+ *	key_migration -v 1.1|1.2 [-n <keys>] [-t <converters>]
+ *		[-m <queue size>] [-r]
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	Both TPMs must be owned with TESTSUITE_OWNER_SECRET and have the SRK
+ *	secret TESTSUITE_SRK_SECRET. The migrated keys are children of the
+ *	migration authority key, which isn't registered, so they are gone
+ *	when the contexts close.
+ */
+
+#include "perf.h"
+
+#define DEFAULT_QUEUE_SIZE	16
+#define KEY_FLAGS		(TSS_KEY_TYPE_SIGNING | TSS_KEY_SIZE_2048 | \
+				 TSS_KEY_NO_AUTHORIZATION | TSS_KEY_MIGRATABLE)
+
+/* a key on the source. The verifier is set up by this thread and used by
+ * the converter the key's blob goes to */
+struct key
+{
+	TSS_HKEY			hKey;
+	struct testsuite_verifier	v;
+};
+
+struct migration_job
+{
+	UINT32		index;
+	BYTE		*random;
+	UINT32		randomSize;
+	BYTE		*blob;
+	UINT32		blobSize;
+};
+
+struct converter
+{
+	pthread_t		thread;
+	TSS_HCONTEXT		hContext;
+	TSS_HKEY		hSRK;
+	TSS_HKEY		hAuthority;
+	struct perf_samples	convert;
+	struct perf_samples	verify;
+	UINT32			failures;
+};
+
+/* the queue of migration_jobs between the source and the converters */
+struct perf_queue queue;
+
+struct key *keys;
+
+char *fn = "key_migration";
+struct perf_opts opts;
+
+/* connect to the destination and load its SRK */
+TSS_RESULT
+dest_connect(TSS_HCONTEXT *hContext, TSS_HKEY *hSRK)
+{
+	TSS_RESULT result;
+
+	if ((result = Tspi_Context_Create(hContext))) {
+		print_error("Tspi_Context_Create", result);
+		return result;
+	}
+
+	if ((result = Tspi_Context_Connect(*hContext, get_server(TESTSUITE_DEST_SERVER)))) {
+		print_error("Tspi_Context_Connect", result);
+		goto close;
+	}
+
+	if ((result = Tspi_Context_LoadKeyByUUID(*hContext, TSS_PS_TYPE_SYSTEM, SRK_UUID, hSRK))) {
+		print_error("Tspi_Context_LoadKeyByUUID", result);
+		goto close;
+	}
+
+	if ((result = set_secret(*hContext, *hSRK, NULL)))
+		goto close;
+
+	return TSS_SUCCESS;
+close:
+	Tspi_Context_Close(*hContext);
+	*hContext = 0;
+	return result;
+}
+
+/* convert one blob and check that the key signs as it did on the source */
+TSS_RESULT
+convert_one(struct converter *c, struct migration_job *job)
+{
+	struct key *k = &keys[job->index];
+	TSS_HKEY hKey;
+	TSS_RESULT result;
+	char what[32];
+	UINT64 start;
+
+	result = Tspi_Context_CreateObject(c->hContext, TSS_OBJECT_TYPE_RSAKEY, KEY_FLAGS, &hKey);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	PERF_TIME(&c->convert,
+		  result = Tspi_Key_ConvertMigrationBlob(hKey, c->hAuthority, job->randomSize,
+							 job->random, job->blobSize, job->blob));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Key_ConvertMigrationBlob", result);
+		goto done;
+	}
+
+	start = perf_now();
+	if ((result = Tspi_Key_LoadKey(hKey, c->hAuthority))) {
+		print_error("Tspi_Key_LoadKey", result);
+		goto done;
+	}
+
+	/* it must sign as the key did on the source */
+	snprintf(what, sizeof(what), "migrated key %u", job->index);
+	if ((result = perf_sign_verify(c->hContext, hKey, &k->v, what)) == TSS_SUCCESS)
+		perf_samples_add(&c->verify, perf_now() - start);
+	Tspi_Key_UnloadKey(hKey);
+done:
+	Tspi_Context_CloseObject(c->hContext, hKey);
+
+	return result;
+}
+
+void *
+converter_thread(void *arg)
+{
+	struct converter *c = arg;
+	struct migration_job job;
+
+	while (perf_queue_get(&queue, &job)) {
+		if (convert_one(c, &job))
+			c->failures++;
+
+		free(job.random);
+		free(job.blob);
+		perf_queue_done(&queue);
+	}
+
+	return NULL;
+}
+
+/* queue a migration blob, copying it out of TSS memory. Returns the time
+ * spent waiting for room */
+UINT64
+queue_blob(UINT32 index, UINT32 randomSize, BYTE *random, UINT32 blobSize, BYTE *blob)
+{
+	struct migration_job job;
+
+	job.index = index;
+	job.randomSize = randomSize;
+	job.blobSize = blobSize;
+	job.random = malloc(randomSize ? randomSize : 1);
+	job.blob = malloc(blobSize);
+	if (job.random == NULL || job.blob == NULL) {
+		free(job.random);
+		free(job.blob);
+		return (UINT64)-1;
+	}
+	memcpy(job.random, random, randomSize);
+	memcpy(job.blob, blob, blobSize);
+
+	return perf_queue_put(&queue, &job);
+}
+
+/* the migration authority: a storage key on the destination, loaded in each
+ * converter's context, and its public key in the source's context */
+TSS_RESULT
+create_authority(TSS_HCONTEXT hContext, struct converter *converters, TSS_HKEY *hAuthorityPub)
+{
+	TSS_HCONTEXT hDestContext;
+	TSS_HKEY hDestSRK, hAuthority;
+	TSS_RESULT result;
+	BYTE *blob, *pub;
+	UINT32 blobSize, pubSize, t;
+
+	if ((result = dest_connect(&hDestContext, &hDestSRK)))
+		return result;
+
+	if ((result = create_key(hDestContext, TSS_KEY_TYPE_STORAGE | TSS_KEY_SIZE_2048 |
+				 TSS_KEY_NO_AUTHORIZATION, hDestSRK, &hAuthority)))
+		goto close;
+
+	if ((result = Tspi_GetAttribData(hAuthority, TSS_TSPATTRIB_KEY_BLOB,
+					 TSS_TSPATTRIB_KEYBLOB_BLOB, &blobSize, &blob)) ||
+	    (result = Tspi_GetAttribData(hAuthority, TSS_TSPATTRIB_KEY_BLOB,
+					 TSS_TSPATTRIB_KEYBLOB_PUBLIC_KEY, &pubSize, &pub))) {
+		print_error("Tspi_GetAttribData", result);
+		goto close;
+	}
+
+	for (t = 0; t < opts.threads; t++) {
+		if ((result = dest_connect(&converters[t].hContext, &converters[t].hSRK)))
+			goto close;
+		result = Tspi_Context_LoadKeyByBlob(converters[t].hContext, converters[t].hSRK,
+						    blobSize, blob, &converters[t].hAuthority);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Context_LoadKeyByBlob", result);
+			goto close;
+		}
+	}
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_RSAKEY,
+					   TSS_KEY_TYPE_STORAGE | TSS_KEY_SIZE_2048 |
+					   TSS_KEY_NO_AUTHORIZATION, hAuthorityPub);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		goto close;
+	}
+
+	result = Tspi_SetAttribData(*hAuthorityPub, TSS_TSPATTRIB_KEY_BLOB,
+				    TSS_TSPATTRIB_KEYBLOB_PUBLIC_KEY, pubSize, pub);
+	if (result != TSS_SUCCESS)
+		print_error("Tspi_SetAttribData", result);
+close:
+	Tspi_Context_FreeMemory(hDestContext, NULL);
+	Tspi_Context_Close(hDestContext);
+
+	return result;
+}
+
+/* the keys to migrate, on the source, and a verifier of each */
+TSS_RESULT
+create_keys(TSS_HCONTEXT hContext, TSS_HKEY hSRK)
+{
+	struct perf_samples samples;
+	TSS_HPOLICY hMigPolicy;
+	TSS_RESULT result;
+	UINT32 i;
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_POLICY, TSS_POLICY_MIGRATION,
+					   &hMigPolicy);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+	result = Tspi_Policy_SetSecret(hMigPolicy, TESTSUITE_KEY_SECRET_MODE,
+				       TESTSUITE_KEY_SECRET_LEN, TESTSUITE_KEY_SECRET);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Policy_SetSecret", result);
+		return result;
+	}
+
+	perf_samples_init(&samples, opts.iterations, "migrate/create_key");
+	for (i = 0; i < opts.iterations; i++) {
+		result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_RSAKEY, KEY_FLAGS,
+						   &keys[i].hKey);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Context_CreateObject", result);
+			break;
+		}
+		if ((result = Tspi_Policy_AssignToObject(hMigPolicy, keys[i].hKey))) {
+			print_error("Tspi_Policy_AssignToObject", result);
+			break;
+		}
+
+		PERF_TIME(&samples, result = Tspi_Key_CreateKey(keys[i].hKey, hSRK, 0));
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Key_CreateKey", result);
+			break;
+		}
+
+		result = TestSuite_Verifier_Init(&keys[i].v, hContext, keys[i].hKey);
+		if (result != TSS_SUCCESS) {
+			print_error("TestSuite_Verifier_Init", result);
+			break;
+		}
+	}
+	if (result == TSS_SUCCESS)
+		perf_report(&samples, &opts);
+	perf_samples_free(&samples);
+
+	return result;
+}
+
+TSS_RESULT
+bench_migrate(TSS_HCONTEXT hContext, TSS_HKEY hSRK, UINT32 ticketSize, BYTE *ticket,
+	      struct converter *converters)
+{
+	struct perf_samples create, convert, verify;
+	TSS_RESULT result = TSS_SUCCESS;
+	BYTE *random, *blob;
+	UINT32 randomSize, blobSize, i, t, failures = 0;
+	UINT64 start, wait, waited = 0;
+
+	perf_samples_init(&create, opts.iterations, "migrate/create_blob");
+
+	start = perf_now();
+	for (i = 0; i < opts.iterations; i++) {
+		PERF_TIME(&create,
+			  result = Tspi_Key_CreateMigrationBlob(keys[i].hKey, hSRK, ticketSize,
+								ticket, &randomSize, &random,
+								&blobSize, &blob));
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Key_CreateMigrationBlob", result);
+			break;
+		}
+
+		wait = queue_blob(i, randomSize, random, blobSize, blob);
+		Tspi_Context_FreeMemory(hContext, random);
+		Tspi_Context_FreeMemory(hContext, blob);
+		if (wait == (UINT64)-1) {
+			result = TSS_E_OUTOFMEMORY;
+			break;
+		}
+		waited += wait;
+
+		/* the source is done with the key */
+		Tspi_Context_CloseObject(hContext, keys[i].hKey);
+		keys[i].hKey = 0;
+	}
+	perf_queue_drain(&queue);
+
+	if (result == TSS_SUCCESS) {
+		perf_report(&create, &opts);
+
+		perf_samples_init(&convert, opts.iterations, "migrate/convert");
+		perf_samples_init(&verify, opts.iterations, "migrate/verify");
+		for (t = 0; t < opts.threads; t++) {
+			for (i = 0; i < converters[t].convert.count; i++)
+				perf_samples_add(&convert, converters[t].convert.ns[i]);
+			for (i = 0; i < converters[t].verify.count; i++)
+				perf_samples_add(&verify, converters[t].verify.ns[i]);
+			failures += converters[t].failures;
+		}
+		perf_report(&convert, &opts);
+		perf_report(&verify, &opts);
+		perf_samples_free(&convert);
+		perf_samples_free(&verify);
+
+		perf_metric("migrate", "keys_per_s",
+			    opts.iterations * 1000000000.0 / (perf_now() - start));
+		perf_metric("migrate", "source_wait_ms", waited / 1000000.0);
+		perf_metric("migrate", "failures", failures);
+		if (failures)
+			result = TSS_E_FAIL;
+	}
+
+	perf_samples_free(&create);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct converter *converters;
+	TSS_HCONTEXT hContext;
+	TSS_HTPM hTPM;
+	TSS_HKEY hSRK, hAuthorityPub;
+	TSS_HPOLICY hPolicy;
+	TSS_RESULT result;
+	BYTE *ticket;
+	UINT32 ticketSize, i, t, started = 0;
+	UINT64 start;
+
+	perf_parse_args(argc, argv, &opts, DEFAULT_QUEUE_SIZE);
+	if (opts.max == 0)
+		opts.max = 1;
+
+	print_begin_test(fn);
+
+	if ((result = connect_load_all(&hContext, &hSRK, &hTPM))) {
+		print_error("connect_load_all", result);
+		exit(result);
+	}
+
+	if ((result = Tspi_GetPolicyObject(hTPM, TSS_POLICY_USAGE, &hPolicy)) ||
+	    (result = Tspi_Policy_SetSecret(hPolicy, TESTSUITE_OWNER_SECRET_MODE,
+					    TESTSUITE_OWNER_SECRET_LEN, TESTSUITE_OWNER_SECRET))) {
+		print_error("Tspi_Policy_SetSecret", result);
+		goto close;
+	}
+
+	keys = calloc(opts.iterations, sizeof(struct key));
+	converters = calloc(opts.threads, sizeof(struct converter));
+	if (keys == NULL || converters == NULL ||
+	    perf_queue_init(&queue, opts.max, sizeof(struct migration_job))) {
+		result = TSS_E_OUTOFMEMORY;
+		goto free;
+	}
+
+	if ((result = create_authority(hContext, converters, &hAuthorityPub)))
+		goto stop;
+
+	start = perf_now();
+	result = Tspi_TPM_AuthorizeMigrationTicket(hTPM, hAuthorityPub, TSS_MS_MIGRATE,
+						   &ticketSize, &ticket);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_AuthorizeMigrationTicket", result);
+		goto stop;
+	}
+	perf_metric("migrate/ticket", "us", (perf_now() - start) / 1000.0);
+
+	if ((result = create_keys(hContext, hSRK)))
+		goto stop;
+
+	for (; started < opts.threads; started++) {
+		perf_samples_init(&converters[started].convert, opts.iterations,
+				  "converter %u", started);
+		perf_samples_init(&converters[started].verify, opts.iterations,
+				  "converter %u", started);
+		if (pthread_create(&converters[started].thread, NULL, converter_thread,
+				   &converters[started])) {
+			fprintf(stderr, "%s: pthread_create failed\n", fn);
+			perf_samples_free(&converters[started].convert);
+			perf_samples_free(&converters[started].verify);
+			result = TSS_E_INTERNAL_ERROR;
+			goto stop;
+		}
+	}
+
+	result = bench_migrate(hContext, hSRK, ticketSize, ticket, converters);
+
+stop:
+	perf_queue_stop(&queue);
+	for (t = 0; t < started; t++) {
+		pthread_join(converters[t].thread, NULL);
+		perf_samples_free(&converters[t].convert);
+		perf_samples_free(&converters[t].verify);
+	}
+	for (t = 0; t < opts.threads; t++) {
+		if (converters[t].hContext) {
+			Tspi_Context_FreeMemory(converters[t].hContext, NULL);
+			Tspi_Context_Close(converters[t].hContext);
+		}
+	}
+free:
+	for (i = 0; keys && i < opts.iterations; i++) {
+		if (keys[i].hKey)
+			Tspi_Context_CloseObject(hContext, keys[i].hKey);
+		TestSuite_Verifier_Free(&keys[i].v);
+	}
+	free(converters);
+	perf_queue_free(&queue);
+	free(keys);
+close:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
@@ -0,0 +1,323 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	nv_throughput.c
+ *
+ * DESCRIPTION
+ *	This benchmark measures Tspi_NV_WriteValue and Tspi_NV_ReadValue
+ *	throughput by chunk size, for NV spaces of different sizes and
+ *	permission modes:
+ *
+ *	owner	TPM_NV_PER_OWNERWRITE | TPM_NV_PER_OWNERREAD, every access is
+ *		authorized with the owner secret
+ *	auth	TPM_NV_PER_AUTHWRITE | TPM_NV_PER_AUTHREAD, every access is
+ *		authorized with the secret of the NV object's policy
+ *	open	no permission bits, accesses need no authorization
+ *
+ *	The difference between the open mode and the two authorized modes
+ *	at the same chunk size is the cost of the auth session.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context
+ *		Connect Context
+ *		Get TPM Object, set the owner secret in its policy
+ *
+ *	Test, for each mode and space size up to -m:
+ *		Define the space at NV_INDEX_BASE
+ *		For each chunk size that fits the space:
+ *			Time -n writes of one chunk, walking the space
+ *			Time -n reads of one chunk, walking the space
+ *		Release the space
+ *
+ *	Cleanup:
+ *		Free memory associated with the context
+ *		Close the context
+ *
+ * USAGE
+ *	nv_throughput -v 1.2 [-n <samples>] [-m <largest space size>] [-r]
+ *
+ *	-m is the size in bytes of the largest space defined (default 2048).
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	TSS 1.2 only. Every write sample is a write to the TPM's NV storage;
+ *	on real hardware keep -n small. Unless the TPM's NV is locked
+ *	(TSS_TPMSTATUS_NV_LOCK), the TPM limits the number of writes and the
+ *	benchmark will stop with TPM_E_MAXNVWRITES.
+ */
+
+#include "perf.h"
+
+#define NV_INDEX_BASE		0x00011200
+#define DEFAULT_MAX_SPACE	2048
+
+struct nv_mode
+{
+	const char	*name;
+	UINT32		permissions;
+	TSS_BOOL	use_policy;	/* assign TESTSUITE_KEY_SECRET to the NV object */
+};
+
+struct nv_mode nv_modes[] = {
+	{ "open", 0, FALSE },
+	{ "auth", TPM_NV_PER_AUTHWRITE | TPM_NV_PER_AUTHREAD, TRUE },
+	{ "owner", TPM_NV_PER_OWNERWRITE | TPM_NV_PER_OWNERREAD, FALSE },
+	{ NULL, 0, FALSE }
+};
+
+UINT32 space_sizes[] = { 32, 256, 1024, 2048, 4096, 0 };
+UINT32 chunk_sizes[] = { 1, 16, 64, 256, 512, 1024, 0 };
+
+char *fn = "nv_throughput";
+struct perf_opts opts;
+TSS_HCONTEXT hContext;
+
+TSS_RESULT
+define_space(struct nv_mode *mode, UINT32 index, UINT32 size, TSS_HNVSTORE *hNVStore)
+{
+	TSS_HPOLICY hPolicy;
+	TSS_RESULT result;
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_NV, 0, hNVStore);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	if (mode->use_policy) {
+		result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_POLICY,
+						   TSS_POLICY_USAGE, &hPolicy);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Context_CreateObject", result);
+			return result;
+		}
+
+		result = Tspi_Policy_SetSecret(hPolicy, TESTSUITE_KEY_SECRET_MODE,
+					       TESTSUITE_KEY_SECRET_LEN, TESTSUITE_KEY_SECRET);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Policy_SetSecret", result);
+			return result;
+		}
+
+		result = Tspi_Policy_AssignToObject(hPolicy, *hNVStore);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_Policy_AssignToObject", result);
+			return result;
+		}
+	}
+
+	result = Tspi_SetAttribUint32(*hNVStore, TSS_TSPATTRIB_NV_INDEX, 0, index);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_SetAttribUint32 for setting NV index", result);
+		return result;
+	}
+
+	result = Tspi_SetAttribUint32(*hNVStore, TSS_TSPATTRIB_NV_PERMISSIONS, 0,
+				      mode->permissions);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_SetAttribUint32 for setting permission", result);
+		return result;
+	}
+
+	result = Tspi_SetAttribUint32(*hNVStore, TSS_TSPATTRIB_NV_DATASIZE, 0, size);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_SetAttribUint32 for setting data size", result);
+		return result;
+	}
+
+	/* a previous, interrupted run may have left the space defined */
+	Tspi_NV_ReleaseSpace(*hNVStore);
+
+	result = Tspi_NV_DefineSpace(*hNVStore, 0, 0);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_NV_DefineSpace", result);
+		return result;
+	}
+
+	return TSS_SUCCESS;
+}
+
+TSS_RESULT
+bench_space(struct nv_mode *mode, UINT32 size, BYTE *data)
+{
+	struct perf_samples wr, rd;
+	TSS_HNVSTORE hNVStore;
+	TSS_RESULT result;
+	UINT32 c, i, chunk, offset, len;
+	BYTE *out;
+
+	if ((result = define_space(mode, NV_INDEX_BASE, size, &hNVStore)))
+		return result;
+
+	perf_samples_init(&wr, opts.iterations, "nv");
+	perf_samples_init(&rd, opts.iterations, "nv");
+
+	for (c = 0; chunk_sizes[c] && chunk_sizes[c] <= size; c++) {
+		chunk = chunk_sizes[c];
+
+		snprintf(wr.name, sizeof(wr.name), "nv/%s/space=%u/chunk=%u/write",
+			 mode->name, size, chunk);
+		snprintf(rd.name, sizeof(rd.name), "nv/%s/space=%u/chunk=%u/read",
+			 mode->name, size, chunk);
+		perf_samples_reset(&wr);
+		perf_samples_reset(&rd);
+		wr.bytes = rd.bytes = chunk;
+
+		for (i = 0; i < opts.iterations; i++) {
+			offset = (i % (size / chunk)) * chunk;
+
+			PERF_TIME(&wr, result = Tspi_NV_WriteValue(hNVStore, offset, chunk,
+								   data));
+			if (result != TSS_SUCCESS)
+				break;
+		}
+
+		/* chunks larger than the TPM's input buffer are expected to fail.
+		 * Report it and move on to the next space */
+		if (result != TSS_SUCCESS) {
+			printf("PERF %s failed=1 result=0x%x (%s)\n", wr.name, result,
+			       err_string(result));
+			if (TSS_ERROR_CODE(result) == TPM_E_MAXNVWRITES)
+				goto done;
+			result = TSS_SUCCESS;
+			break;
+		}
+
+		for (i = 0; i < opts.iterations; i++) {
+			offset = (i % (size / chunk)) * chunk;
+			len = chunk;
+
+			PERF_TIME(&rd, result = Tspi_NV_ReadValue(hNVStore, offset, &len, &out));
+			if (result != TSS_SUCCESS)
+				break;
+
+			if (len != chunk || memcmp(out, data, chunk)) {
+				fprintf(stderr, "%s: read back %u bytes at offset %u which "
+					"don't match what was written\n", rd.name, len, offset);
+				Tspi_Context_FreeMemory(hContext, out);
+				result = TSS_E_FAIL;
+				goto done;
+			}
+			Tspi_Context_FreeMemory(hContext, out);
+		}
+
+		if (result != TSS_SUCCESS) {
+			printf("PERF %s failed=1 result=0x%x (%s)\n", rd.name, result,
+			       err_string(result));
+			result = TSS_SUCCESS;
+			break;
+		}
+
+		perf_report(&wr, &opts);
+		perf_report(&rd, &opts);
+	}
+
+done:
+	perf_samples_free(&wr);
+	perf_samples_free(&rd);
+
+	if (Tspi_NV_ReleaseSpace(hNVStore) != TSS_SUCCESS)
+		fprintf(stderr, "%s: could not release NV index 0x%x\n", fn, NV_INDEX_BASE);
+	Tspi_Context_CloseObject(hContext, hNVStore);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct nv_mode *mode;
+	TSS_HTPM hTPM;
+	TSS_HPOLICY hPolicy;
+	TSS_RESULT result;
+	BYTE *data;
+	UINT32 s;
+
+	perf_parse_args(argc, argv, &opts, DEFAULT_MAX_SPACE);
+	if (opts.version == TESTSUITE_TEST_TSS_1_1)
+		print_NA();
+
+	print_begin_test(fn);
+
+	result = Tspi_Context_Create(&hContext);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_Create", result);
+		exit(result);
+	}
+
+	result = Tspi_Context_Connect(hContext, get_server(GLOBALSERVER));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_Connect", result);
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+
+	result = Tspi_Context_GetTpmObject(hContext, &hTPM);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_GetTpmObject", result);
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+
+	result = Tspi_GetPolicyObject(hTPM, TSS_POLICY_USAGE, &hPolicy);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_GetPolicyObject", result);
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+
+	result = Tspi_Policy_SetSecret(hPolicy, TESTSUITE_OWNER_SECRET_MODE,
+				       TESTSUITE_OWNER_SECRET_LEN, TESTSUITE_OWNER_SECRET);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Policy_SetSecret", result);
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+
+	if ((data = malloc(opts.max)) == NULL) {
+		fprintf(stderr, "malloc of %llu bytes failed.\n", (unsigned long long)opts.max);
+		Tspi_Context_Close(hContext);
+		exit(TSS_E_OUTOFMEMORY);
+	}
+	for (s = 0; s < opts.max; s++)
+		data[s] = (BYTE)s;
+
+	for (mode = nv_modes; mode->name; mode++) {
+		for (s = 0; space_sizes[s] && space_sizes[s] <= opts.max; s++) {
+			if ((result = bench_space(mode, space_sizes[s], data)))
+				goto done;
+		}
+	}
+
+done:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	free(data);
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
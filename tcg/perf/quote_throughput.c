@@ -0,0 +1,349 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	quote_throughput.c
+ *
+ * DESCRIPTION
+ *	This benchmark measures attestation throughput: Tspi_TPM_Quote, and
+ *	on 1.2 Tspi_TPM_Quote2 with and without version info, for PCR
+ *	selections of increasing size.
+ *
+ *	Every quote is handed to a pool of -t verifier threads, which check
+ *	in software that the quote carries the nonce that was asked for and
+ *	that its signature verifies against the quoting key's public key,
+ *	each with its own TestSuite_Verifier. The TPM side and the verifier side are
+ *	reported separately, so it can be seen whether the verifiers keep up
+ *	with the TPM:
+ *
+ *	quote/<type>/pcrs=<n>/tpm	latency of the Tspi call
+ *	quote/<type>/pcrs=<n>/verify	latency of one software verification
+ *	quote/<type>/pcrs=<n>		verified_per_s over the whole case
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context
+ *		Connect Context
+ *		Load SRK, get the TPM object
+ *		Create and load a 2048 bit signing key
+ *		Start -t verifier threads
+ *
+ *	Test, for each quote type and PCR selection size up to -m:
+ *		Select PCRs 0 .. n-1
+ *		-n times: quote with a fresh nonce, queue the result
+ *		Wait for the verifiers to drain the queue
+ *
+ *	Cleanup:
+ *		Stop the verifier threads
+ *		Free memory associated with the context
+ *		Close the context
+ *
+ * USAGE
+ *	quote_throughput -v 1.1|1.2 [-n <samples>] [-t <verifiers>]
+ *		[-m <largest PCR selection>] [-r]
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	None.
+ */
+
+#include <pthread.h>
+
+#include "perf.h"
+
+#define DEFAULT_MAX_PCRS	24
+#define QUEUE_SIZE		64
+#define NONCE_SIZE		20
+
+/* offset of the nonce in the signed TPM_QUOTE_INFO and TPM_QUOTE_INFO2 */
+#define QUOTE_INFO_NONCE_OFFSET		(4 + 4 + 20)
+#define QUOTE_INFO2_NONCE_OFFSET	(2 + 4)
+
+struct quote_job
+{
+	BYTE		nonce[NONCE_SIZE];
+	UINT32		nonceOffset;
+	BYTE		*data;
+	UINT32		dataLen;
+	BYTE		*sig;
+	UINT32		sigLen;
+};
+
+/* a verifier thread. v is set up by the main thread, for the quoting key */
+struct verifier
+{
+	pthread_t			thread;
+	struct testsuite_verifier	v;
+	struct perf_samples		samples;
+	UINT32				failures;
+};
+
+/* the queue of quote_jobs between the quoting thread and the verifiers */
+struct perf_queue queue;
+
+char *fn = "quote_throughput";
+struct perf_opts opts;
+TSS_HCONTEXT hContext;
+
+void *
+verifier_thread(void *arg)
+{
+	struct verifier *v = arg;
+	struct quote_job job;
+	TSS_VALIDATION valData;
+	TSS_RESULT result;
+
+	while (perf_queue_get(&queue, &job)) {
+		memset(&valData, 0, sizeof(valData));
+		valData.rgbData = job.data;
+		valData.ulDataLength = job.dataLen;
+		valData.rgbValidationData = job.sig;
+		valData.ulValidationDataLength = job.sigLen;
+
+		PERF_TIME(&v->samples, result = TestSuite_Verifier_Verify(&v->v, &valData));
+		if (result != TSS_SUCCESS ||
+		    job.dataLen < job.nonceOffset + NONCE_SIZE ||
+		    memcmp(job.data + job.nonceOffset, job.nonce, NONCE_SIZE))
+			v->failures++;
+
+		free(job.data);
+		free(job.sig);
+		perf_queue_done(&queue);
+	}
+
+	return NULL;
+}
+
+/* queue a quote for verification, copying it out of TSS memory */
+int
+queue_quote(TSS_VALIDATION *validation, UINT32 nonceOffset)
+{
+	struct quote_job job;
+
+	memcpy(job.nonce, validation->rgbExternalData, NONCE_SIZE);
+	job.nonceOffset = nonceOffset;
+	job.dataLen = validation->ulDataLength;
+	job.sigLen = validation->ulValidationDataLength;
+	job.data = malloc(job.dataLen);
+	job.sig = malloc(job.sigLen);
+	if (job.data == NULL || job.sig == NULL) {
+		free(job.data);
+		free(job.sig);
+		return -1;
+	}
+	memcpy(job.data, validation->rgbData, job.dataLen);
+	memcpy(job.sig, validation->rgbValidationData, job.sigLen);
+
+	perf_queue_put(&queue, &job);
+
+	return 0;
+}
+
+TSS_RESULT
+bench_quote(TSS_HTPM hTPM, TSS_HKEY hKey, UINT32 numPcrs, int quote2, TSS_BOOL addVersion,
+	    struct verifier *verifiers)
+{
+	struct perf_samples tpm, verify;
+	TSS_VALIDATION validation;
+	TSS_HPCRS hPcrs;
+	TSS_RESULT result;
+	UINT32 i, t, versionInfoSize, failures = 0;
+	BYTE nonce[NONCE_SIZE], *versionInfo;
+	char name[PERF_NAME_LEN];
+	UINT64 start;
+
+	snprintf(name, sizeof(name), "quote/%s/pcrs=%u", !quote2 ? "quote" :
+		 addVersion ? "quote2_version" : "quote2", numPcrs);
+
+	result = Tspi_Context_CreateObject(hContext, TSS_OBJECT_TYPE_PCRS,
+					   quote2 ? TSS_PCRS_STRUCT_INFO_SHORT : 0, &hPcrs);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_CreateObject", result);
+		return result;
+	}
+
+	for (i = 0; i < numPcrs; i++) {
+		if (quote2)
+			result = Tspi_PcrComposite_SelectPcrIndexEx(hPcrs, i,
+								    TSS_PCRS_DIRECTION_RELEASE);
+		else
+			result = Tspi_PcrComposite_SelectPcrIndex(hPcrs, i);
+		if (result != TSS_SUCCESS) {
+			print_error("Tspi_PcrComposite_SelectPcrIndex", result);
+			Tspi_Context_CloseObject(hContext, hPcrs);
+			return result;
+		}
+	}
+
+	perf_samples_init(&tpm, opts.iterations, "%s/tpm", name);
+	for (t = 0; t < opts.threads; t++)
+		perf_samples_reset(&verifiers[t].samples);
+
+	start = perf_now();
+	for (i = 0; i < opts.iterations; i++) {
+		memset(&validation, 0, sizeof(validation));
+		memcpy(nonce, &i, sizeof(i));
+		memcpy(nonce + sizeof(i), &start, sizeof(start));
+		memset(nonce + sizeof(i) + sizeof(start), 0xa5,
+		       NONCE_SIZE - sizeof(i) - sizeof(start));
+		validation.ulExternalDataLength = NONCE_SIZE;
+		validation.rgbExternalData = nonce;
+
+		if (quote2)
+			PERF_TIME(&tpm, result = Tspi_TPM_Quote2(hTPM, hKey, addVersion, hPcrs,
+								 &validation, &versionInfoSize,
+								 &versionInfo));
+		else
+			PERF_TIME(&tpm, result = Tspi_TPM_Quote(hTPM, hKey, hPcrs, &validation));
+		if (result != TSS_SUCCESS) {
+			print_error(quote2 ? "Tspi_TPM_Quote2" : "Tspi_TPM_Quote", result);
+			break;
+		}
+
+		/* the TSP may have replaced the nonce pointer with its own copy */
+		if (queue_quote(&validation, quote2 ? QUOTE_INFO2_NONCE_OFFSET :
+				QUOTE_INFO_NONCE_OFFSET)) {
+			result = TSS_E_OUTOFMEMORY;
+			break;
+		}
+
+		if (quote2 && addVersion)
+			Tspi_Context_FreeMemory(hContext, versionInfo);
+		Tspi_Context_FreeMemory(hContext, validation.rgbData);
+		Tspi_Context_FreeMemory(hContext, validation.rgbValidationData);
+		if (validation.rgbExternalData != nonce)
+			Tspi_Context_FreeMemory(hContext, validation.rgbExternalData);
+	}
+	perf_queue_drain(&queue);
+
+	if (result == TSS_SUCCESS) {
+		perf_report(&tpm, &opts);
+
+		perf_samples_init(&verify, opts.iterations, "%s/verify", name);
+		for (t = 0; t < opts.threads; t++) {
+			for (i = 0; i < verifiers[t].samples.count; i++)
+				perf_samples_add(&verify, verifiers[t].samples.ns[i]);
+			failures += verifiers[t].failures;
+			verifiers[t].failures = 0;
+		}
+		perf_report(&verify, &opts);
+		perf_samples_free(&verify);
+
+		perf_metric(name, "verified_per_s",
+			    opts.iterations * 1000000000.0 / (perf_now() - start));
+		perf_metric(name, "verify_failures", failures);
+		if (failures)
+			result = TSS_E_FAIL;
+	}
+
+	perf_samples_free(&tpm);
+	Tspi_Context_CloseObject(hContext, hPcrs);
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct verifier *verifiers = NULL;
+	TSS_HTPM hTPM;
+	TSS_HKEY hSRK, hKey;
+	TSS_RESULT result;
+	UINT32 t, started = 0, numPcrs, maxPcrs;
+	UINT32 sizes[] = { 1, 2, 4, 8, 16, 24, 0 }, *s;
+	int quote2;
+
+	perf_parse_args(argc, argv, &opts, DEFAULT_MAX_PCRS);
+
+	print_begin_test(fn);
+
+	if ((result = connect_load_all(&hContext, &hSRK, &hTPM))) {
+		print_error("connect_load_all", result);
+		exit(result);
+	}
+
+	if ((result = TestSuite_Get_Num_PCRs(hContext, hTPM, &maxPcrs)))
+		goto close;
+	if (maxPcrs > opts.max)
+		maxPcrs = opts.max;
+
+	if ((result = create_load_key(hContext, TSS_KEY_TYPE_SIGNING | TSS_KEY_SIZE_2048 |
+				      TSS_KEY_NO_AUTHORIZATION, hSRK, &hKey)))
+		goto close;
+
+	verifiers = calloc(opts.threads, sizeof(struct verifier));
+	if (verifiers == NULL || perf_queue_init(&queue, QUEUE_SIZE, sizeof(struct quote_job))) {
+		result = TSS_E_OUTOFMEMORY;
+		goto free;
+	}
+	for (t = 0; t < opts.threads; t++) {
+		result = TestSuite_Verifier_Init(&verifiers[t].v, hContext, hKey);
+		if (result != TSS_SUCCESS) {
+			print_error("TestSuite_Verifier_Init", result);
+			goto stop;
+		}
+	}
+	for (; started < opts.threads; started++) {
+		perf_samples_init(&verifiers[started].samples, opts.iterations,
+				  "verifier %u", started);
+		if (pthread_create(&verifiers[started].thread, NULL, verifier_thread,
+				   &verifiers[started])) {
+			fprintf(stderr, "%s: pthread_create failed\n", fn);
+			perf_samples_free(&verifiers[started].samples);
+			result = TSS_E_INTERNAL_ERROR;
+			goto stop;
+		}
+	}
+
+	for (quote2 = 0; quote2 <= (opts.version == TESTSUITE_TEST_TSS_1_2); quote2++) {
+		for (s = sizes; *s && *s <= maxPcrs; s++) {
+			numPcrs = *s;
+
+			if ((result = bench_quote(hTPM, hKey, numPcrs, quote2, FALSE, verifiers)))
+				goto stop;
+			if (quote2 &&
+			    (result = bench_quote(hTPM, hKey, numPcrs, quote2, TRUE, verifiers)))
+				goto stop;
+		}
+	}
+
+stop:
+	perf_queue_stop(&queue);
+	for (t = 0; t < started; t++) {
+		pthread_join(verifiers[t].thread, NULL);
+		perf_samples_free(&verifiers[t].samples);
+	}
+	for (t = 0; t < opts.threads; t++)
+		TestSuite_Verifier_Free(&verifiers[t].v);
+free:
+	perf_queue_free(&queue);
+	free(verifiers);
+close:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
@@ -0,0 +1,127 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	tcsd_resources.c
+ *
+ * DESCRIPTION
+ *	Reports the TPM resources currently in use, so that resources
+ *	leaked by tcsd across many contexts can be tracked over a soak run
+ *	(see tsstests.sh -s). Prints:
+ *
+ *	PERF tcsd/resources tpm_keys=..
+ *	PERF tcsd/resources tpm_auths=..
+ *
+ *	the number of key handles and of authorization session handles
+ *	loaded in the TPM, which are what the TCS has loaded on behalf of
+ *	all of its contexts, since this program's own context holds none.
+ *
+ * ALGORITHM
+ *	Create and connect a context
+ *	Tspi_TPM_GetCapability(TSS_TPMCAP_HANDLE) for keys and auth sessions
+ *	Close the context
+ *
+ * USAGE
+ *	tcsd_resources [-v <version>]
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	TSS_TPMCAP_HANDLE is only in TSS 1.2.
+ */
+
+#include "perf.h"
+
+char *fn = "tcsd_resources";
+
+/* the capability returns a TPM_KEY_HANDLE_LIST: a UINT16 count, then the
+ * handles */
+TSS_RESULT
+count_handles(TSS_HTPM hTPM, UINT32 type, UINT32 *count)
+{
+	TSS_RESULT result;
+	UINT32 size;
+	BYTE *data;
+
+	result = Tspi_TPM_GetCapability(hTPM, TSS_TPMCAP_HANDLE, sizeof(UINT32),
+					(BYTE *)&type, &size, &data);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_TPM_GetCapability", result);
+		return result;
+	}
+
+	*count = size >= 2 ? (data[0] << 8) | data[1] : 0;
+
+	return TSS_SUCCESS;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct perf_opts opts;
+	TSS_HCONTEXT hContext;
+	TSS_HTPM hTPM;
+	TSS_RESULT result;
+	UINT32 keys, auths;
+
+	perf_parse_args(argc, argv, &opts, 0);
+	if (opts.version == TESTSUITE_TEST_TSS_1_1)
+		print_NA();
+
+	print_begin_test(fn);
+
+	result = Tspi_Context_Create(&hContext);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_Create", result);
+		exit(result);
+	}
+
+	result = Tspi_Context_Connect(hContext, get_server(GLOBALSERVER));
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_Connect", result);
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+
+	result = Tspi_Context_GetTpmObject(hContext, &hTPM);
+	if (result != TSS_SUCCESS) {
+		print_error("Tspi_Context_GetTpmObject", result);
+		Tspi_Context_Close(hContext);
+		exit(result);
+	}
+
+	if ((result = count_handles(hTPM, TSS_RT_KEY, &keys)) ||
+	    (result = count_handles(hTPM, TSS_RT_AUTH, &auths)))
+		goto done;
+
+	perf_metric("tcsd/resources", "tpm_keys", keys);
+	perf_metric("tcsd/resources", "tpm_auths", auths);
+
+done:
+	if (result)
+		print_error(fn, result);
+	else
+		print_success(fn, result);
+	print_end_test(fn);
+	Tspi_Context_FreeMemory(hContext, NULL);
+	Tspi_Context_Close(hContext);
+
+	return result;
+}
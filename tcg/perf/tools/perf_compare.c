@@ -0,0 +1,356 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	perf_compare.c
+ *
+ * DESCRIPTION
+ *	Compares the timings of two runs, e.g. of the testsuite against an
+ *	old and a new TrouSerS build, and reports which cases got
+ *	significantly slower or faster. Samples are matched by name and
+ *	taken, in order of preference, from:
+ *
+ *	SAMPLE <case> <ns>		benchmarks run with -r
+ *	PERF <case> ... p50_us=..	one sample per run of a benchmark
+ *	PMC <test> client wall_us=..	one sample per run of tsstests.sh -k
+ *
+ *	so each side may be the output of several runs concatenated. For
+ *	each case one line is printed:
+ *
+ *	CMP <case> old_n=.. new_n=.. old_p50_us=.. new_p50_us=..
+ *		change_pct=.. ci_low_pct=.. ci_high_pct=.. p=.. <verdict>
+ *
+ *	where change_pct is the change of the median, [ci_low_pct,
+ *	ci_high_pct] its 1 - alpha bootstrap confidence interval and p the two sided
+ *	Mann-Whitney p-value. The verdict is "regression" or "improvement"
+ *	when p is below alpha and the interval doesn't include 0, "same"
+ *	otherwise, and "few_samples" when either side has less than 5.
+ *
+ * ALGORITHM
+ *	Mann-Whitney U test with the normal approximation and tie
+ *	correction. Percentile bootstrap of the ratio of the medians.
+ *
+ * USAGE
+ *	perf_compare [-a <alpha>] [-b <resamples>] [-c <percent>] [-s <seed>]
+ *		<old> <new>
+ *
+ *	-a	significance level, default 0.01
+ *	-b	bootstrap resamples, default 2000
+ *	-c	CI mode: exit with 1 if a case is a regression whose interval
+ *		lies entirely above <percent>
+ *	-s	seed of the bootstrap, so that reports can be reproduced
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	Samples of a case are assumed to be independent, which is not quite
+ *	true for consecutive calls against the same TPM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define NAME_LEN	128
+#define MIN_SAMPLES	5
+
+/* where the samples of a series came from, better sources replace worse */
+#define SRC_PMC		1
+#define SRC_PERF	2
+#define SRC_SAMPLE	3
+
+struct series
+{
+	char	name[NAME_LEN];
+	int	src[2];
+	double	*v[2];
+	size_t	n[2];
+	size_t	size[2];
+};
+
+static struct series *series;
+static size_t num_series, size_series;
+
+static unsigned long long rng_state = 0x2545F4914F6CDD1DULL;
+
+static unsigned long long
+rng_next(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+
+	return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static struct series *
+find_series(const char *name)
+{
+	struct series *tmp;
+	size_t i;
+
+	for (i = 0; i < num_series; i++) {
+		if (!strcmp(series[i].name, name))
+			return &series[i];
+	}
+
+	if (num_series == size_series) {
+		size_series = size_series ? size_series * 2 : 64;
+		if ((tmp = realloc(series, size_series * sizeof(struct series))) == NULL) {
+			fprintf(stderr, "realloc failed.\n");
+			exit(2);
+		}
+		series = tmp;
+	}
+	memset(&series[num_series], 0, sizeof(struct series));
+	strcpy(series[num_series].name, name);
+
+	return &series[num_series++];
+}
+
+static void
+add_sample(const char *name, int side, int src, double ns)
+{
+	struct series *s = find_series(name);
+	double *tmp;
+
+	if (src < s->src[side])
+		return;
+	if (src > s->src[side]) {
+		s->src[side] = src;
+		s->n[side] = 0;
+	}
+
+	if (s->n[side] == s->size[side]) {
+		s->size[side] = s->size[side] ? s->size[side] * 2 : 64;
+		if ((tmp = realloc(s->v[side], s->size[side] * sizeof(double))) == NULL) {
+			fprintf(stderr, "realloc failed.\n");
+			exit(2);
+		}
+		s->v[side] = tmp;
+	}
+	s->v[side][s->n[side]++] = ns;
+}
+
+static int
+read_file(const char *path, int side)
+{
+	char line[1024], name[NAME_LEN], *p;
+	unsigned long long ns;
+	double us;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "SAMPLE %127s %llu", name, &ns) == 2) {
+			add_sample(name, side, SRC_SAMPLE, ns);
+		} else if (sscanf(line, "PERF %127s n=", name) == 1 &&
+			   (p = strstr(line, " p50_us=")) && sscanf(p, " p50_us=%lf", &us) == 1) {
+			add_sample(name, side, SRC_PERF, us * 1000.0);
+		} else if (sscanf(line, "PMC %127s client wall_us=%lf", name, &us) == 2) {
+			add_sample(name, side, SRC_PMC, us * 1000.0);
+		}
+	}
+	fclose(f);
+
+	return 0;
+}
+
+static int
+dbl_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* v must be sorted */
+static double
+median(const double *v, size_t n)
+{
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+static double
+resampled_median(const double *v, size_t n, double *tmp)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		tmp[i] = v[rng_next() % n];
+	qsort(tmp, n, sizeof(double), dbl_cmp);
+
+	return median(tmp, n);
+}
+
+/* two sided p-value of the Mann-Whitney U test, a and b sorted */
+static double
+mann_whitney(const double *a, size_t na, const double *b, size_t nb)
+{
+	double r1 = 0.0, ties = 0.0, n = na + nb, u, mu, sigma, z, rank;
+	size_t i = 0, j = 0, ca, cb, t;
+	double x;
+
+	/* walk both sorted lists, giving tied values their average rank */
+	rank = 1.0;
+	while (i < na || j < nb) {
+		x = (j == nb || (i < na && a[i] <= b[j])) ? a[i] : b[j];
+		for (ca = 0; i < na && a[i] == x; i++)
+			ca++;
+		for (cb = 0; j < nb && b[j] == x; j++)
+			cb++;
+
+		t = ca + cb;
+		r1 += ca * (rank + (t - 1) / 2.0);
+		ties += (double)t * t * t - t;
+		rank += t;
+	}
+
+	u = r1 - na * (na + 1) / 2.0;
+	mu = na * (double)nb / 2.0;
+	sigma = sqrt(na * (double)nb / 12.0 * ((n + 1) - ties / (n * (n - 1))));
+	if (sigma == 0.0)
+		return 1.0;
+
+	/* continuity correction */
+	z = (fabs(u - mu) - 0.5) / sigma;
+	if (z < 0)
+		z = 0;
+
+	return erfc(z / sqrt(2.0));
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-a <alpha>] [-b <resamples>] [-c <percent>] [-s <seed>] "
+		"<old> <new>\n", argv0);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	double alpha = 0.01, threshold = 0.0, *ratios, *tmp, m0, m1, lo, hi, p;
+	int c, ci_mode = 0, regressions = 0;
+	unsigned int boots = 2000, b;
+	const char *verdict;
+	struct series *s;
+	size_t i, max_n;
+
+	while ((c = getopt(argc, argv, "a:b:c:s:h")) != -1) {
+		switch (c) {
+		case 'a':
+			alpha = atof(optarg);
+			break;
+		case 'b':
+			boots = atoi(optarg);
+			break;
+		case 'c':
+			ci_mode = 1;
+			threshold = atof(optarg);
+			break;
+		case 's':
+			rng_state = strtoull(optarg, NULL, 0) | 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2 || boots == 0)
+		usage(argv[0]);
+
+	if (read_file(argv[optind], 0) || read_file(argv[optind + 1], 1))
+		return 2;
+
+	for (max_n = 1, i = 0; i < num_series; i++) {
+		if (series[i].n[0] > max_n)
+			max_n = series[i].n[0];
+		if (series[i].n[1] > max_n)
+			max_n = series[i].n[1];
+	}
+	if ((ratios = malloc(boots * sizeof(double))) == NULL ||
+	    (tmp = malloc(max_n * sizeof(double))) == NULL) {
+		fprintf(stderr, "malloc failed.\n");
+		return 2;
+	}
+
+	for (i = 0; i < num_series; i++) {
+		s = &series[i];
+
+		/* cases run by one side only */
+		if (s->n[0] == 0 || s->n[1] == 0) {
+			printf("CMP %s old_n=%zu new_n=%zu %s\n", s->name, s->n[0], s->n[1],
+			       s->n[0] ? "removed" : "added");
+			continue;
+		}
+
+		qsort(s->v[0], s->n[0], sizeof(double), dbl_cmp);
+		qsort(s->v[1], s->n[1], sizeof(double), dbl_cmp);
+		m0 = median(s->v[0], s->n[0]);
+		m1 = median(s->v[1], s->n[1]);
+
+		printf("CMP %s old_n=%zu new_n=%zu old_p50_us=%.3f new_p50_us=%.3f "
+		       "change_pct=%.2f", s->name, s->n[0], s->n[1], m0 / 1000.0, m1 / 1000.0,
+		       m0 > 0 ? 100.0 * (m1 / m0 - 1.0) : 0.0);
+
+		if (s->n[0] < MIN_SAMPLES || s->n[1] < MIN_SAMPLES || m0 <= 0) {
+			printf(" few_samples\n");
+			continue;
+		}
+
+		for (b = 0; b < boots; b++) {
+			m0 = resampled_median(s->v[0], s->n[0], tmp);
+			m1 = resampled_median(s->v[1], s->n[1], tmp);
+			ratios[b] = m0 > 0 ? m1 / m0 : 1.0;
+		}
+		qsort(ratios, boots, sizeof(double), dbl_cmp);
+		lo = 100.0 * (ratios[(size_t)(boots * alpha / 2)] - 1.0);
+		hi = 100.0 * (ratios[(size_t)((boots - 1) * (1.0 - alpha / 2))] - 1.0);
+		p = mann_whitney(s->v[0], s->n[0], s->v[1], s->n[1]);
+
+		if (p < alpha && lo > 0)
+			verdict = "regression";
+		else if (p < alpha && hi < 0)
+			verdict = "improvement";
+		else
+			verdict = "same";
+
+		printf(" ci_low_pct=%.2f ci_high_pct=%.2f p=%.3g %s\n", lo, hi, p, verdict);
+
+		if (ci_mode && p < alpha && lo > threshold)
+			regressions++;
+	}
+
+	if (ci_mode && regressions)
+		fprintf(stderr, "%d case(s) regressed by more than %.1f%%\n", regressions,
+			threshold);
+
+	free(ratios);
+	free(tmp);
+
+	return regressions ? 1 : 0;
+}
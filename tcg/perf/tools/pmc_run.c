@@ -0,0 +1,299 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	pmc_run.c
+ *
+ * DESCRIPTION
+ *	Runs a command under hardware performance counters, to show the CPU
+ *	cost of the TSP (OAEP, HMACs, the testsuite's own RSA helpers) next
+ *	to its wall time. Cycles, instructions, cache misses and page faults
+ *	are counted for the command and the threads it creates, and, with -p,
+ *	for the tcsd process over the same window. When the command exits,
+ *	one line is printed per process to stdout:
+ *
+ *	PMC <name> <client|tcsd> wall_us=.. cycles=.. instructions=.. ipc=..
+ *		cache_misses=.. page_faults=..
+ *
+ *	Counters the CPU or kernel doesn't provide are printed as "n/a".
+ *	Counts are scaled up when the kernel had to multiplex the counters.
+ *
+ * ALGORITHM
+ *	Fork, open the counters on the child with enable_on_exec set, then
+ *	let the child exec the command. The tcsd counters are opened on each
+ *	of its threads before the fork and read after the child is reaped.
+ *
+ * USAGE
+ *	pmc_run [-n <name>] [-p <tcsd pid>] <command> [args]
+ *
+ *	The exit status is the command's, or 128 + signal if it was killed.
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	Only user space is counted, which works with the default
+ *	perf_event_paranoid setting. Counting tcsd needs permission to
+ *	ptrace it, i.e. the same user or root.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#define NUM_COUNTERS	4
+#define MAX_THREADS	256
+
+static const struct {
+	const char	*name;
+	__u32		type;
+	__u64		config;
+} counters[NUM_COUNTERS] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+struct pmc
+{
+	int	fds[MAX_THREADS][NUM_COUNTERS];
+	int	num_threads;
+};
+
+static int
+pmc_open_one(pid_t tid, int counter, int enable_on_exec)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = counters[counter].type;
+	attr.config = counters[counter].config;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.disabled = enable_on_exec;
+	attr.enable_on_exec = enable_on_exec;
+
+	return syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0);
+}
+
+static void
+pmc_open(struct pmc *p, pid_t tid, int enable_on_exec)
+{
+	int i;
+
+	if (p->num_threads == MAX_THREADS)
+		return;
+
+	for (i = 0; i < NUM_COUNTERS; i++)
+		p->fds[p->num_threads][i] = pmc_open_one(tid, i, enable_on_exec);
+	p->num_threads++;
+}
+
+/* tcsd starts a thread per client connection; threads which exist now are
+ * opened one by one, the ones started later are counted by inheritance */
+static int
+pmc_open_process(struct pmc *p, pid_t pid)
+{
+	struct dirent *d;
+	char path[64];
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	if ((dir = opendir(path)) == NULL) {
+		perror(path);
+		return -1;
+	}
+	while ((d = readdir(dir))) {
+		if (d->d_name[0] != '.')
+			pmc_open(p, atoi(d->d_name), 0);
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+/* -1 if the counter couldn't be opened */
+static double
+pmc_read(struct pmc *p, int counter)
+{
+	__u64 v[3];
+	double sum = -1.0;
+	int i, fd;
+
+	for (i = 0; i < p->num_threads; i++) {
+		if ((fd = p->fds[i][counter]) < 0)
+			continue;
+		if (read(fd, v, sizeof(v)) != sizeof(v))
+			continue;
+
+		if (sum < 0)
+			sum = 0;
+		/* a thread which slept through the window never ran */
+		if (v[2])
+			sum += (double)v[0] * v[1] / v[2];
+	}
+
+	return sum;
+}
+
+static void
+pmc_print(struct pmc *p, const char *name, const char *who, double wall_us)
+{
+	double v[NUM_COUNTERS];
+	int i;
+
+	for (i = 0; i < NUM_COUNTERS; i++)
+		v[i] = pmc_read(p, i);
+
+	printf("PMC %s %s wall_us=%.3f", name, who, wall_us);
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (v[i] < 0)
+			printf(" %s=n/a", counters[i].name);
+		else
+			printf(" %s=%.0f", counters[i].name, v[i]);
+
+		if (i == 1) {
+			if (v[0] > 0 && v[1] >= 0)
+				printf(" ipc=%.3f", v[1] / v[0]);
+			else
+				printf(" ipc=n/a");
+		}
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static void
+pmc_close(struct pmc *p)
+{
+	int i, j;
+
+	for (i = 0; i < p->num_threads; i++) {
+		for (j = 0; j < NUM_COUNTERS; j++) {
+			if (p->fds[i][j] >= 0)
+				close(p->fds[i][j]);
+		}
+	}
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-n <name>] [-p <tcsd pid>] <command> [args]\n", argv0);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct pmc client, tcsd;
+	struct timeval start, end;
+	const char *name = NULL;
+	pid_t pid, tcsd_pid = 0;
+	int c, status, go[2];
+	double wall_us;
+	char x = 0;
+
+	while ((c = getopt(argc, argv, "+n:p:h")) != -1) {
+		switch (c) {
+		case 'n':
+			name = optarg;
+			break;
+		case 'p':
+			tcsd_pid = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc)
+		usage(argv[0]);
+	if (name == NULL) {
+		name = strrchr(argv[optind], '/');
+		name = name ? name + 1 : argv[optind];
+	}
+
+	memset(&client, 0, sizeof(client));
+	memset(&tcsd, 0, sizeof(tcsd));
+
+	if (pipe(go)) {
+		perror("pipe");
+		return 1;
+	}
+
+	/* counting tcsd from before the fork includes a few microseconds of
+	 * idle time, but never misses the first command */
+	if (tcsd_pid > 0)
+		pmc_open_process(&tcsd, tcsd_pid);
+
+	gettimeofday(&start, NULL);
+	if ((pid = fork()) < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(go[1]);
+		/* wait for the counters before exec enables them */
+		if (read(go[0], &x, 1) != 1)
+			_exit(1);
+		close(go[0]);
+		execvp(argv[optind], &argv[optind]);
+		perror(argv[optind]);
+		_exit(127);
+	}
+
+	close(go[0]);
+	pmc_open(&client, pid, 1);
+	if (write(go[1], &x, 1) != 1)
+		perror("write");
+	close(go[1]);
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			perror("waitpid");
+			return 1;
+		}
+	}
+	gettimeofday(&end, NULL);
+	wall_us = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec);
+
+	pmc_print(&client, name, "client", wall_us);
+	if (tcsd_pid > 0)
+		pmc_print(&tcsd, name, "tcsd", wall_us);
+
+	pmc_close(&client);
+	pmc_close(&tcsd);
+
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+
+	return WEXITSTATUS(status);
+}
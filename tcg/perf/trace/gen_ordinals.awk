@@ -0,0 +1,52 @@
+#
+#  Copyright (c) International Business Machines  Corp., 2007
+#
+#  This program is free software;  you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+#  the GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program;  if not, write to the Free Software
+#  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+#
+
+#
+# NAME
+#	gen_ordinals.awk
+#
+# DESCRIPTION
+#	Generates the table of TPM ordinal names used by the TDDL timer from
+#	the "#define TPM_ORD_<name> ((UINT32)0x<ordinal>)" lines of
+#	tpm_ordinal.h.
+#
+# USAGE
+#	awk -f gen_ordinals.awk tpm_ordinal.h > tddl_ordinals.c
+#
+
+BEGIN {
+	print "/* generated from tpm_ordinal.h by gen_ordinals.awk, do not edit */"
+	print ""
+	print "#include \"tddl_timer.h\""
+	print ""
+	print "struct tddl_ordinal tddl_ordinals[] = {"
+}
+
+{
+	sub(/\r$/, "")
+}
+
+$1 == "#define" && $2 ~ /^TPM_ORD_/ && $3 ~ /0x[0-9A-Fa-f]+/ {
+	match($3, /0x[0-9A-Fa-f]+/)
+	print "\t{ " substr($3, RSTART, RLENGTH) ", \"" substr($2, 9) "\" },"
+}
+
+END {
+	print "\t{ 0, NULL }"
+	print "};"
+}
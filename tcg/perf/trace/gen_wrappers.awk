@@ -0,0 +1,179 @@
+#
+#  Copyright (c) International Business Machines  Corp., 2007
+#
+#  This program is free software;  you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+#  the GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program;  if not, write to the Free Software
+#  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+#
+
+#
+# NAME
+#	gen_wrappers.awk
+#
+# DESCRIPTION
+#	Generates a tracing wrapper for every TSPICALL prototype in tspi.h.
+#	tspi.h declares each function as
+#
+#	TSPICALL <name>
+#	(
+#	    <type>    <param>,         // in|out|in, out
+#	    ...
+#	);
+#
+#	For every function, the first handle parameter (TSS_H*) is recorded,
+#	input parameters of type UINT32 and output parameters of type UINT32*
+#	whose names end in Length or <Blob|Data|Info|Digest>Size are summed as
+#	the bytes going in and out of the call. A handle returned through a
+#	TSS_H* pointer is recorded with its type, which for a TSS_HOBJECT is
+#	given by the objectType parameter, and so is the object closed by
+#	Tspi_Context_CloseObject, so that the runtime knows the type of every
+#	handle later passed in.
+#
+# USAGE
+#	awk -f gen_wrappers.awk tspi.h > tspi_trace_gen.c
+#
+
+BEGIN {
+	n = 0
+	print "/* generated from tspi.h by gen_wrappers.awk, do not edit */"
+	print ""
+	print "#include \"tspi_trace.h\""
+}
+
+function is_size(name) {
+	return name ~ /(Length|BlobSize|DataSize|InfoSize|DigestSize)$/
+}
+
+# tspi.h has DOS line endings
+{
+	sub(/\r$/, "")
+}
+
+/^TSPICALL/ {
+	name = $2
+	np = 0
+	inproto = 1
+	next
+}
+
+inproto && /^\(/ {
+	next
+}
+
+inproto && /^\);/ {
+	emit()
+	inproto = 0
+	next
+}
+
+inproto {
+	dir = ""
+	if (match($0, /\/\/.*/)) {
+		dir = substr($0, RSTART + 2)
+		gsub(/^[ \t]+|[ \t]+$/, "", dir)
+		$0 = substr($0, 1, RSTART - 1)
+	}
+	gsub(/,/, "")
+	if (NF < 2)
+		next
+	np++
+	ptype[np] = $1
+	pname[np] = $2
+	pdir[np] = dir
+	next
+}
+
+function emit(    i, proto, types, args, handle, objtype) {
+	proto = ""
+	types = ""
+	args = ""
+	for (i = 1; i <= np; i++) {
+		sep = (i > 1) ? ", " : ""
+		proto = proto sep ptype[i] " " pname[i]
+		types = types sep ptype[i]
+		args = args sep pname[i]
+	}
+	if (np == 0) {
+		proto = "void"
+		types = "void"
+	}
+
+	print ""
+	print "TSS_RESULT"
+	print name "(" proto ")"
+	print "{"
+	print "\tstatic TSS_RESULT (*real)(" types ");"
+	print "\tstruct trace_record rec;"
+	print "\tTSS_RESULT result;"
+	print ""
+	print "\tif (!real && !(real = trace_resolve(\"" name "\")))"
+	print "\t\treturn TSS_E_INTERNAL_ERROR;"
+	print ""
+	print "\ttrace_begin(&rec, " n ");"
+
+	handle = 0
+	for (i = 1; i <= np; i++) {
+		if (!handle && ptype[i] ~ /^TSS_H[A-Z_]+$/) {
+			print "\trec.handle = " pname[i] ";"
+			print "\trec.handle_type = \"" ptype[i] "\";"
+			handle = 1
+		}
+		if (ptype[i] == "UINT32" && pdir[i] ~ /^in/ && is_size(pname[i]))
+			print "\trec.bytes_in += " pname[i] ";"
+		if (ptype[i] == "UINT32*" && pdir[i] ~ /^in, out/ && is_size(pname[i]))
+			print "\tif (" pname[i] ")\n\t\trec.bytes_in += *" pname[i] ";"
+	}
+
+	if (name == "Tspi_Context_CloseObject")
+		print "\trec.closed_handle = " pname[2] ";"
+	print "\tresult = real(" args ");"
+
+	objtype = ""
+	for (i = 1; i <= np; i++) {
+		if (pname[i] == "objectType")
+			objtype = pname[i]
+	}
+
+	handle = 0
+	for (i = 1; i <= np; i++) {
+		if (ptype[i] == "UINT32*" && pdir[i] ~ /out/ && is_size(pname[i]))
+			print "\tif (result == TSS_SUCCESS && " pname[i] ")\n\t\trec.bytes_out += *" pname[i] ";"
+		if (!handle && ptype[i] ~ /^TSS_H[A-Z_]+\*$/ && pdir[i] == "out") {
+			print "\tif (result == TSS_SUCCESS && " pname[i] ") {"
+			print "\t\trec.out_handle = *" pname[i] ";"
+			if (ptype[i] == "TSS_HOBJECT*" && objtype != "")
+				print "\t\trec.out_object_type = " objtype ";"
+			else
+				print "\t\trec.out_type = \"" substr(ptype[i], 1, length(ptype[i]) - 1) "\";"
+			print "\t}"
+			handle = 1
+		}
+	}
+
+	print "\ttrace_end(&rec, result);"
+	print ""
+	print "\treturn result;"
+	print "}"
+
+	names[n++] = name
+}
+
+END {
+	print ""
+	print "const char *trace_api_names[] = {"
+	for (i = 0; i < n; i++)
+		print "\t\"" names[i] "\","
+	print "};"
+	print ""
+	print "const UINT32 trace_api_count = " n ";"
+}
@@ -0,0 +1,277 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	tddl_split.c
+ *
+ * DESCRIPTION
+ *	Splits the time of each Tspi_* call into time spent inside the TPM
+ *	and time spent in the stack (TSP and TCS marshalling, HMACs and
+ *	IPC), by correlating a Chrome trace written by libtspi_trace.so in
+ *	the client with the command log written by libtddl_timer.so in
+ *	tcsd. Both use CLOCK_MONOTONIC, so a TPM command belongs to the
+ *	Tspi call which was running when it was sent; if calls of several
+ *	threads were running, to the one which started last. Only outermost
+ *	Tspi calls are counted. One line is printed per API, sorted by total
+ *	time, followed by the totals of the whole trace, where commands sent
+ *	while no call was running are counted as unattributed:
+ *
+ *	SPLIT <api> calls=.. total_us=.. tpm_us=.. stack_us=.. tpm_cmds=..
+ *	SPLIT all calls=.. total_us=.. tpm_us=.. stack_us=.. tpm_cmds=..
+ *		tpm_pct=.. unattributed_tpm_us=..
+ *
+ * ALGORITHM
+ *	Read both files, sort the calls and the TPM commands by start time,
+ *	and walk both lists once, giving each command to a call.
+ *
+ * USAGE
+ *	tddl_split <tspi_trace.json> <tddl_timer.log>
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	tcsd serves all clients, so TPM commands of other programs running
+ *	at the same time are counted against the traced program.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tddl_timer.h"
+
+#define NAME_LEN	128
+#define LOOKBACK	64
+
+struct span
+{
+	UINT64	start;
+	UINT64	end;
+	char	name[NAME_LEN];
+};
+
+struct api
+{
+	char	name[NAME_LEN];
+	UINT32	calls;
+	UINT32	cmds;
+	UINT64	total;
+	UINT64	tpm;
+};
+
+static int
+span_cmp(const void *a, const void *b)
+{
+	const struct span *x = a, *y = b;
+
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+static int
+api_cmp(const void *a, const void *b)
+{
+	const struct api *x = a, *y = b;
+
+	return (x->total < y->total) - (x->total > y->total);
+}
+
+static int
+add_span(struct span **spans, UINT32 *n, UINT32 *size, struct span *s)
+{
+	struct span *tmp;
+
+	if (*n == *size) {
+		*size = *size ? *size * 2 : 1024;
+		if ((tmp = realloc(*spans, *size * sizeof(struct span))) == NULL) {
+			fprintf(stderr, "realloc of %zu bytes failed.\n",
+				*size * sizeof(struct span));
+			return -1;
+		}
+		*spans = tmp;
+	}
+	(*spans)[(*n)++] = *s;
+
+	return 0;
+}
+
+/* the outermost Tspi calls of a trace written by libtspi_trace.so */
+static int
+read_calls(const char *path, struct span **calls, UINT32 *n)
+{
+	struct span s;
+	double ts, dur;
+	char line[1024], *p;
+	UINT32 size = 0;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		p = strstr(line, "{\"name\":\"");
+		if (p == NULL || sscanf(p, "{\"name\":\"%127[^\"]\",\"cat\":\"tspi\",\"ph\":\"X\","
+					"\"ts\":%lf,\"dur\":%lf", s.name, &ts, &dur) != 3)
+			continue;
+		if ((p = strstr(line, "\"depth\":")) && atoi(p + 8) != 0)
+			continue;
+
+		s.start = (UINT64)(ts * 1000.0 + 0.5);
+		s.end = s.start + (UINT64)(dur * 1000.0 + 0.5);
+		if (add_span(calls, n, &size, &s))
+			break;
+	}
+	fclose(f);
+
+	return 0;
+}
+
+static int
+read_cmds(const char *path, struct span **cmds, UINT32 *n)
+{
+	struct span s;
+	unsigned long long start, end;
+	char line[256];
+	UINT32 size = 0;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "TPM %llu %llu %*s %127s", &start, &end, s.name) != 3)
+			continue;
+		s.start = start;
+		s.end = end;
+		if (add_span(cmds, n, &size, &s))
+			break;
+	}
+	fclose(f);
+
+	return 0;
+}
+
+static struct api *
+find_api(struct api *apis, UINT32 *n, const char *name)
+{
+	UINT32 i;
+
+	for (i = 0; i < *n; i++) {
+		if (!strcmp(apis[i].name, name))
+			return &apis[i];
+	}
+
+	memset(&apis[*n], 0, sizeof(struct api));
+	strcpy(apis[*n].name, name);
+
+	return &apis[(*n)++];
+}
+
+static void
+print_api(struct api *a)
+{
+	printf("SPLIT %s calls=%u total_us=%.3f tpm_us=%.3f stack_us=%.3f tpm_cmds=%u",
+	       a->name, a->calls, a->total / 1000.0, a->tpm / 1000.0,
+	       (a->total - a->tpm) / 1000.0, a->cmds);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct span *calls = NULL, *cmds = NULL;
+	struct api *apis, all, **owner, *a;
+	UINT32 ncalls = 0, ncmds = 0, napis = 0, i, j, k;
+	UINT64 end, unattributed = 0;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <tspi_trace.json> <tddl_timer.log>\n", argv[0]);
+		return 1;
+	}
+
+	if (read_calls(argv[1], &calls, &ncalls) || read_cmds(argv[2], &cmds, &ncmds))
+		return 1;
+
+	qsort(calls, ncalls, sizeof(struct span), span_cmp);
+	qsort(cmds, ncmds, sizeof(struct span), span_cmp);
+
+	if ((apis = calloc(ncalls ? ncalls : 1, sizeof(struct api))) == NULL) {
+		fprintf(stderr, "calloc failed.\n");
+		return 1;
+	}
+	memset(&all, 0, sizeof(all));
+	strcpy(all.name, "all");
+
+	if ((owner = calloc(ncalls ? ncalls : 1, sizeof(struct api *))) == NULL) {
+		fprintf(stderr, "calloc failed.\n");
+		return 1;
+	}
+
+	for (i = 0; i < ncalls; i++) {
+		a = owner[i] = find_api(apis, &napis, calls[i].name);
+		a->calls++;
+		a->total += calls[i].end - calls[i].start;
+	}
+
+	/* give each command to the latest starting call which encloses it.
+	 * Calls of different threads can overlap, so look back over a few of
+	 * them rather than only at the last one starting before the command */
+	for (j = 0, i = 0; j < ncmds; j++) {
+		while (i < ncalls && calls[i].start <= cmds[j].start)
+			i++;
+
+		for (k = i; k > 0 && i - k < LOOKBACK; k--) {
+			if (calls[k - 1].end >= cmds[j].start)
+				break;
+		}
+		if (k == 0 || i - k >= LOOKBACK) {
+			unattributed += cmds[j].end - cmds[j].start;
+			continue;
+		}
+
+		/* clip to the call, the response may be read after it returned */
+		end = cmds[j].end < calls[k - 1].end ? cmds[j].end : calls[k - 1].end;
+		owner[k - 1]->tpm += end - cmds[j].start;
+		owner[k - 1]->cmds++;
+	}
+
+	qsort(apis, napis, sizeof(struct api), api_cmp);
+	for (i = 0; i < napis; i++) {
+		print_api(&apis[i]);
+		printf("\n");
+
+		all.calls += apis[i].calls;
+		all.cmds += apis[i].cmds;
+		all.total += apis[i].total;
+		all.tpm += apis[i].tpm;
+	}
+	print_api(&all);
+	printf(" tpm_pct=%.1f unattributed_tpm_us=%.3f\n",
+	       all.total ? 100.0 * all.tpm / all.total : 0.0, unattributed / 1000.0);
+
+	free(owner);
+	free(apis);
+	free(calls);
+	free(cmds);
+
+	return 0;
+}
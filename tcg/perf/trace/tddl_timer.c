@@ -0,0 +1,353 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *      tddl_timer.c
+ *
+ * DESCRIPTION
+ *      Times every TPM command at the TDDL boundary. Preloaded into the
+ *	TCS daemon, it wraps Tddli_TransmitData when the TDDL is a shared
+ *	library. Since tcsd usually links its TDDL statically, it also
+ *	watches open() of the TPM device and times each write() of a
+ *	command to it up to the read() of the response, which is the same
+ *	boundary one level lower.
+ *
+ *	Every command is appended as a line to the command log (see
+ *	tddl_timer.h) as it completes, so the log can be read while tcsd
+ *	keeps running. At exit a summary per ordinal is printed:
+ *
+ *	TPMCMD <ordinal name> count=.. total_us=.. mean_us=.. max_us=..
+ *		bytes_in=.. bytes_out=.. errors=..
+ *
+ *	Environment:
+ *	TDDL_TIMER_FILE		command log, default /tmp/tddl_timer.<pid>.log
+ *	TDDL_TIMER_DEVICE	path prefix of the TPM device, default /dev/tpm
+ *
+ * ALGORITHM
+ *      None.
+ *
+ * USAGE
+ *      LD_PRELOAD=libtddl_timer.so tcsd -f
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *      TPM emulators reached over a socket instead of a device node are
+ *	only seen when the TDDL is a shared library.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "tss/tss_typedef.h"
+#include "tss/tddli.h"
+#include "tddl_timer.h"
+
+#define TDDL_MAX_FDS		1024
+#define TDDL_DEFAULT_DEVICE	"/dev/tpm"
+
+/* a TPM command header is tag(2) size(4) ordinal(4), a response header
+ * tag(2) size(4) returncode(4) */
+#define TPM_HEADER_SIZE		10
+
+struct tddl_stats
+{
+	UINT32		count;
+	UINT32		errors;
+	UINT64		total;
+	UINT64		max;
+	UINT64		bytes_in;
+	UINT64		bytes_out;
+};
+
+static struct tddl_stats *stats;
+static UINT32 num_ordinals;
+static struct tddl_stats other_stats;	/* ordinals missing from tpm_ordinal.h */
+
+static pthread_mutex_t tddl_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *tddl_log;
+
+static char tpm_fds[TDDL_MAX_FDS];
+static struct {
+	UINT64	start;
+	UINT32	ordinal;
+	UINT32	bytes_in;
+} pending[TDDL_MAX_FDS];
+
+/* set while inside Tddli_TransmitData, so that the device I/O it does is
+ * not counted a second time */
+static __thread int in_transmit;
+
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_read)(int, void *, size_t);
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_close)(int);
+static TSS_RESULT (*real_transmit)(BYTE *, UINT32, BYTE *, UINT32 *);
+
+/* hooks can be called before the constructor has run, e.g. from another
+ * library's constructor, so each resolves its real function on first use */
+#define TDDL_RESOLVE(fn)						\
+	do {								\
+		if (!real_##fn)						\
+			real_##fn = dlsym(RTLD_NEXT, #fn);		\
+	} while (0)
+
+static UINT64
+tddl_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((UINT64)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static UINT32
+tddl_get_uint32(const BYTE *b)
+{
+	return ((UINT32)b[0] << 24) | ((UINT32)b[1] << 16) | ((UINT32)b[2] << 8) | b[3];
+}
+
+static UINT32
+tddl_ordinal_index(UINT32 ordinal)
+{
+	UINT32 i;
+
+	for (i = 0; i < num_ordinals; i++) {
+		if (tddl_ordinals[i].ordinal == ordinal)
+			return i;
+	}
+
+	return num_ordinals;
+}
+
+static void
+tddl_record(UINT64 start, UINT64 end, UINT32 ordinal, UINT32 bytes_in, const BYTE *resp,
+	    UINT32 bytes_out)
+{
+	struct tddl_stats *s;
+	UINT32 i, rc = 0;
+	char def[64], *path;
+
+	if (bytes_out >= TPM_HEADER_SIZE)
+		rc = tddl_get_uint32(resp + 6);
+
+	i = tddl_ordinal_index(ordinal);
+
+	pthread_mutex_lock(&tddl_lock);
+
+	s = (i < num_ordinals && stats) ? &stats[i] : &other_stats;
+	s->count++;
+	s->total += end - start;
+	if (end - start > s->max)
+		s->max = end - start;
+	s->bytes_in += bytes_in;
+	s->bytes_out += bytes_out;
+	if (rc)
+		s->errors++;
+
+	if (tddl_log == NULL) {
+		if ((path = getenv("TDDL_TIMER_FILE")) == NULL || *path == '\0') {
+			snprintf(def, sizeof(def), "/tmp/tddl_timer.%d.log", getpid());
+			path = def;
+		}
+		if ((tddl_log = fopen(path, "a")))
+			setvbuf(tddl_log, NULL, _IOLBF, 0);
+	}
+	if (tddl_log)
+		fprintf(tddl_log, "TPM %llu %llu 0x%08x %s %u %u 0x%x\n",
+			(unsigned long long)start, (unsigned long long)end, ordinal,
+			i < num_ordinals ? tddl_ordinals[i].name : "unknown", bytes_in,
+			bytes_out, rc);
+
+	pthread_mutex_unlock(&tddl_lock);
+}
+
+TSS_RESULT
+Tddli_TransmitData(BYTE *pTransmitBuf, UINT32 TransmitBufLen, BYTE *pReceiveBuf,
+		   UINT32 *puntReceiveBufLen)
+{
+	TSS_RESULT result;
+	UINT64 start;
+
+	if (!real_transmit)
+		return TSS_LAYER_TDDL | TDDL_E_FAIL;
+
+	in_transmit++;
+	start = tddl_now();
+	result = real_transmit(pTransmitBuf, TransmitBufLen, pReceiveBuf, puntReceiveBufLen);
+	in_transmit--;
+
+	if (result == TSS_SUCCESS && TransmitBufLen >= TPM_HEADER_SIZE)
+		tddl_record(start, tddl_now(), tddl_get_uint32(pTransmitBuf + 6), TransmitBufLen,
+			    pReceiveBuf, *puntReceiveBufLen);
+
+	return result;
+}
+
+static int
+tddl_is_device(const char *path)
+{
+	const char *dev = getenv("TDDL_TIMER_DEVICE");
+
+	if (dev == NULL || *dev == '\0')
+		dev = TDDL_DEFAULT_DEVICE;
+
+	return path && !strncmp(path, dev, strlen(dev));
+}
+
+static int
+tddl_open(int (*fn)(const char *, int, ...), const char *path, int flags, va_list ap)
+{
+	mode_t mode = 0;
+	int fd;
+
+	if (flags & O_CREAT)
+		mode = va_arg(ap, mode_t);
+
+	fd = fn(path, flags, mode);
+	if (fd >= 0 && fd < TDDL_MAX_FDS)
+		tpm_fds[fd] = tddl_is_device(path);
+
+	return fd;
+}
+
+int
+open(const char *path, int flags, ...)
+{
+	va_list ap;
+	int fd;
+
+	TDDL_RESOLVE(open);
+	va_start(ap, flags);
+	fd = tddl_open(real_open, path, flags, ap);
+	va_end(ap);
+
+	return fd;
+}
+
+int
+open64(const char *path, int flags, ...)
+{
+	va_list ap;
+	int fd;
+
+	TDDL_RESOLVE(open);
+	TDDL_RESOLVE(open64);
+	va_start(ap, flags);
+	fd = tddl_open(real_open64 ? real_open64 : real_open, path, flags, ap);
+	va_end(ap);
+
+	return fd;
+}
+
+int
+close(int fd)
+{
+	TDDL_RESOLVE(close);
+	if (fd >= 0 && fd < TDDL_MAX_FDS)
+		tpm_fds[fd] = 0;
+
+	return real_close(fd);
+}
+
+ssize_t
+write(int fd, const void *buf, size_t count)
+{
+	ssize_t ret;
+	UINT64 start;
+
+	TDDL_RESOLVE(write);
+	if (fd < 0 || fd >= TDDL_MAX_FDS || !tpm_fds[fd] || in_transmit)
+		return real_write(fd, buf, count);
+
+	start = tddl_now();
+	ret = real_write(fd, buf, count);
+	if (ret >= TPM_HEADER_SIZE) {
+		pending[fd].start = start;
+		pending[fd].ordinal = tddl_get_uint32((const BYTE *)buf + 6);
+		pending[fd].bytes_in = ret;
+	}
+
+	return ret;
+}
+
+ssize_t
+read(int fd, void *buf, size_t count)
+{
+	ssize_t ret;
+
+	TDDL_RESOLVE(read);
+	if (fd < 0 || fd >= TDDL_MAX_FDS || !tpm_fds[fd] || in_transmit)
+		return real_read(fd, buf, count);
+
+	ret = real_read(fd, buf, count);
+	if (ret > 0 && pending[fd].start) {
+		tddl_record(pending[fd].start, tddl_now(), pending[fd].ordinal,
+			    pending[fd].bytes_in, buf, ret);
+		pending[fd].start = 0;
+	}
+
+	return ret;
+}
+
+__attribute__((constructor)) static void
+tddl_init(void)
+{
+	real_transmit = dlsym(RTLD_NEXT, "Tddli_TransmitData");
+
+	for (num_ordinals = 0; tddl_ordinals[num_ordinals].name; num_ordinals++)
+		;
+	stats = calloc(num_ordinals, sizeof(struct tddl_stats));
+}
+
+static void
+tddl_print(const char *name, struct tddl_stats *s)
+{
+	fprintf(stderr, "TPMCMD %s count=%u total_us=%.3f mean_us=%.3f max_us=%.3f "
+		"bytes_in=%llu bytes_out=%llu errors=%u\n", name, s->count,
+		s->total / 1000.0, s->total / 1000.0 / s->count, s->max / 1000.0,
+		(unsigned long long)s->bytes_in, (unsigned long long)s->bytes_out, s->errors);
+}
+
+__attribute__((destructor)) static void
+tddl_fini(void)
+{
+	UINT32 i;
+
+	for (i = 0; stats && i < num_ordinals; i++) {
+		if (stats[i].count)
+			tddl_print(tddl_ordinals[i].name, &stats[i]);
+	}
+	if (other_stats.count)
+		tddl_print("unknown", &other_stats);
+
+	if (tddl_log)
+		fclose(tddl_log);
+}
@@ -0,0 +1,63 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *      tddl_timer.h
+ *
+ * DESCRIPTION
+ *      TPM ordinal names, shared by the TDDL timer and the tools reading
+ *	its command log.
+ *
+ *	Each line of the command log describes one TPM command:
+ *
+ *	TPM <start_ns> <end_ns> <ordinal> <name> <bytes_in> <bytes_out> <rc>
+ *
+ *	with the times taken from CLOCK_MONOTONIC and ordinal and rc in hex.
+ *
+ * ALGORITHM
+ *      None.
+ *
+ * USAGE
+ *      Included by tddl_timer.c, tddl_split.c and the generated
+ *	tddl_ordinals.c
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *      None.
+ */
+
+#ifndef _TDDL_TIMER_H_
+#define _TDDL_TIMER_H_
+
+#include <stddef.h>
+
+#include "tss/tss_typedef.h"
+
+struct tddl_ordinal
+{
+	UINT32		ordinal;
+	const char	*name;
+};
+
+/* terminated by a NULL name */
+extern struct tddl_ordinal tddl_ordinals[];
+
+#endif
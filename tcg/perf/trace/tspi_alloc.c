@@ -0,0 +1,425 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *      tspi_alloc.c
+ *
+ * DESCRIPTION
+ *      Runtime of the Tspi_* allocation accounting library. It shares the
+ *	wrappers generated from tspi.h with libtspi_trace.so, and interposes
+ *	malloc, calloc, realloc and free, so that every heap block of the
+ *	process is attributed to the outermost Tspi_* call which was running
+ *	in its thread when it was allocated.
+ *
+ *	At exit one line is printed for the whole program, where peak is the
+ *	largest number of bytes live at once and leaked what is still live:
+ *
+ *	ALLOC <program> peak_bytes=.. leaked_bytes=.. leaked_blocks=..
+ *		allocs=.. frees=..
+ *
+ *	and one line per API which allocated, sorted by allocations:
+ *
+ *	ALLOC <program> <api> calls=.. allocs=.. allocs_per_call=..
+ *		bytes=.. leaked_bytes=.. leaked_blocks=.. close_bytes=..
+ *
+ *	close_bytes counts the blocks returned by the API which the program
+ *	never freed itself, but which were reclaimed by Tspi_Context_Close,
+ *	e.g. data from Tspi_GetAttribData never given to
+ *	Tspi_Context_FreeMemory. Allocations made outside any Tspi_* call
+ *	are only counted in the program's line.
+ *
+ *	Environment:
+ *	TSPI_ALLOC_SUMMARY	summary output, default stderr
+ *
+ * ALGORITHM
+ *      Live blocks are kept in a hash table keyed by address, which holds
+ *	the size and the API of each block. Its entries come from the real
+ *	malloc, called with a per-thread flag set so they aren't counted.
+ *
+ * USAGE
+ *      LD_PRELOAD=libtspi_alloc.so <program>
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *      Blocks from posix_memalign and friends are not seen, and freeing
+ *	them is ignored. Every allocation takes a global lock, so
+ *	multithreaded programs run slower than usual.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include "tspi_trace.h"
+
+#define ALLOC_BUCKETS		65536
+#define ALLOC_MAX_APIS		512
+#define ALLOC_NO_API		((UINT32)-1)
+
+/* dlsym() may allocate before the real calloc is known */
+#define ALLOC_BOOT_SIZE		4096
+
+struct alloc_block
+{
+	struct alloc_block	*next;
+	void			*ptr;
+	size_t			size;
+	UINT32			api;
+};
+
+struct alloc_api
+{
+	UINT32	calls;
+	UINT64	allocs;
+	UINT64	bytes;
+	UINT64	close_bytes;
+};
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+static char boot_buf[ALLOC_BOOT_SIZE];
+static size_t boot_used;
+static int resolving;
+
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct alloc_block *buckets[ALLOC_BUCKETS];
+static struct alloc_block *spare;	/* entries of freed blocks, for reuse */
+static struct alloc_api apis[ALLOC_MAX_APIS];
+static UINT64 live_bytes, peak_bytes, total_allocs, total_frees;
+
+/* initial-exec, so that touching them never calls malloc itself */
+#define ALLOC_TLS	__thread __attribute__((tls_model("initial-exec")))
+
+static ALLOC_TLS UINT32 my_api = ALLOC_NO_API;
+static ALLOC_TLS UINT32 my_depth;
+static ALLOC_TLS int in_hook;	/* the hooks' own use of the heap */
+
+static UINT32 close_api = ALLOC_NO_API;
+
+static void
+alloc_resolve(void)
+{
+	if (real_malloc || resolving)
+		return;
+
+	resolving = 1;
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	resolving = 0;
+}
+
+static int
+alloc_is_boot(void *ptr)
+{
+	return (char *)ptr >= boot_buf && (char *)ptr < boot_buf + ALLOC_BOOT_SIZE;
+}
+
+static void *
+alloc_boot(size_t size)
+{
+	void *ptr;
+
+	size = (size + 15) & ~15;
+	if (boot_used + size > ALLOC_BOOT_SIZE)
+		return NULL;
+	ptr = boot_buf + boot_used;
+	boot_used += size;
+
+	return ptr;
+}
+
+static unsigned long
+alloc_hash(void *ptr)
+{
+	return ((unsigned long)ptr >> 4) % ALLOC_BUCKETS;
+}
+
+static void
+alloc_add(void *ptr, size_t size)
+{
+	struct alloc_block *b;
+
+	pthread_mutex_lock(&alloc_lock);
+
+	if ((b = spare))
+		spare = b->next;
+	else {
+		in_hook++;
+		b = real_malloc(sizeof(struct alloc_block));
+		in_hook--;
+	}
+
+	if (b) {
+		b->ptr = ptr;
+		b->size = size;
+		b->api = my_api;
+		b->next = buckets[alloc_hash(ptr)];
+		buckets[alloc_hash(ptr)] = b;
+
+		if (my_api != ALLOC_NO_API) {
+			apis[my_api].allocs++;
+			apis[my_api].bytes += size;
+		}
+		total_allocs++;
+		live_bytes += size;
+		if (live_bytes > peak_bytes)
+			peak_bytes = live_bytes;
+	}
+
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+static void
+alloc_remove(void *ptr)
+{
+	struct alloc_block **p, *b;
+
+	pthread_mutex_lock(&alloc_lock);
+
+	for (p = &buckets[alloc_hash(ptr)]; (b = *p); p = &b->next) {
+		if (b->ptr != ptr)
+			continue;
+
+		*p = b->next;
+		live_bytes -= b->size;
+		total_frees++;
+		if (my_api == close_api && b->api != ALLOC_NO_API && b->api != close_api)
+			apis[b->api].close_bytes += b->size;
+
+		b->next = spare;
+		spare = b;
+		break;
+	}
+
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+void *
+malloc(size_t size)
+{
+	void *ptr;
+
+	alloc_resolve();
+	if (!real_malloc)
+		return alloc_boot(size);
+
+	ptr = real_malloc(size);
+	if (ptr && !in_hook)
+		alloc_add(ptr, size);
+
+	return ptr;
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+	void *ptr;
+
+	alloc_resolve();
+	if (!real_calloc)
+		return alloc_boot(n * size);	/* static, so already zeroed */
+
+	ptr = real_calloc(n, size);
+	if (ptr && !in_hook)
+		alloc_add(ptr, n * size);
+
+	return ptr;
+}
+
+void *
+realloc(void *old, size_t size)
+{
+	void *ptr;
+
+	alloc_resolve();
+	if (alloc_is_boot(old)) {
+		if ((ptr = malloc(size)))
+			memcpy(ptr, old, size < ALLOC_BOOT_SIZE ? size : ALLOC_BOOT_SIZE);
+		return ptr;
+	}
+	if (!real_realloc)
+		return NULL;
+
+	/* forget the old block first, another thread may get its address
+	 * from malloc as soon as it is released */
+	if (old && !in_hook)
+		alloc_remove(old);
+	ptr = real_realloc(old, size);
+	if (!in_hook) {
+		if (ptr)
+			alloc_add(ptr, size);
+		else if (old && size)
+			alloc_add(old, malloc_usable_size(old));
+	}
+
+	return ptr;
+}
+
+void
+free(void *ptr)
+{
+	if (ptr == NULL || alloc_is_boot(ptr))
+		return;
+
+	alloc_resolve();
+	if (!real_free)
+		return;
+	if (!in_hook)
+		alloc_remove(ptr);
+	real_free(ptr);
+}
+
+void *
+trace_resolve(const char *name)
+{
+	void *sym = dlsym(RTLD_NEXT, name);
+
+	if (sym == NULL)
+		fprintf(stderr, "tspi_alloc: can't find %s: %s\n", name, dlerror());
+
+	return sym;
+}
+
+void
+trace_begin(struct trace_record *rec, UINT32 api)
+{
+	rec->api = api;
+	rec->depth = my_depth++;
+	if (rec->depth || api >= ALLOC_MAX_APIS)
+		return;
+
+	my_api = api;
+	__atomic_add_fetch(&apis[api].calls, 1, __ATOMIC_RELAXED);
+}
+
+void
+trace_end(struct trace_record *rec, TSS_RESULT result)
+{
+	if (--my_depth == 0)
+		my_api = ALLOC_NO_API;
+}
+
+static int
+alloc_api_cmp(const void *a, const void *b)
+{
+	const struct alloc_api *x = &apis[*(const UINT32 *)a], *y = &apis[*(const UINT32 *)b];
+
+	return (x->allocs < y->allocs) - (x->allocs > y->allocs);
+}
+
+static void
+alloc_write_summary(FILE *f)
+{
+	UINT64 leaked_bytes[ALLOC_MAX_APIS], leaked_blocks[ALLOC_MAX_APIS];
+	UINT64 total_leaked = 0, total_blocks = 0;
+	UINT32 sorted[ALLOC_MAX_APIS], i, n = 0;
+	struct alloc_block *b;
+	struct alloc_api *a;
+
+	memset(leaked_bytes, 0, sizeof(leaked_bytes));
+	memset(leaked_blocks, 0, sizeof(leaked_blocks));
+
+	pthread_mutex_lock(&alloc_lock);
+	for (i = 0; i < ALLOC_BUCKETS; i++) {
+		for (b = buckets[i]; b; b = b->next) {
+			total_leaked += b->size;
+			total_blocks++;
+			if (b->api != ALLOC_NO_API) {
+				leaked_bytes[b->api] += b->size;
+				leaked_blocks[b->api]++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&alloc_lock);
+
+	fprintf(f, "ALLOC %s peak_bytes=%llu leaked_bytes=%llu leaked_blocks=%llu "
+		"allocs=%llu frees=%llu\n", program_invocation_short_name,
+		(unsigned long long)peak_bytes, (unsigned long long)total_leaked,
+		(unsigned long long)total_blocks, (unsigned long long)total_allocs,
+		(unsigned long long)total_frees);
+
+	for (i = 0; i < trace_api_count && i < ALLOC_MAX_APIS; i++) {
+		if (apis[i].allocs)
+			sorted[n++] = i;
+	}
+	qsort(sorted, n, sizeof(UINT32), alloc_api_cmp);
+
+	for (i = 0; i < n; i++) {
+		a = &apis[sorted[i]];
+		fprintf(f, "ALLOC %s %s calls=%u allocs=%llu allocs_per_call=%.2f bytes=%llu "
+			"leaked_bytes=%llu leaked_blocks=%llu close_bytes=%llu\n",
+			program_invocation_short_name, trace_api_names[sorted[i]], a->calls,
+			(unsigned long long)a->allocs,
+			a->calls ? (double)a->allocs / a->calls : 0.0,
+			(unsigned long long)a->bytes, (unsigned long long)leaked_bytes[sorted[i]],
+			(unsigned long long)leaked_blocks[sorted[i]],
+			(unsigned long long)a->close_bytes);
+	}
+}
+
+__attribute__((constructor)) static void
+alloc_init(void)
+{
+	UINT32 i;
+
+	alloc_resolve();
+
+	for (i = 0; i < trace_api_count; i++) {
+		if (!strcmp(trace_api_names[i], "Tspi_Context_Close"))
+			close_api = i;
+	}
+}
+
+__attribute__((destructor)) static void
+alloc_fini(void)
+{
+	char *path;
+	FILE *f;
+	UINT32 i;
+
+	/* nothing to report, e.g. a shell started with LD_PRELOAD set */
+	for (i = 0; i < ALLOC_MAX_APIS && !apis[i].calls; i++)
+		;
+	if (i == ALLOC_MAX_APIS)
+		return;
+
+	/* stdio's own buffers are not the program's */
+	in_hook++;
+	if ((path = getenv("TSPI_ALLOC_SUMMARY")) && *path) {
+		if ((f = fopen(path, "a"))) {
+			alloc_write_summary(f);
+			fclose(f);
+		} else
+			perror(path);
+	} else
+		alloc_write_summary(stderr);
+	in_hook--;
+}
@@ -0,0 +1,531 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *      tspi_trace.c
+ *
+ * DESCRIPTION
+ *      Runtime of the Tspi_* tracing library. Loaded with LD_PRELOAD in
+ *	front of libtspi, the wrappers generated from tspi.h record every
+ *	Tspi_* call of the process. Each thread writes its records into its
+ *	own ring buffer, so recording takes no locks; the rings are linked
+ *	into a global list with an atomic compare-and-swap when a thread
+ *	makes its first call. When a ring is full the oldest records are
+ *	overwritten and counted as dropped.
+ *
+ *	At exit the records are written as a Chrome trace (load it in
+ *	chrome://tracing or ui.perfetto.dev), and a summary with one line
+ *	per API, sorted by total time, is printed:
+ *
+ *	TRACE <api> calls=.. errors=.. total_us=.. mean_us=.. p50_us=..
+ *		p95_us=.. max_us=.. bytes_in=.. bytes_out=..
+ *
+ *	The type of the handle recorded with a call is the type of the
+ *	object, not of the parameter: every handle a Tspi_* call returns is
+ *	entered with its type into a lock-free table, and removed when it is
+ *	closed with Tspi_Context_CloseObject or its context is closed. The
+ *	handles still in the table at exit, which the program didn't close,
+ *	are counted per type:
+ *
+ *	TRACE handles_open <type>=<count> ...
+ *
+ *	Environment:
+ *	TSPI_TRACE_FILE		Chrome trace output, default
+ *				tspi_trace.<pid>.json, empty for none
+ *	TSPI_TRACE_SUMMARY	summary output, default stderr
+ *	TSPI_TRACE_EVENTS	records kept per thread, default 65536
+ *
+ * ALGORITHM
+ *      None.
+ *
+ * USAGE
+ *      LD_PRELOAD=libtspi_trace.so <program>
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *      Only calls that go through the dynamic linker are seen, so calls
+ *	libtspi makes to its own Tspi_* functions are not traced. Records
+ *	of threads which are still running at exit may be missing their
+ *	last call. Handles the program got other than from a Tspi_* call
+ *	are reported with the type of the parameter they were passed as.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "tspi_trace.h"
+
+#define TRACE_DEFAULT_EVENTS	65536
+#define TRACE_HANDLES		65536	/* a power of 2 */
+
+struct trace_ring
+{
+	struct trace_ring	*next;
+	pid_t			tid;
+	UINT32			size;
+	UINT64			head;	/* records written, including overwritten ones */
+	struct trace_record	rec[];
+};
+
+/* a handle returned by a Tspi_* call; type is NULL once it is closed */
+struct trace_handle
+{
+	UINT32		handle;
+	UINT32		context;	/* the context the object belongs to */
+	const char	*type;
+};
+
+static struct trace_handle handles[TRACE_HANDLES];
+static UINT32 handles_dropped;
+static UINT32 api_close_context = (UINT32)-1;
+
+static struct trace_ring *rings;
+static __thread struct trace_ring *my_ring;
+static __thread UINT32 my_depth;
+static UINT32 ring_size;
+
+static UINT64
+trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((UINT64)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+void *
+trace_resolve(const char *name)
+{
+	void *sym = dlsym(RTLD_NEXT, name);
+
+	if (sym == NULL)
+		fprintf(stderr, "tspi_trace: can't find %s: %s\n", name, dlerror());
+
+	return sym;
+}
+
+static struct trace_ring *
+trace_ring_new(void)
+{
+	struct trace_ring *ring;
+	char *env;
+
+	if (ring_size == 0) {
+		env = getenv("TSPI_TRACE_EVENTS");
+		ring_size = env ? strtoul(env, NULL, 0) : 0;
+		if (ring_size == 0)
+			ring_size = TRACE_DEFAULT_EVENTS;
+	}
+
+	ring = malloc(sizeof(struct trace_ring) + ring_size * sizeof(struct trace_record));
+	if (ring == NULL)
+		return NULL;
+
+	ring->tid = syscall(SYS_gettid);
+	ring->size = ring_size;
+	ring->head = 0;
+
+	/* lock-free push onto the list of rings */
+	ring->next = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0,
+					    __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+		;
+
+	return ring;
+}
+
+static const char *
+trace_object_type(UINT32 type)
+{
+	switch (type) {
+		case TSS_OBJECT_TYPE_POLICY:		return "TSS_HPOLICY";
+		case TSS_OBJECT_TYPE_RSAKEY:		return "TSS_HKEY";
+		case TSS_OBJECT_TYPE_ENCDATA:		return "TSS_HENCDATA";
+		case TSS_OBJECT_TYPE_PCRS:		return "TSS_HPCRS";
+		case TSS_OBJECT_TYPE_HASH:		return "TSS_HHASH";
+		case TSS_OBJECT_TYPE_DELFAMILY:		return "TSS_HDELFAMILY";
+		case TSS_OBJECT_TYPE_NV:		return "TSS_HNVSTORE";
+		case TSS_OBJECT_TYPE_MIGDATA:		return "TSS_HMIGDATA";
+		case TSS_OBJECT_TYPE_DAA_CERTIFICATE:	return "TSS_HDAA_CREDENTIAL";
+		case TSS_OBJECT_TYPE_DAA_ISSUER_KEY:	return "TSS_HDAA_ISSUER_KEY";
+		case TSS_OBJECT_TYPE_DAA_ARA_KEY:	return "TSS_HDAA_ARA_KEY";
+		default:				return "TSS_HOBJECT";
+	}
+}
+
+/* the slot of handle, or the empty slot where it would go. Slots are never
+ * freed, a closed handle keeps its slot with no type */
+static struct trace_handle *
+trace_handle_slot(UINT32 handle, int insert)
+{
+	struct trace_handle *h;
+	UINT32 i, n, empty;
+
+	for (i = (handle * 2654435761U) & (TRACE_HANDLES - 1), n = 0; n < TRACE_HANDLES;
+	     i = (i + 1) & (TRACE_HANDLES - 1), n++) {
+		h = &handles[i];
+		if (__atomic_load_n(&h->handle, __ATOMIC_ACQUIRE) == handle)
+			return h;
+		if (__atomic_load_n(&h->handle, __ATOMIC_ACQUIRE) != 0)
+			continue;
+		if (!insert)
+			return NULL;
+
+		/* claim the slot, unless another thread took it meanwhile */
+		empty = 0;
+		if (__atomic_compare_exchange_n(&h->handle, &empty, handle, 0, __ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE) || empty == handle)
+			return h;
+	}
+
+	return NULL;
+}
+
+static const char *
+trace_handle_type(UINT32 handle)
+{
+	struct trace_handle *h;
+
+	if (handle == 0 || (h = trace_handle_slot(handle, 0)) == NULL)
+		return NULL;
+
+	return __atomic_load_n(&h->type, __ATOMIC_ACQUIRE);
+}
+
+/* the handle returned by rec's call, created in the context of rec's first
+ * handle parameter */
+static void
+trace_handle_add(struct trace_record *rec)
+{
+	struct trace_handle *h, *parent;
+	const char *type;
+
+	type = rec->out_type ? rec->out_type : trace_object_type(rec->out_object_type);
+	if ((h = trace_handle_slot(rec->out_handle, 1)) == NULL) {
+		__atomic_add_fetch(&handles_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (!strcmp(type, "TSS_HCONTEXT"))
+		h->context = rec->out_handle;
+	else if (rec->handle && (parent = trace_handle_slot(rec->handle, 0)))
+		h->context = parent->context;
+	else
+		h->context = rec->handle;
+	__atomic_store_n(&h->type, type, __ATOMIC_RELEASE);
+}
+
+/* closing a context frees all of its objects */
+static void
+trace_handle_close_context(UINT32 context)
+{
+	UINT32 i;
+
+	for (i = 0; i < TRACE_HANDLES; i++) {
+		if (__atomic_load_n(&handles[i].handle, __ATOMIC_ACQUIRE) &&
+		    handles[i].context == context)
+			__atomic_store_n(&handles[i].type, NULL, __ATOMIC_RELEASE);
+	}
+}
+
+static void
+trace_handle_end(struct trace_record *rec)
+{
+	struct trace_handle *h;
+	const char *type;
+
+	if ((type = trace_handle_type(rec->handle)))
+		rec->handle_type = type;
+
+	if (rec->result != TSS_SUCCESS)
+		return;
+
+	if (rec->closed_handle) {
+		if ((h = trace_handle_slot(rec->closed_handle, 0)))
+			__atomic_store_n(&h->type, NULL, __ATOMIC_RELEASE);
+	} else if (rec->api == api_close_context)
+		trace_handle_close_context(rec->handle);
+	else if (rec->out_handle)
+		trace_handle_add(rec);
+}
+
+void
+trace_begin(struct trace_record *rec, UINT32 api)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->api = api;
+	rec->depth = my_depth++;
+	rec->start = trace_now();
+}
+
+void
+trace_end(struct trace_record *rec, TSS_RESULT result)
+{
+	struct trace_ring *ring;
+	UINT64 head;
+
+	rec->end = trace_now();
+	rec->result = result;
+	my_depth--;
+
+	trace_handle_end(rec);
+
+	if ((ring = my_ring) == NULL && (ring = my_ring = trace_ring_new()) == NULL)
+		return;
+
+	/* only this thread writes to its ring. The release store makes the
+	 * record visible before the new head to the thread dumping at exit */
+	head = ring->head;
+	ring->rec[head % ring->size] = *rec;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* a forked child starts with no records, its rings belong to the parent */
+static void
+trace_atfork_child(void)
+{
+	rings = NULL;
+	my_ring = NULL;
+}
+
+static int
+trace_cmp(const void *a, const void *b)
+{
+	UINT64 x = *(const UINT64 *)a, y = *(const UINT64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+struct trace_api
+{
+	UINT32		calls;
+	UINT32		errors;
+	UINT64		total;
+	UINT64		bytes_in;
+	UINT64		bytes_out;
+	UINT64		*ns;
+	UINT32		n;
+};
+
+static int
+trace_api_cmp(const void *a, const void *b)
+{
+	const struct trace_api *x = *(struct trace_api * const *)a;
+	const struct trace_api *y = *(struct trace_api * const *)b;
+
+	return (x->total < y->total) - (x->total > y->total);
+}
+
+/* first record still held in a ring */
+static UINT64
+trace_ring_first(struct trace_ring *ring, UINT64 head)
+{
+	return head > ring->size ? head - ring->size : 0;
+}
+
+static void
+trace_write_json(FILE *f)
+{
+	struct trace_ring *ring;
+	struct trace_record *rec;
+	UINT64 head, i;
+	pid_t pid = getpid();
+	int first = 1;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		for (i = trace_ring_first(ring, head); i < head; i++) {
+			rec = &ring->rec[i % ring->size];
+			fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"tspi\",\"ph\":\"X\","
+				"\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+				"\"args\":{\"result\":\"0x%x\",\"handle\":\"0x%x\","
+				"\"handle_type\":\"%s\",\"bytes_in\":%u,\"bytes_out\":%u,"
+				"\"depth\":%u}}",
+				first ? "" : ",\n", trace_api_names[rec->api],
+				rec->start / 1000.0, (rec->end - rec->start) / 1000.0,
+				pid, ring->tid, rec->result, rec->handle,
+				rec->handle_type ? rec->handle_type : "", rec->bytes_in,
+				rec->bytes_out, rec->depth);
+			first = 0;
+		}
+	}
+	fprintf(f, "\n]}\n");
+}
+
+/* the handles never closed, counted per type */
+static void
+trace_write_handles(FILE *f)
+{
+	const char *types[TRACE_HANDLES / 64], *type;
+	UINT32 counts[TRACE_HANDLES / 64], i, j, n = 0;
+
+	for (i = 0; i < TRACE_HANDLES; i++) {
+		if ((type = __atomic_load_n(&handles[i].type, __ATOMIC_ACQUIRE)) == NULL)
+			continue;
+		for (j = 0; j < n && strcmp(types[j], type); j++)
+			;
+		if (j == n) {
+			if (n == TRACE_HANDLES / 64)
+				continue;
+			types[n] = type;
+			counts[n++] = 0;
+		}
+		counts[j]++;
+	}
+
+	if (n == 0 && handles_dropped == 0)
+		return;
+
+	fprintf(f, "TRACE handles_open");
+	for (j = 0; j < n; j++)
+		fprintf(f, " %s=%u", types[j], counts[j]);
+	if (handles_dropped)
+		fprintf(f, " untracked=%u", handles_dropped);
+	fprintf(f, "\n");
+}
+
+static void
+trace_write_summary(FILE *f)
+{
+	struct trace_ring *ring;
+	struct trace_record *rec;
+	struct trace_api *apis, **sorted, *a;
+	UINT64 head, i, dropped = 0;
+	UINT32 j, n = 0;
+
+	if ((apis = calloc(trace_api_count, sizeof(struct trace_api))) == NULL ||
+	    (sorted = calloc(trace_api_count, sizeof(struct trace_api *))) == NULL) {
+		free(apis);
+		return;
+	}
+
+	/* count first, so that each API's samples fit one allocation */
+	for (ring = rings; ring; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		dropped += trace_ring_first(ring, head);
+		for (i = trace_ring_first(ring, head); i < head; i++)
+			apis[ring->rec[i % ring->size].api].calls++;
+	}
+
+	for (j = 0; j < trace_api_count; j++) {
+		if (apis[j].calls == 0)
+			continue;
+		if ((apis[j].ns = malloc(apis[j].calls * sizeof(UINT64))) == NULL)
+			goto done;
+		sorted[n++] = &apis[j];
+	}
+
+	for (ring = rings; ring; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		for (i = trace_ring_first(ring, head); i < head; i++) {
+			rec = &ring->rec[i % ring->size];
+			a = &apis[rec->api];
+			/* a thread still running may have added records since counting */
+			if (a->n == a->calls)
+				continue;
+			a->ns[a->n++] = rec->end - rec->start;
+			a->total += rec->end - rec->start;
+			a->bytes_in += rec->bytes_in;
+			a->bytes_out += rec->bytes_out;
+			if (rec->result != TSS_SUCCESS)
+				a->errors++;
+		}
+	}
+
+	qsort(sorted, n, sizeof(struct trace_api *), trace_api_cmp);
+
+	for (j = 0; j < n; j++) {
+		a = sorted[j];
+		if (a->n == 0)
+			continue;
+		qsort(a->ns, a->n, sizeof(UINT64), trace_cmp);
+		fprintf(f, "TRACE %s calls=%u errors=%u total_us=%.3f mean_us=%.3f "
+			"p50_us=%.3f p95_us=%.3f max_us=%.3f bytes_in=%llu bytes_out=%llu\n",
+			trace_api_names[a - apis], a->n, a->errors, a->total / 1000.0,
+			a->total / 1000.0 / a->n, a->ns[(a->n - 1) * 50 / 100] / 1000.0,
+			a->ns[(a->n - 1) * 95 / 100] / 1000.0, a->ns[a->n - 1] / 1000.0,
+			(unsigned long long)a->bytes_in, (unsigned long long)a->bytes_out);
+	}
+	if (dropped)
+		fprintf(f, "TRACE dropped=%llu\n", (unsigned long long)dropped);
+
+	trace_write_handles(f);
+
+done:
+	for (j = 0; j < trace_api_count; j++)
+		free(apis[j].ns);
+	free(apis);
+	free(sorted);
+}
+
+__attribute__((constructor)) static void
+trace_init(void)
+{
+	UINT32 i;
+
+	for (i = 0; i < trace_api_count; i++) {
+		if (!strcmp(trace_api_names[i], "Tspi_Context_Close"))
+			api_close_context = i;
+	}
+
+	pthread_atfork(NULL, NULL, trace_atfork_child);
+}
+
+__attribute__((destructor)) static void
+trace_fini(void)
+{
+	char def[64], *path;
+	FILE *f;
+
+	/* nothing traced, e.g. a shell started with LD_PRELOAD set */
+	if (__atomic_load_n(&rings, __ATOMIC_ACQUIRE) == NULL)
+		return;
+
+	if ((path = getenv("TSPI_TRACE_FILE")) == NULL) {
+		snprintf(def, sizeof(def), "tspi_trace.%d.json", getpid());
+		path = def;
+	}
+	if (*path) {
+		if ((f = fopen(path, "w"))) {
+			trace_write_json(f);
+			fclose(f);
+		} else
+			perror(path);
+	}
+
+	if ((path = getenv("TSPI_TRACE_SUMMARY")) && *path) {
+		if ((f = fopen(path, "a"))) {
+			trace_write_summary(f);
+			fclose(f);
+		} else
+			perror(path);
+	} else
+		trace_write_summary(stderr);
+}
@@ -0,0 +1,70 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *      tspi_trace.h
+ *
+ * DESCRIPTION
+ *      Interface between the generated Tspi_* wrappers and the tracing
+ *	runtime in tspi_trace.c.
+ *
+ * ALGORITHM
+ *      None.
+ *
+ * USAGE
+ *      Included by tspi_trace.c and the generated tspi_trace_gen.c
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *      None.
+ */
+
+#ifndef _TSPI_TRACE_H_
+#define _TSPI_TRACE_H_
+
+#include "tss/tspi.h"
+
+/* one traced call */
+struct trace_record
+{
+	UINT64		start;		/* CLOCK_MONOTONIC, ns */
+	UINT64		end;
+	UINT32		api;		/* index into trace_api_names */
+	TSS_RESULT	result;
+	UINT32		handle;		/* first handle parameter, if any */
+	const char	*handle_type;	/* its parameter type, until trace_end() */
+	UINT32		out_handle;	/* handle returned, if any */
+	const char	*out_type;	/* its parameter type, NULL for TSS_HOBJECT */
+	UINT32		out_object_type; /* TSS_OBJECT_TYPE_* of a TSS_HOBJECT */
+	UINT32		closed_handle;	/* object given to Tspi_Context_CloseObject */
+	UINT32		bytes_in;
+	UINT32		bytes_out;
+	UINT32		depth;		/* Tspi calls made while this one was running */
+};
+
+extern const char *trace_api_names[];
+extern const UINT32 trace_api_count;
+
+void *trace_resolve(const char *);
+void trace_begin(struct trace_record *, UINT32);
+void trace_end(struct trace_record *, TSS_RESULT);
+
+#endif
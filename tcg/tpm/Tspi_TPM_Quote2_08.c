@@ -0,0 +1,219 @@
+/*
+ *
+ *   Copyright (C) International Business Machines  Corp., 2007
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ *   the GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program;  if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * NAME
+ *	Tspi_TPM_Quote2_08.c
+ *
+ * DESCRIPTION
+ *	This test will verify that the TPM_PCR_INFO_SHORT signed by
+ *		Tspi_TPM_Quote2 is the one TestSuite_Blob_Put_PCR_INFO_SHORT
+ *		builds in software from the values of the selected PCRs,
+ *		read back with Tspi_TPM_PcrRead, at locality zero.
+ *
+ * ALGORITHM
+ *	Setup:
+ *		Create Context
+ *		Connect Context
+ *		Load the SRK
+ *		Create and load a signing key
+ *		Get the number of PCRs from the TPM
+ *		Create an INFO_SHORT PcrComposite
+ *		SelectPcrIndexEx the first, the ninth and the last PCR
+ *		Read the selected PCRs into the software composite
+ *		Get Random for the external data
+ *
+ *	Test:
+ *		Call Quote2
+ *		Verify the signature
+ *		Compare the PCR_INFO_SHORT in the quote info with the
+ *		software one
+ *
+ *	Cleanup:
+ *		Free memory associated with the context
+ *		Close the context
+ *		Print error/success message
+ *
+ * USAGE:	First parameter is --options
+ *			-v or --version
+ *		Second Parameter is the version of the test case to be run.
+ *		This test case is currently only implemented for 1.2
+ *
+ * HISTORY
+ *
+ * RESTRICTIONS
+ *	Expects to be run at locality zero.
+ */
+
+#include "common.h"
+
+/* TPM_QUOTE_INFO2: tag, "QUT2", externalData, then the TPM_PCR_INFO_SHORT */
+#define QUOTE_INFO2_PCR_INFO_OFFSET	(2 + 4 + TPM_SHA1_160_HASH_LEN)
+
+
+char *function = "Tspi_TPM_Quote2_08";
+
+int
+main( int argc, char **argv )
+{
+	char		version;
+
+	version = parseArgs( argc, argv );
+	if (version == TESTSUITE_TEST_TSS_1_2)
+		main_v1_2(version);
+	else if (version == TESTSUITE_TEST_TSS_1_1)
+		print_NA();
+	else
+		print_wrongVersion();
+}
+
+int
+main_v1_2(char version)
+{
+	struct testsuite_pcr_composite	model;
+	struct testsuite_blob		b;
+	TSS_HCONTEXT	hContext;
+	TSS_HTPM	hTPM;
+	TSS_HKEY	hSRK, hIdentKey;
+	TSS_HPCRS	hPcrComposite;
+	TSS_VALIDATION	valData;
+	TSS_RESULT	result;
+	UINT32		numPcrs, pcrs[3], i, valueLen, versionInfoSize;
+	BYTE		expected[2 + TESTSUITE_PCR_MAX / 8 + 1 + TPM_SHA1_160_HASH_LEN];
+	BYTE		*value, *versionInfo, *nonce;
+
+	print_begin_test( function );
+
+	result = connect_load_srk( &hContext, &hSRK );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "connect_load_srk", result );
+		print_error_exit( function, err_string(result) );
+		exit( result );
+	}
+
+	result = create_load_key( hContext, TSS_KEY_SIZE_2048 | TSS_KEY_TYPE_SIGNING |
+				  TSS_KEY_NO_AUTHORIZATION, hSRK, &hIdentKey );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "create_load_key", result );
+		goto done;
+	}
+
+	result = Tspi_Context_GetTpmObject( hContext, &hTPM );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_GetTpmObject", result );
+		goto done;
+	}
+
+	if ((result = TestSuite_Get_Num_PCRs(hContext, hTPM, &numPcrs)))
+		goto done;
+	if (numPcrs < 9 || numPcrs > TESTSUITE_PCR_MAX) {
+		fprintf(stderr, "%s: unexpected number of PCRs: %u\n", function, numPcrs);
+		result = TSS_E_FAIL;
+		goto done;
+	}
+
+	result = Tspi_Context_CreateObject( hContext, TSS_OBJECT_TYPE_PCRS,
+					    TSS_PCRS_STRUCT_INFO_SHORT, &hPcrComposite );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_Context_CreateObject (hPcrComposite)", result );
+		goto done;
+	}
+
+	TestSuite_Pcr_Composite_Init(&model, numPcrs);
+	pcrs[0] = 0;
+	pcrs[1] = 8;
+	pcrs[2] = numPcrs - 1;
+
+	for (i = 0; i < 3; i++) {
+		result = Tspi_PcrComposite_SelectPcrIndexEx( hPcrComposite, pcrs[i],
+							     TSS_PCRS_DIRECTION_RELEASE );
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_PcrComposite_SelectPcrIndexEx", result );
+			goto done;
+		}
+
+		result = Tspi_TPM_PcrRead( hTPM, pcrs[i], &valueLen, &value );
+		if ( result != TSS_SUCCESS )
+		{
+			print_error( "Tspi_TPM_PcrRead", result );
+			goto done;
+		}
+		if (valueLen != TPM_SHA1_160_HASH_LEN) {
+			fprintf(stderr, "Tspi_TPM_PcrRead: %u bytes returned\n", valueLen);
+			result = TSS_E_FAIL;
+			goto done;
+		}
+		TestSuite_Pcr_Composite_Set_Value(&model, pcrs[i], value);
+		Tspi_Context_FreeMemory( hContext, value );
+	}
+
+	result = Tspi_TPM_GetRandom( hTPM, TPM_SHA1_160_HASH_LEN, &nonce );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_TPM_GetRandom", result );
+		goto done;
+	}
+	valData.ulExternalDataLength = TPM_SHA1_160_HASH_LEN;
+	valData.rgbExternalData = nonce;
+
+	result = Tspi_TPM_Quote2( hTPM, hIdentKey, FALSE, hPcrComposite, &valData,
+				  &versionInfoSize, &versionInfo );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Tspi_TPM_Quote2", result );
+		goto done;
+	}
+
+	result = Testsuite_Verify_Signature( hContext, hIdentKey, &valData );
+	if ( result != TSS_SUCCESS )
+	{
+		print_error( "Testsuite_Verify_Signature", result );
+		goto done;
+	}
+
+	TestSuite_Blob_Init(&b, expected, sizeof(expected));
+	TestSuite_Blob_Put_PCR_INFO_SHORT(&b, &model, TPM_LOC_ZERO);
+	if ((result = b.result))
+		goto done;
+
+	if (valData.ulDataLength != QUOTE_INFO2_PCR_INFO_OFFSET + b.offset ||
+	    memcmp(&valData.rgbData[QUOTE_INFO2_PCR_INFO_OFFSET], expected, b.offset)) {
+		fprintf(stderr, "PCR_INFO_SHORT doesn't match\nActual (%u bytes):\n",
+			valData.ulDataLength);
+		print_hex(valData.rgbData, valData.ulDataLength);
+		fprintf(stderr, "Expected at offset %u:\n", QUOTE_INFO2_PCR_INFO_OFFSET);
+		print_hex(expected, b.offset);
+		result = TSS_E_FAIL;
+	}
+
+done:
+	if (result == TSS_SUCCESS)
+		print_success( function, result );
+	else
+		print_error( function, result );
+	print_end_test( function );
+	Tspi_Context_FreeMemory( hContext, NULL );
+	Tspi_Context_Close( hContext );
+	exit( result );
+}
@@ -34,6 +34,10 @@
 #      Megan Schneider, mschnei@us.ibm.com, 6/04.
 #      kyoder@users.sf.net, Added shifts to the option processing
 #                           Added output format options
+#      Added TPM command budgets (-c, -b, -u, -p)
+#      Added performance counters (-k)
+#      Added soak mode (-s)
+#      Added allocation accounting (-a)
 #
 # RESTRICTIONS
 #      None.
@@ -53,6 +57,23 @@ TEST_RUN=
 TEST_OUTPUT=
 OUTPUT_FORMAT="standard"
 
+# TPM command budgets, see budget_check()
+CMDLOG=
+BUDGET_DIR=$LOGDIR/budget
+BUDGET_UPDATE=0
+BUDGET_PCT=10
+
+# run each test under perf/tools/pmc_run
+COUNTERS=0
+
+# run each test with perf/trace/libtspi_alloc.so preloaded
+ALLOCS=0
+export ALLOCLOG=$LOGDIR/tsstests.alloc
+
+# soak mode, see soak_sample()
+SOAK_MINUTES=0
+export SOAKLOG=$LOGDIR/tsstests.soak
+
 # this variable needs to be changed to testcases/tcg/ for ltp compatibility
 TESTCASEDIR=testsuite/tcg/
 
@@ -65,7 +86,8 @@ cd $TESTCASEDIR
 usage()
 {
 	cat <<-END >&2
-	usage: ./tsstests.sh [-v <version>] [-l <logfile>] [-e <errfile>] [-d <dir>] [-h]
+	usage: ./tsstests.sh [-v <version>] [-l <logfile>] [-e <errfile>] [-d <dir>]
+			[-c <cmdlog> [-b <dir>] [-u] [-p <percent>]] [-k] [-a] [-s <minutes>] [-h]
 		This script will run all tspi-related tests unless the <dir> option is provided.
 		-v	 version of the TSS spec to use, 1.1 or 1.2
 		-l	 logfile to redirect output to (default is command line)
@@ -74,12 +96,24 @@ usage()
 		-q	 run quietly - display only total number of tests passed/failed
 		-e	 file name to log errors to
 		-d <dir> a specific directory to run tests from (to run a subset of all tests)
+		-c	 command log of a tcsd running with libtddl_timer.so preloaded; the
+			 TPM commands of each test are checked against its budget
+		-b	 directory of the budgets (default ./budget)
+		-u	 record the budgets of this run instead of checking them
+		-p	 percentage a test may exceed its budget by (default 10)
+		-k	 print the CPU performance counters of each test, and of tcsd
+			 over the same time, as PMC lines with the test output
+		-a	 account the heap allocations of each test to the Tspi calls
+			 making them, appending ALLOC lines to tsstests.alloc
+		-s	 soak: run the tests over and over for <minutes>, sampling the
+			 resources held by tcsd after each pass into tsstests.soak,
+			 and report the ones which only ever grew
 	END
 	exit -1
 }
 
 # Parse the options
-while getopts v:l:f:hqd:e: arg
+while getopts v:l:f:hqd:e:c:b:up:kas: arg
 do
 	case $arg in
 		v)
@@ -119,6 +153,27 @@ do
 				usage
 			fi
 			;;
+		c)
+			CMDLOG=$OPTARG
+			;;
+		b)
+			BUDGET_DIR=$OPTARG
+			;;
+		u)
+			BUDGET_UPDATE=1
+			;;
+		p)
+			BUDGET_PCT=$OPTARG
+			;;
+		k)
+			COUNTERS=1
+			;;
+		a)
+			ALLOCS=1
+			;;
+		s)
+			SOAK_MINUTES=$OPTARG
+			;;
 		?)
 			usage
 			;;
@@ -127,6 +182,35 @@ done
 
 #echo "DEBUG DOLLARSTAR: $*"
 
+# relative paths are given from where the script was started
+case "$CMDLOG" in
+	""|/*)
+		;;
+	*)
+		CMDLOG=$LOGDIR/$CMDLOG
+		;;
+esac
+case "$BUDGET_DIR" in
+	/*)
+		;;
+	*)
+		BUDGET_DIR=$LOGDIR/$BUDGET_DIR
+		;;
+esac
+if test x$CMDLOG != x; then
+	if ! test -f $CMDLOG; then
+		echo "Command log $CMDLOG not found, is tcsd running with libtddl_timer.so?"
+		exit -1
+	fi
+	mkdir -p $BUDGET_DIR/$TSS_VERSION
+fi
+if test $COUNTERS -eq 1; then
+	TCSD_PID=$(pidof tcsd | cut -d' ' -f1)
+	if test x$TCSD_PID = x; then
+		echo "tcsd not found, counting the tests only"
+	fi
+fi
+
 # Verify the output format
 case "$OUTPUT_FORMAT" in
 	*standard*)
@@ -147,6 +231,7 @@ esac
 # $3 = number not implemented
 # $4 = number not applicable
 # $5 = number segfaulted
+# $6 = number over their TPM command budget
 print_totals()
 {
 	case "$OUTPUT_FORMAT" in
@@ -155,6 +240,9 @@ print_totals()
 			echo -e "PASSED: $1\nFAILED: $2 (NOTIMPL: $3)\nNOT APPLICABLE: $4\nSEGFAULTED: $5\n" >> $LOGFILE
 		fi
 		echo -e "PASSED: $1\nFAILED: $2 (NOTIMPL: $3)\nNOT APPLICABLE: $4\nSEGFAULTED: $5\n" >> $ERR_SUMMARY
+		if test x$CMDLOG != x; then
+			echo -e "OVER BUDGET: $6\n" >> $ERR_SUMMARY
+		fi
 		;;
 	*wiki*)
 		# Print a new header
@@ -163,6 +251,9 @@ print_totals()
 		echo "    Total Not Implemented |"  >> $ERR_SUMMARY
 		echo "      Total Not Applicable |"  >> $ERR_SUMMARY
 		echo "        Total segfaulted"  >> $ERR_SUMMARY
+		if test x$CMDLOG != x; then
+			echo "          | Total over budget"  >> $ERR_SUMMARY
+		fi
 
 		# Print the final info
 		echo "$1 | "  >> $ERR_SUMMARY
@@ -170,6 +261,9 @@ print_totals()
 		echo "    $3 |"  >> $ERR_SUMMARY
 		echo "      $4 |"  >> $ERR_SUMMARY
 		echo "        $5"  >> $ERR_SUMMARY
+		if test x$CMDLOG != x; then
+			echo "          | $6"  >> $ERR_SUMMARY
+		fi
 		;;
 	*)
 		echo "Unknown output format!"
@@ -237,9 +331,79 @@ print_init()
 }
 
 
+# Sum up the TPM commands in the command log from line $1 on by ordinal,
+# one line per ordinal: <name> <count> <bytes in> <bytes out>
+budget_summarize()
+{
+	tail -n +$1 $CMDLOG | awk '$1 == "TPM" {
+		count[$5]++; bin[$5] += $6; bout[$5] += $7
+	}
+	END {
+		for (o in count)
+			print o, count[o], bin[o], bout[o]
+	}' | sort
+}
+
+# Compare the commands a test sent with its budget. The test is over budget
+# if its total number of commands or bytes grew by more than BUDGET_PCT
+# percent; the ordinals that changed are then printed.
+# $1 = testcase name
+# $2 = line of the command log the test's commands start at
+budget_check()
+{
+	local BUDGET=$BUDGET_DIR/$TSS_VERSION/$1.budget
+	local DIFF
+
+	if test $BUDGET_UPDATE -eq 1; then
+		budget_summarize $2 > $BUDGET
+		return
+	fi
+	if ! test -f $BUDGET; then
+		return
+	fi
+
+	DIFF=$( budget_summarize $2 | awk -v pct=$BUDGET_PCT -v test=$1 '
+	FILENAME == ARGV[1] {
+		count[$1] = 0; bytes[$1] = 0
+		bcount[$1] = $2; bbytes[$1] = $3 + $4
+		btotal += $2; bbtotal += $3 + $4
+		next
+	}
+	{
+		count[$1] = $2; bytes[$1] = $3 + $4
+		total += $2; btotal_now += $3 + $4
+		if (!($1 in bcount)) { bcount[$1] = 0; bbytes[$1] = 0 }
+	}
+	END {
+		if (total <= btotal * (1 + pct / 100) && btotal_now <= bbtotal * (1 + pct / 100))
+			exit 0
+		printf "%s over TPM command budget: commands %d -> %d, bytes %d -> %d\n",
+		       test, btotal, total, bbtotal, btotal_now
+		for (o in bcount)
+			if (count[o] != bcount[o] || bytes[o] != bbytes[o])
+				printf "\t%s commands %d -> %d (%+d), bytes %d -> %d (%+d)\n", o,
+				       bcount[o], count[o], count[o] - bcount[o], bbytes[o],
+				       bytes[o], bytes[o] - bbytes[o]
+	}' $BUDGET - )
+
+	if test "x$DIFF" != x; then
+		OVERBUDGET=$(( $OVERBUDGET + 1 ))
+		echo "$DIFF" >> $ERR_SUMMARY
+		if test $LOGGING -eq 1; then
+			echo "$DIFF" >> $LOGFILE
+		elif test $QUIET -eq 0; then
+			echo "$DIFF"
+		fi
+	fi
+}
+
 # $1 = the test command line
 execute_test()
 {
+	if test x$CMDLOG != x; then
+		CMDLOG_LINE=$(( $(wc -l < $CMDLOG) + 1 ))
+	fi
+
 	if test $LOGGING -eq 1; then
 		# capture stderr and send stdout to the logfile
 		TEST_STDERR=$( $1 -v ${TSS_VERSION} 2>&1 >> $LOGFILE )
@@ -275,6 +439,81 @@ execute_test()
 
 		PASSED=$(( $PASSED + 1))
 	fi
+
+	# only passing tests have a budget, others stop part way through
+	if test x$CMDLOG != x -a $RUNRESULT -eq 0; then
+		budget_check $(basename ${1##* }) $CMDLOG_LINE
+	fi
+}
+
+# Sample the resources held by tcsd into the soak log. The TCS starts a
+# thread per connected context, so the threads besides the main one count
+# the contexts still open.
+# $1 = number of passes run so far
+soak_sample()
+{
+	local PID=$(pidof tcsd | cut -d' ' -f1)
+	local RSS FDS CONTEXTS RESOURCES KEYS AUTHS
+
+	if test x$PID = x; then
+		echo "SOAK pass=$1 tcsd not running" >> $SOAKLOG
+		return
+	fi
+
+	RSS=$(awk '/^VmRSS:/ { print $2 }' /proc/$PID/status)
+	FDS=$(ls /proc/$PID/fd | wc -l)
+	CONTEXTS=$(( $(ls /proc/$PID/task | wc -l) - 1 ))
+
+	# run after reading /proc, its own context would be counted otherwise
+	RESOURCES=$( cd ${LTPTSSROOT}/${TESTCASEDIR}../bin && ./tcsd_resources -v ${TSS_VERSION} 2>/dev/null )
+	KEYS=$(echo "$RESOURCES" | awk '$3 ~ /^tpm_keys=/ { sub(/.*=/, "", $3); print int($3) }')
+	AUTHS=$(echo "$RESOURCES" | awk '$3 ~ /^tpm_auths=/ { sub(/.*=/, "", $3); print int($3) }')
+
+	echo "SOAK pass=$1 elapsed_s=$(( $(date +%s) - $SOAK_START )) rss_kb=$RSS fds=$FDS" \
+	     "contexts=$CONTEXTS tpm_keys=${KEYS:-n/a} tpm_auths=${AUTHS:-n/a}" >> $SOAKLOG
+}
+
+# Report each resource in the soak log which grew from the first pass to the
+# last without ever going down. The sample before the first pass is left
+# out, since caches in tcsd fill up during the first pass.
+soak_report()
+{
+	local REPORT
+
+	REPORT=$( awk '
+	$1 == "SOAK" && $2 != "pass=0" && $3 ~ /^elapsed_s=/ {
+		for (i = 4; i <= NF; i++) {
+			split($i, kv, "=")
+			if (kv[2] == "n/a")
+				continue
+			if (!(kv[1] in first)) {
+				first[kv[1]] = kv[2]; order[++n] = kv[1]
+			} else if (kv[2] + 0 < last[kv[1]] + 0) {
+				dropped[kv[1]] = 1
+			}
+			last[kv[1]] = kv[2]; samples[kv[1]]++
+		}
+	}
+	END {
+		for (i = 1; i <= n; i++) {
+			m = order[i]
+			if (samples[m] >= 4 && !(m in dropped) && last[m] + 0 > first[m] + 0)
+				printf "SOAK %s grew from %d to %d over %d passes (%+.2f per pass)\n",
+				       m, first[m], last[m], samples[m],
+				       (last[m] - first[m]) / (samples[m] - 1)
+		}
+	}' $SOAKLOG )
+
+	if test "x$REPORT" = x; then
+		REPORT="SOAK no resource of tcsd grew monotonically"
+	fi
+	echo "$REPORT" >> $SOAKLOG
+	echo "$REPORT" >> $ERR_SUMMARY
+	if test $LOGGING -eq 1; then
+		echo "$REPORT" >> $LOGFILE
+	else
+		echo "$REPORT"
+	fi
 }
 
 # main is called at the very end of this script
@@ -286,11 +525,12 @@ main()
 	SEGFAULTED=0
 	NOTIMPL=0
 	NA=0
+	OVERBUDGET=0
 
 	if test x$1 != x; then
 		DIRS_TO_RUN=$1
 	else
-		DIRS_TO_RUN=`ls */Makefile | sed "s/Makefile//g" | sed "s/common\///g" | sed "s/highlevel\///g"`
+		DIRS_TO_RUN=`ls */Makefile | sed "s/Makefile//g" | sed "s/common\///g" | sed "s/highlevel\///g" | sed "s/perf\///g"`
 	fi
 
 	for DIRECTORY in $DIRS_TO_RUN
@@ -312,7 +552,14 @@ main()
 
 		for TEST in $TESTS_TO_RUN
 		do
-			execute_test ./$TEST
+			TEST_CMD=./$TEST
+			if test $ALLOCS -eq 1; then
+				TEST_CMD="env LD_PRELOAD=$PWD/libtspi_alloc.so TSPI_ALLOC_SUMMARY=$ALLOCLOG $TEST_CMD"
+			fi
+			if test $COUNTERS -eq 1; then
+				TEST_CMD="./pmc_run -n $TEST ${TCSD_PID:+-p $TCSD_PID} $TEST_CMD"
+			fi
+			execute_test "$TEST_CMD"
 
 			# Printing totals here is a special case: if you're watching the output
 			# roll by (not going to a log file), its good to know a general pass/fail
@@ -326,12 +573,29 @@ main()
 	done
 
 	if test $QUIET -eq 0; then
-		print_totals $PASSED $FAILED $NOTIMPL $NA $SEGFAULTED
+		print_totals $PASSED $FAILED $NOTIMPL $NA $SEGFAULTED $OVERBUDGET
 		echo "<<< Test suite run completed >>>"
 	fi
 }
 
-main $SPECIFIC_TEST_DIR
+if test $SOAK_MINUTES -gt 0; then
+	SOAK_START=$(date +%s)
+	SOAK_END=$(( $SOAK_START + $SOAK_MINUTES * 60 ))
+	PASS=0
+	echo "SOAK start $(date)" > $SOAKLOG
+	soak_sample $PASS
+
+	while test $(date +%s) -lt $SOAK_END
+	do
+		main $SPECIFIC_TEST_DIR
+		PASS=$(( $PASS + 1 ))
+		soak_sample $PASS
+	done
+
+	soak_report
+else
+	main $SPECIFIC_TEST_DIR
+fi
 
 exit 0
 